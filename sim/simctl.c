@@ -6,6 +6,7 @@
 
 #include "simbus.h"
 #include "simctl.h"
+#include "simdegrade.h"
 #include "simdrive.h"
 #include "simmedia.h"
 
@@ -125,6 +126,108 @@ ctl_wp(struct sim_gw *gw, const char *us, const char *val, int out)
 }
 
 
+/* "all", "N" or "N-M", as media tracks. */
+
+static int
+parse_tracks(const char *s, int *first, int *last)
+{
+	char	*end;
+
+	if (!s)
+		return -1;
+
+	if (!strcmp(s, "all")) {
+		*first = 0;
+		*last  = SIM_DEGRADE_TRACKS - 1;
+		return 0;
+	}
+
+	long	a = strtol(s, &end, 10);
+	long	b = a;
+
+	if (end == s)
+		return -1;
+
+	if (*end == '-') {
+		const char	*bs = end + 1;
+
+		b = strtol(bs, &end, 10);
+
+		if (end == bs)
+			return -1;
+	}
+
+	if (*end || a < 0 || b < a || b >= SIM_DEGRADE_TRACKS)
+		return -1;
+
+	*first = a;
+	*last  = b;
+
+	return 0;
+}
+
+
+static void
+ctl_degrade(struct sim_gw *gw, const char *us, const char *ts,
+	    const char *spec, int out)
+{
+	struct sim_drive	*drv = unit_drive(gw, us, out, NULL);
+	struct sim_degrade	dg = { .on = false };
+	int			first, last;
+
+	if (!drv)
+		return;
+
+	if (parse_tracks(ts, &first, &last) == -1 || !spec ||
+	    (strcmp(spec, "off") && sim_degrade_parse(spec, &dg) == -1)) {
+		dprintf(out, "error: degrade <unit> all|<track>[-<track>] "
+			"<setting>[,<setting>...]|off\n");
+		return;
+	}
+
+	if (sim_drive_set_degrade(drv, first, last, &dg) == -1) {
+		dprintf(out, "error: out of memory\n");
+		return;
+	}
+
+	dprintf(out, "degrade %s\n", dg.on ? "on" : "off");
+}
+
+
+/* Runs of tracks degraded alike. */
+
+static void
+status_degrade(const struct sim_drive *drv, int out)
+{
+	for (int t = 0; t < SIM_DEGRADE_TRACKS; ) {
+		const struct sim_degrade *dg = sim_drive_degrade(drv, t);
+		int	e = t + 1;
+
+		if (!dg) {
+			++t;
+			continue;
+		}
+
+		while (e < SIM_DEGRADE_TRACKS && sim_drive_degrade(drv, e) &&
+		       !memcmp(sim_drive_degrade(drv, e), dg, sizeof(*dg)))
+			++e;
+
+		char	desc[128];
+
+		sim_degrade_format(dg, desc, sizeof(desc));
+
+		if (e - 1 > t)
+			dprintf(out, "        degraded tracks %d-%d: %s\n",
+				t, e - 1, desc);
+		else
+			dprintf(out, "        degraded track %d: %s\n", t,
+				desc);
+
+		t = e;
+	}
+}
+
+
 static void
 ctl_status(struct sim_gw *gw, int out)
 {
@@ -154,6 +257,8 @@ ctl_status(struct sim_gw *gw, int out)
 		} else {
 			dprintf(out, "        (no diskette)\n");
 		}
+
+		status_degrade(drv, out);
 	}
 }
 
@@ -180,11 +285,18 @@ sim_ctl_command(struct sim_gw *gw, char *line, int out)
 		char	*val = strtok_r(NULL, sep, &save);
 
 		ctl_wp(gw, us, val, out);
+	} else if (!strcmp(cmd, "degrade")) {
+		char	*us   = strtok_r(NULL, sep, &save);
+		char	*ts   = strtok_r(NULL, sep, &save);
+		char	*spec = strtok_r(NULL, sep, &save);
+
+		ctl_degrade(gw, us, ts, spec, out);
 	} else if (!strcmp(cmd, "status")) {
 		ctl_status(gw, out);
 	} else if (!strcmp(cmd, "help")) {
 		dprintf(out, "commands: insert <unit> <file>, "
-			"eject <unit>, wp <unit> on|off, status, "
+			"eject <unit>, wp <unit> on|off, "
+			"degrade <unit> <tracks> <settings>|off, status, "
 			"help, quit\n");
 	} else if (!strcmp(cmd, "quit") || !strcmp(cmd, "exit")) {
 		return 1;
@@ -10,6 +10,8 @@
  *   insert <unit> <file>     insert a diskette image
  *   eject <unit>             remove the diskette (flushes writes)
  *   wp <unit> on|off         force/release write protect
+ *   degrade <unit> <tracks> <settings>|off
+ *                            degrade media tracks (see simdegrade.h)
  *   status                   show drives and media
  *   help                     list commands
  *   quit                     shut the simulator down
@@ -0,0 +1,413 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simflux.h"
+#include "simdegrade.h"
+
+/* Region lengths, in microseconds. */
+#define WEAK_US		64
+#define DROPOUT_US	32
+#define SPLICE_US	24
+
+/* Most regions of each kind per track. */
+#define REGIONS_MAX	64
+
+enum { KIND_WEAK, KIND_DROPOUT, KIND_SPLICE };
+
+struct region {
+	int		kind;
+	int		n;		/* of its kind */
+	uint64_t	start;		/* ticks into the turn */
+	uint64_t	end;
+	bool		active;		/* this turn */
+	bool		done;
+};
+
+
+/* Fold "v" into hash "h" (a splitmix64 step). */
+
+static uint64_t
+mix(uint64_t h, uint64_t v)
+{
+	uint64_t	z = h + (v + 1) * 0x9e3779b97f4a7c15ull;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+	return z ^ (z >> 31);
+}
+
+
+/* A xorshift generator, seeded from a hash. */
+
+static uint32_t
+rng_seed(uint64_t h)
+{
+	return (uint32_t)(h ^ (h >> 32)) | 1;
+}
+
+
+static double
+rng_next(uint32_t *s)
+{
+	uint32_t	x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*s = x;
+
+	return x / 4294967296.0;
+}
+
+
+/* Near-normal, unit deviation: four uniforms summed. */
+
+static double
+rng_normal(uint32_t *s)
+{
+	double	sum = rng_next(s) + rng_next(s) + rng_next(s) +
+		      rng_next(s);
+
+	return (sum - 2.0) * 1.7320508;
+}
+
+
+int
+sim_degrade_parse(const char *spec, struct sim_degrade *dg)
+{
+	struct sim_degrade	d = { .on = true };
+	char			*s = strdup(spec);
+	char			*save = NULL;
+	int			ret = -1;
+
+	if (!s)
+		return -1;
+
+	for (char *w = strtok_r(s, ",", &save); w;
+	     w = strtok_r(NULL, ",", &save)) {
+		char	*v = strchr(w, '=');
+		char	*end;
+
+		if (!v || !v[1])
+			goto out;
+
+		*v++ = '\0';
+
+		if (!strcmp(w, "wobble")) {
+			d.wobble = strtod(v, &end);
+
+			if (*end || d.wobble < 0 || d.wobble >= 50)
+				goto out;
+
+			continue;
+		}
+
+		unsigned long	n = strtoul(v, &end, 0);
+
+		if (*end)
+			goto out;
+
+		if (!strcmp(w, "seed") && n <= UINT32_MAX)
+			d.seed = n;
+		else if (!strcmp(w, "jitter") && n <= 100000)
+			d.jitter_ns = n;
+		else if (!strcmp(w, "weak") && n <= REGIONS_MAX)
+			d.weak = n;
+		else if (!strcmp(w, "dropout") && n <= REGIONS_MAX)
+			d.dropout = n;
+		else if (!strcmp(w, "splice") && n <= REGIONS_MAX)
+			d.splice = n;
+		else
+			goto out;
+	}
+
+	*dg = d;
+	ret = 0;
+out:
+	free(s);
+
+	return ret;
+}
+
+
+void
+sim_degrade_format(const struct sim_degrade *dg, char *buf, size_t buflen)
+{
+	int	n = snprintf(buf, buflen, "seed=%u", dg->seed);
+
+	if (dg->jitter_ns && n >= 0 && (size_t)n < buflen)
+		n += snprintf(buf + n, buflen - n, ",jitter=%u",
+			      dg->jitter_ns);
+	if (dg->wobble > 0 && n >= 0 && (size_t)n < buflen)
+		n += snprintf(buf + n, buflen - n, ",wobble=%g", dg->wobble);
+	if (dg->weak && n >= 0 && (size_t)n < buflen)
+		n += snprintf(buf + n, buflen - n, ",weak=%d", dg->weak);
+	if (dg->dropout && n >= 0 && (size_t)n < buflen)
+		n += snprintf(buf + n, buflen - n, ",dropout=%d",
+			      dg->dropout);
+	if (dg->splice && n >= 0 && (size_t)n < buflen)
+		snprintf(buf + n, buflen - n, ",splice=%d", dg->splice);
+}
+
+
+static int
+region_cmp(const void *a, const void *b)
+{
+	const struct region	*ra = a, *rb = b;
+
+	return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+
+/*
+ * Where each region falls on the turn, clear of the final interval
+ * (and so of the index at the end), sorted by start.  Returns the
+ * count placed.
+ */
+
+static int
+place_regions(const struct sim_degrade *dg, uint64_t key,
+	      const struct sim_rev *rev, double tpu, struct region *reg)
+{
+	const int	count[] = { dg->weak, dg->dropout, dg->splice };
+	const int	us[]	= { WEAK_US, DROPOUT_US, SPLICE_US };
+	uint64_t	room = rev->total_ticks - rev->last_ticks;
+	int		nreg = 0;
+
+	for (int k = 0; k < 3; ++k) {
+		uint64_t	len = us[k] * tpu;
+
+		if (len == 0 || len >= room)
+			continue;
+
+		for (int i = 0; i < count[k]; ++i) {
+			uint32_t	s = rng_seed(mix(mix(key, k), i));
+			uint64_t	start = rng_next(&s) * (room - len);
+
+			reg[nreg++] = (struct region){
+				.kind  = k,
+				.n     = i,
+				.start = start,
+				.end   = start + len
+			};
+		}
+	}
+
+	qsort(reg, nreg, sizeof(*reg), region_cmp);
+
+	return nreg;
+}
+
+
+/* Laying out the degraded loop. */
+struct lay {
+	struct sim_rev		*out;
+	const struct sim_rev	*rev;
+	uint64_t		base;	/* loop ticks where this turn began */
+	uint64_t		prev;	/* loop ticks of the last transition */
+	double			wob_a;	/* wobble, in ticks of shift */
+	double			wob_ph;
+	double			wob_0;
+	size_t			ix;	/* next of the turn's indexes */
+};
+
+
+/* Turn ticks to where wobble puts them. */
+
+static double
+warp(const struct lay *ly, uint64_t t)
+{
+	if (ly->wob_a == 0)
+		return t;
+
+	return t + ly->wob_a *
+		   sin(2 * M_PI * t / ly->rev->total_ticks + ly->wob_ph) -
+		   ly->wob_0;
+}
+
+
+/* The index "i" of the media's turn, and how many it has. */
+
+static uint64_t
+index_ticks(const struct sim_rev *rev, size_t i, size_t *cnt)
+{
+	*cnt = rev->index_cnt ? rev->index_cnt : 1;
+
+	return rev->index_cnt ? rev->index[i].ticks : rev->total_ticks;
+}
+
+
+/*
+ * Append a transition at turn ticks "t" (warped, already), putting in
+ * any indexes up to it.  "last" is the turn's final one, which must
+ * land exactly.
+ */
+
+static int
+lay_pulse(struct lay *ly, double t, bool last)
+{
+	const uint64_t	rt  = ly->rev->total_ticks;
+	uint64_t	at;
+
+	if (last) {
+		at = ly->base + rt;
+	} else {
+		double	lo = ly->prev + 1;
+		double	hi = ly->base + rt - 1;
+		double	a  = ly->base + t;
+
+		if (lo > hi)
+			return 0;
+
+		at = (a < lo) ? lo : (a > hi) ? hi : a;
+	}
+
+	size_t	cnt;
+
+	for (;;) {
+		if (ly->ix == (size_t)-1)
+			break;
+
+		uint64_t	it = index_ticks(ly->rev, ly->ix, &cnt);
+		uint64_t	wt = ly->base + (uint64_t)warp(ly, it);
+
+		if (wt > rt + ly->base)
+			wt = rt + ly->base;
+		if (wt <= ly->prev)
+			wt = ly->prev + 1;
+
+		if (wt > at)
+			break;
+
+		if (sim_rev_index(ly->out, wt) == -1)
+			return -1;
+
+		if (++ly->ix == cnt)
+			ly->ix = (size_t)-1;
+	}
+
+	if (sim_rev_pulse(at - ly->prev, ly->out) == -1)
+		return -1;
+
+	ly->prev = at;
+
+	return 0;
+}
+
+
+/* Disordered flux over a region, near the turn's own density. */
+
+static int
+lay_fill(struct lay *ly, const struct region *r, uint32_t s, double mean)
+{
+	for (double t = r->start + rng_next(&s) * mean; t < r->end;
+	     t += mean * (0.5 + rng_next(&s))) {
+		if (lay_pulse(ly, warp(ly, t), false) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+int
+sim_degrade_rev(const struct sim_degrade *dg, int track, int side,
+		const struct sim_rev *rev, uint64_t revno, unsigned nrevs,
+		uint32_t freq, struct sim_rev *out)
+{
+	const uint64_t	rt = rev->total_ticks;
+
+	if (rt == 0 || rev->intervals == 0 || nrevs == 0)
+		return -1;
+
+	uint64_t	key  = mix(mix(mix(0, dg->seed), track), side);
+	double		tpu  = freq / 1e6;
+	double		mean = (double)rt / rev->intervals;
+	struct region	reg[3 * REGIONS_MAX];
+	int		nreg = place_regions(dg, key, rev, tpu, reg);
+
+	if (sim_rev_init(out, rev->cnt * nrevs + 64) == -1)
+		return -1;
+
+	struct lay	ly = { .out = out, .rev = rev };
+	uint32_t	ws = rng_seed(mix(key, 3));
+
+	if (dg->wobble > 0) {
+		ly.wob_a  = dg->wobble / 100 * rt / (2 * M_PI);
+		ly.wob_ph = rng_next(&ws) * 2 * M_PI;
+		ly.wob_0  = ly.wob_a * sin(ly.wob_ph);
+	}
+
+	double	jit = dg->jitter_ns * (freq / 1e9);
+
+	for (unsigned k = 0; k < nrevs; ++k) {
+		uint64_t	n = revno + k;
+		uint32_t	js = rng_seed(mix(mix(key, 4), n));
+
+		ly.base = (uint64_t)k * rt;
+		ly.ix	= 0;
+
+		/* A weak region's coin: the hash's top bit. */
+		for (int i = 0; i < nreg; ++i) {
+			reg[i].active = reg[i].kind != KIND_WEAK ||
+					mix(mix(mix(key, 5), i), n) >> 63;
+			reg[i].done   = false;
+		}
+
+		uint64_t	t   = 0;
+		size_t		off = 0;
+
+		while (off < rev->cnt) {
+			uint32_t	p;
+
+			off += sim_rev_interval(rev, off, &p);
+			t   += p;
+
+			bool	last = off == rev->cnt;
+			bool	drop = false;
+
+			for (int i = 0; i < nreg && !last; ++i) {
+				struct region	*r = &reg[i];
+
+				if (!r->active || t < r->start)
+					continue;
+
+				if (!r->done && r->kind != KIND_DROPOUT) {
+					/* Splices are the same every turn. */
+					uint64_t h = mix(mix(key, 6), i);
+					uint32_t s = rng_seed(r->kind ==
+						KIND_SPLICE ? h : mix(h, n));
+
+					if (lay_fill(&ly, r, s, mean) == -1)
+						goto err;
+				}
+
+				r->done = true;
+
+				if (t < r->end)
+					drop = true;
+			}
+
+			if (drop)
+				continue;
+
+			double	at = warp(&ly, t);
+
+			if (jit > 0 && !last)
+				at += jit * rng_normal(&js);
+
+			if (lay_pulse(&ly, at, last) == -1)
+				goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	sim_rev_free(out);
+
+	return -1;
+}
@@ -0,0 +1,62 @@
+#ifndef SIMDEGRADE_H
+#define SIMDEGRADE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sim_rev;
+
+/*
+ * Degraded media: a seeded layer between a media's revolution and
+ * the read stream, standing in for a marginal diskette.
+ *
+ *   jitter   each transition moved by a near-normal amount of this
+ *            many ns (standard deviation), afresh every revolution
+ *   wobble   rotational speed varying sinusoidally by this many
+ *            percent either way over each revolution
+ *   weak     regions that read garbled on about half the revolutions
+ *   dropout  regions with no flux at all
+ *   splice   regions of disordered flux, the same every revolution
+ *
+ * Regions fall at angles drawn from the seed, track and side, and
+ * every random choice from those plus the revolution's number, so a
+ * read is the same on every run.  Each degraded revolution keeps the
+ * media's period and index positions.
+ */
+
+/* Enough for any drive's cylinders. */
+#define SIM_DEGRADE_TRACKS	100
+
+struct sim_degrade {
+	bool		on;
+	uint32_t	seed;
+	uint32_t	jitter_ns;
+	double		wobble;
+	int		weak;
+	int		dropout;
+	int		splice;
+};
+
+/*
+ * Parse settings "name=value[,name=value...]" over "dg", turning it
+ * on.  Returns 0, or -1 (with "dg" unchanged) if any is bad.
+ */
+extern int sim_degrade_parse(const char *spec, struct sim_degrade *dg);
+
+/* The settings that differ from the defaults, as parsed. */
+extern void sim_degrade_format(const struct sim_degrade *dg, char *buf,
+			       size_t buflen);
+
+/*
+ * Render "nrevs" degraded turns of "rev", which holds one turn of
+ * "track" and "side", numbered from "revno" on, into a loop in
+ * "out" (see simflux.h).  "freq" is the sample clock.  Returns 0, or
+ * -1 on error.
+ */
+extern int sim_degrade_rev(const struct sim_degrade *dg, int track,
+			   int side, const struct sim_rev *rev,
+			   uint64_t revno, unsigned nrevs, uint32_t freq,
+			   struct sim_rev *out);
+
+#endif
@@ -1,20 +1,43 @@
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "dmk.h"
 #include "dmkx.h"
 #include "gwdecode.h"
 #include "gwmedia.h"
 
+#include "simflux.h"
 #include "simmedia.h"
 #include "simdmk.h"
 
 
+/* A write pass in progress: gw2dmk's decoder, fed as flux arrives. */
+struct dmk_write {
+	int				track;
+	int				side;
+	uint64_t			total;
+	size_t				cnt;
+	struct gw_media_encoding	gme;
+	struct flux2dmk_sm		f2d;
+	struct dmk_track		merged;
+	struct dmk_disk_stats		dds;
+	struct dmk_track_stats		dts;
+};
+
 struct sim_dmk {
 	struct sim_media	m;
 	struct dmk_file		*dmkf;
+	struct dmk_write	*wr;
+	struct dmk_track	rd;	/* Track being encoded for a read */
+
+	/* What has changed since the file was last written. */
+	bool			header_dirty;
+	bool			track_dirty[DMK_MAX_TRACKS][DMK_SIDES];
 };
 
 
@@ -45,6 +68,7 @@ dmk_load(const char *path)
 	if (h->ntracks == 0 || h->ntracks > DMK_MAX_TRACKS ||
 	    h->tracklen <= DMK_TKHDR_SIZE ||
 	    h->tracklen > DMKRD_TRACKLEN_MAX) {
+		dmk_file_free(dm->dmkf);
 		free(dm->dmkf);
 		free(dm);
 		return NULL;
@@ -59,6 +83,8 @@ dmk_load(const char *path)
 
 err:
 	fclose(fp);
+	if (dm->dmkf)
+		dmk_file_free(dm->dmkf);
 	free(dm->dmkf);
 	free(dm);
 
@@ -66,67 +92,182 @@ err:
 }
 
 
+/* Close a saved file, first syncing it if writing through. */
+
 static int
-dmk_save(struct sim_media *media)
+dmk_save_close(struct sim_dmk *dm, FILE *fp, int ret)
 {
-	struct sim_dmk	*dm = (struct sim_dmk *)media;
-	FILE		*fp = fopen(media->path, "wb");
+	if (ret == 0 && dm->m.write_through &&
+	    (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+		ret = -1;
 
-	if (!fp)
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	return ret;
+}
+
+
+/* Make a rename into "path"'s directory durable. */
+
+static int
+dmk_sync_dir(const char *path)
+{
+	const char	*slash = strrchr(path, '/');
+	char		dir[PATH_MAX];
+
+	if (!slash)
+		strcpy(dir, ".");
+	else if (slash == path)
+		strcpy(dir, "/");
+	else if (slash - path < sizeof(dir))
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	else
+		return -1;
+
+	int	fd = open(dir, O_RDONLY | O_DIRECTORY);
+
+	if (fd == -1)
 		return -1;
 
-	int	ret = dmk2fp(dm->dmkf, fp);
+	int	ret = fsync(fd);
+
+	return close(fd) == 0 ? ret : -1;
+}
+
+
+/*
+ * Write the whole image to a new file beside it and rename that over
+ * it, so a crash part way leaves the old image whole.  The new file
+ * is synced before the rename whether or not writing through, as a
+ * rename can otherwise land before the data.
+ */
+
+static int
+dmk_save_all(struct sim_dmk *dm)
+{
+	char		*real = realpath(dm->m.path, NULL);
+	const char	*path = real ? real : dm->m.path;
+	size_t		len = strlen(path);
+	char		*tmp = malloc(len + sizeof(".XXXXXX"));
+	int		ret = -1;
+
+	if (!tmp)
+		goto out;
+
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+	int	fd = mkstemp(tmp);
+
+	if (fd == -1)
+		goto out;
+
+	FILE	*fp = fdopen(fd, "wb");
+
+	if (!fp) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	/* mkstemp() makes it private; keep the image's own mode. */
+	struct stat	st;
+
+	fchmod(fd, stat(path, &st) == 0 ? st.st_mode & 07777 : 0644);
+
+	ret = dmk2fp(dm->dmkf, fp);
+
+	if (ret == 0 && (fflush(fp) != 0 || fsync(fd) != 0))
+		ret = -1;
 
 	if (fclose(fp) != 0)
 		ret = -1;
 
-	if (ret == 0)
-		media->dirty = false;
+	if (ret == 0 && rename(tmp, path) == -1)
+		ret = -1;
+
+	if (ret != 0)
+		unlink(tmp);
+	else if (dm->m.write_through)
+		ret = dmk_sync_dir(path);
+
+out:
+	free(tmp);
+	free(real);
 
 	return ret;
 }
 
 
-static void
-dmk_unload(struct sim_media *media)
+/* Write just the header, if it changed, and the tracks that did. */
+
+static int
+dmk_save_tracks(struct sim_dmk *dm)
 {
-	struct sim_dmk	*dm = (struct sim_dmk *)media;
+	struct dmk_header	*h = &dm->dmkf->header;
+	int	sides = 2 - !!(h->options & DMK_SSIDE_OPT);
+	FILE	*fp = fopen(dm->m.path, "r+b");
 
-	free(dm->dmkf);
-	free(media->path);
-	free(dm);
-}
+	/* Gone from under us; put it all back. */
+	if (!fp)
+		return dmk_save_all(dm);
 
+	int	ret = 0;
+
+	if (dm->header_dirty &&
+	    (fseek(fp, 0, SEEK_SET) == -1 || !dmk_header_fwrite(h, fp)))
+		ret = -1;
+
+	for (int t = 0; t < h->ntracks && ret == 0; ++t) {
+		for (int s = 0; s < sides && ret == 0; ++s) {
+			if (dm->track_dirty[t][s] &&
+			    (dmk_track_fseek(h, t, s, fp) == -1 ||
+			     !dmk_file_track_fwrite(dm->dmkf, t, s, fp)))
+				ret = -1;
+		}
+	}
+
+	return dmk_save_close(dm, fp, ret);
+}
 
-struct pulse_vec {
-	uint32_t	*p;
-	size_t		cnt;
-	size_t		len;
-};
 
+/*
+ * Write back what changed.  Packed blocks move as they change size,
+ * so a packed image is written whole, to a new file.
+ */
 
 static int
-collect_pulse(uint32_t pulse, void *data)
+dmk_save(struct sim_media *media)
 {
-	struct pulse_vec *pv = (struct pulse_vec *)data;
+	struct sim_dmk	*dm = (struct sim_dmk *)media;
+	int		ret;
 
-	if (pulse == 0)
-		return 0;
+	if (dm->dmkf->zipped)
+		ret = dmk_save_all(dm);
+	else
+		ret = dmk_save_tracks(dm);
 
-	if (pv->cnt == pv->len) {
-		size_t	nlen = pv->len ? pv->len * 2 : 65536;
-		uint32_t *np = realloc(pv->p, nlen * sizeof(*np));
+	if (ret == 0) {
+		media->dirty	 = false;
+		dm->header_dirty = false;
+		memset(dm->track_dirty, 0, sizeof(dm->track_dirty));
+	}
 
-		if (!np)
-			return -1;
+	return ret;
+}
 
-		pv->p   = np;
-		pv->len = nlen;
-	}
 
-	pv->p[pv->cnt++] = pulse;
+static void
+dmk_unload(struct sim_media *media)
+{
+	struct sim_dmk	*dm = (struct sim_dmk *)media;
 
-	return 0;
+	free(dm->wr);
+	dmk_file_free(dm->dmkf);
+	free(dm->dmkf);
+	free(media->path);
+	free(dm);
 }
 
 
@@ -159,9 +300,18 @@ dmk_mult(const struct dmk_header *h, uint32_t freq, int rpm)
 }
 
 
+/*
+ * Room for a revolution's stream bytes: at most 16 intervals per
+ * byte of track (FM at single density), one byte each at any usual
+ * bit rate.
+ */
+
+#define DMK_REV_BYTES(h)	((size_t)(h)->tracklen * 16)
+
+
 static int
-dmk_track_pulses(struct sim_media *media, int track, int side,
-		 uint32_t freq, int rpm, uint32_t **pulses, size_t *cnt)
+dmk_track_rev(struct sim_media *media, int track, int side,
+	      uint32_t freq, int rpm, struct sim_rev *rev)
 {
 	struct sim_dmk		*dm = (struct sim_dmk *)media;
 	struct dmk_header	*h  = &dm->dmkf->header;
@@ -170,7 +320,10 @@ dmk_track_pulses(struct sim_media *media, int track, int side,
 	if (track < 0 || track >= h->ntracks || side < 0 || side >= sides)
 		return 1;
 
-	struct dmk_track	*dmkt = &dm->dmkf->track[track][side];
+	/* dmk2pulses() tidies the track as it goes; leave the image be. */
+	struct dmk_track	*dmkt = &dm->rd;
+
+	dmk_file_get_track(dm->dmkf, track, side, dmkt);
 
 	int	extra_bytes = 0;
 
@@ -199,38 +352,39 @@ dmk_track_pulses(struct sim_media *media, int track, int side,
 	ebs.precomp	= 0.0;
 	ebs.extra_bytes	= extra_bytes;
 
-	struct pulse_vec	pv = { NULL, 0, 0 };
+	if (sim_rev_init(rev, DMK_REV_BYTES(h)) == -1)
+		return -1;
 
+	/* Stream bytes come straight from the encoder. */
 	struct dmk_encode_s	des = {
-		.encode_pulse = collect_pulse,
-		.pulse_data   = &pv
+		.encode_pulse = sim_rev_pulse,
+		.pulse_data   = rev
 	};
 
-	dmk2pulses(dmkt, &eti, &ebs, &des);
+	if (dmk2pulses(dmkt, &eti, &ebs, &des) < 0) {
+		sim_rev_free(rev);
+		return -1;
+	}
 
-	if (pv.cnt == 0) {
-		free(pv.p);
+	if (rev->cnt == 0) {
+		sim_rev_free(rev);
 		return 1;
 	}
 
-	*pulses = pv.p;
-	*cnt	= pv.cnt;
-
 	return 0;
 }
 
 
 /*
- * Decode one written revolution of flux pulses back into a DMK
- * track, reusing gw2dmk's flux decoder state machine.  The stream
- * was cued at the index hole, so decoding starts at the track start
- * and no rotation to the hole is needed.
+ * Decode a written revolution back into a DMK track as it arrives,
+ * reusing gw2dmk's flux decoder state machine.  The stream was cued
+ * at the index hole, so decoding starts at the track start and no
+ * rotation to the hole is needed.
  */
 
 static int
-dmk_track_from_pulses(struct sim_media *media, int track, int side,
-		      uint32_t freq, int rpm, const uint32_t *pulses,
-		      size_t cnt)
+dmk_write_begin(struct sim_media *media, int track, int side,
+		uint32_t freq, int rpm)
 {
 	struct sim_dmk		*dm = (struct sim_dmk *)media;
 	struct dmk_header	*h  = &dm->dmkf->header;
@@ -240,63 +394,101 @@ dmk_track_from_pulses(struct sim_media *media, int track, int side,
 	    side >= sides)
 		return -1;
 
-	struct decode_ctx {
-		struct flux2dmk_sm	f2d;
-		struct dmk_track	merged;
-		struct dmk_disk_stats	dds;
-		struct dmk_track_stats	dts;
-	};
+	struct dmk_write	*wr = dm->wr;
 
-	struct decode_ctx	*ctx = calloc(1, sizeof(*ctx));
+	if (wr)
+		memset(wr, 0, sizeof(*wr));
+	else
+		wr = calloc(1, sizeof(*wr));
 
-	if (!ctx)
+	if (!wr)
 		return -1;
 
-	dmk_disk_stats_init(&ctx->dds);
-	dmk_track_stats_init(&ctx->dts);
+	dm->wr	  = wr;
+	wr->track = track;
+	wr->side  = side;
 
-	fdecoder_init(&ctx->f2d.fdec, freq);
+	dmk_disk_stats_init(&wr->dds);
+	dmk_track_stats_init(&wr->dts);
 
-	ctx->f2d.fdec.usr_encoding   = MIXED;
-	ctx->f2d.fdec.first_encoding = MIXED;
-	ctx->f2d.fdec.cur_encoding   = MIXED;
-	ctx->f2d.fdec.maxsecsize     = 3;
-	ctx->f2d.fdec.use_hole	     = 0;
-	ctx->f2d.fdec.quirk	     = h->quirks;
-	ctx->f2d.fdec.cyl_prev_seen  = track;
+	fdecoder_init(&wr->f2d.fdec, freq);
 
-	dmk_track_sm_init(&ctx->f2d.dtsm, &ctx->dds, h, &ctx->merged,
-			  &ctx->dts);
+	wr->f2d.fdec.usr_encoding   = MIXED;
+	wr->f2d.fdec.first_encoding = MIXED;
+	wr->f2d.fdec.cur_encoding   = MIXED;
+	wr->f2d.fdec.maxsecsize     = 3;
+	wr->f2d.fdec.use_hole	    = 0;
+	wr->f2d.fdec.quirk	    = h->quirks;
+	wr->f2d.fdec.cyl_prev_seen  = track;
 
-	struct gw_media_encoding	gme;
+	dmk_track_sm_init(&wr->f2d.dtsm, &wr->dds, h, &wr->merged,
+			  &wr->dts);
 
-	media_encoding_init(&gme, freq,
+	media_encoding_init(&wr->gme, freq,
 			    2.0 * 500000.0 / dmk_rate_bps(h, rpm));
-	gme.postcomp = 0.5;
+	wr->gme.postcomp = 0.5;
 
-	uint64_t	total = 0;
+	gwflux_decode_index(0, &wr->f2d);
 
-	gwflux_decode_index(0, &ctx->f2d);
+	return 0;
+}
 
-	for (size_t i = 0; i < cnt; ++i) {
-		total += pulses[i];
 
-		if (gwflux_decode_pulse(pulses[i], &gme, &ctx->f2d))
-			break;
-	}
+static int
+dmk_write_pulse(struct sim_media *media, uint32_t ticks)
+{
+	struct dmk_write	*wr = ((struct sim_dmk *)media)->wr;
 
-	gwflux_decode_index(total, &ctx->f2d);
-	gw_decode_flush(&ctx->f2d);
+	if (!wr)
+		return 1;
 
-	if (track >= h->ntracks)
-		h->ntracks = track + 1;
+	wr->total += ticks;
+	++wr->cnt;
 
-	dm->dmkf->track[track][side] = ctx->f2d.dtsm.trk_working;
-	media->dirty = true;
+	return gwflux_decode_pulse(ticks, &wr->gme, &wr->f2d);
+}
 
-	free(ctx);
 
-	return 0;
+static int
+dmk_write_end(struct sim_media *media, bool commit)
+{
+	struct sim_dmk		*dm = (struct sim_dmk *)media;
+	struct dmk_header	*h  = &dm->dmkf->header;
+	struct dmk_write	*wr = dm->wr;
+
+	if (!wr)
+		return -1;
+
+	dm->wr = NULL;
+
+	int	ret = 0;
+
+	if (commit && wr->cnt > 0) {
+		gwflux_decode_index(wr->total, &wr->f2d);
+		gw_decode_flush(&wr->f2d);
+
+		/* Tracks the image grows by go out with it, blank or not. */
+		for (; h->ntracks <= wr->track; ++h->ntracks) {
+			dm->track_dirty[h->ntracks][0] = true;
+			dm->track_dirty[h->ntracks][1] = true;
+			dm->header_dirty = true;
+		}
+
+		if (dmk_file_put_track(dm->dmkf, wr->track, wr->side,
+				       &wr->f2d.dtsm.trk_working) != 0) {
+			ret = -1;
+		} else {
+			dm->track_dirty[wr->track][wr->side] = true;
+			media->dirty = true;
+
+			if (media->write_through && !media->wp)
+				ret = dmk_save(media);
+		}
+	}
+
+	free(wr);
+
+	return ret;
 }
 
 
@@ -331,8 +523,10 @@ const struct sim_media_ops sim_dmk_ops = {
 	.load		   = dmk_load,
 	.save		   = dmk_save,
 	.unload		   = dmk_unload,
-	.track_pulses	   = dmk_track_pulses,
-	.track_from_pulses = dmk_track_from_pulses,
+	.track_rev	   = dmk_track_rev,
+	.write_begin	   = dmk_write_begin,
+	.write_pulse	   = dmk_write_pulse,
+	.write_end	   = dmk_write_end,
 	.tracks		   = dmk_tracks,
 	.describe	   = dmk_describe,
 };
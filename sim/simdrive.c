@@ -80,6 +80,7 @@ sim_drive_free(struct sim_drive *drv)
 	if (drv->media)
 		sim_media_eject(drv->media);
 
+	free(drv->degrade);
 	free(drv);
 }
 
@@ -146,3 +147,39 @@ sim_drive_media_track(const struct sim_drive *drv, int cyl)
 
 	return cyl;
 }
+
+
+int
+sim_drive_set_degrade(struct sim_drive *drv, int first, int last,
+		      const struct sim_degrade *dg)
+{
+	if (first < 0 || last >= SIM_DEGRADE_TRACKS || first > last)
+		return -1;
+
+	if (!drv->degrade) {
+		if (!dg->on)
+			return 0;
+
+		drv->degrade = calloc(SIM_DEGRADE_TRACKS,
+				      sizeof(*drv->degrade));
+
+		if (!drv->degrade)
+			return -1;
+	}
+
+	for (int t = first; t <= last; ++t)
+		drv->degrade[t] = *dg;
+
+	return 0;
+}
+
+
+const struct sim_degrade *
+sim_drive_degrade(const struct sim_drive *drv, int track)
+{
+	if (!drv->degrade || track < 0 || track >= SIM_DEGRADE_TRACKS ||
+	    !drv->degrade[track].on)
+		return NULL;
+
+	return &drv->degrade[track];
+}
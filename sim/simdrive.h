@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "simdegrade.h"
 #include "simmedia.h"
 
 /*
@@ -45,8 +46,12 @@ struct sim_drive {
 	bool		motor_on;
 	uint64_t	spin_ref_ns;	/* rotation phase reference */
 	uint64_t	phase_ticks;	/* fast-mode rotation cursor */
+	uint64_t	turns;		/* and whole turns so far */
 
 	struct sim_media	*media;	/* NULL = no diskette */
+
+	/* Per media track, or NULL if none is degraded. */
+	struct sim_degrade	*degrade;
 };
 
 extern const struct sim_drive_type *sim_drive_type_find(const char *name);
@@ -76,4 +81,15 @@ extern bool sim_drive_wp(const struct sim_drive *drv);
  */
 extern int sim_drive_media_track(const struct sim_drive *drv, int cyl);
 
+/*
+ * Degrade media tracks "first" through "last" as "dg" says, or stop
+ * if it's off.  Returns 0, or -1 on error.
+ */
+extern int sim_drive_set_degrade(struct sim_drive *drv, int first, int last,
+				 const struct sim_degrade *dg);
+
+/* How media track "track" is degraded, or NULL if it isn't. */
+extern const struct sim_degrade *sim_drive_degrade(
+				 const struct sim_drive *drv, int track);
+
 #endif
@@ -6,222 +6,395 @@
 
 #include "simflux.h"
 
+/* Longest encoding of one interval, and of an index op. */
+#define PULSE_MAX	7
+#define INDEX_LEN	6
 
-void
-sim_pulses_total(struct sim_pulses *sp)
+
+int
+sim_rev_init(struct sim_rev *rev, size_t cap)
 {
-	uint64_t	total = 0;
+	memset(rev, 0, sizeof(*rev));
+
+	rev->b = malloc(cap);
 
-	for (size_t i = 0; i < sp->cnt; ++i)
-		total += sp->p[i];
+	if (!rev->b)
+		return -1;
+
+	rev->cap = cap;
 
-	sp->total_ticks = total;
+	return 0;
 }
 
 
-int
-sim_noise_pulses(uint32_t freq, int rpm, struct sim_pulses *sp)
+void
+sim_rev_free(struct sim_rev *rev)
 {
-	uint64_t	rev_ticks = (uint64_t)(freq * 60.0 / rpm);
+	if (!rev->shared) {
+		free(rev->b);
+		free(rev->mark);
+		free(rev->index);
+	}
 
-	/* Random transitions 2us..30us apart. */
-	uint32_t	min_t   = 2e-6 * freq;
-	uint32_t	range_t = 28e-6 * freq;
+	memset(rev, 0, sizeof(*rev));
+}
 
-	size_t		len = rev_ticks / min_t + 1;
-	uint32_t	*p  = malloc(len * sizeof(*p));
 
-	if (!p)
-		return -1;
+/*
+ * Encode one inter-transition interval.  Same encoding as the
+ * firmware's read streams: direct byte, two-byte extended, or a
+ * FLUXOP_SPACE followed by a final short pulse.  (FLUXOP_ASTABLE is
+ * a write-stream opcode; it never appears in read streams.)  Returns
+ * the bytes used.
+ */
 
-	static uint32_t	seed = 20260711;
+static size_t
+put_pulse(uint8_t *b, uint64_t ticks)
+{
+	if (ticks < 250) {
+		b[0] = ticks;
+		return 1;
+	}
 
-	uint64_t	total = 0;
-	size_t		cnt   = 0;
+	if (ticks < 250 + 5 * 255) {
+		b[0] = 250 + (ticks - 250) / 255;
+		b[1] = 1 + (ticks - 250) % 255;
+		return 2;
+	}
 
-	while (total < rev_ticks && cnt < len) {
-		seed = seed * 1664525 + 1013904223;	/* LCG */
+	b[0] = 255;
+	b[1] = FLUXOP_SPACE;
+	gw_write_28(ticks - 249, &b[2]);
+	b[6] = 249;
 
-		uint32_t t = min_t + (uint64_t)seed * range_t / 4294967296u;
+	return PULSE_MAX;
+}
 
-		if (total + t > rev_ticks)
-			t = rev_ticks - total;
 
-		if (t == 0)
-			break;
+/* Decode the interval put_pulse() encoded at "b", of "*len" bytes. */
 
-		p[cnt++] = t;
-		total	+= t;
+static uint32_t
+get_pulse(const uint8_t *b, size_t *len)
+{
+	if (b[0] < 250) {
+		*len = 1;
+		return b[0];
 	}
 
-	sp->p		= p;
-	sp->cnt		= cnt;
-	sp->total_ticks	= total;
+	if (b[0] < 255) {
+		*len = 2;
+		return 250 + (b[0] - 250) * 255 + b[1] - 1;
+	}
 
-	return 0;
+	*len = PULSE_MAX;
+
+	return gw_read_28(&b[2]) + 249;
 }
 
 
-/* Dynamically growing output stream. */
-struct sbuf {
-	uint8_t		*b;
-	size_t		cnt;
-	size_t		len;
-};
+static size_t
+put_index(uint8_t *b, uint64_t ticks_to_index)
+{
+	b[0] = 255;
+	b[1] = FLUXOP_INDEX;
+	gw_write_28(ticks_to_index, &b[2]);
+
+	return INDEX_LEN;
+}
 
 
-static int
-sbuf_room(struct sbuf *sb, size_t need)
+int
+sim_rev_pulse(uint32_t ticks, void *data)
 {
-	if (sb->cnt + need <= sb->len)
+	struct sim_rev	*rev = data;
+
+	if (ticks == 0)
 		return 0;
 
-	size_t	nlen = sb->len ? sb->len * 2 : 65536;
+	if (rev->cap - rev->cnt < PULSE_MAX) {
+		size_t	ncap = rev->cap ? rev->cap * 2 : 65536;
+		uint8_t	*nb = realloc(rev->b, ncap);
 
-	while (nlen < sb->cnt + need)
-		nlen *= 2;
+		if (!nb)
+			return -1;
 
-	uint8_t	*nb = realloc(sb->b, nlen);
+		rev->b	 = nb;
+		rev->cap = ncap;
+	}
 
-	if (!nb)
-		return -1;
+	if (rev->intervals % SIM_REV_MARK_EVERY == 0) {
+		if (rev->mark_cnt == rev->mark_cap) {
+			size_t	ncap = rev->mark_cap ? rev->mark_cap * 2 : 256;
+			struct sim_rev_mark *nm =
+				realloc(rev->mark, ncap * sizeof(*nm));
+
+			if (!nm)
+				return -1;
+
+			rev->mark     = nm;
+			rev->mark_cap = ncap;
+		}
+
+		rev->mark[rev->mark_cnt++] = (struct sim_rev_mark){
+			.ticks = rev->total_ticks,
+			.off   = rev->cnt
+		};
+	}
 
-	sb->b	= nb;
-	sb->len	= nlen;
+	rev->last_off	  = rev->cnt;
+	rev->last_ticks	  = ticks;
+	rev->cnt	 += put_pulse(&rev->b[rev->cnt], ticks);
+	rev->total_ticks += ticks;
+	++rev->intervals;
 
 	return 0;
 }
 
 
-/*
- * Emit one inter-transition interval.  Same encoding as the
- * firmware's read streams: direct byte, two-byte extended, or a
- * FLUXOP_SPACE followed by a final short pulse.  (FLUXOP_ASTABLE is
- * a write-stream opcode; it never appears in read streams.)
- */
-
-static int
-sbuf_pulse(struct sbuf *sb, uint64_t ticks)
+int
+sim_rev_index(struct sim_rev *rev, uint64_t ticks)
 {
-	if (sbuf_room(sb, 8) == -1)
-		return -1;
+	if (rev->index_cnt == rev->index_cap) {
+		size_t	ncap = rev->index_cap ? rev->index_cap * 2 : 16;
+		struct sim_rev_index *ni =
+			realloc(rev->index, ncap * sizeof(*ni));
 
-	if (ticks == 0)
-		return 0;
+		if (!ni)
+			return -1;
 
-	if (ticks < 250) {
-		sb->b[sb->cnt++] = ticks;
-	} else if (ticks < 250 + 5 * 255) {
-		sb->b[sb->cnt++] = 250 + (ticks - 250) / 255;
-		sb->b[sb->cnt++] = 1 + (ticks - 250) % 255;
-	} else {
-		sb->b[sb->cnt++] = 255;
-		sb->b[sb->cnt++] = FLUXOP_SPACE;
-		gw_write_28(ticks - 249, &sb->b[sb->cnt]);
-		sb->cnt += 4;
-		sb->b[sb->cnt++] = 249;
+		rev->index     = ni;
+		rev->index_cap = ncap;
 	}
 
+	rev->index[rev->index_cnt++] = (struct sim_rev_index){
+		.ticks = ticks,
+		.start = rev->total_ticks,
+		.off   = rev->cnt
+	};
+
 	return 0;
 }
 
 
-static int
-sbuf_index(struct sbuf *sb, uint64_t ticks_to_index)
+size_t
+sim_rev_interval(const struct sim_rev *rev, size_t off, uint32_t *ticks)
 {
-	if (sbuf_room(sb, 6) == -1)
+	size_t	len;
+
+	*ticks = get_pulse(&rev->b[off], &len);
+
+	return len;
+}
+
+
+int
+sim_noise_rev(uint32_t freq, int rpm, struct sim_rev *rev)
+{
+	uint64_t	rev_ticks = (uint64_t)(freq * 60.0 / rpm);
+
+	/* Random transitions 2us..30us apart. */
+	uint32_t	min_t   = 2e-6 * freq;
+	uint32_t	range_t = 28e-6 * freq;
+
+	size_t		len = rev_ticks / min_t + 1;
+
+	if (sim_rev_init(rev, len * 2) == -1)
 		return -1;
 
-	sb->b[sb->cnt++] = 255;
-	sb->b[sb->cnt++] = FLUXOP_INDEX;
-	gw_write_28(ticks_to_index, &sb->b[sb->cnt]);
-	sb->cnt += 4;
+	static uint32_t	seed = 20260711;
+
+	size_t		cnt = 0;
+
+	while (rev->total_ticks < rev_ticks && cnt < len) {
+		seed = seed * 1664525 + 1013904223;	/* LCG */
+
+		uint32_t t = min_t + (uint64_t)seed * range_t / 4294967296u;
+
+		if (rev->total_ticks + t > rev_ticks)
+			t = rev_ticks - rev->total_ticks;
+
+		if (t == 0)
+			break;
+
+		if (sim_rev_pulse(t, rev) == -1) {
+			sim_rev_free(rev);
+			return -1;
+		}
+
+		++cnt;
+	}
 
 	return 0;
 }
 
 
+/*
+ * Find the interval in progress at "phase": set *off to where it
+ * starts in the bytes and *start to when.
+ */
+
+static void
+rev_seek(const struct sim_rev *rev, uint64_t phase, size_t *off,
+	 uint64_t *start)
+{
+	size_t	lo = 0, hi = rev->mark_cnt;
+
+	/* The last mark at or before "phase"; the first is at 0. */
+	while (hi - lo > 1) {
+		size_t	mid = (lo + hi) / 2;
+
+		if (rev->mark[mid].ticks <= phase)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	size_t		o = rev->mark[lo].off;
+	uint64_t	t = rev->mark[lo].ticks;
+
+	for (;;) {
+		size_t		len;
+		uint32_t	p = get_pulse(&rev->b[o], &len);
+
+		if (t + p > phase)
+			break;
+
+		t += p;
+		o += len;
+	}
+
+	*off   = o;
+	*start = t;
+}
+
+
 int
-sim_flux_stream(const struct sim_pulses *sp, uint64_t phase,
+sim_flux_stream(const struct sim_rev *rev, uint64_t phase,
 		unsigned max_index, uint64_t max_ticks,
 		uint8_t **out, size_t *out_cnt, uint64_t *dur_ticks)
 {
-	const uint64_t	rev = sp->total_ticks;
+	const uint64_t	rt = rev->total_ticks;
 
-	if (rev == 0 || sp->cnt == 0)
+	if (rt == 0 || rev->cnt == 0)
 		return -1;
 
 	if (max_index == 0 && max_ticks == 0)
 		max_index = 2;
 
-	phase %= rev;
+	phase %= rt;
+
+	/* Unless they're listed, the index falls at the end. */
+	const struct sim_rev_index	end = {
+		.ticks = rt,
+		.start = rt - rev->last_ticks,
+		.off   = rev->last_off
+	};
+	const struct sim_rev_index	*index = rev->index_cnt ?
+						 rev->index : &end;
+	const size_t			index_cnt = rev->index_cnt ?
+						    rev->index_cnt : 1;
 
-	struct sbuf	sb = { NULL, 0, 0 };
+	/*
+	 * Size the stream for every loop it touches, each with its
+	 * indexes, plus the first interval re-encoded and the
+	 * terminator.
+	 */
+
+	uint64_t	loops = max_index ?
+				(max_index + index_cnt - 1) / index_cnt + 1 :
+				(phase + max_ticks) / rt + 2;
+	size_t		cap  = loops * (rev->cnt + index_cnt * INDEX_LEN) +
+			       PULSE_MAX + 1;
+	uint8_t		*b   = malloc(cap);
+	size_t		n    = 0;
+
+	if (!b)
+		return -1;
 
 	/*
-	 * Walk transitions in unrolled time.  "last" is the absolute
-	 * angle of the previous transition (or of stream start);
-	 * "base"+"cum" track the current revolution.  Index pulses
-	 * occur at every multiple of "rev" and do not advance the
-	 * sample cursor.
+	 * Walk in unrolled time.  "last" is the absolute angle of the
+	 * previous transition (or of stream start); "base" is where the
+	 * current loop began and "start" where, within it, the interval
+	 * at "off" begins.  Each index is reported just before the
+	 * interval it falls within; "ix" is the next one to come.
 	 */
 
+	size_t		off;
+	size_t		ix = 0;
+	uint64_t	start;
 	uint64_t	base = 0;
-	uint64_t	cum  = 0;
-	size_t		j    = 0;
+	uint64_t	last = phase;
+	unsigned	idx  = 0;
+	bool		first = true;
 
-	/* Skip transitions at or before the starting phase. */
-	while (j < sp->cnt && cum + sp->p[j] <= phase)
-		cum += sp->p[j++];
+	rev_seek(rev, phase, &off, &start);
 
-	uint64_t	last	   = phase;
-	uint64_t	next_index = rev;
-	unsigned	idx	   = 0;
+	while (ix < index_cnt &&
+	       (index[ix].off < off ||
+		(index[ix].off == off && index[ix].ticks < phase)))
+		++ix;
 
 	for (;;) {
-		if (j == sp->cnt) {
-			base += rev;
-			cum   = 0;
-			j     = 0;
+		if (off == rev->cnt) {
+			base += rt;
+			off   = 0;
+			start = 0;
+			ix    = 0;
 		}
 
-		uint64_t	t_abs = base + cum + sp->p[j];
+		const struct sim_rev_index *ni = (ix < index_cnt) ?
+						 &index[ix] : NULL;
 
-		if (max_index && next_index <= t_abs) {
-			if (sbuf_index(&sb, next_index - last) == -1)
-				goto err;
+		if (ni && off == ni->off) {
+			n += put_index(&b[n], base + ni->ticks - last);
+			++ix;
 
-			if (++idx >= max_index)
+			if (max_index && ++idx >= max_index)
 				break;
 
-			next_index += rev;
 			continue;
 		}
 
-		if (sbuf_pulse(&sb, t_abs - last) == -1)
-			goto err;
+		size_t		to	 = ni ? ni->off : rev->cnt;
+		uint64_t	to_start = ni ? ni->start : rt;
+
+		if (!first &&
+		    (max_index || base + to_start - phase < max_ticks)) {
+			/* The rest up to the next index, whole. */
+			memcpy(&b[n], &rev->b[off], to - off);
+			n    += to - off;
+			off   = to;
+			start = to_start;
+			last  = base + start;
+			continue;
+		}
+
+		size_t		len;
+		uint32_t	p = get_pulse(&rev->b[off], &len);
+		uint64_t	t = base + start + p;
+
+		if (first) {
+			/* Only part of it is after "phase". */
+			n += put_pulse(&b[n], t - last);
+			first = false;
+		} else {
+			memcpy(&b[n], &rev->b[off], len);
+			n += len;
+		}
 
-		last = t_abs;
-		cum += sp->p[j];
-		++j;
+		last   = t;
+		start += p;
+		off   += len;
 
 		if (max_index == 0 && last - phase >= max_ticks)
 			break;
 	}
 
-	if (sbuf_room(&sb, 1) == -1)
-		goto err;
+	b[n++] = 0;	/* end of stream */
 
-	sb.b[sb.cnt++] = 0;	/* end of stream */
-
-	*out	   = sb.b;
-	*out_cnt   = sb.cnt;
+	*out	   = b;
+	*out_cnt   = n;
 	*dur_ticks = last - phase;
 
 	return 0;
-
-err:
-	free(sb.b);
-
-	return -1;
 }
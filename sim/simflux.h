@@ -1,45 +1,114 @@
 #ifndef SIMFLUX_H
 #define SIMFLUX_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 /*
  * Flux stream synthesis for CMD_READ_FLUX.
  *
- * A pulse train is one full revolution of inter-transition tick
- * counts; total_ticks is their sum and defines the revolution
- * period (and thus the RPM the host will measure).
+ * A revolution is rendered once, straight from the encoder, as the
+ * Greaseweazle read-stream bytes of its inter-transition intervals:
+ * one byte below 250 ticks, two below 1525, else a FLUXOP_SPACE and
+ * a final 249.  total_ticks is their sum and defines the revolution
+ * period (and thus the RPM the host will measure).  A read is then
+ * mostly copies of those bytes, with the index ops put in as it
+ * goes.
+ *
+ * Every SIM_REV_MARK_EVERY intervals a mark records where in the
+ * bytes, and when in the revolution, the next one starts, so a read
+ * can begin at any rotational phase without walking the whole
+ * revolution.
+ *
+ * The index normally falls at the end of the revolution.  A recorded
+ * track instead loops through several revolutions, each index
+ * falling where it was captured, within some interval; these are
+ * listed in "index".
+ *
+ * A media may keep a revolution of its own and lend it out for reads
+ * by copying the struct with "shared" set; sim_rev_free() then only
+ * forgets the copy.
  */
 
-struct sim_pulses {
-	uint32_t	*p;
-	size_t		cnt;
-	uint64_t	total_ticks;
+#define SIM_REV_MARK_EVERY	64
+
+struct sim_rev_mark {
+	uint64_t	ticks;		/* start of the interval at "off" */
+	size_t		off;
+};
+
+struct sim_rev_index {
+	uint64_t	ticks;		/* when in the loop it falls */
+	uint64_t	start;		/* start of the interval at "off" */
+	size_t		off;
+};
+
+struct sim_rev {
+	uint8_t			*b;
+	size_t			cnt;
+	size_t			cap;
+	uint64_t		total_ticks;
+	size_t			intervals;
+	size_t			last_off;	/* where the final one starts */
+	uint32_t		last_ticks;	/* and its length */
+	struct sim_rev_mark	*mark;
+	size_t			mark_cnt;
+	size_t			mark_cap;
+	struct sim_rev_index	*index;		/* none: one at the end */
+	size_t			index_cnt;
+	size_t			index_cap;
+	bool			shared;
 };
 
-/* Sum pulse ticks into total_ticks. */
-extern void sim_pulses_total(struct sim_pulses *sp);
+/*
+ * Start an empty revolution with room for "cap" bytes, which it
+ * outgrows only if need be.  Returns 0, or -1 on error.
+ */
+extern int sim_rev_init(struct sim_rev *rev, size_t cap);
+
+extern void sim_rev_free(struct sim_rev *rev);
+
+/*
+ * Append an interval of "ticks", ignoring zero.  Matches the encoder
+ * callback (struct dmk_encode_s), with "data" the struct sim_rev.
+ * Returns 0, or -1 on error.
+ */
+extern int sim_rev_pulse(uint32_t ticks, void *data);
+
+/*
+ * Put an index "ticks" into the loop, within the interval appended
+ * next.  Returns 0, or -1 on error.
+ */
+extern int sim_rev_index(struct sim_rev *rev, uint64_t ticks);
+
+/*
+ * The interval at "off" in the bytes: sets *ticks and returns its
+ * length, to step to the next.
+ */
+extern size_t sim_rev_interval(const struct sim_rev *rev, size_t off,
+			       uint32_t *ticks);
 
 /*
  * Random flux for an unformatted surface (or no data on this head).
  * Fills one nominal revolution at "rpm".  Returns 0, or -1 on error.
  */
-extern int sim_noise_pulses(uint32_t freq, int rpm,
-			    struct sim_pulses *sp);
+extern int sim_noise_rev(uint32_t freq, int rpm, struct sim_rev *rev);
 
 /*
- * Build a Greaseweazle read stream from the pulse train.
+ * Build a Greaseweazle read stream from the revolution.
  *
  * "phase" is how far (in ticks) the media has rotated past the
- * index at stream start.  The stream ends after "max_index" index
+ * start of the loop at stream start (past the index, unless indexes
+ * are listed).  The stream ends after "max_index" index
  * pulses, or after "max_ticks" ticks if max_index is 0, and is
- * always terminated with a 0x00 byte.
+ * always terminated with a 0x00 byte.  Index pulses are reported
+ * either way, as the firmware does.
  *
  * Returns 0 with a malloc'd stream in *out (caller frees) and the
  * stream's duration in ticks in *dur_ticks, or -1 on error.
  */
-extern int sim_flux_stream(const struct sim_pulses *sp, uint64_t phase,
+extern int sim_flux_stream(const struct sim_rev *rev, uint64_t phase,
 			   unsigned max_index, uint64_t max_ticks,
 			   uint8_t **out, size_t *out_cnt,
 			   uint64_t *dur_ticks);
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "greaseweazle.h"
+#include "gw.h"
+#include "gwreplay.h"
+#include "gwwalk.h"
+
+#include "simflux.h"
+#include "simmedia.h"
+#include "simgwlog.h"
+
+
+/*
+ * Recorded flux: the READ_FLUX streams of a Greaseweazle transaction
+ * log (as written by -U), served back as they were captured.
+ *
+ * Each position's streams are laid end to end, once, into a loop of
+ * every revolution recorded there, each index where it fell.  A
+ * stream is taken from the first transition after its first index,
+ * and is closed past its last index by one interval spliced from
+ * the flux either side of the index, so the loop holds no
+ * transition that wasn't captured.  Reads then copy the recorded
+ * stream bytes; as the drive turns, successive reads rotate through
+ * the revolutions.  Only if the sample clock differs from the
+ * capture's are the intervals rescaled.
+ *
+ * The recording is read-only, and the drive's RPM has no say in it.
+ */
+
+struct sim_gwlog {
+	struct sim_media	m;
+	struct gw_replay_log	*log;
+	int			tracks;
+	int			revs;		/* complete, all positions */
+
+	/* Each position's loop, laid out on its first read. */
+	struct sim_rev		rev[GW_MAX_TRACKS][2];
+	uint32_t		rev_freq[GW_MAX_TRACKS][2];
+};
+
+/* Laying out one stream. */
+struct gwlog_lay {
+	struct sim_rev	*rev;
+	uint32_t	freq;
+	uint32_t	rec_freq;
+	uint64_t	base;		/* loop ticks when the stream began */
+	uint64_t	lead;		/* next stream's, first index on */
+	int		indexes;	/* in the stream */
+
+	int		index;		/* seen so far */
+	uint64_t	t;		/* stream ticks */
+	uint64_t	zero;		/* stream ticks where it's taken from */
+	uint64_t	prev;		/* loop ticks of the last transition */
+	bool		zeroed;
+	bool		pending;
+	uint64_t	pending_ticks;
+	uint64_t	first_index;
+	uint64_t	last_index;
+	int		err;
+};
+
+
+/* Stream ticks to sample clock ticks, in the capture's frame. */
+
+static uint64_t
+gwlog_scale(const struct gwlog_lay *ll, uint64_t ticks)
+{
+	if (ll->freq == ll->rec_freq)
+		return ticks;
+
+	return (ticks * ll->freq + ll->rec_freq / 2) / ll->rec_freq;
+}
+
+
+/*
+ * First pass: count the indexes from the last before any flux, and
+ * time the first transition after it.
+ */
+
+static int
+scan_imark(struct gwlog_lay *ll, uint32_t ticks)
+{
+	if (!ll->zeroed) {
+		ll->index	= 0;
+		ll->first_index = ticks;
+	}
+
+	++ll->index;
+	ll->last_index = ticks;
+
+	return 0;
+}
+
+
+static int
+scan_pulse(struct gwlog_lay *ll, uint32_t ticks)
+{
+	ll->t += ticks;
+
+	if (ll->index > 0 && !ll->zeroed) {
+		ll->zero   = ll->t;
+		ll->zeroed = true;
+	}
+
+	return 0;
+}
+
+
+static int
+lay_imark(struct gwlog_lay *ll, uint32_t ticks)
+{
+	if (!ll->zeroed) {
+		ll->index = 1;
+		return 0;
+	}
+
+	++ll->index;
+
+	uint64_t	at = gwlog_scale(ll, ticks - ll->zero);
+
+	if (ll->index < ll->indexes) {
+		ll->pending	  = true;
+		ll->pending_ticks = at;
+		return 0;
+	}
+
+	/* The last: close the loop across it. */
+	if ((ll->pending &&
+	     sim_rev_index(ll->rev, ll->base + ll->pending_ticks) == -1) ||
+	    sim_rev_index(ll->rev, ll->base + at) == -1 ||
+	    sim_rev_pulse(at - ll->prev + ll->lead, ll->rev) == -1)
+		ll->err = -1;
+
+	return 1;
+}
+
+
+static int
+lay_pulse(struct gwlog_lay *ll, uint32_t ticks)
+{
+	ll->t += ticks;
+
+	if (ll->index == 0)
+		return 0;
+
+	if (!ll->zeroed) {
+		ll->zero   = ll->t;
+		ll->zeroed = true;
+		return 0;
+	}
+
+	uint64_t	now = gwlog_scale(ll, ll->t - ll->zero);
+
+	if (now == ll->prev)
+		return 0;
+
+	if (ll->pending) {
+		if (sim_rev_index(ll->rev, ll->base + ll->pending_ticks) == -1)
+			goto err;
+		ll->pending = false;
+	}
+
+	if (sim_rev_pulse(now - ll->prev, ll->rev) == -1)
+		goto err;
+
+	ll->prev = now;
+
+	return 0;
+
+err:
+	ll->err = -1;
+	return 1;
+}
+
+
+GW_STREAM_WALKER(scan_stream, struct gwlog_lay, scan_imark, gw_walk_ignore,
+		 scan_pulse)
+
+GW_STREAM_WALKER(lay_stream, struct gwlog_lay, lay_imark, gw_walk_ignore,
+		 lay_pulse)
+
+
+/*
+ * Scan a recorded stream: how many indexes, and from the first how
+ * long to the first transition (in the capture's ticks).  Returns
+ * whether it holds a complete revolution with flux in it.
+ */
+
+static bool
+gwlog_scan(const struct gw_replay_flux *fx, int *indexes, uint64_t *lead)
+{
+	struct gwlog_lay	ll = { 0 };
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+	if (fx->status != ACK_OKAY ||
+	    scan_stream(fx->buf, fx->cnt, &ws, &ll) < 0)
+		return false;
+
+	*indexes = ll.index;
+	*lead	 = ll.zero - ll.first_index;
+
+	/* Some flux before the last index. */
+	return ll.index >= 2 && ll.zeroed && ll.zero <= ll.last_index;
+}
+
+
+/* Lay out every usable stream at a position. */
+
+static int
+gwlog_build(struct sim_gwlog *gl, int track, int side, uint32_t freq,
+	    struct sim_rev *rev)
+{
+	const struct gw_replay_pos	*pos = &gl->log->pos[track][side];
+
+	if (pos->cnt == 0)
+		return 1;
+
+	uint32_t	rec_freq = gl->log->sample_freq ?
+				   gl->log->sample_freq : freq;
+	int		*indexes = calloc(pos->cnt, sizeof(*indexes));
+	uint64_t	*lead	 = calloc(pos->cnt, sizeof(*lead));
+	int		first	 = -1;
+	int		ret	 = -1;
+
+	if (!indexes || !lead)
+		goto out;
+
+	for (int i = 0; i < pos->cnt; ++i) {
+		if (!gwlog_scan(&pos->flux[i], &indexes[i], &lead[i]))
+			indexes[i] = 0;
+		else if (first == -1)
+			first = i;
+	}
+
+	ret = 1;
+	if (first == -1)
+		goto out;
+
+	ret = -1;
+	if (sim_rev_init(rev, pos->flux[first].cnt) == -1)
+		goto out;
+
+	for (int i = first; i < pos->cnt; ++i) {
+		if (!indexes[i])
+			continue;
+
+		/* The splice leads into the next stream, or back round. */
+		int	next = i + 1;
+
+		while (next < pos->cnt && !indexes[next])
+			++next;
+
+		if (next == pos->cnt)
+			next = first;
+
+		struct gwlog_lay	ll = {
+			.rev	  = rev,
+			.freq	  = freq,
+			.rec_freq = rec_freq,
+			.base	  = rev->total_ticks,
+			.indexes  = indexes[i]
+		};
+
+		struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+		ll.lead = gwlog_scale(&ll, lead[next]);
+
+		if (lay_stream(pos->flux[i].buf, pos->flux[i].cnt, &ws,
+			       &ll) < 0 || ll.err) {
+			sim_rev_free(rev);
+			goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	free(indexes);
+	free(lead);
+
+	return ret;
+}
+
+
+static struct sim_media *
+gwlog_load(const char *path)
+{
+	FILE	*fp = fopen(path, "r");
+
+	if (!fp)
+		return NULL;
+
+	struct sim_gwlog	*gl = calloc(1, sizeof(*gl));
+
+	if (!gl || !(gl->log = calloc(1, sizeof(*gl->log))) ||
+	    gw_replay_parse(fp, gl->log) != 0) {
+		fclose(fp);
+		goto err;
+	}
+
+	fclose(fp);
+
+	for (int t = 0; t < GW_MAX_TRACKS; ++t) {
+		for (int s = 0; s < 2; ++s) {
+			const struct gw_replay_pos *pos = &gl->log->pos[t][s];
+
+			for (int i = 0; i < pos->cnt; ++i) {
+				int		indexes;
+				uint64_t	lead;
+
+				if (!gwlog_scan(&pos->flux[i], &indexes,
+						&lead))
+					continue;
+
+				gl->revs  += indexes - 1;
+				gl->tracks = t + 1;
+			}
+		}
+	}
+
+	if (gl->tracks == 0) {
+		fprintf(stderr, "gwsim: %s: no recorded flux\n", path);
+		goto err;
+	}
+
+	gl->m.ops   = &sim_gwlog_ops;
+	gl->m.path  = strdup(path);
+	gl->m.wp    = true;
+	gl->m.dirty = false;
+
+	return &gl->m;
+
+err:
+	if (gl && gl->log) {
+		gw_replay_log_free(gl->log);
+		free(gl->log);
+	}
+	free(gl);
+
+	return NULL;
+}
+
+
+static int
+gwlog_save(struct sim_media *media)
+{
+	return 0;
+}
+
+
+static void
+gwlog_unload(struct sim_media *media)
+{
+	struct sim_gwlog	*gl = (struct sim_gwlog *)media;
+
+	for (int t = 0; t < GW_MAX_TRACKS; ++t) {
+		for (int s = 0; s < 2; ++s)
+			sim_rev_free(&gl->rev[t][s]);
+	}
+
+	gw_replay_log_free(gl->log);
+	free(gl->log);
+	free(media->path);
+	free(gl);
+}
+
+
+static int
+gwlog_track_rev(struct sim_media *media, int track, int side,
+		uint32_t freq, int rpm, struct sim_rev *rev)
+{
+	struct sim_gwlog	*gl = (struct sim_gwlog *)media;
+
+	if (track < 0 || track >= gl->tracks || side < 0 || side >= 2)
+		return 1;
+
+	struct sim_rev	*own = &gl->rev[track][side];
+
+	if (own->cnt && gl->rev_freq[track][side] != freq)
+		sim_rev_free(own);
+
+	if (!own->cnt) {
+		int	r = gwlog_build(gl, track, side, freq, own);
+
+		if (r != 0)
+			return r;
+
+		gl->rev_freq[track][side] = freq;
+	}
+
+	*rev	    = *own;
+	rev->shared = true;
+
+	return 0;
+}
+
+
+static int
+gwlog_tracks(struct sim_media *media)
+{
+	return ((struct sim_gwlog *)media)->tracks;
+}
+
+
+static void
+gwlog_describe(struct sim_media *media, char *buf, size_t buflen)
+{
+	struct sim_gwlog	*gl = (struct sim_gwlog *)media;
+
+	snprintf(buf, buflen, "recorded flux %s: %d tracks, "
+		 "%d revolutions at %u Hz, write-protected",
+		 media->path, gl->tracks, gl->revs, gl->log->sample_freq);
+}
+
+
+const struct sim_media_ops sim_gwlog_ops = {
+	.name		   = "gwlog",
+	.load		   = gwlog_load,
+	.save		   = gwlog_save,
+	.unload		   = gwlog_unload,
+	.track_rev	   = gwlog_track_rev,
+	.write_begin	   = NULL,
+	.write_pulse	   = NULL,
+	.write_end	   = NULL,
+	.tracks		   = gwlog_tracks,
+	.describe	   = gwlog_describe,
+};
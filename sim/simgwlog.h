@@ -0,0 +1,8 @@
+#ifndef SIMGWLOG_H
+#define SIMGWLOG_H
+
+#include "simmedia.h"
+
+extern const struct sim_media_ops sim_gwlog_ops;
+
+#endif
@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "greaseweazle.h"
+#include "gw.h"
+
+#include "simclock.h"
+#include "simgw.h"
+#include "simmedia.h"
+#include "simhost.h"
+#include "simproto.h"
+#include "simsetup.h"
+#include "simshm.h"
+
+#define SPEC_WORDS_MAX	(SIM_MAX_UNITS * 2 + 2)
+
+
+static struct sim_host {
+	bool			active;
+	struct sim_gw		gw;
+	struct sim_proto	proto;
+	uint8_t			*outq;
+	size_t			outq_cnt, outq_off, outq_cap;
+
+	struct sim_shm		*shm;
+} sh;
+
+
+/* In process: replies queue up until the host reads them. */
+
+static int
+host_out(void *ctx, const uint8_t *buf, size_t cnt)
+{
+	size_t	need = sh.outq_cnt + cnt;
+
+	if (need > sh.outq_cap) {
+		size_t	new_cap = sh.outq_cap ? sh.outq_cap : 65536;
+
+		while (new_cap < need)
+			new_cap *= 2;
+
+		uint8_t	*new_q = realloc(sh.outq, new_cap);
+
+		if (!new_q)
+			return -1;
+
+		sh.outq	    = new_q;
+		sh.outq_cap = new_cap;
+	}
+
+	memcpy(sh.outq + sh.outq_cnt, buf, cnt);
+	sh.outq_cnt = need;
+
+	return 0;
+}
+
+
+static ssize_t
+host_bwrite(void *ctx, const uint8_t *wbuf, size_t wbuf_cnt)
+{
+	if (sim_proto_input(&sh.proto, wbuf, wbuf_cnt) == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return wbuf_cnt;
+}
+
+
+static ssize_t
+host_bread(void *ctx, uint8_t *rbuf, size_t rbuf_cnt)
+{
+	size_t	avail = sh.outq_cnt - sh.outq_off;
+
+	if (avail == 0) {
+		/* Nothing more is coming; the host is out of step. */
+		errno = EIO;
+		return -1;
+	}
+
+	size_t	cnt = rbuf_cnt < avail ? rbuf_cnt : avail;
+
+	memcpy(rbuf, sh.outq + sh.outq_off, cnt);
+	sh.outq_off += cnt;
+
+	if (sh.outq_off == sh.outq_cnt)
+		sh.outq_off = sh.outq_cnt = 0;
+
+	return cnt;
+}
+
+
+static ssize_t
+host_bytes_waiting(void *ctx)
+{
+	return sh.outq_cnt - sh.outq_off;
+}
+
+
+static const struct gw_backend_ops sim_host_ops = {
+	.bread		= host_bread,
+	.bwrite		= host_bwrite,
+	.bytes_waiting	= host_bytes_waiting,
+};
+
+
+/* Over shared memory: the rings stand in for the pty. */
+
+static ssize_t
+shm_bwrite(void *ctx, const uint8_t *wbuf, size_t wbuf_cnt)
+{
+	if (sim_ring_write(sh.shm, &sh.shm->to_sim, wbuf, wbuf_cnt) == -1) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	return wbuf_cnt;
+}
+
+
+static ssize_t
+shm_bread(void *ctx, uint8_t *rbuf, size_t rbuf_cnt)
+{
+	return sim_ring_read(sh.shm, &sh.shm->to_host, rbuf, rbuf_cnt,
+			     SIM_SHM_TIMEOUT_S);
+}
+
+
+static ssize_t
+shm_bytes_waiting(void *ctx)
+{
+	return sim_ring_avail(&sh.shm->to_host);
+}
+
+
+static const struct gw_backend_ops sim_shm_ops = {
+	.bread		= shm_bread,
+	.bwrite		= shm_bwrite,
+	.bytes_waiting	= shm_bytes_waiting,
+};
+
+
+bool
+sim_host_device(const char *device)
+{
+	return !strncmp(device, SIM_HOST_PREFIX, strlen(SIM_HOST_PREFIX)) ||
+	       !strncmp(device, SIM_SHM_PREFIX, strlen(SIM_SHM_PREFIX));
+}
+
+
+/*
+ * Build the in-process simulator from the words of "spec": drives
+ * first, then the model and defaults, then the diskettes.
+ */
+
+static int
+host_setup(char *spec)
+{
+	const char	*model = "f7";
+	char		*inserts[SPEC_WORDS_MAX];
+	bool		bare[SPEC_WORDS_MAX];
+	int		insert_cnt = 0;
+	char		*save = NULL;
+
+	sim_fast = true;
+	sim_media_write_through = false;
+
+	for (char *w = strtok_r(spec, ";", &save); w;
+	     w = strtok_r(NULL, ";", &save)) {
+		if (!strncmp(w, "model=", 6)) {
+			model = w + 6;
+		} else if (!strcmp(w, "timed")) {
+			sim_fast = false;
+		} else if (!strcmp(w, "write-through")) {
+			sim_media_write_through = true;
+		} else if (!strncmp(w, "drive=", 6)) {
+			if (sim_setup_drive(&sh.gw, w + 6) == -1)
+				return -1;
+		} else if (insert_cnt == SPEC_WORDS_MAX) {
+			fprintf(stderr, "gwsim: too many diskettes\n");
+			return -1;
+		} else {
+			bare[insert_cnt]    = strncmp(w, "insert=", 7) != 0;
+			inserts[insert_cnt] = bare[insert_cnt] ? w : w + 7;
+			++insert_cnt;
+		}
+	}
+
+	if (sim_setup_finish(&sh.gw, model) == -1)
+		return -1;
+
+	for (int i = 0; i < insert_cnt; ++i) {
+		char	*ins = inserts[i];
+		int	ret;
+
+		/* A bare file goes in as "insert=0:FILE". */
+		if (bare[i]) {
+			ins = malloc(strlen(inserts[i]) + 3);
+
+			if (!ins)
+				return -1;
+
+			sprintf(ins, "0:%s", inserts[i]);
+		}
+
+		ret = sim_setup_insert(&sh.gw, ins);
+
+		if (bare[i])
+			free(ins);
+
+		if (ret == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+shm_attach(const char *name)
+{
+	char	path[256];
+
+	snprintf(path, sizeof(path), "/%s", name);
+
+	sh.shm = sim_shm_map(path);
+
+	if (!sh.shm) {
+		fprintf(stderr, "gwsim: cannot map '%s': %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	if (atomic_exchange(&sh.shm->attached, 1)) {
+		fprintf(stderr, "gwsim: '%s' is in use\n", path);
+		sim_shm_destroy(sh.shm, NULL);
+		sh.shm = NULL;
+		return -1;
+	}
+
+	/* Drop anything an earlier host left unread. */
+	struct sim_ring	*r = &sh.shm->to_host;
+
+	atomic_store(&r->tail, atomic_load(&r->head));
+	sem_post(&r->space);
+	atomic_fetch_add(&sh.shm->session, 1);
+
+	return 0;
+}
+
+
+static void
+sim_host_exit(void)
+{
+	sim_host_close();
+}
+
+
+gw_devt
+sim_host_open(const char *device)
+{
+	if (sh.active || !sim_host_device(device))
+		return GW_DEVT_INVALID;
+
+	memset(&sh, 0, sizeof(sh));
+
+	char	*spec = strdup(strchr(device, ':') + 1);
+
+	if (!spec)
+		return GW_DEVT_INVALID;
+
+	int	ret;
+
+	if (!strncmp(device, SIM_SHM_PREFIX, strlen(SIM_SHM_PREFIX))) {
+		ret = shm_attach(spec);
+	} else {
+		ret = host_setup(spec);
+
+		if (ret == -1)
+			sim_setup_free(&sh.gw);
+		else
+			sim_proto_init(&sh.proto, &sh.gw, host_out, NULL);
+	}
+
+	free(spec);
+
+	if (ret == -1)
+		return GW_DEVT_INVALID;
+
+	sh.active = true;
+
+	gw_set_backend(sh.shm ? &sim_shm_ops : &sim_host_ops, NULL);
+
+	static bool	exit_hook = false;
+
+	if (!exit_hook)
+		exit_hook = atexit(sim_host_exit) == 0;
+
+	return GW_SIM_DEVT;
+}
+
+
+void
+sim_host_close(void)
+{
+	if (!sh.active)
+		return;
+
+	gw_set_backend(NULL, NULL);
+
+	if (sh.shm) {
+		atomic_store(&sh.shm->attached, 0);
+		sim_shm_destroy(sh.shm, NULL);
+	} else {
+		sim_setup_free(&sh.gw);
+		free(sh.outq);
+	}
+
+	memset(&sh, 0, sizeof(sh));
+}
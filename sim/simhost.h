@@ -0,0 +1,43 @@
+#ifndef SIMHOST_H
+#define SIMHOST_H
+
+#include <stdbool.h>
+
+#include "gw.h"
+
+/*
+ * The simulator as a gw backend, for host tools given a device name
+ *
+ *   sim:WORD[;WORD]...    the simulator, in process
+ *   shm:NAME              a gwsim serving "--shm NAME"
+ *
+ * A sim: WORD is "model=NAME", "drive=N:TYPE[,...]" or
+ * "insert=N:FILE" as for gwsim's options, "timed" to keep its seek
+ * and rotational delays, or a bare FILE inserted at unit 0.  Without
+ * drive= words, unit 0 is a 525dd drive.
+ *
+ * Either way no device is opened: the protocol bytes pass in memory,
+ * the in-process simulator answering each command as it's written.
+ * Its media are flushed back to their files at exit.
+ */
+
+/* Sentinel device handle; never touched by a syscall. */
+#define GW_SIM_DEVT	((gw_devt)-4)
+
+#define SIM_HOST_PREFIX	"sim:"
+#define SIM_SHM_PREFIX	"shm:"
+
+
+/* True if "device" names a simulator rather than a device. */
+extern bool sim_host_device(const char *device);
+
+/*
+ * Start the simulator "device" names and register it as the gw
+ * backend.  Returns GW_SIM_DEVT, or GW_DEVT_INVALID on failure.
+ */
+extern gw_devt sim_host_open(const char *device);
+
+/* Deregister and shut the simulator down; done at exit if not before. */
+extern void sim_host_close(void);
+
+#endif
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,17 +25,21 @@
 #include "simclock.h"
 #include "simctl.h"
 #include "simdrive.h"
-#include "simfdadap.h"
 #include "simgw.h"
 #include "simmedia.h"
 #include "simproto.h"
 #include "simpty.h"
+#include "simsetup.h"
+#include "simshm.h"
 
 #define MAX_CTL_CLIENTS	4
 #define CTL_LINE_MAX	512
 
 static volatile sig_atomic_t	got_signal = 0;
 
+/* Held while the device model runs, as the shm server has a thread. */
+static pthread_mutex_t		sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 static void
 sig_handler(int sig)
@@ -55,12 +60,22 @@ usage(FILE *fp, const char *prog)
 		"[./gwsim-pty]\n"
 		"  -s, --socket PATH     control socket, "
 		"\"none\" disables [./gwsim.sock]\n"
+		"  -S, --shm NAME        also serve hosts given "
+		"\"-G shm:NAME\"\n"
+		"  -R, --shm-reclaim     take over a stale shared memory "
+		"NAME\n"
 		"  -D, --drive N:TYPE[,tracks=T][,rpm=R][,sides=S]"
 		"[,fdadap][,wp]\n"
 		"                        attach a drive at unit N "
 		"[0:525dd]\n"
 		"  -i, --insert N:FILE   insert diskette image at "
 		"startup\n"
+		"  -w, --write-through   save each track to its image as "
+		"it is written\n"
+		"  -L, --latency US      USB turnaround per command "
+		"transfer [0]\n"
+		"  -b, --link KBPS       host-to-device rate for write "
+		"streams [unlimited]\n"
 		"  -l, --list            list drive types and models\n"
 		"  -h, --help            this help\n"
 		"\n"
@@ -70,110 +85,6 @@ usage(FILE *fp, const char *prog)
 }
 
 
-static int
-parse_drive_spec(struct sim_gw *gw, char *spec)
-{
-	char	*colon = strchr(spec, ':');
-
-	if (!colon || colon == spec) {
-		fprintf(stderr, "gwsim: bad drive spec '%s'\n", spec);
-		return -1;
-	}
-
-	*colon = '\0';
-
-	char	*end;
-	long	unit = strtol(spec, &end, 10);
-
-	if (*end || unit < 0 || unit >= SIM_MAX_UNITS) {
-		fprintf(stderr, "gwsim: bad unit '%s'\n", spec);
-		return -1;
-	}
-
-	if (gw->unit[unit]) {
-		fprintf(stderr, "gwsim: unit %ld already has a drive\n",
-			unit);
-		return -1;
-	}
-
-	char	*save = NULL;
-	char	*type = strtok_r(colon + 1, ",", &save);
-
-	const struct sim_drive_type *dt =
-			type ? sim_drive_type_find(type) : NULL;
-
-	if (!dt) {
-		fprintf(stderr, "gwsim: unknown drive type '%s'\n",
-			type ? type : "");
-		return -1;
-	}
-
-	struct sim_drive	*drv = sim_drive_new(dt);
-
-	if (!drv)
-		return -1;
-
-	for (char *opt = strtok_r(NULL, ",", &save); opt;
-	     opt = strtok_r(NULL, ",", &save)) {
-		if (!strncmp(opt, "tracks=", 7)) {
-			int	t = atoi(opt + 7);
-
-			if (t < 1 || t > 88) {
-				fprintf(stderr, "gwsim: bad tracks "
-					"'%s'\n", opt);
-				goto err;
-			}
-
-			drv->tracks = t;
-		} else if (!strncmp(opt, "rpm=", 4)) {
-			int	r = atoi(opt + 4);
-
-			if (r != dt->rpm && r != dt->rpm_alt) {
-				fprintf(stderr, "gwsim: %s does not "
-					"support %d RPM\n", dt->name, r);
-				goto err;
-			}
-
-			drv->rpm = r;
-		} else if (!strncmp(opt, "sides=", 6)) {
-			int	s = atoi(opt + 6);
-
-			if (s < 1 || s > 2) {
-				fprintf(stderr, "gwsim: bad sides "
-					"'%s'\n", opt);
-				goto err;
-			}
-
-			drv->sides = s;
-		} else if (!strcmp(opt, "fdadap")) {
-			drv->fdadap = true;
-		} else if (!strcmp(opt, "wp")) {
-			drv->wp_force = true;
-		} else {
-			fprintf(stderr, "gwsim: unknown drive option "
-				"'%s'\n", opt);
-			goto err;
-		}
-	}
-
-	char	errbuf[128];
-
-	if (!sim_fdadap_attach_ok(drv, errbuf, sizeof(errbuf))) {
-		fprintf(stderr, "gwsim: unit %ld: %s\n", unit, errbuf);
-		goto err;
-	}
-
-	gw->unit[unit] = drv;
-
-	return 0;
-
-err:
-	sim_drive_free(drv);
-
-	return -1;
-}
-
-
 static int
 ctl_socket_open(const char *path)
 {
@@ -241,14 +152,72 @@ ctl_feed(struct sim_gw *gw, struct ctl_client *cc, int out)
 }
 
 
+static int
+pty_out(void *ctx, const uint8_t *buf, size_t cnt)
+{
+	return sim_pty_write_all(ctx, buf, cnt);
+}
+
+
+struct shm_server {
+	struct sim_shm		*shm;
+	struct sim_proto	proto;
+	unsigned		session;
+};
+
+
+static int
+shm_out(void *ctx, const uint8_t *buf, size_t cnt)
+{
+	struct sim_shm	*shm = ctx;
+
+	return sim_ring_write(shm, &shm->to_host, buf, cnt);
+}
+
+
+/*
+ * Serve the shared-memory host until the simulator closes, starting
+ * each newly attached host with a clean command buffer.
+ */
+
+static void *
+shm_serve(void *arg)
+{
+	struct shm_server	*ss = arg;
+	uint8_t			buf[8192];
+	ssize_t			rd;
+
+	while ((rd = sim_ring_read(ss->shm, &ss->shm->to_sim, buf,
+				   sizeof(buf), 0)) > 0) {
+		pthread_mutex_lock(&sim_lock);
+
+		unsigned	session = atomic_load(&ss->shm->session);
+
+		if (session != ss->session) {
+			ss->session = session;
+			sim_proto_reset(&ss->proto);
+		}
+
+		sim_proto_input(&ss->proto, buf, rd);
+
+		pthread_mutex_unlock(&sim_lock);
+	}
+
+	return NULL;
+}
+
+
 int
 main(int argc, char **argv)
 {
 	const char	*pty_link  = "./gwsim-pty";
 	const char	*sock_path = "./gwsim.sock";
 	const char	*model	   = "f7";
+	const char	*shm_name  = NULL;
+	bool		shm_reclaim = false;
 
-	static struct sim_gw	gw;
+	static struct sim_gw		gw;
+	static struct shm_server	ss;
 
 	struct {
 		char	*spec;
@@ -260,17 +229,21 @@ main(int argc, char **argv)
 		{ "fast",	no_argument,	   NULL, 'f' },
 		{ "pty-link",	required_argument, NULL, 'p' },
 		{ "socket",	required_argument, NULL, 's' },
+		{ "shm",	required_argument, NULL, 'S' },
+		{ "shm-reclaim", no_argument,	   NULL, 'R' },
 		{ "drive",	required_argument, NULL, 'D' },
 		{ "insert",	required_argument, NULL, 'i' },
+		{ "write-through", no_argument,	   NULL, 'w' },
+		{ "latency",	required_argument, NULL, 'L' },
+		{ "link",	required_argument, NULL, 'b' },
 		{ "list",	no_argument,	   NULL, 'l' },
 		{ "help",	no_argument,	   NULL, 'h' },
 		{ NULL, 0, NULL, 0 }
 	};
 
 	int	c;
-	bool	have_drive = false;
 
-	while ((c = getopt_long(argc, argv, "m:fp:s:D:i:lh", opts,
+	while ((c = getopt_long(argc, argv, "m:fp:s:S:RD:i:wL:b:lh", opts,
 				NULL)) != -1) {
 		switch (c) {
 		case 'm':
@@ -289,11 +262,18 @@ main(int argc, char **argv)
 			sock_path = optarg;
 			break;
 
+		case 'S':
+			shm_name = optarg;
+			break;
+
+		case 'R':
+			shm_reclaim = true;
+			break;
+
 		case 'D':
-			if (parse_drive_spec(&gw, optarg) == -1)
+			if (sim_setup_drive(&gw, optarg) == -1)
 				return 1;
 
-			have_drive = true;
 			break;
 
 		case 'i':
@@ -307,6 +287,39 @@ main(int argc, char **argv)
 			inserts[insert_cnt++].spec = optarg;
 			break;
 
+		case 'w':
+			sim_media_write_through = true;
+			break;
+
+		case 'L': {
+			char		*end;
+			unsigned long	us = strtoul(optarg, &end, 10);
+
+			if (*end || end == optarg || us > 1000000) {
+				fprintf(stderr, "gwsim: bad --latency "
+					"'%s'\n", optarg);
+				return 1;
+			}
+
+			sim_proto_latency_us = us;
+			break;
+		}
+
+		case 'b': {
+			char		*end;
+			unsigned long	kbps = strtoul(optarg, &end, 10);
+
+			if (*end || end == optarg || kbps == 0 ||
+			    kbps > 1000000) {
+				fprintf(stderr, "gwsim: bad --link "
+					"'%s'\n", optarg);
+				return 1;
+			}
+
+			sim_proto_link_kbps = kbps;
+			break;
+		}
+
 		case 'l':
 			printf("Greaseweazle models:\n");
 			sim_gw_model_list();
@@ -329,49 +342,12 @@ main(int argc, char **argv)
 		return 1;
 	}
 
-	gw.model = sim_gw_model_find(model);
-
-	if (!gw.model) {
-		fprintf(stderr, "gwsim: unknown model '%s'\n", model);
+	if (sim_setup_finish(&gw, model) == -1)
 		return 1;
-	}
-
-	if (!have_drive) {
-		char	spec[] = "0:525dd";
-
-		if (parse_drive_spec(&gw, spec) == -1)
-			return 1;
-	}
-
-	sim_gw_reset(&gw);
 
 	for (int i = 0; i < insert_cnt; ++i) {
-		char	*spec  = inserts[i].spec;
-		char	*colon = strchr(spec, ':');
-
-		if (!colon || colon[1] == '\0' ||
-		    colon - spec != 1 || spec[0] < '0' || spec[0] > '2') {
-			fprintf(stderr, "gwsim: bad insert spec '%s'\n",
-				spec);
-			return 1;
-		}
-
-		int			unit = spec[0] - '0';
-		struct sim_drive	*drv = gw.unit[unit];
-
-		if (!drv) {
-			fprintf(stderr, "gwsim: no drive at unit %d\n",
-				unit);
-			return 1;
-		}
-
-		drv->media = sim_media_load(colon + 1);
-
-		if (!drv->media) {
-			fprintf(stderr, "gwsim: cannot load '%s'\n",
-				colon + 1);
+		if (sim_setup_insert(&gw, inserts[i].spec) == -1)
 			return 1;
-		}
 	}
 
 	struct sim_pty	pty;
@@ -395,6 +371,29 @@ main(int argc, char **argv)
 		}
 	}
 
+	char	shm_path[256];
+
+	if (shm_name) {
+		snprintf(shm_path, sizeof(shm_path), "/%s", shm_name);
+		ss.shm = sim_shm_create(shm_path, shm_reclaim);
+
+		if (!ss.shm && errno == EEXIST) {
+			fprintf(stderr, "gwsim: shared memory '%s' exists; "
+				"another gwsim is serving it, or use -R if "
+				"one died\n", shm_path);
+		} else if (!ss.shm) {
+			fprintf(stderr, "gwsim: cannot create shared memory "
+				"'%s': %s\n", shm_path, strerror(errno));
+		}
+
+		if (!ss.shm) {
+			if (lfd != -1)
+				unlink(sock_path);
+			sim_pty_close(&pty);
+			return 1;
+		}
+	}
+
 	signal(SIGINT, sig_handler);
 	signal(SIGTERM, sig_handler);
 	signal(SIGPIPE, SIG_IGN);
@@ -406,12 +405,38 @@ main(int argc, char **argv)
 	if (lfd != -1)
 		printf("gwsim: control socket: %s\n", sock_path);
 
+	if (ss.shm)
+		printf("gwsim: shared memory: shm:%s\n", shm_name);
+
 	printf("gwsim: example: gw2dmk -G %s out.dmk\n", pty_link);
 	fflush(stdout);
 
 	struct sim_proto	proto;
 
-	sim_proto_init(&proto, &gw, &pty);
+	sim_proto_init(&proto, &gw, pty_out, &pty);
+
+	pthread_t	shm_thread;
+
+	if (ss.shm) {
+		sigset_t	all, old;
+
+		/* Signals are for the main loop's poll(). */
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &old);
+
+		sim_proto_init(&ss.proto, &gw, shm_out, ss.shm);
+
+		int	err = pthread_create(&shm_thread, NULL, shm_serve, &ss);
+
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+		if (err) {
+			fprintf(stderr, "gwsim: cannot start shared memory "
+				"server: %s\n", strerror(err));
+			sim_shm_destroy(ss.shm, shm_path);
+			ss.shm = NULL;
+		}
+	}
 
 	struct ctl_client	stdin_cc   = { .fd = 0 };
 	bool			stdin_open = true;
@@ -463,7 +488,9 @@ main(int argc, char **argv)
 						  sizeof(buf));
 
 			if (rd > 0) {
+				pthread_mutex_lock(&sim_lock);
 				sim_proto_input(&proto, buf, rd);
+				pthread_mutex_unlock(&sim_lock);
 			} else if (rd == -1 && errno != EAGAIN &&
 				   errno != EIO) {
 				fprintf(stderr, "gwsim: pty read: %s\n",
@@ -479,7 +506,9 @@ main(int argc, char **argv)
 
 			if (rd > 0) {
 				stdin_cc.cnt += rd;
+				pthread_mutex_lock(&sim_lock);
 				quit = ctl_feed(&gw, &stdin_cc, 1);
+				pthread_mutex_unlock(&sim_lock);
 			} else if (rd == 0) {
 				/* EOF: keep serving pty/socket. */
 				stdin_open = false;
@@ -524,18 +553,22 @@ main(int argc, char **argv)
 			}
 
 			cc->cnt += rd;
+			pthread_mutex_lock(&sim_lock);
 			quit = ctl_feed(&gw, cc, cc->fd);
+			pthread_mutex_unlock(&sim_lock);
 		}
 	}
 
-	/* Flush any dirty media back to their files. */
-	for (int u = 0; u < SIM_MAX_UNITS; ++u) {
-		if (gw.unit[u]) {
-			sim_drive_free(gw.unit[u]);
-			gw.unit[u] = NULL;
-		}
+	if (ss.shm) {
+		atomic_store(&ss.shm->closing, 1);
+		sim_shm_wake(ss.shm);
+		pthread_join(shm_thread, NULL);
+		sim_shm_destroy(ss.shm, shm_path);
 	}
 
+	/* Flush any dirty media back to their files. */
+	sim_setup_free(&gw);
+
 	for (int i = 0; i < MAX_CTL_CLIENTS; ++i) {
 		if (clients[i].fd != -1)
 			close(clients[i].fd);
@@ -547,7 +580,6 @@ main(int argc, char **argv)
 	}
 
 	sim_pty_close(&pty);
-	free(proto.wbuf);
 
 	printf("gwsim: exiting\n");
 
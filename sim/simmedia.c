@@ -4,10 +4,15 @@
 
 #include "simmedia.h"
 #include "simdmk.h"
+#include "simgwlog.h"
+
+
+bool	sim_media_write_through = false;
 
 
 static const struct sim_media_ops *const media_ops[] = {
 	&sim_dmk_ops,
+	&sim_gwlog_ops,
 };
 
 
@@ -29,7 +34,12 @@ sim_media_load(const char *path)
 		}
 	}
 
-	return ops->load(path);
+	struct sim_media	*media = ops->load(path);
+
+	if (media)
+		media->write_through = sim_media_write_through;
+
+	return media;
 }
 
 
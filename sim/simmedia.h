@@ -9,15 +9,18 @@
  * Media abstraction.
  *
  * A media instance represents one "diskette".  Backends implement the
- * ops table to translate between their on-file format and trains of
- * flux transition pulses (tick counts at the Greaseweazle sample
- * clock) for one full revolution.
+ * ops table to translate between their on-file format and one full
+ * revolution of flux: rendered as read-stream bytes (struct sim_rev)
+ * for reads, and taken a transition interval (tick counts at the
+ * Greaseweazle sample clock) at a time for writes.
  *
- * The only backend for now is DMK (simdmk.c); the vtable exists so
- * other formats can be added without touching the device model.
+ * Backends are DMK (simdmk.c) and recorded flux from -U logs
+ * (simgwlog.c); the vtable lets other formats be added without
+ * touching the device model.
  */
 
 struct sim_media;
+struct sim_rev;
 
 struct sim_media_ops {
 	const char	*name;
@@ -25,37 +28,47 @@ struct sim_media_ops {
 	/* Load media from a file.  Returns NULL on failure. */
 	struct sim_media *(*load)(const char *path);
 
-	/* Flush any modified track data back to the file. */
+	/*
+	 * Flush any modified track data back to the file, writing
+	 * only what changed where the format allows.
+	 */
 	int		(*save)(struct sim_media *media);
 
 	/* Free the media instance. */
 	void		(*unload)(struct sim_media *media);
 
 	/*
-	 * Produce the flux pulse train for one full revolution of
-	 * the given track and side, as read by a drive rotating at
-	 * "rpm" and sampled at "freq" ticks per second.
+	 * Render one full revolution of the given track and side, as
+	 * read by a drive rotating at "rpm" and sampled at "freq" ticks
+	 * per second, into "rev" (see simflux.h).
 	 *
-	 * On success returns 0 and a malloc'd array of inter-
-	 * transition tick counts the caller must free.  Returns 1 if
-	 * the track/side is unformatted (caller synthesizes noise),
-	 * or -1 on error.
+	 * On success returns 0 with "rev" initialized; the caller frees
+	 * it.  Returns 1 if the track/side is unformatted (caller
+	 * synthesizes noise), or -1 on error.
 	 */
-	int		(*track_pulses)(struct sim_media *media,
-					int track, int side,
-					uint32_t freq, int rpm,
-					uint32_t **pulses, size_t *cnt);
+	int		(*track_rev)(struct sim_media *media,
+				     int track, int side,
+				     uint32_t freq, int rpm,
+				     struct sim_rev *rev);
 
 	/*
-	 * Decode a flux pulse train (one write pass) back into the
-	 * media's track storage.  Returns 0 on success, -1 on error.
-	 * May be NULL if the backend is read-only.
+	 * Decode one write pass into the media's track storage as its
+	 * flux arrives.  write_begin() opens a pass for the given track
+	 * and side, write_pulse() feeds it each inter-transition
+	 * interval in turn, and write_end() stores the track (if
+	 * "commit" and any flux arrived) and closes the pass.  A media
+	 * has at most one pass open; unload drops it.
+	 *
+	 * write_begin() and write_end() return 0, or -1 on error.
+	 * write_pulse() returns 0, or nonzero once the pass wants no
+	 * more flux.  All are NULL if the backend is read-only.
 	 */
-	int		(*track_from_pulses)(struct sim_media *media,
-					     int track, int side,
-					     uint32_t freq, int rpm,
-					     const uint32_t *pulses,
-					     size_t cnt);
+	int		(*write_begin)(struct sim_media *media,
+				       int track, int side,
+				       uint32_t freq, int rpm);
+	int		(*write_pulse)(struct sim_media *media,
+				       uint32_t ticks);
+	int		(*write_end)(struct sim_media *media, bool commit);
 
 	/* Number of formatted tracks per side. */
 	int		(*tracks)(struct sim_media *media);
@@ -70,8 +83,15 @@ struct sim_media {
 	char				*path;
 	bool				wp;	/* write-protected */
 	bool				dirty;
+	bool				write_through;
 };
 
+/*
+ * Media loaded while this is set save each track to its file as soon
+ * as a write pass stores it, instead of only on eject.
+ */
+extern bool sim_media_write_through;
+
 /* Load media from "path", choosing a backend by file extension. */
 extern struct sim_media *sim_media_load(const char *path);
 
@@ -7,17 +7,22 @@
 
 #include "simbus.h"
 #include "simclock.h"
+#include "simdegrade.h"
 #include "simdrive.h"
 #include "simflux.h"
 #include "simgw.h"
 #include "simproto.h"
 
-/* Cap on captured write-stream size (far beyond any real track). */
-#define WRBUF_MAX	(4 * 1024 * 1024)
-
 /* Wall time the firmware waits before giving up on an index pulse. */
 #define NO_INDEX_MS	500
 
+/* Write stream bytes buffered before a write starts (GW_WRITE_PREFILL). */
+#define WR_PREFILL	8192
+
+
+unsigned	sim_proto_latency_us = 0;
+unsigned	sim_proto_link_kbps = 0;
+
 
 static uint16_t
 get_le16(const uint8_t *p)
@@ -34,16 +39,26 @@ get_le32(const uint8_t *p)
 }
 
 
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
 static int
 reply(struct sim_proto *sp, uint8_t ack, const void *payload, size_t cnt)
 {
 	uint8_t	hdr[2] = { sp->cbuf[0], ack };
 
-	if (sim_pty_write_all(sp->pty, hdr, 2) == -1)
+	if (sp->out(sp->out_ctx, hdr, 2) == -1)
 		return -1;
 
 	if (ack == ACK_OKAY && payload && cnt)
-		return sim_pty_write_all(sp->pty, payload, cnt);
+		return sp->out(sp->out_ctx, payload, cnt);
 
 	return 0;
 }
@@ -51,23 +66,33 @@ reply(struct sim_proto *sp, uint8_t ack, const void *payload, size_t cnt)
 
 void
 sim_proto_init(struct sim_proto *sp, struct sim_gw *gw,
-	       struct sim_pty *pty)
+	       sim_proto_out_fn out, void *out_ctx)
 {
 	memset(sp, 0, sizeof(*sp));
 
-	sp->gw	= gw;
-	sp->pty	= pty;
+	sp->gw	    = gw;
+	sp->out	    = out;
+	sp->out_ctx = out_ctx;
 
 	sim_proto_reset(sp);
 }
 
 
+static struct sim_media *wrstream_media(struct sim_proto *sp);
+
+
 void
 sim_proto_reset(struct sim_proto *sp)
 {
+	struct sim_media	*media = wrstream_media(sp);
+
+	/* A write cut off mid-stream is dropped. */
+	if (media)
+		media->ops->write_end(media, false);
+
 	sp->state    = PROTO_CMD;
 	sp->cbuf_cnt = 0;
-	sp->wbuf_cnt = 0;
+	sp->wr_open  = false;
 }
 
 
@@ -94,17 +119,17 @@ do_get_info(struct sim_proto *sp)
 		rbuf[10] = m->usb_speed;
 		break;
 
-	case GETINFO_BW_STATS:
-		/* Plausible fixed 8 Mbps min and max. */
+	case GETINFO_BW_STATS: {
+		/* The --link rate, else a plausible fixed 8 Mbps. */
+		uint32_t	bytes = sim_proto_link_kbps ?
+					sim_proto_link_kbps * 125 : 1000000;
+
 		for (int i = 0; i < 24; i += 8) {
-			rbuf[i]     = 0x40;	/* bytes = 1000000 */
-			rbuf[i + 1] = 0x42;
-			rbuf[i + 2] = 0x0f;
-			rbuf[i + 4] = 0x40;	/* usecs = 1000000 */
-			rbuf[i + 5] = 0x42;
-			rbuf[i + 6] = 0x0f;
+			put_le32(&rbuf[i], bytes);
+			put_le32(&rbuf[i + 4], 1000000);	/* usecs */
 		}
 		break;
+	}
 
 	default:
 		return reply(sp, ACK_BAD_COMMAND, NULL, 0);
@@ -268,16 +293,25 @@ do_set_params(struct sim_proto *sp)
 }
 
 
-/* Rotational position, in ticks past the index hole. */
+/*
+ * Rotational position, in ticks past the index hole, and in *turns
+ * the whole turns before it.
+ */
 static uint64_t
-drive_phase(struct sim_drive *drv, uint64_t rev_ticks, uint32_t freq)
+drive_phase(struct sim_drive *drv, uint64_t rev_ticks, uint32_t freq,
+	    uint64_t *turns)
 {
-	if (sim_fast)
+	if (sim_fast) {
+		*turns = drv->turns;
 		return drv->phase_ticks % rev_ticks;
+	}
+
+	double		sec = (sim_now_ns() - drv->spin_ref_ns) / 1e9;
+	uint64_t	ticks = sec * freq;
 
-	double	sec = (sim_now_ns() - drv->spin_ref_ns) / 1e9;
+	*turns = ticks / rev_ticks;
 
-	return (uint64_t)(sec * freq) % rev_ticks;
+	return ticks % rev_ticks;
 }
 
 
@@ -307,52 +341,67 @@ do_read_flux(struct sim_proto *sp)
 		sim_sleep_ms(NO_INDEX_MS);
 		gw->flux_status = ACK_NO_INDEX;
 
-		return sim_pty_write_all(sp->pty, (uint8_t[]){ 0 }, 1);
+		return sp->out(sp->out_ctx, (uint8_t[]){ 0 }, 1);
 	}
 
-	struct sim_pulses	pul = { NULL, 0, 0 };
+	struct sim_rev		rev;
 	struct sim_media	*media = drv->media;
-	int			pr = 1;
+	const struct sim_degrade *dg = NULL;
+	int			mtrack = -1;
+	int			rr = 1;
 
 	if (gw->head < drv->sides) {
-		int	mtrack = sim_drive_media_track(drv, drv->cyl);
-
-		pr = media->ops->track_pulses(media, mtrack, gw->head,
-					      freq, drv->rpm,
-					      &pul.p, &pul.cnt);
+		mtrack = sim_drive_media_track(drv, drv->cyl);
+		rr = media->ops->track_rev(media, mtrack, gw->head, freq,
+					   drv->rpm, &rev);
 	}
 
-	if (pr == 0) {
-		sim_pulses_total(&pul);
-	} else {
-		free(pul.p);
-		pul = (struct sim_pulses){ NULL, 0, 0 };
-
-		if (sim_noise_pulses(freq, drv->rpm, &pul) == -1)
-			return reply(sp, ACK_BAD_COMMAND, NULL, 0);
-	}
+	if (rr == 0)
+		dg = sim_drive_degrade(drv, mtrack);
+	else if (sim_noise_rev(freq, drv->rpm, &rev) == -1)
+		return reply(sp, ACK_BAD_COMMAND, NULL, 0);
 
 	uint8_t		*stream	   = NULL;
 	size_t		stream_cnt = 0;
 	uint64_t	dur	   = 0;
-	uint64_t	phase = drive_phase(drv, pul.total_ticks, freq);
+	uint64_t	rev_ticks  = rev.total_ticks;
+	uint64_t	turns;
+	uint64_t	phase = drive_phase(drv, rev_ticks, freq, &turns);
+
+	if (dg) {
+		/* Each turn the read will see, degraded afresh. */
+		struct sim_rev	drev;
+		unsigned	nrevs = max_index ? max_index + 1 :
+					(phase + max_ticks) / rev_ticks + 2;
+		int		dr = sim_degrade_rev(dg, mtrack, gw->head,
+						     &rev, turns, nrevs, freq,
+						     &drev);
+
+		sim_rev_free(&rev);
+
+		if (dr == -1)
+			return reply(sp, ACK_BAD_COMMAND, NULL, 0);
+
+		rev = drev;
+	}
 
-	int	sr = sim_flux_stream(&pul, phase, max_index, max_ticks,
+	int	sr = sim_flux_stream(&rev, phase, max_index, max_ticks,
 				     &stream, &stream_cnt, &dur);
 
-	free(pul.p);
+	sim_rev_free(&rev);
 
 	if (sr == -1)
 		return reply(sp, ACK_BAD_COMMAND, NULL, 0);
 
-	drv->phase_ticks = (phase + dur) % pul.total_ticks;
+	drv->phase_ticks = (phase + dur) % rev_ticks;
+	drv->turns	+= (phase + dur) / rev_ticks;
 	gw->flux_status	 = ACK_OKAY;
 
 	int	ret = reply(sp, ACK_OKAY, NULL, 0);
 
 	if (ret == 0) {
 		sim_sleep_ticks(dur, freq);
-		ret = sim_pty_write_all(sp->pty, stream, stream_cnt);
+		ret = sp->out(sp->out_ctx, stream, stream_cnt);
 	}
 
 	free(stream);
@@ -378,180 +427,176 @@ do_write_flux(struct sim_proto *sp)
 	sp->wr_term = (sp->cbuf[1] > 3) ? sp->cbuf[3] != 0 : true;
 	sp->wr_ok   = drv && drv->media && sim_drive_spinning(drv);
 
-	sp->wbuf_cnt = 0;
-	sp->state    = PROTO_WRSTREAM;
+	sp->wr_open = sp->wr_ok && drv->media->ops->write_begin &&
+		      gw->head < drv->sides &&
+		      drv->media->ops->write_begin(drv->media,
+				sim_drive_media_track(drv, drv->cyl),
+				gw->head, gw->model->sample_freq,
+				drv->rpm) == 0;
+
+	sp->wcode_cnt	   = 0;
+	sp->wbytes	   = 0;
+	sp->wrev_ticks	   = drv ? (uint64_t)gw->model->sample_freq * 60 /
+				   drv->rpm : 0;
+	sp->wr_under	   = false;
+	sp->wticks	   = 0;
+	sp->wlast	   = 0;
+	sp->wspace_start   = 0;
+	sp->wspace_pending = 0;
+	sp->state	   = PROTO_WRSTREAM;
 
 	return reply(sp, ACK_OKAY, NULL, 0);
 }
 
 
 /*
- * Parse a captured write stream into flux transition pulses.
- * Handles direct and two-byte tick codes, FLUXOP_SPACE, and
- * FLUXOP_ASTABLE (regular transitions filling the preceding space).
- * Returns 0 with a malloc'd pulse array, or -1 on error.
+ * The media the write stream is decoding into, or NULL if none (or
+ * it's been swapped out from under the write).
  */
 
-static int
-wrstream_pulses(const uint8_t *b, size_t cnt, uint32_t **out,
-		size_t *out_cnt)
+static struct sim_media *
+wrstream_media(struct sim_proto *sp)
 {
-	uint32_t	*p   = NULL;
-	size_t		n    = 0;
-	size_t		len  = 0;
-	uint64_t	ticks = 0;
-	uint64_t	last  = 0;
-	uint64_t	space_start   = 0;
-	uint64_t	space_pending = 0;
-	size_t		i = 0;
+	struct sim_drive	*drv;
 
-	while (i < cnt) {
-		uint64_t	trans[1];
-		size_t		ntrans = 0;
-		uint64_t	astable_end = 0;
-		uint32_t	astable_per = 0;
-
-		uint8_t	c = b[i++];
-
-		if (c == 255) {
-			if (i + 5 > cnt)
-				break;
-
-			uint8_t		op = b[i++];
-			uint32_t	v  = gw_read_28(&b[i]);
-
-			i += 4;
-
-			switch (op) {
-			case FLUXOP_SPACE:
-				if (space_pending == 0)
-					space_start = ticks;
-
-				space_pending += v;
-				ticks	      += v;
-				continue;
-
-			case FLUXOP_ASTABLE:
-				if (v == 0 || space_pending == 0)
-					continue;
-
-				astable_per = v;
-				astable_end = space_start + space_pending;
-				space_pending = 0;
-				break;
-
-			case FLUXOP_INDEX:
-				continue;
-
-			default:
-				goto bad;
-			}
-		} else if (c < 250) {
-			ticks	     += c;
-			trans[0]      = ticks;
-			ntrans	      = 1;
-			space_pending = 0;
-		} else {
-			if (i >= cnt)
-				break;
-
-			ticks	     += 250 + (c - 250) * 255 + b[i++] - 1;
-			trans[0]      = ticks;
-			ntrans	      = 1;
-			space_pending = 0;
-		}
+	if (!sp->wr_open || !(drv = sim_gw_sel_drive(sp->gw)))
+		return NULL;
+
+	return drv->media;
+}
+
+
+/* A transition at "t" ticks into the stream. */
 
-		uint64_t	t = ntrans ? trans[0]
-					   : space_start + astable_per;
+static void
+wrstream_trans(struct sim_proto *sp, struct sim_media *media, uint64_t t)
+{
+	if (t > sp->wlast && media && sp->wr_open &&
+	    media->ops->write_pulse(media, t - sp->wlast) != 0) {
+		/* The media has all it wants; ignore the rest. */
+		media->ops->write_end(media, !sp->wr_under);
+		sp->wr_open = false;
+	}
 
-		for (;;) {
-			if (n == len) {
-				size_t	nlen = len ? len * 2 : 65536;
-				uint32_t *np = realloc(p,
-						nlen * sizeof(*np));
+	sp->wlast = t;
+}
 
-				if (!np)
-					goto bad;
 
-				p   = np;
-				len = nlen;
-			}
+/*
+ * A code is due at "t" ticks into the write, once the flux before it
+ * is written; note whether the link, after the prefill, could have
+ * delivered the stream through it (wbytes) by then.  Codes past the
+ * revolution are never written, so never due.
+ */
 
-			if (t > last)
-				p[n++] = t - last;
+static void
+wrstream_due(struct sim_proto *sp, uint64_t t)
+{
+	if (!sim_proto_link_kbps || sp->wr_under || t >= sp->wrev_ticks ||
+	    sp->wbytes <= WR_PREFILL)
+		return;
 
-			last = t;
+	/* Bytes past the prefill against the link's bytes by "t". */
+	uint64_t	late = (sp->wbytes - WR_PREFILL) * 8000 *
+			       sp->gw->model->sample_freq;
 
-			if (ntrans)
-				break;
+	if (late > (uint64_t)sim_proto_link_kbps * 1000000 * t)
+		sp->wr_under = true;
+}
 
-			t += astable_per;
 
-			if (t > astable_end)
-				break;
-		}
+/*
+ * One complete code of the write stream: direct and two-byte tick
+ * codes, FLUXOP_SPACE, and FLUXOP_ASTABLE (regular transitions
+ * filling the preceding space).  Returns -1 on a bad opcode.
+ */
+
+static int
+wrstream_code(struct sim_proto *sp, struct sim_media *media,
+	      const uint8_t *b)
+{
+	if (b[0] < 250) {
+		sp->wticks	  += b[0];
+		sp->wspace_pending = 0;
+		wrstream_trans(sp, media, sp->wticks);
+
+		return 0;
 	}
 
-	*out	 = p;
-	*out_cnt = n;
+	if (b[0] < 255) {
+		sp->wticks	  += 250 + (b[0] - 250) * 255 + b[1] - 1;
+		sp->wspace_pending = 0;
+		wrstream_trans(sp, media, sp->wticks);
 
-	return 0;
+		return 0;
+	}
+
+	uint32_t	v = gw_read_28(&b[2]);
 
-bad:
-	free(p);
+	switch (b[1]) {
+	case FLUXOP_SPACE:
+		if (sp->wspace_pending == 0)
+			sp->wspace_start = sp->wticks;
 
-	return -1;
+		sp->wspace_pending += v;
+		sp->wticks	   += v;
+		break;
+
+	case FLUXOP_ASTABLE:
+		if (v == 0 || sp->wspace_pending == 0)
+			break;
+
+		uint64_t	end = sp->wspace_start + sp->wspace_pending;
+
+		for (uint64_t t = sp->wspace_start + v; t <= end; t += v)
+			wrstream_trans(sp, media, t);
+
+		sp->wspace_pending = 0;
+		break;
+
+	case FLUXOP_INDEX:
+		break;
+
+	default:
+		return -1;
+	}
+
+	return 0;
 }
 
 
 /*
- * A complete write stream has arrived.  Decode it into the inserted
- * media, answer the host's synchronization read, and record the
- * outcome for CMD_GET_FLUX_STATUS.
+ * A complete write stream has arrived.  Store what was decoded into
+ * the inserted media, answer the host's synchronization read, and
+ * record the outcome for CMD_GET_FLUX_STATUS.
  */
 
 static int
 wrstream_done(struct sim_proto *sp)
 {
-	struct sim_gw		*gw  = sp->gw;
-	struct sim_drive	*drv = sim_gw_sel_drive(gw);
+	struct sim_gw		*gw    = sp->gw;
+	struct sim_drive	*drv   = sim_gw_sel_drive(gw);
+	struct sim_media	*media = wrstream_media(sp);
 
 	sp->state = PROTO_CMD;
 
 	if (!sp->wr_ok || !drv || !drv->media) {
 		gw->flux_status = ACK_NO_INDEX;
 	} else {
-		struct sim_media	*media = drv->media;
-
-		gw->flux_status = ACK_OKAY;
-
-		if (media->ops->track_from_pulses &&
-		    gw->head < drv->sides) {
-			uint32_t	*pulses = NULL;
-			size_t		cnt	= 0;
+		/* An underflowed write leaves the track as it was. */
+		gw->flux_status = sp->wr_under ? ACK_FLUX_UNDERFLOW : ACK_OKAY;
 
-			if (wrstream_pulses(sp->wbuf, sp->wbuf_cnt,
-					    &pulses, &cnt) == 0 &&
-			    cnt > 0) {
-				int	mtrack =
-					sim_drive_media_track(drv,
-							      drv->cyl);
-
-				media->ops->track_from_pulses(media,
-					mtrack, gw->head,
-					gw->model->sample_freq,
-					drv->rpm, pulses, cnt);
-			}
-
-			free(pulses);
-		}
+		if (media)
+			media->ops->write_end(media, !sp->wr_under);
 
 		/* Wait out the rotational time of the write. */
 		sim_sleep_ms(60000 / drv->rpm);
 	}
 
+	sp->wr_open = false;
+
 	/* Synchronize with the host (see gw_write_stream()). */
-	return sim_pty_write_all(sp->pty, (uint8_t[]){ 0 }, 1);
+	return sp->out(sp->out_ctx, (uint8_t[]){ 0 }, 1);
 }
 
 
@@ -616,46 +661,82 @@ dispatch(struct sim_proto *sp)
 }
 
 
-static int
-wrstream_byte(struct sim_proto *sp, uint8_t b)
-{
-	if (b == 0)
-		return wrstream_done(sp);
+/*
+ * Take write-stream bytes up to and including the terminator.  A
+ * code split across calls is held over in wcode.  Returns the bytes
+ * taken, or -1 on I/O error.
+ */
 
-	if (sp->wbuf_cnt == sp->wbuf_len) {
-		if (sp->wbuf_len >= WRBUF_MAX) {
-			/* Runaway stream; drop data but stay in sync. */
-			return 0;
+static ssize_t
+wrstream_input(struct sim_proto *sp, const uint8_t *buf, size_t cnt)
+{
+	const uint8_t		*end = memchr(buf, 0, cnt);
+	size_t			n = end ? (size_t)(end - buf) : cnt;
+	struct sim_media	*media = wrstream_media(sp);
+
+	for (size_t i = 0; i < n; ++i) {
+		sp->wbytes++;
+
+		if (sp->wcode_cnt == 0 && buf[i] < 250) {
+			/* The usual case, one byte per transition. */
+			wrstream_due(sp, sp->wticks);
+			sp->wticks	  += buf[i];
+			sp->wspace_pending = 0;
+			wrstream_trans(sp, media, sp->wticks);
+			continue;
 		}
 
-		size_t	nlen = sp->wbuf_len ? sp->wbuf_len * 2 : 65536;
-		uint8_t	*nb  = realloc(sp->wbuf, nlen);
+		sp->wcode[sp->wcode_cnt++] = buf[i];
+
+		size_t	len = (sp->wcode[0] < 255) ? 2 : 6;
 
-		if (!nb)
-			return 0;
+		if (sp->wcode_cnt < len)
+			continue;
+
+		sp->wcode_cnt = 0;
+		wrstream_due(sp, sp->wticks);
 
-		sp->wbuf     = nb;
-		sp->wbuf_len = nlen;
+		if (wrstream_code(sp, media, sp->wcode) == -1) {
+			/* Garbage; keep consuming to the terminator. */
+			if (media && sp->wr_open)
+				media->ops->write_end(media, false);
+			sp->wr_open = false;
+		}
 	}
 
-	sp->wbuf[sp->wbuf_cnt++] = b;
+	if (!end)
+		return cnt;
 
-	return 0;
+	/* A partial code before the terminator is dropped. */
+	sp->wcode_cnt = 0;
+
+	if (wrstream_done(sp) == -1)
+		return -1;
+
+	return n + 1;
 }
 
 
 int
 sim_proto_input(struct sim_proto *sp, const uint8_t *buf, size_t cnt)
 {
-	for (size_t i = 0; i < cnt; ++i) {
+	size_t	i = 0;
+
+	if (sp->state == PROTO_CMD && cnt > 0)
+		sim_sleep_us(sim_proto_latency_us);
+
+	while (i < cnt) {
 		if (sp->state == PROTO_WRSTREAM) {
-			if (wrstream_byte(sp, buf[i]) == -1)
+			ssize_t	taken = wrstream_input(sp, &buf[i], cnt - i);
+
+			if (taken == -1)
 				return -1;
 
+			i += taken;
 			continue;
 		}
 
-		sp->cbuf[sp->cbuf_cnt++] = buf[i];
+		sp->cbuf[sp->cbuf_cnt++] = buf[i++];
 
 		if (sp->cbuf_cnt < 2)
 			continue;
@@ -6,7 +6,6 @@
 #include <stdint.h>
 
 #include "simgw.h"
-#include "simpty.h"
 
 /*
  * Greaseweazle serial protocol engine.
@@ -14,9 +13,16 @@
  * Commands arrive as [opcode, total_length, args...]; each is
  * answered with [opcode, ack] plus an optional payload.  After
  * CMD_WRITE_FLUX the engine switches to consuming a flux stream
- * until its 0x00 terminator.
+ * until its 0x00 terminator, passing it to the media as it comes in
+ * whatever pieces the host sends it in.
+ *
+ * Replies go out through "out", which must take all "cnt" bytes
+ * before returning 0, or return -1 on error.  The pty, the in-process
+ * host backend and the shared-memory ring each supply their own.
  */
 
+typedef int (*sim_proto_out_fn)(void *ctx, const uint8_t *buf, size_t cnt);
+
 enum sim_proto_state {
 	PROTO_CMD,
 	PROTO_WRSTREAM
@@ -24,23 +30,49 @@ enum sim_proto_state {
 
 struct sim_proto {
 	struct sim_gw		*gw;
-	struct sim_pty		*pty;
+	sim_proto_out_fn	out;
+	void			*out_ctx;
 
 	enum sim_proto_state	state;
 	uint8_t			cbuf[64];
 	size_t			cbuf_cnt;
 
-	/* CMD_WRITE_FLUX stream capture */
-	uint8_t			*wbuf;
-	size_t			wbuf_cnt;
-	size_t			wbuf_len;
+	/*
+	 * CMD_WRITE_FLUX stream, decoded as it arrives.  A code split
+	 * across input chunks waits in wcode; the times are in ticks
+	 * from stream start.
+	 */
+	uint8_t			wcode[6];
+	size_t			wcode_cnt;
+	uint64_t		wticks;
+	uint64_t		wlast;		/* last transition */
+	uint64_t		wspace_start;
+	uint64_t		wspace_pending;
 	bool			wr_cue;
 	bool			wr_term;
 	bool			wr_ok;	/* writable target selected */
+	bool			wr_open; /* media write pass open */
+	uint64_t		wbytes;	/* stream bytes taken */
+	uint64_t		wrev_ticks; /* one revolution */
+	bool			wr_under; /* the link fell behind */
 };
 
+/*
+ * USB turnaround charged to each host transfer that carries commands,
+ * in microseconds (timed mode only).  Commands sent together share
+ * one.
+ */
+extern unsigned sim_proto_latency_us;
+
+/*
+ * Host-to-device link rate for write streams, in kbps; 0 for
+ * unlimited.  A write whose stream the link could not keep ahead of,
+ * past the device's prefill, fails with ACK_FLUX_UNDERFLOW.
+ */
+extern unsigned sim_proto_link_kbps;
+
 extern void sim_proto_init(struct sim_proto *sp, struct sim_gw *gw,
-			   struct sim_pty *pty);
+			   sim_proto_out_fn out, void *out_ctx);
 
 extern void sim_proto_reset(struct sim_proto *sp);
 
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simdrive.h"
+#include "simfdadap.h"
+#include "simgw.h"
+#include "simmedia.h"
+#include "simsetup.h"
+
+#define DEFAULT_DRIVE	"0:525dd"
+
+
+int
+sim_setup_drive(struct sim_gw *gw, char *spec)
+{
+	char	*colon = strchr(spec, ':');
+
+	if (!colon || colon == spec) {
+		fprintf(stderr, "gwsim: bad drive spec '%s'\n", spec);
+		return -1;
+	}
+
+	*colon = '\0';
+
+	char	*end;
+	long	unit = strtol(spec, &end, 10);
+
+	if (*end || unit < 0 || unit >= SIM_MAX_UNITS) {
+		fprintf(stderr, "gwsim: bad unit '%s'\n", spec);
+		return -1;
+	}
+
+	if (gw->unit[unit]) {
+		fprintf(stderr, "gwsim: unit %ld already has a drive\n",
+			unit);
+		return -1;
+	}
+
+	char	*save = NULL;
+	char	*type = strtok_r(colon + 1, ",", &save);
+
+	const struct sim_drive_type *dt =
+			type ? sim_drive_type_find(type) : NULL;
+
+	if (!dt) {
+		fprintf(stderr, "gwsim: unknown drive type '%s'\n",
+			type ? type : "");
+		return -1;
+	}
+
+	struct sim_drive	*drv = sim_drive_new(dt);
+
+	if (!drv)
+		return -1;
+
+	for (char *opt = strtok_r(NULL, ",", &save); opt;
+	     opt = strtok_r(NULL, ",", &save)) {
+		if (!strncmp(opt, "tracks=", 7)) {
+			int	t = atoi(opt + 7);
+
+			if (t < 1 || t > 88) {
+				fprintf(stderr, "gwsim: bad tracks "
+					"'%s'\n", opt);
+				goto err;
+			}
+
+			drv->tracks = t;
+		} else if (!strncmp(opt, "rpm=", 4)) {
+			int	r = atoi(opt + 4);
+
+			if (r != dt->rpm && r != dt->rpm_alt) {
+				fprintf(stderr, "gwsim: %s does not "
+					"support %d RPM\n", dt->name, r);
+				goto err;
+			}
+
+			drv->rpm = r;
+		} else if (!strncmp(opt, "sides=", 6)) {
+			int	s = atoi(opt + 6);
+
+			if (s < 1 || s > 2) {
+				fprintf(stderr, "gwsim: bad sides "
+					"'%s'\n", opt);
+				goto err;
+			}
+
+			drv->sides = s;
+		} else if (!strcmp(opt, "fdadap")) {
+			drv->fdadap = true;
+		} else if (!strcmp(opt, "wp")) {
+			drv->wp_force = true;
+		} else {
+			fprintf(stderr, "gwsim: unknown drive option "
+				"'%s'\n", opt);
+			goto err;
+		}
+	}
+
+	char	errbuf[128];
+
+	if (!sim_fdadap_attach_ok(drv, errbuf, sizeof(errbuf))) {
+		fprintf(stderr, "gwsim: unit %ld: %s\n", unit, errbuf);
+		goto err;
+	}
+
+	gw->unit[unit] = drv;
+
+	return 0;
+
+err:
+	sim_drive_free(drv);
+
+	return -1;
+}
+
+
+int
+sim_setup_insert(struct sim_gw *gw, const char *spec)
+{
+	const char	*colon = strchr(spec, ':');
+
+	if (!colon || colon[1] == '\0' ||
+	    colon - spec != 1 || spec[0] < '0' || spec[0] > '2') {
+		fprintf(stderr, "gwsim: bad insert spec '%s'\n", spec);
+		return -1;
+	}
+
+	int			unit = spec[0] - '0';
+	struct sim_drive	*drv = gw->unit[unit];
+
+	if (!drv) {
+		fprintf(stderr, "gwsim: no drive at unit %d\n", unit);
+		return -1;
+	}
+
+	if (drv->media) {
+		fprintf(stderr, "gwsim: unit %d already has a diskette\n",
+			unit);
+		return -1;
+	}
+
+	drv->media = sim_media_load(colon + 1);
+
+	if (!drv->media) {
+		fprintf(stderr, "gwsim: cannot load '%s'\n", colon + 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int
+sim_setup_finish(struct sim_gw *gw, const char *model)
+{
+	gw->model = sim_gw_model_find(model);
+
+	if (!gw->model) {
+		fprintf(stderr, "gwsim: unknown model '%s'\n", model);
+		return -1;
+	}
+
+	bool	have_drive = false;
+
+	for (int u = 0; u < SIM_MAX_UNITS; ++u)
+		have_drive |= gw->unit[u] != NULL;
+
+	if (!have_drive) {
+		char	spec[] = DEFAULT_DRIVE;
+
+		if (sim_setup_drive(gw, spec) == -1)
+			return -1;
+	}
+
+	sim_gw_reset(gw);
+
+	return 0;
+}
+
+
+void
+sim_setup_free(struct sim_gw *gw)
+{
+	for (int u = 0; u < SIM_MAX_UNITS; ++u) {
+		if (gw->unit[u]) {
+			sim_drive_free(gw->unit[u]);
+			gw->unit[u] = NULL;
+		}
+	}
+}
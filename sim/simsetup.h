@@ -0,0 +1,31 @@
+#ifndef SIMSETUP_H
+#define SIMSETUP_H
+
+#include "simgw.h"
+
+/*
+ * Assembling a simulated Greaseweazle from its drive and diskette
+ * specifications, shared by gwsim's command line and the in-process
+ * host backend.  Errors are reported on stderr.
+ *
+ *   drive:   N:TYPE[,tracks=T][,rpm=R][,sides=S][,fdadap][,wp]
+ *   insert:  N:FILE
+ */
+
+/* Attach the drive described by "spec" (modified).  0 or -1. */
+extern int sim_setup_drive(struct sim_gw *gw, char *spec);
+
+/* Insert the diskette image described by "spec".  0 or -1. */
+extern int sim_setup_insert(struct sim_gw *gw, const char *spec);
+
+/*
+ * Select the model named "model", attach the default drive if none
+ * was given, and reset the device.  Returns 0, or -1 if the model is
+ * unknown.  Call before inserting any diskettes.
+ */
+extern int sim_setup_finish(struct sim_gw *gw, const char *model);
+
+/* Detach all drives, flushing any dirty media back to their files. */
+extern void sim_setup_free(struct sim_gw *gw);
+
+#endif
@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simshm.h"
+
+
+static void
+ring_init(struct sim_ring *ring)
+{
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	sem_init(&ring->data, 1, 0);
+	sem_init(&ring->space, 1, 0);
+}
+
+
+struct sim_shm *
+sim_shm_create(const char *name, bool reclaim)
+{
+	if (reclaim)
+		shm_unlink(name);
+
+	int	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+			      0600);
+
+	if (fd == -1)
+		return NULL;
+
+	struct sim_shm	*shm = MAP_FAILED;
+
+	if (ftruncate(fd, sizeof(*shm)) == 0)
+		shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (shm == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+
+	atomic_init(&shm->attached, 0);
+	atomic_init(&shm->session, 0);
+	atomic_init(&shm->closing, 0);
+	ring_init(&shm->to_sim);
+	ring_init(&shm->to_host);
+
+	shm->version = SIM_SHM_VERSION;
+	atomic_thread_fence(memory_order_release);
+	shm->magic = SIM_SHM_MAGIC;
+
+	return shm;
+}
+
+
+struct sim_shm *
+sim_shm_map(const char *name)
+{
+	int	fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+
+	if (fd == -1)
+		return NULL;
+
+	struct sim_shm	*shm = mmap(NULL, sizeof(*shm),
+				    PROT_READ | PROT_WRITE, MAP_SHARED,
+				    fd, 0);
+
+	close(fd);
+
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	if (shm->magic != SIM_SHM_MAGIC ||
+	    shm->version != SIM_SHM_VERSION) {
+		munmap(shm, sizeof(*shm));
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return shm;
+}
+
+
+void
+sim_shm_destroy(struct sim_shm *shm, const char *name)
+{
+	munmap(shm, sizeof(*shm));
+
+	if (name)
+		shm_unlink(name);
+}
+
+
+size_t
+sim_ring_avail(struct sim_ring *ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire) -
+	       atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+
+/*
+ * Wait on "sem", for up to "timeout_s" seconds if not zero.  Returns
+ * 0, or -1 with "errno" set on timeout.
+ */
+
+static int
+ring_wait(sem_t *sem, int timeout_s)
+{
+	if (timeout_s == 0) {
+		while (sem_wait(sem) == -1) {
+			if (errno != EINTR)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_s;
+
+	while (sem_timedwait(sem, &ts) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+int
+sim_ring_write(struct sim_shm *shm, struct sim_ring *ring,
+	       const uint8_t *buf, size_t cnt)
+{
+	unsigned	head = atomic_load_explicit(&ring->head,
+						    memory_order_relaxed);
+
+	while (cnt > 0) {
+		unsigned	tail = atomic_load_explicit(&ring->tail,
+						memory_order_acquire);
+		size_t		room = SIM_SHM_RING_SIZE - (head - tail);
+
+		if (room == 0) {
+			if (atomic_load(&shm->closing))
+				return -1;
+
+			ring_wait(&ring->space, 0);
+			continue;
+		}
+
+		size_t	off = head % SIM_SHM_RING_SIZE;
+		size_t	n = cnt < room ? cnt : room;
+
+		if (n > SIM_SHM_RING_SIZE - off)
+			n = SIM_SHM_RING_SIZE - off;
+
+		memcpy(&ring->buf[off], buf, n);
+		head += n;
+		buf  += n;
+		cnt  -= n;
+
+		atomic_store_explicit(&ring->head, head,
+				      memory_order_release);
+		sem_post(&ring->data);
+	}
+
+	return 0;
+}
+
+
+ssize_t
+sim_ring_read(struct sim_shm *shm, struct sim_ring *ring,
+	      uint8_t *buf, size_t cnt, int timeout_s)
+{
+	size_t	avail;
+
+	while ((avail = sim_ring_avail(ring)) == 0) {
+		if (atomic_load(&shm->closing)) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		if (ring_wait(&ring->data, timeout_s) == -1)
+			return -1;
+	}
+
+	unsigned	tail = atomic_load_explicit(&ring->tail,
+						    memory_order_relaxed);
+	size_t		off = tail % SIM_SHM_RING_SIZE;
+	size_t		n = cnt < avail ? cnt : avail;
+	size_t		n1 = n;
+
+	/*
+	 * Take everything asked for that's there, across the wrap, as
+	 * callers of gw_bytes_waiting() count on getting that much.
+	 */
+	if (n1 > SIM_SHM_RING_SIZE - off)
+		n1 = SIM_SHM_RING_SIZE - off;
+
+	memcpy(buf, &ring->buf[off], n1);
+	memcpy(buf + n1, ring->buf, n - n1);
+
+	atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+	sem_post(&ring->space);
+
+	return n;
+}
+
+
+void
+sim_shm_wake(struct sim_shm *shm)
+{
+	sem_post(&shm->to_sim.data);
+	sem_post(&shm->to_sim.space);
+	sem_post(&shm->to_host.data);
+	sem_post(&shm->to_host.space);
+}
@@ -0,0 +1,86 @@
+#ifndef SIMSHM_H
+#define SIMSHM_H
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Shared-memory transport.
+ *
+ * A POSIX shared memory object holds two single-producer rings, one
+ * each way, standing in for the pty.  Each ring's producer and
+ * consumer only advance their own counter; a semaphore per direction
+ * wakes a waiting consumer or producer.  Counts run freely and wrap,
+ * so "head - tail" is always the fill.
+ *
+ * One host at a time attaches.  Attaching bumps "session" so the
+ * simulator drops any half-received command left by an earlier host.
+ */
+
+#define SIM_SHM_MAGIC		0x4d485357	/* "WSHM" */
+#define SIM_SHM_VERSION		1
+#define SIM_SHM_RING_SIZE	(1u << 20)
+
+/* How long a host waits for the simulator before giving up. */
+#define SIM_SHM_TIMEOUT_S	30
+
+struct sim_ring {
+	atomic_uint	head;		/* bytes produced */
+	atomic_uint	tail;		/* bytes consumed */
+	sem_t		data;		/* posted when head moves */
+	sem_t		space;		/* posted when tail moves */
+	uint8_t		buf[SIM_SHM_RING_SIZE];
+};
+
+struct sim_shm {
+	uint32_t	magic;
+	uint32_t	version;
+	atomic_int	attached;	/* a host holds the rings */
+	atomic_uint	session;	/* bumped by each attach */
+	atomic_int	closing;	/* the simulator is exiting */
+	struct sim_ring	to_sim;
+	struct sim_ring	to_host;
+};
+
+
+/*
+ * Create the shared memory object "name" (as for shm_open(), with a
+ * leading '/') and initialize it.  Returns NULL on failure, with
+ * errno EEXIST if the object is there already: in use by another
+ * simulator, or left by one that died.  "reclaim" removes it first.
+ */
+extern struct sim_shm *sim_shm_create(const char *name, bool reclaim);
+
+/* Map the existing object "name".  Returns NULL on failure. */
+extern struct sim_shm *sim_shm_map(const char *name);
+
+/* Unmap "shm", and if "name" is given, remove the object. */
+extern void sim_shm_destroy(struct sim_shm *shm, const char *name);
+
+/* Bytes waiting in "ring", without blocking. */
+extern size_t sim_ring_avail(struct sim_ring *ring);
+
+/*
+ * Copy all "cnt" bytes into "ring", waiting for room as needed.
+ * Returns 0, or -1 if the simulator is closing.
+ */
+extern int sim_ring_write(struct sim_shm *shm, struct sim_ring *ring,
+			  const uint8_t *buf, size_t cnt);
+
+/*
+ * Copy up to "cnt" bytes out of "ring", waiting until at least one
+ * is there, or for "timeout_s" seconds if not zero.  Returns the
+ * count, or -1 with "errno" set on timeout or if the simulator is
+ * closing.
+ */
+extern ssize_t sim_ring_read(struct sim_shm *shm, struct sim_ring *ring,
+			     uint8_t *buf, size_t cnt, int timeout_s);
+
+/* Wake anything waiting on either ring, once "closing" is set. */
+extern void sim_shm_wake(struct sim_shm *shm);
+
+#endif
@@ -10,7 +10,8 @@
  * Generated tracks are IBM-style MFM: for each sector, 12x00,
  * 3xA1, FE, C H R N, CRC, gap2, 12x00, 3xA1, FB, 256 data bytes,
  * CRC, gap3.  Payload bytes derive from (track, side, sector) so
- * mismatches are unambiguous.
+ * mismatches are unambiguous.  An output name ending in ".dmkz"
+ * writes the packed container.
  */
 
 #include <stdio.h>
@@ -20,6 +21,7 @@
 #include <unistd.h>
 
 #include "dmk.h"
+#include "dmkz.h"
 #include "crc.h"
 
 #define SECSIZE	256
@@ -131,22 +133,35 @@ generate(const char *path, int tracks, int sides, int nsec,
 	if (sides == 1)
 		dmkf->header.options |= DMK_SSIDE_OPT;
 
+	static struct dmk_track	trk;
+
 	for (int t = 0; t < tracks; ++t) {
-		for (int s = 0; s < sides; ++s)
-			gen_track(&dmkf->track[t][s], tracklen, t, s,
-				  nsec);
+		for (int s = 0; s < sides; ++s) {
+			gen_track(&trk, tracklen, t, s, nsec);
+
+			if (dmk_file_put_track(dmkf, t, s, &trk) != 0) {
+				perror("mkdmk");
+				dmk_file_free(dmkf);
+				free(dmkf);
+				return 1;
+			}
+		}
 	}
 
+	dmkf->zipped = dmkz_path(path);
+
 	FILE	*fp = fopen(path, "wb");
 
 	if (!fp) {
 		perror(path);
+		dmk_file_free(dmkf);
 		free(dmkf);
 		return 1;
 	}
 
 	dmk2fp(dmkf, fp);
 	fclose(fp);
+	dmk_file_free(dmkf);
 	free(dmkf);
 
 	return 0;
@@ -162,9 +177,12 @@ static int
 find_sector(const struct dmk_file *dmkf, int t, int s, int r,
 	    uint8_t *payload)
 {
-	const struct dmk_track	*trk = &dmkf->track[t][s];
+	static struct dmk_track	work;
+	const struct dmk_track	*trk = &work;
 	int	datalen = dmkf->header.tracklen - DMK_TKHDR_SIZE;
 
+	dmk_file_get_track(dmkf, t, s, &work);
+
 	for (int i = 0; i < DMK_MAX_SECTORS && trk->idam_offset[i];
 	     ++i) {
 		int	off = (trk->idam_offset[i] & DMK_IDAMP_BITS) -
@@ -209,6 +227,7 @@ load_dmk(const char *path)
 
 	if (dmkf && fp2dmk(fp, dmkf) != 0) {
 		fprintf(stderr, "mkdmk: bad DMK file '%s'\n", path);
+		dmk_file_free(dmkf);
 		free(dmkf);
 		dmkf = NULL;
 	}
@@ -272,7 +291,9 @@ compare(const char *patha, const char *pathb, int nsec)
 	printf("mkdmk: %ld sectors match, %ld differ, %ld missing\n",
 	       ok, bad, missing);
 
+	dmk_file_free(a);
 	free(a);
+	dmk_file_free(b);
 	free(b);
 
 	return (bad || missing || !ok) ? 1 : 0;
@@ -23,6 +23,7 @@ XDG_CONFIG_HOME=$tmp/xdg
 export XDG_CONFIG_HOME
 
 gwsim_pid=
+gwd_pid=
 
 fail() {
 	echo "FAIL: $*" >&2
@@ -31,12 +32,13 @@ fail() {
 
 cleanup() {
 	[ -n "$gwsim_pid" ] && kill "$gwsim_pid" 2>/dev/null
+	[ -n "$gwd_pid" ] && kill "$gwd_pid" 2>/dev/null
 	rm -rf "$tmp"
 }
 
 trap cleanup EXIT INT TERM
 
-for b in gwsim gw2dmk dmk2gw gwhist mkdmk; do
+for b in gwsim gw2dmk dmk2gw gwhist gwd mkdmk; do
 	[ -x "$bld/$b" ] || fail "$bld/$b not built"
 done
 
@@ -239,4 +241,416 @@ fi
 grep -q "does not support" "$tmp/gw2dmkrbad.log" || \
 	fail "-R with -d error message"
 
+echo "=== test 9: dmk2gw --verify"
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/target2.dmk"
+start_gwsim -D 0:525dd -i "0:$tmp/target2.dmk"
+timeout 120 "$bld/dmk2gw" -G "$tmp/pty" -d a --verify "$tmp/golden.dmk" \
+	> "$tmp/dmk2gwv.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwv.log"; fail "dmk2gw --verify"; }
+grep -q "0 tracks rewritten, 0 tracks failed" "$tmp/dmk2gwv.log" || \
+	{ cat "$tmp/dmk2gwv.log"; fail "dmk2gw --verify result"; }
+stop_gwsim
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/target2.dmk" || \
+	fail "verified write sector compare"
+
+echo "=== test 10: gwhist whole-disk sweep"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+timeout 120 "$bld/gwhist" -G "$tmp/pty" -t 0-39 -s 0-1 -J "$tmp/sweep.csv" \
+	> "$tmp/gwhists.log" 2>&1 || \
+	{ cat "$tmp/gwhists.log"; fail "gwhist sweep"; }
+[ "$(wc -l < "$tmp/sweep.csv")" -eq 81 ] || \
+	{ cat "$tmp/sweep.csv"; fail "gwhist sweep row count"; }
+grep -q "^39,1,1," "$tmp/sweep.csv" || fail "gwhist sweep last track"
+grep -q "All tracks: .* 3 peaks at " "$tmp/gwhists.log" || \
+	{ cat "$tmp/gwhists.log"; fail "gwhist sweep summary"; }
+timeout 120 "$bld/gwhist" -G "$tmp/pty" -t 2-3 -J "$tmp/sweep.json" \
+	> "$tmp/gwhistj.log" 2>&1 || \
+	{ cat "$tmp/gwhistj.log"; fail "gwhist sweep JSON"; }
+[ "$(grep -c '"track"' "$tmp/sweep.json")" -eq 2 ] || \
+	{ cat "$tmp/sweep.json"; fail "gwhist sweep JSON rows"; }
+# One-tick buckets find the same three peaks.
+timeout 60 "$bld/gwhist" -G "$tmp/pty" -b 0 > "$tmp/gwhistb.log" 2>&1 || \
+	{ cat "$tmp/gwhistb.log"; fail "gwhist -b 0"; }
+grep -q "^Peak 2:" "$tmp/gwhistb.log" || \
+	{ cat "$tmp/gwhistb.log"; fail "gwhist -b 0 peaks"; }
+stop_gwsim
+
+echo "=== test 11: gwd daemon runs jobs on one open device"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+"$bld/gwd" -G "$tmp/pty" "$tmp/gwd.sock" > "$tmp/gwd.log" 2>&1 &
+gwd_pid=$!
+i=0
+while [ ! -S "$tmp/gwd.sock" ]; do
+	i=$((i + 1))
+	[ "$i" -gt 50 ] && { cat "$tmp/gwd.log"; fail "gwd did not start"; }
+	sleep 0.1
+done
+(cd "$tmp" && timeout 120 "$bld/gwd" -c "$tmp/gwd.sock" gw2dmk -t 40 \
+	--force gwd1.dmk) > "$tmp/gwdjob1.log" 2>&1 || \
+	{ cat "$tmp/gwdjob1.log"; fail "gwd gw2dmk job"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/gwd1.dmk" || \
+	fail "gwd job sector compare"
+# A waiting job starts only once the diskette has been swapped.
+timeout 120 "$bld/gwd" -c "$tmp/gwd.sock" -w gw2dmk -t 40 --force \
+	"$tmp/gwd2.dmk" > "$tmp/gwdjob2.log" 2>&1 &
+job_pid=$!
+sleep 1
+[ -e "$tmp/gwd2.dmk" ] && fail "gwd -w job did not wait"
+ctl "eject 0" > /dev/null
+sleep 1
+ctl "insert 0 $tmp/golden.dmk" > /dev/null
+wait "$job_pid" || { cat "$tmp/gwdjob2.log"; fail "gwd -w job"; }
+grep -q "Waiting for diskette change" "$tmp/gwdjob2.log" || \
+	fail "gwd -w job message"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/gwd2.dmk" || \
+	fail "gwd -w job sector compare"
+# Only gw2dmk and dmk2gw may be run, and the status comes back.
+if "$bld/gwd" -c "$tmp/gwd.sock" sh -c true > "$tmp/gwdbad.log" 2>&1; then
+	fail "gwd ran an arbitrary command"
+fi
+kill -TERM "$gwd_pid"
+wait "$gwd_pid" || fail "gwd exit status"
+gwd_pid=
+[ -e "$tmp/gwd.sock" ] && fail "gwd left its socket"
+stop_gwsim
+
+echo "=== test 12: drive calibration cache"
+XDG_CONFIG_HOME=$tmp/xdgcal
+calib=$XDG_CONFIG_HOME/gw2dmk/calib.txt
+mkdir -p "$XDG_CONFIG_HOME"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 5 --force "$tmp/cal1.dmk" \
+	> "$tmp/cal1.log" 2>&1 || { cat "$tmp/cal1.log"; fail "gw2dmk uncached"; }
+grep -q "(calibrated)" "$tmp/cal1.log" && fail "calibrated with no cache"
+grep -q "^0 2 " "$calib" || { cat "$calib"; fail "calibration not stored"; }
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 40 --force "$tmp/cal2.dmk" \
+	> "$tmp/cal2.log" 2>&1 || { cat "$tmp/cal2.log"; fail "gw2dmk cached"; }
+grep -q "(calibrated)" "$tmp/cal2.log" || fail "calibration not used"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/cal2.dmk" || \
+	fail "calibrated sector compare"
+# A stale entry is detected and replaced; --nocalib ignores the cache.
+sed -i 's/^0 2 /0 4 /' "$calib"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 5 --force "$tmp/cal3.dmk" \
+	> "$tmp/cal3.log" 2>&1 || { cat "$tmp/cal3.log"; fail "gw2dmk stale"; }
+grep -q "(calibrated)" "$tmp/cal3.log" && fail "stale calibration used"
+grep -q "^0 2 " "$calib" || fail "stale calibration not replaced"
+timeout 120 "$bld/gw2dmk" --nocalib -G "$tmp/pty" -t 5 --force \
+	"$tmp/cal4.dmk" > "$tmp/cal4.log" 2>&1 || \
+	{ cat "$tmp/cal4.log"; fail "gw2dmk --nocalib"; }
+grep -q "(calibrated)" "$tmp/cal4.log" && fail "--nocalib used the cache"
+stop_gwsim
+XDG_CONFIG_HOME=$tmp/xdg
+
+echo "=== test 13: deferred retries"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+# -X forces retries of clean tracks, so every track is left pending.
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 5 -X 2 --defer --force \
+	"$tmp/defer.dmk" > "$tmp/defer.log" 2>&1 || \
+	{ cat "$tmp/defer.log"; fail "gw2dmk --defer"; }
+grep -q "Retry pass 2: 10 tracks" "$tmp/defer.log" || \
+	fail "--defer retry passes"
+grep -q "Retry pass 3" "$tmp/defer.log" && fail "--defer extra pass"
+# The first retry pass sweeps back down from where the head was left.
+[ "$(grep -n "Track 4, side 0, pass 2/5" "$tmp/defer.log" | cut -d: -f1)" \
+	-lt "$(grep -n "Track 0, side 0, pass 2/5" "$tmp/defer.log" | \
+	cut -d: -f1)" ] || fail "--defer retry pass order"
+grep -q "20 retries" "$tmp/defer.log" || fail "--defer retry count"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/defer.dmk" || \
+	fail "--defer sector compare"
+stop_gwsim
+
+echo "=== test 14: retries stop when reads stall"
+# Corrupt a data byte of track 2, side 0 so it never reads clean.
+python3 -c '
+import sys
+d = bytearray(open(sys.argv[1], "rb").read())
+tl = d[2] | d[3] << 8
+off = 16 + 4 * tl
+idam = (d[off] | d[off + 1] << 8) & 0x3fff
+d[off + idam + 60] ^= 0xff
+open(sys.argv[2], "wb").write(d)
+' "$tmp/golden.dmk" "$tmp/badsec.dmk"
+start_gwsim -D 0:525dd -i "0:$tmp/badsec.dmk"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 4 -x 10 --stall 2 --vary \
+	--force "$tmp/stall.dmk" > "$tmp/stall.log" 2>&1 || \
+	{ cat "$tmp/stall.log"; fail "gw2dmk --stall"; }
+grep -q "trying other postcomp" "$tmp/stall.log" || \
+	fail "--vary strategy switch"
+grep -q "pass 5/11: 15 good sectors, 1 error \[retries stalled\]" \
+	"$tmp/stall.log" || { cat "$tmp/stall.log"; fail "--stall stop"; }
+grep -q "1 track stopped retrying when reads stalled, 6 retries saved" \
+	"$tmp/stall.log" || fail "--stall summary"
+# Deferred, the policy carries across retry passes.
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 4 -x 10 --stall 2 --defer \
+	--force "$tmp/stall2.dmk" > "$tmp/stall2.log" 2>&1 || \
+	{ cat "$tmp/stall2.log"; fail "gw2dmk --stall --defer"; }
+grep -q "Retry pass 2: 1 track" "$tmp/stall2.log" || \
+	fail "--stall --defer passes"
+grep -q "Retry pass 3" "$tmp/stall2.log" && fail "--stall --defer stop"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 4 -x 10 --stall 0 --force \
+	"$tmp/stall3.dmk" > "$tmp/stall3.log" 2>&1 || \
+	{ cat "$tmp/stall3.log"; fail "gw2dmk --stall 0"; }
+grep -q "pass 11/11" "$tmp/stall3.log" || fail "--stall 0 retries"
+stop_gwsim
+
+echo "=== test 15: immediate-start reads"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 5 --immediate \
+	"$tmp/immed.dmk" > "$tmp/immed.log" 2>&1 || \
+	{ cat "$tmp/immed.log"; fail "gw2dmk --immediate"; }
+grep -q "no wraparound" "$tmp/immed.log" && fail "--immediate fallback"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/immed.dmk" || \
+	fail "--immediate sector compare"
+stop_gwsim
+# A single sector seldom comes around again within the read, so
+# most tracks fall back to reading from the index.
+start_gwsim -D 0:525dd -i "0:$tmp/small.dmk"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 5 --immediate \
+	"$tmp/immed1.dmk" > "$tmp/immed1.log" 2>&1 || \
+	{ cat "$tmp/immed1.log"; fail "gw2dmk --immediate fallback"; }
+grep -q "no wraparound; reading from index" "$tmp/immed1.log" || \
+	fail "--immediate fallback message"
+"$bld/mkdmk" -n 1 -c "$tmp/small.dmk" "$tmp/immed1.dmk" || \
+	fail "--immediate fallback sector compare"
+stop_gwsim
+
+echo "=== test 16: checkpoints and resuming an unfinished read"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+# The DMK can't be written over a directory, so the read dies at the
+# end with its checkpoint whole; cut that short mid-record as a crash
+# would.
+mkdir "$tmp/ckpt.dmk"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 10 --force "$tmp/ckpt.dmk" \
+	> "$tmp/ckpt.log" 2>&1 && fail "gw2dmk over a directory"
+rmdir "$tmp/ckpt.dmk"
+[ -f "$tmp/ckpt.dmk.ckpt" ] || fail "checkpoint kept"
+python3 -c '
+import os, sys
+os.truncate(sys.argv[1], os.path.getsize(sys.argv[1]) * 6 // 10)
+' "$tmp/ckpt.dmk.ckpt"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 10 "$tmp/ckpt.dmk" \
+	> "$tmp/ckpt2.log" 2>&1 && fail "checkpoint overwritten"
+grep -q "Use the --resume option" "$tmp/ckpt2.log" || \
+	fail "checkpoint exists check"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" --resume "$tmp/ckpt.dmk" \
+	> "$tmp/resume.log" 2>&1 || \
+	{ cat "$tmp/resume.log"; fail "gw2dmk --resume"; }
+grep -q "Resuming from .*: 11 tracks kept" "$tmp/resume.log" || \
+	{ cat "$tmp/resume.log"; fail "--resume kept tracks"; }
+[ "$(grep -c "kept from earlier read" "$tmp/resume.log")" -eq 11 ] || \
+	fail "--resume reread kept tracks"
+[ -f "$tmp/ckpt.dmk.ckpt" ] && fail "checkpoint removed"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/ckpt.dmk" || \
+	fail "--resume sector compare"
+stop_gwsim
+
+echo "=== test 17: packed DMK images"
+"$bld/mkdmk" -t 40 -s 2 "$tmp/golden.dmkz"
+[ "$(head -c 4 "$tmp/golden.dmkz")" = DMKZ ] || fail "packed by name"
+[ "$(wc -c < "$tmp/golden.dmkz")" -lt \
+  "$(($(wc -c < "$tmp/golden.dmk") / 4))" ] || fail "packed size"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/golden.dmkz" || \
+	fail "packed sector compare"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmkz"
+timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 40 "$tmp/outz.dmkz" \
+	> "$tmp/outz.log" 2>&1 || \
+	{ cat "$tmp/outz.log"; fail "gw2dmk to a packed DMK"; }
+[ "$(head -c 4 "$tmp/outz.dmkz")" = DMKZ ] || fail "gw2dmk packed output"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outz.dmkz" || \
+	fail "gw2dmk packed sector compare"
+stop_gwsim
+# Packed media stays packed when the simulator writes it back.
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/targetz.dmkz"
+start_gwsim -D 0:525dd -i "0:$tmp/targetz.dmkz"
+timeout 120 "$bld/dmk2gw" -G "$tmp/pty" -d a "$tmp/golden.dmkz" \
+	> "$tmp/dmk2gwz.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwz.log"; fail "dmk2gw from a packed DMK"; }
+stop_gwsim
+[ "$(head -c 4 "$tmp/targetz.dmkz")" = DMKZ ] || fail "packed media kept"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/targetz.dmkz" || \
+	fail "dmk2gw packed sector compare"
+
+echo "=== test 18: in-process and shared-memory transports"
+timeout 120 "$bld/gw2dmk" -G "sim:drive=0:525dd;$tmp/golden.dmk" -t 40 \
+	"$tmp/outip.dmk" > "$tmp/outip.log" 2>&1 || \
+	{ cat "$tmp/outip.log"; fail "gw2dmk in process"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outip.dmk" || \
+	fail "in-process sector compare"
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/targetip.dmk"
+timeout 120 "$bld/dmk2gw" -G "sim:insert=0:$tmp/targetip.dmk" -d a \
+	"$tmp/golden.dmk" > "$tmp/dmk2gwip.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwip.log"; fail "dmk2gw in process"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/targetip.dmk" || \
+	fail "in-process media written back"
+"$bld/gw2dmk" -G "sim:drive=0:bogus" "$tmp/bad.dmk" > /dev/null 2>&1 && \
+	fail "bad in-process spec accepted"
+shm=gwsim-test-$$
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk" -S "$shm"
+# A second gwsim may not take the segment from under the first.
+timeout 10 "$bld/gwsim" --fast -p "$tmp/pty2" -s none -S "$shm" \
+	< /dev/null > "$tmp/gwsim2.log" 2>&1 && \
+	fail "second gwsim took the shared memory"
+grep -q "exists" "$tmp/gwsim2.log" || fail "shared memory in use message"
+for pass in 1 2; do
+	timeout 120 "$bld/gw2dmk" -G "shm:$shm" -t 40 --force \
+		"$tmp/outshm.dmk" > "$tmp/outshm.log" 2>&1 || \
+		{ cat "$tmp/outshm.log"; fail "gw2dmk over shm, pass $pass"; }
+	"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outshm.dmk" || \
+		fail "shm sector compare, pass $pass"
+done
+stop_gwsim
+[ -e "/dev/shm/$shm" ] && fail "shared memory left behind"
+# What a killed gwsim leaves is refused, then taken over with -R.
+start_gwsim -D 0:525dd -S "$shm"
+kill -KILL "$gwsim_pid"
+wait "$gwsim_pid" 2> /dev/null
+gwsim_pid=
+rm -f "$tmp/pty" "$tmp/sock"
+timeout 10 "$bld/gwsim" --fast -p "$tmp/pty2" -s none -S "$shm" \
+	< /dev/null > "$tmp/gwsim2.log" 2>&1 && \
+	fail "stale shared memory taken without -R"
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk" -S "$shm" -R
+timeout 120 "$bld/gw2dmk" -G "shm:$shm" -t 40 --force \
+	"$tmp/outshm.dmk" > "$tmp/outshm.log" 2>&1 || \
+	{ cat "$tmp/outshm.log"; fail "gw2dmk over reclaimed shm"; }
+stop_gwsim
+[ -e "/dev/shm/$shm" ] && fail "reclaimed shared memory left behind"
+"$bld/gw2dmk" -G "shm:$shm" "$tmp/bad.dmk" > /dev/null 2>&1 && \
+	fail "shm without gwsim accepted"
+
+echo "=== test 19: incremental and write-through media writeback"
+# Only tracks written go back to the file: a byte changed on disk in
+# a track beyond them while the diskette is in survives the eject.
+"$bld/mkdmk" -t 20 -s 2 "$tmp/golden20.dmk"
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/targetinc.dmk"
+tracklen=$(od -An -tu2 -j2 -N2 "$tmp/targetinc.dmk" | tr -d ' ')
+off=$((16 + 60 * tracklen + 128 + 200))
+start_gwsim -D 0:525dd -i "0:$tmp/targetinc.dmk"
+printf 'Z' | dd of="$tmp/targetinc.dmk" bs=1 seek="$off" conv=notrunc \
+	2> /dev/null
+timeout 120 "$bld/dmk2gw" -G "$tmp/pty" -d a "$tmp/golden20.dmk" \
+	> "$tmp/dmk2gwinc.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwinc.log"; fail "dmk2gw, incremental"; }
+stop_gwsim
+"$bld/mkdmk" -c "$tmp/golden20.dmk" "$tmp/targetinc.dmk" || \
+	fail "incremental writeback sector compare"
+[ "$(dd if="$tmp/targetinc.dmk" bs=1 skip="$off" count=1 2> /dev/null)" \
+  = Z ] || fail "unwritten track rewritten"
+# With write-through, writes survive the simulator being killed.
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/targetwt.dmk"
+start_gwsim -w -D 0:525dd -i "0:$tmp/targetwt.dmk"
+timeout 120 "$bld/dmk2gw" -G "$tmp/pty" -d a "$tmp/golden.dmk" \
+	> "$tmp/dmk2gwwt.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwwt.log"; fail "dmk2gw, write-through"; }
+kill -KILL "$gwsim_pid"
+wait "$gwsim_pid" 2> /dev/null
+gwsim_pid=
+rm -f "$tmp/pty" "$tmp/sock"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/targetwt.dmk" || \
+	fail "write-through sector compare"
+# A packed image is replaced whole by rename, never rewritten in place.
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/targetwt.dmkz"
+start_gwsim -w -D 0:525dd -i "0:$tmp/targetwt.dmkz"
+timeout 120 "$bld/dmk2gw" -G "$tmp/pty" -d a "$tmp/golden.dmk" \
+	> "$tmp/dmk2gwwtz.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwwtz.log"; fail "dmk2gw, packed write-through"; }
+kill -KILL "$gwsim_pid"
+wait "$gwsim_pid" 2> /dev/null
+gwsim_pid=
+rm -f "$tmp/pty" "$tmp/sock"
+[ "$(head -c 4 "$tmp/targetwt.dmkz")" = DMKZ ] || \
+	fail "packed write-through kept packed"
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/targetwt.dmkz" || \
+	fail "packed write-through sector compare"
+ls "$tmp"/targetwt.dmkz.?????? > /dev/null 2>&1 && \
+	fail "packed write-through left a temporary file"
+
+echo "=== test 20: recorded flux media"
+# test 8's capture, served as the diskette, reads back as the original,
+# pass after pass as reads come round to other revolutions.
+cp "$tmp/cap.gwlog" "$tmp/cap.bak"
+start_gwsim -D 0:525dd -i "0:$tmp/cap.gwlog"
+ctl status | grep -q "recorded flux" || fail "recorded flux status"
+for pass in 1 2; do
+	timeout 120 "$bld/gw2dmk" -G "$tmp/pty" -t 40 --force \
+		"$tmp/outrec.dmk" > "$tmp/outrec.log" 2>&1 || \
+		{ cat "$tmp/outrec.log"; fail "gw2dmk of capture, pass $pass"; }
+	"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outrec.dmk" || \
+		fail "recorded flux sector compare, pass $pass"
+done
+timeout 60 "$bld/dmk2gw" -G "$tmp/pty" -d a "$tmp/small.dmk" \
+	> "$tmp/dmk2gwrec.log" 2>&1
+stop_gwsim
+cmp -s "$tmp/cap.gwlog" "$tmp/cap.bak" || fail "recorded flux was modified"
+timeout 120 "$bld/gw2dmk" --noconfig -G "sim:drive=0:525dd;$tmp/cap.gwlog" \
+	"$tmp/outrecip.dmk" > "$tmp/outrecip.log" 2>&1 || \
+	{ cat "$tmp/outrecip.log"; fail "gw2dmk of a capture in process"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outrecip.dmk" || \
+	fail "recorded flux autodetect sector compare"
+
+echo "=== test 21: degraded media"
+# Jitter and speed wobble a sound drive reads through; weak regions
+# read garbled on some turns, which retries get past.
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+[ "$(ctl "degrade 0 all jitter=150,wobble=1")" = "degrade on" ] || \
+	fail "degrade all"
+[ "$(ctl "degrade 0 3 weak=2")" = "degrade on" ] || fail "degrade track"
+ctl status | grep -q "degraded track 3: seed=0,weak=2" || \
+	fail "degrade status"
+ctl "degrade 0 7 bogus=1" | grep -q "^error" || fail "bad degrade accepted"
+timeout 120 "$bld/gw2dmk" --noconfig -G "$tmp/pty" -t 40 --force \
+	"$tmp/outdeg.dmk" > "$tmp/outdeg.log" 2>&1 || \
+	{ cat "$tmp/outdeg.log"; fail "gw2dmk of degraded media"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outdeg.dmk" || \
+	fail "degraded media sector compare"
+grep -q " 0 retries" "$tmp/outdeg.log" && fail "weak regions never seen"
+[ "$(ctl "degrade 0 all off")" = "degrade off" ] || fail "degrade off"
+ctl status | grep -q "degraded" && fail "degrade left on"
+stop_gwsim
+
+echo "=== test 22: batched track reads"
+# Each track's seek, head and read go in one transfer; the -U log of
+# that replays the same.  The report puts that transfer's round trip
+# in batch_ns, there being no seek_ns apart from it.
+start_gwsim -D 0:525dd -i "0:$tmp/golden.dmk"
+timeout 120 "$bld/gw2dmk" --noconfig --batch -G "$tmp/pty" -t 40 --force \
+	-U "$tmp/batch.gwlog" -J "$tmp/batch.csv" "$tmp/outbatch.dmk" \
+	> "$tmp/outbatch.log" 2>&1 || \
+	{ cat "$tmp/outbatch.log"; fail "gw2dmk --batch"; }
+stop_gwsim
+awk -F, 'NR == 1 { ok = $5 == "seek_ns" && $6 == "batch_ns"; next }
+	 $5 != 0 || $6 == 0 { ok = 0 } END { exit !(ok && NR > 1) }' \
+	"$tmp/batch.csv" || \
+	{ cat "$tmp/batch.csv"; fail "batched report times"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outbatch.dmk" || \
+	fail "batched read sector compare"
+grep -q "^-> 0x02 0x03 0x[0-9a-f]* 0x03 0x03" "$tmp/batch.gwlog" || \
+	fail "reads weren't batched"
+timeout 120 "$bld/gw2dmk" --noconfig -R "$tmp/batch.gwlog" --force \
+	"$tmp/outbatchrp.dmk" > "$tmp/outbatchrp.log" 2>&1 || \
+	{ cat "$tmp/outbatchrp.log"; fail "replay of a batched log"; }
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/outbatchrp.dmk" || \
+	fail "batched log replay sector compare"
+
+echo "=== test 23: write link bandwidth"
+# A DD track needs about 2.7 Mbps past the prefill: 4 Mbps writes it,
+# while at 2 Mbps the first underflow is final, not retried.
+"$bld/mkdmk" -t 40 -s 2 -n 1 "$tmp/target3.dmk"
+start_gwsim -D 0:525dd -i "0:$tmp/target3.dmk" -b 4000
+timeout 120 "$bld/dmk2gw" --noconfig -G "$tmp/pty" -d a "$tmp/golden.dmk" \
+	> "$tmp/dmk2gwlink.log" 2>&1 || \
+	{ cat "$tmp/dmk2gwlink.log"; fail "dmk2gw over a 4 Mbps link"; }
+stop_gwsim
+"$bld/mkdmk" -c "$tmp/golden.dmk" "$tmp/target3.dmk" || \
+	fail "4 Mbps link sector compare"
+start_gwsim -D 0:525dd -i "0:$tmp/target3.dmk" -b 2000
+timeout 60 "$bld/dmk2gw" --noconfig -G "$tmp/pty" -d a \
+	-U "$tmp/link.gwlog" "$tmp/golden.dmk" > "$tmp/dmk2gwslow.log" 2>&1 \
+	&& fail "dmk2gw over a 2 Mbps link succeeded"
+stop_gwsim
+grep -q "the link carried 2.00" "$tmp/dmk2gwslow.log" || \
+	{ cat "$tmp/dmk2gwslow.log"; fail "link shortfall not reported"; }
+[ "$(grep -c "^-> 0x0d" "$tmp/link.gwlog")" = 1 ] || \
+	fail "a hopeless write was retried"
+
 echo "=== all tests passed"
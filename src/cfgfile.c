@@ -251,19 +251,19 @@ cfg_scan_argv(int argc, char **argv, bool *noconfig)
 
 
 char *
-cfg_default_path(void)
+cfg_dir_path(const char *name)
 {
 	char		*path;
 
 #if defined(WIN64) || defined(WIN32)
-	static const char	sub[] = "\\gw2dmk\\gw2dmk.ini";
+	static const char	sub[] = "\\gw2dmk\\";
 	const char	*base = getenv("APPDATA");
 
 	if (!base || !*base)
 		return NULL;
 #else
-	static const char	xdg_sub[]  = "/gw2dmk/gw2dmk.ini";
-	static const char	home_sub[] = "/.config/gw2dmk/gw2dmk.ini";
+	static const char	xdg_sub[]  = "/gw2dmk/";
+	static const char	home_sub[] = "/.config/gw2dmk/";
 	const char	*sub  = xdg_sub;
 	const char	*base = getenv("XDG_CONFIG_HOME");
 
@@ -276,14 +276,23 @@ cfg_default_path(void)
 	}
 #endif
 
-	path = malloc(strlen(base) + strlen(sub) + 1);
+	path = malloc(strlen(base) + strlen(sub) + strlen(name) + 1);
 
 	if (!path)
 		msg_fatal("Cannot allocate config file path.\n");
 
-	sprintf(path, "%s%s", base, sub);
+	sprintf(path, "%s%s%s", base, sub, name);
+
+	return path;
+}
+
+
+char *
+cfg_default_path(void)
+{
+	char	*path = cfg_dir_path("gw2dmk.ini");
 
-	if (access(path, F_OK) != 0) {
+	if (path && access(path, F_OK) != 0) {
 		free(path);
 		return NULL;
 	}
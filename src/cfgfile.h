@@ -38,6 +38,13 @@ extern const char *cfg_scan_argv(int argc, char **argv, bool *noconfig);
  */
 extern char *cfg_default_path(void);
 
+/*
+ * Return the malloc'd path of file "name" in the directory holding
+ * the default config file, whether or not either exists, or NULL if
+ * the directory can't be determined.
+ */
+extern char *cfg_dir_path(const char *name);
+
 /*
  * Parse the config file, applying the [global] section then the
  * [tool_section] section, and return a synthesized argument vector
@@ -1,4 +1,7 @@
+#include <stdlib.h>
+
 #include "dmk.h"
+#include "dmkz.h"
 
 
 void
@@ -244,6 +247,281 @@ dmk_data_rotate(struct dmk_track *trk, uint8_t *data_hole)
 }
 
 
+/*
+ * Rebuild the slab at "size" bytes with just the live tracks, in
+ * track order.  Returns 0 on success or -1 if out of memory, leaving
+ * the slab as it was.
+ */
+
+static int
+slab_resize(struct dmk_file *dmkf, size_t size)
+{
+	uint8_t	*slab = malloc(size ? size : 1);
+
+	if (!slab)
+		return -1;
+
+	size_t	used = 0;
+
+	for (int t = 0; t < DMK_MAX_TRACKS; ++t) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			uint16_t	len = dmkf->track_len[t][s];
+
+			if (!len)
+				continue;
+
+			memcpy(slab + used, dmkf->slab + dmkf->track_off[t][s],
+			       len);
+			dmkf->track_off[t][s] = used;
+			used += len;
+		}
+	}
+
+	free(dmkf->slab);
+	dmkf->slab	= slab;
+	dmkf->slab_size	= size;
+	dmkf->slab_used	= used;
+	dmkf->slab_dead	= 0;
+
+	return 0;
+}
+
+
+void
+dmk_file_init(struct dmk_file *dmkf)
+{
+	*dmkf = (struct dmk_file){};
+}
+
+
+void
+dmk_file_free(struct dmk_file *dmkf)
+{
+	free(dmkf->slab);
+	dmk_file_init(dmkf);
+}
+
+
+/*
+ * Make room for "size" more bytes of tracks, as when loading a whole
+ * image, so the slab is sized to it exactly.  Returns 0 on success or
+ * -1 if out of memory.
+ */
+
+int
+dmk_file_reserve(struct dmk_file *dmkf, size_t size)
+{
+	if (dmkf->slab_used + size <= dmkf->slab_size)
+		return 0;
+
+	return slab_resize(dmkf, dmkf->slab_used - dmkf->slab_dead + size);
+}
+
+
+uint16_t
+dmk_file_track_len(const struct dmk_file *dmkf, int track, int side)
+{
+	return dmkf->track_len[track][side];
+}
+
+
+/*
+ * The stored bytes of a track, or NULL if it has none.  Good until
+ * the next change to any track of dmkf.
+ */
+
+const uint8_t *
+dmk_file_track_raw(const struct dmk_file *dmkf, int track, int side)
+{
+	if (!dmkf->track_len[track][side])
+		return NULL;
+
+	return dmkf->slab + dmkf->track_off[track][side];
+}
+
+
+/*
+ * Make room for "len" (nonzero) bytes of track and return where
+ * they go, for the caller to fill in.  A track keeping its length is
+ * rewritten in place; otherwise its old bytes become dead space,
+ * reclaimed when the slab next fills.  Returns NULL if out of memory
+ * or "len" is too long for a track, leaving the track as it was.
+ */
+
+uint8_t *
+dmk_file_track_alloc(struct dmk_file *dmkf, int track, int side,
+		     uint16_t len)
+{
+	if (len == 0 || len > DMKRD_TRACKLEN_MAX)
+		return NULL;
+
+	if (len == dmkf->track_len[track][side])
+		return dmkf->slab + dmkf->track_off[track][side];
+
+	if (dmkf->slab_used + len > dmkf->slab_size) {
+		size_t	live = dmkf->slab_used - dmkf->slab_dead;
+		size_t	size = 2 * (live + len);
+
+		if (slab_resize(dmkf, size) == -1)
+			return NULL;
+	}
+
+	dmk_file_clear_track(dmkf, track, side);
+
+	dmkf->track_off[track][side] = dmkf->slab_used;
+	dmkf->track_len[track][side] = len;
+	dmkf->slab_used += len;
+
+	return dmkf->slab + dmkf->track_off[track][side];
+}
+
+
+/*
+ * Copy a track out to a working buffer, zeroed past its length.
+ */
+
+void
+dmk_file_get_track(const struct dmk_file *dmkf, int track, int side,
+		   struct dmk_track *trk)
+{
+	uint16_t	len = dmkf->track_len[track][side];
+
+	trk->track_len = len;
+
+	if (len)
+		memcpy(trk->track, dmkf->slab + dmkf->track_off[track][side],
+		       len);
+
+	memset(trk->track + len, 0, sizeof(trk->track) - len);
+}
+
+
+/*
+ * Store a working buffer's track_len bytes as the track.  Returns 0
+ * on success or -1 on failure, leaving the track as it was.
+ */
+
+int
+dmk_file_put_track(struct dmk_file *dmkf, int track, int side,
+		   const struct dmk_track *trk)
+{
+	if (trk->track_len == 0) {
+		dmk_file_clear_track(dmkf, track, side);
+		return 0;
+	}
+
+	uint8_t	*raw = dmk_file_track_alloc(dmkf, track, side,
+					    trk->track_len);
+
+	if (!raw)
+		return -1;
+
+	memcpy(raw, trk->track, trk->track_len);
+
+	return 0;
+}
+
+
+void
+dmk_file_clear_track(struct dmk_file *dmkf, int track, int side)
+{
+	dmkf->slab_dead += dmkf->track_len[track][side];
+	dmkf->track_len[track][side] = 0;
+}
+
+
+/*
+ * Move a track's bytes to another position, leaving the old
+ * position empty.
+ */
+
+void
+dmk_file_move_track(struct dmk_file *dmkf, int to_track, int to_side,
+		    int from_track, int from_side)
+{
+	if (to_track == from_track && to_side == from_side)
+		return;
+
+	dmk_file_clear_track(dmkf, to_track, to_side);
+
+	dmkf->track_off[to_track][to_side] =
+		dmkf->track_off[from_track][from_side];
+	dmkf->track_len[to_track][to_side] =
+		dmkf->track_len[from_track][from_side];
+	dmkf->track_len[from_track][from_side] = 0;
+}
+
+
+/*
+ * Read a track as dmk_track_fread() does, but straight into its
+ * stored bytes.
+ */
+
+static bool
+track_raw_fread(uint8_t *raw, uint16_t len, FILE *fp)
+{
+	if (fread(raw, len, 1, fp) != 1)
+		return false;
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i) {
+		uint16_t	idam_off;
+
+		memcpy(&idam_off, raw + 2 * i, sizeof(idam_off));
+		idam_off = le16toh(idam_off);
+		memcpy(raw + 2 * i, &idam_off, sizeof(idam_off));
+	}
+
+	return true;
+}
+
+
+/*
+ * Write a track as dmk_track_fwrite() does, from its stored bytes,
+ * padded with zeros to the header's track length.
+ *
+ * Returns 1 when track is written correctly, 0 on failure.
+ */
+
+bool
+dmk_file_track_fwrite(const struct dmk_file *dmkf, int track, int side,
+		      FILE *fp)
+{
+	const uint8_t	*raw = dmk_file_track_raw(dmkf, track, side);
+	uint16_t	len  = dmkf->track_len[track][side];
+	uint16_t	tracklen = dmkf->header.tracklen;
+	size_t		fwsz = 0;
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i) {
+		uint16_t	idam_off = 0;
+
+		if (2 * i + 2 <= len)
+			memcpy(&idam_off, raw + 2 * i, sizeof(idam_off));
+
+		idam_off = htole16(idam_off & ~DMK_EXTRA_FLAG);
+
+		fwsz += fwrite(&idam_off, sizeof(idam_off), 1, fp);
+	}
+
+	int	i = DMK_TKHDR_SIZE;
+
+	if (len > i) {
+		uint16_t	n = min(len, tracklen) - i;
+
+		fwsz += fwrite(raw + i, n, 1, fp);
+		i += n;
+	} else {
+		++fwsz;
+	}
+
+	for (; i < tracklen; ++i) {
+		if (putc(0, fp) == EOF)
+			return false;
+	}
+
+	return fwsz == (DMK_MAX_SECTORS + 1) ? true : false;
+}
+
+
 /*
  * Return the optimal DMK header track length for the entire DMK.
  */
@@ -257,7 +535,7 @@ dmk_track_length_optimal(const struct dmk_file *dmkf)
 
 	for (int t = 0; t < dmkf->header.ntracks; ++t) {
 		for (int s = 0; s < sides; ++s) {
-			uint16_t	trk_len = dmkf->track[t][s].track_len;
+			uint16_t	trk_len = dmkf->track_len[t][s];
 
 			if (trk_len > max_trk_len)
 				max_trk_len = trk_len;
@@ -269,7 +547,23 @@ dmk_track_length_optimal(const struct dmk_file *dmkf)
 
 
 /*
- * Read in the DMK file to a dmk_file data structure.
+ * Sanity check the values of a header read from a DMK file.
+ */
+
+bool
+dmk_header_valid(const struct dmk_header *dmkh)
+{
+	return (dmkh->writeprot == 0x00 || dmkh->writeprot == 0xff) &&
+	       dmkh->real_format == 0 &&
+	       dmkh->ntracks <= DMK_MAX_TRACKS &&
+	       dmkh->tracklen > DMK_TKHDR_SIZE &&
+	       dmkh->tracklen <= DMKRD_TRACKLEN_MAX;
+}
+
+
+/*
+ * Read in the DMK file, plain or packed, to a dmk_file data structure,
+ * replacing what it held.  dmkf must be zeroed or hold an image.
  *
  * Returns 0 on success or -1 on failure.
  */
@@ -277,6 +571,11 @@ dmk_track_length_optimal(const struct dmk_file *dmkf)
 int
 fp2dmk(FILE *fp, struct dmk_file *dmkf)
 {
+	dmk_file_free(dmkf);
+
+	if (dmkz_is_packed(fp))
+		return dmkz_fp2dmk(fp, dmkf);
+
 	if (fseek(fp, 0, SEEK_SET) == -1)
 		return -1;
 
@@ -284,22 +583,24 @@ fp2dmk(FILE *fp, struct dmk_file *dmkf)
 	if (hret != 1)
 		return -1;
 
-	/* Sanity check values read from the DMK file. */
-	if ((dmkf->header.writeprot != 0x00 &&
-	     dmkf->header.writeprot != 0xff) ||
-	    dmkf->header.real_format != 0 ||
-	    dmkf->header.ntracks > DMK_MAX_TRACKS ||
-	    dmkf->header.tracklen <= DMK_TKHDR_SIZE ||
-	    dmkf->header.tracklen > DMKRD_TRACKLEN_MAX) {
+	if (!dmk_header_valid(&dmkf->header))
 		return -1;
-	}
+
+	dmkf->zipped = false;
 
 	int sides = 2 - !!(dmkf->header.options & DMK_SSIDE_OPT);
+	uint16_t tracklen = dmkf->header.tracklen;
+
+	if (dmk_file_reserve(dmkf, (size_t)dmkf->header.ntracks * sides *
+				   tracklen) == -1)
+		return -1;
 
 	for (int t = 0; t < dmkf->header.ntracks; ++t) {
 		for (int s = 0; s < sides; ++s) {
-			if (!dmk_track_fread(&dmkf->header,
-					     &dmkf->track[t][s], fp))
+			uint8_t	*raw = dmk_file_track_alloc(dmkf, t, s,
+							    tracklen);
+
+			if (!raw || !track_raw_fread(raw, tracklen, fp))
 				return -1;
 		}
 	}
@@ -309,12 +610,16 @@ fp2dmk(FILE *fp, struct dmk_file *dmkf)
 
 
 /*
- * Write out the dmk_file data structure as a DMK to file stream fp.
+ * Write out the dmk_file data structure as a DMK to file stream fp,
+ * packed if dmkf->zipped.
  */
 
 int
 dmk2fp(struct dmk_file *dmkf, FILE *fp)
 {
+	if (dmkf->zipped)
+		return dmkz_dmk2fp(dmkf, fp);
+
 	if (fseek(fp, 0, SEEK_SET) == -1)
 		return -1;
 
@@ -325,8 +630,7 @@ dmk2fp(struct dmk_file *dmkf, FILE *fp)
 
 	for (int t = 0; t < dmkf->header.ntracks; ++t) {
 		for (int s = 0; s < sides; ++s) {
-			if (!dmk_track_fwrite(&dmkf->header,
-					      &dmkf->track[t][s], fp))
+			if (!dmk_file_track_fwrite(dmkf, t, s, fp))
 				return -1;
 		}
 	}
@@ -103,6 +103,9 @@ struct dmk_disk_stats {
 	int		err_tracks;
 	int		good_tracks;
 
+	int		stalled_tracks;
+	int		retries_saved;
+
 	bool		flippy;
 };
 
@@ -147,9 +150,27 @@ struct dmk_track {
 };
 
 
+/*
+ * A whole image.  The tracks sit end to end in one slab, each only
+ * as long as it is, rather than in a worst-case struct dmk_track
+ * apiece.  A stored track is laid out as dmk_track.track[] is, IDAM
+ * pointers (in host order) first; use the dmk_file_*track*() calls
+ * below to get at it, and a struct dmk_track to work on it.
+ *
+ * A zeroed dmk_file is empty and valid; dmk_file_free() releases
+ * the slab.
+ */
+
 struct dmk_file {
 	struct dmk_header	header;
-	struct dmk_track	track[DMK_MAX_TRACKS][DMK_SIDES];
+	bool			zipped;		/* In the dmkz container */
+
+	uint8_t			*slab;
+	size_t			slab_size;
+	size_t			slab_used;
+	size_t			slab_dead;	/* Held by replaced tracks */
+	uint32_t		track_off[DMK_MAX_TRACKS][DMK_SIDES];
+	uint16_t		track_len[DMK_MAX_TRACKS][DMK_SIDES];
 };
 
 
@@ -164,6 +185,8 @@ extern bool dmk_header_fread(struct dmk_header *dmkh, FILE *fp);
 
 extern bool dmk_header_fwrite(const struct dmk_header *dmkh, FILE *fp);
 
+extern bool dmk_header_valid(const struct dmk_header *dmkh);
+
 extern long dmk_track_file_offset(struct dmk_header *dmkh, int track, int side);
 
 int dmk_track_fseek(struct dmk_header *dmkh, int track, int side, FILE *fp);
@@ -176,6 +199,35 @@ extern bool dmk_track_fwrite(const struct dmk_header *dmkh,
 
 extern void dmk_data_rotate(struct dmk_track *trk, uint8_t *data_hole);
 
+extern void dmk_file_init(struct dmk_file *dmkf);
+
+extern void dmk_file_free(struct dmk_file *dmkf);
+
+extern int dmk_file_reserve(struct dmk_file *dmkf, size_t size);
+
+extern uint16_t dmk_file_track_len(const struct dmk_file *dmkf,
+				   int track, int side);
+
+extern const uint8_t *dmk_file_track_raw(const struct dmk_file *dmkf,
+					 int track, int side);
+
+extern uint8_t *dmk_file_track_alloc(struct dmk_file *dmkf,
+				     int track, int side, uint16_t len);
+
+extern void dmk_file_get_track(const struct dmk_file *dmkf,
+			       int track, int side, struct dmk_track *trk);
+
+extern int dmk_file_put_track(struct dmk_file *dmkf, int track, int side,
+			      const struct dmk_track *trk);
+
+extern void dmk_file_clear_track(struct dmk_file *dmkf, int track, int side);
+
+extern void dmk_file_move_track(struct dmk_file *dmkf, int to_track,
+				int to_side, int from_track, int from_side);
+
+extern bool dmk_file_track_fwrite(const struct dmk_file *dmkf,
+				  int track, int side, FILE *fp);
+
 extern uint16_t dmk_track_length_optimal(const struct dmk_file *dmkf);
 
 extern int fp2dmk(FILE *fp, struct dmk_file *dmkf);
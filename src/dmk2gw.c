@@ -7,6 +7,8 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <signal.h>
+#include <pthread.h>
+#include <math.h>
 
 #include "greaseweazle.h"
 #include "msg_levels.h"
@@ -15,11 +17,17 @@
 #include "gw.h"
 #include "gwx.h"
 #include "gwhisto.h"
+#include "gwmedia.h"
+#include "gwdecode.h"
+#include "gwcodec.h"
 #include "dmk2gwcmdset.h"
 #include "gwdetect.h"
 #include "dmk.h"
 #include "dmkx.h"
+#include "dmkcmp.h"
 #include "cfgfile.h"
+#include "monotime.h"
+#include "runreport.h"
 
 #if defined(WIN64) || defined(WIN32)
 #include <windows.h>
@@ -43,10 +51,12 @@ static const struct option cmd_long_args[] = {
 	{ "maxsides",	required_argument, NULL, 's' },
 	{ "logfile",	required_argument, NULL, 'u' },
 	{ "verbosity",	required_argument, NULL, 'v' },
+	{ "rewrites",	required_argument, NULL, 'x' },
 	{ "testmode",	required_argument, NULL, 'y' },
 	{ "bustype",	required_argument, NULL, 'B' },
 	{ "device",	required_argument, NULL, 'G' },
 	{ "stepdelay",	required_argument, NULL, 'T' },
+	{ "report",	required_argument, NULL, 'J' },
 	{ "gwlogfile",	required_argument, NULL, 'U' },
 	{ "serial",	required_argument, NULL, 'Z' },
 	/* Start of binary long options without single letter counterparts. */
@@ -59,6 +69,8 @@ static const struct option cmd_long_args[] = {
 	{ "noreset",	no_argument, NULL, 0 },
 	{ "reverse",	no_argument, NULL, 0 },
 	{ "noreverse",	no_argument, NULL, 0 },
+	{ "verify",	no_argument, NULL, 0 },
+	{ "noverify",	no_argument, NULL, 0 },
 	{ 0, 0, 0, 0 }
 };
 
@@ -96,11 +108,14 @@ struct cmd_settings cmd_settings = {
 	.ignore = 0,
 	.dither = false,
 	.gwdebug = false,
+	.verify = false,
+	.rewrites = 2,
 	.test_mode = -1,
 	.scrn_verbosity = MSG_NORMAL,
 	.file_verbosity = MSG_QUIET,
 	.logfile = NULL,
 	.devlogfile = NULL,
+	.reportfile = NULL,
 	.dmkfile = NULL,
 };
 
@@ -108,6 +123,11 @@ static volatile gw_devt	cleanup_gwfd   = GW_DEVT_INVALID;
 static volatile bool	exit_requested = false;
 static volatile bool	writing_floppy = false;
 
+static struct run_report	run_report;
+
+/* Host-to-device rate seen on the last transfer, Mbps; 0 if unknown. */
+static double			link_bw = 0.0;
+
 
 static void
 usage(const char *pgm_name, struct cmd_settings *cmd_set)
@@ -155,9 +175,18 @@ usage(const char *pgm_name, struct cmd_settings *cmd_set)
 	u("  -U gwlogfile    Greaseweazle transaction logfile [%s]\n",
 				cmd_set->devlogfile ? cmd_set->devlogfile :
 				"none");
+	u("  -J report       Write per-track timing report, JSON or "
+				"*.csv [%s]\n",
+				cmd_set->reportfile ? cmd_set->reportfile :
+				"none");
 	u("  --[no]reset     Reset Greaseweazle upon initialization "
 				"[%sreset]\n",
 				cmd_set->reset_on_init ? "" : "no");
+	u("  --[no]verify    Read back and compare each track after "
+				"writing [%sverify]\n",
+				cmd_set->verify ? "" : "no");
+	u("  -x rewrites     Max rewrites of a track failing verify [%d]\n",
+				cmd_set->rewrites);
 
 	u("\nThese values normally need not be changed:\n");
 	u("  -p plo[,phi]    Write-precompensation range (ns) [%g,%g]\n",
@@ -210,7 +239,7 @@ parse_args(int argc,
 	optind = 0;	/* Reset getopt state; parse_args runs twice. */
 
 	while ((opt = getopt_long(argc, argv,
-			"a:d:f:g:h:i:k:l:m:p:s:u:v:y:B:C:G:T:U:Z:",
+			"a:d:f:g:h:i:k:l:m:p:s:u:v:x:y:B:C:G:J:T:U:Z:",
 			cmd_long_args, &lindex)) != -1) {
 
 		switch(opt) {
@@ -239,6 +268,10 @@ parse_args(int argc,
 				cmd_set->reverse_sides = true;
 			} else if (!strcmp(name, "noreverse")) {
 				cmd_set->reverse_sides = false;
+			} else if (!strcmp(name, "verify")) {
+				cmd_set->verify = true;
+			} else if (!strcmp(name, "noverify")) {
+				cmd_set->verify = false;
 			} else {
 				goto err_usage;
 			}
@@ -354,6 +387,13 @@ parse_args(int argc,
 			cmd_set->file_verbosity = optav / 10;
 			break;
 
+		case 'x':;
+			const int rewrites = strtol_strict(optarg, 10, "'x'");
+
+			if (rewrites < 0) goto err_usage;
+			cmd_set->rewrites = rewrites;
+			break;
+
 		case 'y':;
 			const int test_mode = strtol_strict(optarg, 0, "'y'");
 
@@ -375,6 +415,10 @@ parse_args(int argc,
 				goto err_usage;
 			break;
 
+		case 'J':
+			cmd_set->reportfile = optarg;
+			break;
+
 		case 'T':
 			if (parse_stepdelay_arg(optarg, &cmd_set->fdd))
 				goto err_usage;
@@ -559,91 +603,250 @@ get_rpm(gw_devt gwfd, int drive, uint32_t sample_freq)
 }
 
 
-struct t2gw_data {
-	uint8_t		*tbuf;
-	size_t		tbuf_len;
-	size_t		tbuf_cnt;
-	uint32_t 	nfa_thresh;
-	uint32_t 	nfa_period;
+/*
+ * A track's encoding job.  Encoding of a track depends only on its
+ * own DMK data and settings, so jobs can run on worker threads ahead
+ * of the writes.  Each works on its own copy of the track, "dmkt",
+ * kept for verifying until the writer releases the job.
+ */
+
+struct enc_job {
+	const struct dmk_file	*dmkf;
+	int			test_fill;	/* -1 for none */
+	struct dmk_track	*dmkt;
+	struct extra_track_info	eti;
+	struct encode_bit	ebs;
+	uint8_t			*tbuf;
+	size_t			tbuf_cnt;
+	int			ret;
+	uint64_t		cpu_ns;
+	bool			done;
 };
 
 
-static int
-encode_t2gw(uint32_t ticks, void *data)
+/*
+ * Encode a job's track.  The stream is in job->tbuf, for
+ * gw_write_stream() to retry with if needed.
+ */
+
+static void
+encode_track(struct enc_job *job)
 {
-	if (ticks == 0)
-		return 0;
+	uint64_t		cpu_start = threadtime_ns();
 
-	struct t2gw_data *t2gwd = (struct t2gw_data *)data;
+	job->dmkt = malloc(sizeof(*job->dmkt));
 
-	if (t2gwd->tbuf_cnt + GWCODE_MAX >= t2gwd->tbuf_len)
-		return -1;
+	if (!job->dmkt) {
+		job->ret = -1;
+		goto done;
+	}
 
-	t2gwd->tbuf_cnt += encode_ticks(ticks,
-					t2gwd->nfa_thresh,
-					t2gwd->nfa_period,
-					&t2gwd->tbuf[t2gwd->tbuf_cnt]);
+	dmk_file_get_track(job->dmkf, job->eti.track, job->eti.side,
+			   job->dmkt);
 
-	return 0;
+	if (job->test_fill >= 0)
+		memset(job->dmkt->data, job->test_fill,
+		       job->eti.track_len - DMK_TKHDR_SIZE);
+
+	job->ret = dmk2stream(job->dmkt, &job->eti, &job->ebs,
+			      &job->tbuf, &job->tbuf_cnt);
+
+done:
+	job->cpu_ns   = threadtime_ns() - cpu_start;
+}
+
+
+/*
+ * Pool of encoder threads.  Workers claim jobs in write order, but
+ * stay at most ENC_AHEAD tracks ahead of the writer to bound memory.
+ * With no workers, the writer encodes each track itself.
+ */
+
+#define ENC_WORKERS_MAX		4
+#define ENC_AHEAD		8
+
+struct enc_pool {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct enc_job	*jobs;
+	int		njobs;
+	int		next;		/* next job to claim */
+	int		written;	/* jobs released by the writer */
+	bool		stop;
+	pthread_t	threads[ENC_WORKERS_MAX];
+	int		nthreads;
+};
+
+
+static void *
+enc_worker(void *arg)
+{
+	struct enc_pool	*pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (!pool->stop && pool->next < pool->njobs &&
+		       pool->next >= pool->written + ENC_AHEAD)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		if (pool->stop || pool->next >= pool->njobs)
+			break;
+
+		struct enc_job	*job = &pool->jobs[pool->next++];
+
+		pthread_mutex_unlock(&pool->lock);
+		encode_track(job);
+		pthread_mutex_lock(&pool->lock);
+
+		job->done = true;
+		pthread_cond_broadcast(&pool->cond);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
 }
 
 
 static int
-write_track(struct cmd_settings *cmd_set,
-	    struct dmk_track *dmkt,
-	    struct extra_track_info *eti,
-	    struct encode_bit *ebs)
+online_cpus(void)
 {
-	msg(MSG_NORMAL, "Track %d, side %d", eti->track, eti->side);
-	msg(MSG_BYTES, "\n");
-	msg(MSG_NORMAL, "\r");
-	msg_scrn_flush();
+#if defined(WIN64) || defined(WIN32)
+	SYSTEM_INFO	si;
 
-	encode_bit_init(ebs, ebs->freq, ebs->mult);
-	ebs->extra_bytes = eti->extra_bytes;
+	GetSystemInfo(&si);
 
-	uint32_t nfa_thresh = 150e-6 * ebs->freq + 0.5;   /* 150us */
-	uint32_t nfa_period = 1.25e-6 * ebs->freq + 0.5;  /* 1.25us */
+	return si.dwNumberOfProcessors;
+#else
+	long	n = sysconf(_SC_NPROCESSORS_ONLN);
 
-	/*
-	 * Turn DMK track into a train of 8-bit encoded GW tick timings.
-	 *
-	 * We need to encode it as a single GW stream so
-	 * gw_write_stream() can retry if needed.
-	 */
+	return n > 0 ? n : 1;
+#endif
+}
 
-	// XXX Just pick a large value for now.
-	size_t tbuf_sz = sizeof(uint8_t) * 500000;
-	uint8_t *tbuf  = malloc(tbuf_sz);
-	if (!tbuf) msg_fatal("Failed to get buffer.\n");
-	struct t2gw_data tes = { .tbuf     = tbuf,
-				 .tbuf_len = tbuf_sz,
-				 .tbuf_cnt = 0,
-				 .nfa_thresh = nfa_thresh,
-				 .nfa_period = nfa_period };
-
-	struct dmk_encode_s des = {
-		.encode_pulse = encode_t2gw,
-		.pulse_data   = &tes
-	};
 
-	dmk2pulses(dmkt, eti, ebs, &des);
+static void
+enc_pool_start(struct enc_pool *pool, struct enc_job *jobs, int njobs,
+	       int nthreads)
+{
+	*pool = (struct enc_pool){ .jobs = jobs, .njobs = njobs };
 
-        /*
-         * To finish the stream, emit a dummy final flux value and a
-         * 0. The dummy is never written to disk because the write
-         * is aborted immediately the final flux is loaded into the
-         * WDATA timer. The dummy flux is sacrificial, ensuring that
-         * the real final flux gets written in full.
-	 */
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (int i = 0; i < nthreads && i < ENC_WORKERS_MAX; ++i) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   enc_worker, pool) != 0)
+			break;
+
+		++pool->nthreads;
+	}
+}
+
+
+/* Wait for job "i" to be encoded, encoding it here if no workers. */
+
+static struct enc_job *
+enc_pool_get(struct enc_pool *pool, int i)
+{
+	struct enc_job	*job = &pool->jobs[i];
+
+	if (pool->nthreads == 0) {
+		if (!job->done) {
+			encode_track(job);
+			job->done = true;
+		}
+		return job;
+	}
+
+	pthread_mutex_lock(&pool->lock);
 
-	uint32_t	dummy = 100e-6 * ebs->freq + 0.5;
+	while (!job->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
 
-	tes.tbuf_cnt += encode_ticks(dummy, nfa_thresh, nfa_period,
-				     &tes.tbuf[tes.tbuf_cnt]);
+	pthread_mutex_unlock(&pool->lock);
 
-	/* Mark end of stream. */
-	tes.tbuf[tes.tbuf_cnt++] = 0;
+	return job;
+}
+
+
+/* The writer is done with job "i"; let workers move ahead. */
+
+static void
+enc_pool_release(struct enc_pool *pool, int i)
+{
+	free(pool->jobs[i].tbuf);
+	pool->jobs[i].tbuf = NULL;
+	free(pool->jobs[i].dmkt);
+	pool->jobs[i].dmkt = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->written = i + 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void
+enc_pool_finish(struct enc_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->nthreads; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	for (int i = 0; i < pool->njobs; ++i) {
+		free(pool->jobs[i].tbuf);
+		free(pool->jobs[i].dmkt);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+
+/*
+ * Note the host-to-device rate the Greaseweazle saw on the transfer
+ * just made, if it reports a sensible one.
+ */
+
+static void
+measure_link(gw_devt gwfd)
+{
+	double	min_bw, max_bw;
+
+	if (gw_get_bandwidth(gwfd, &min_bw, &max_bw) == ACK_OKAY &&
+	    isfinite(min_bw) && min_bw > 0.0)
+		link_bw = min_bw;
+}
+
+
+static int
+write_track(struct cmd_settings *cmd_set,
+	    struct enc_pool *pool,
+	    int job_idx,
+	    struct rr_track *rt)
+{
+	struct extra_track_info	*eti = &pool->jobs[job_idx].eti;
+
+	msg(MSG_NORMAL, "Track %d, side %d", eti->track, eti->side);
+	msg(MSG_BYTES, "\n");
+	msg(MSG_NORMAL, "\r");
+	msg_scrn_flush();
+
+	struct enc_job	*job = enc_pool_get(pool, job_idx);
+
+	rt->codec_cpu_ns = job->cpu_ns;
+
+	if (job->ret) {
+		msg_error("Failed to encode track %d, side %d.\n",
+			  eti->track, eti->side);
+		return -1;
+	}
 
 	if (cmd_set->gwdebug) {
 		char	fns[25];
@@ -655,7 +858,7 @@ write_track(struct cmd_settings *cmd_set,
 		if (!gwfp) {
 			msg_error("Failed to create debug file '%s': %s\n",
 				  fns, strerror(errno));
-		} else if (fwrite(tes.tbuf, tes.tbuf_cnt, 1, gwfp) != 1 ||
+		} else if (fwrite(job->tbuf, job->tbuf_cnt, 1, gwfp) != 1 ||
 			   fclose(gwfp) == EOF) {
 			msg_error("Failed to write debug file '%s': %s\n",
 				  fns, strerror(errno));
@@ -666,13 +869,14 @@ write_track(struct cmd_settings *cmd_set,
 	 * Write out 8-bit encoded GW timings to physical track.
 	 */
 
+	uint64_t seek_start = monotime_ns();
+
 	int cmd_ret = gw_seek(cmd_set->fdd.gwfd,
 			      eti->track * cmd_set->fdd.steps);
 
 	if (cmd_ret != ACK_OKAY) {
 		msg_error("Failed to seek to track %d (%d).\n",
 			  eti->track * cmd_set->fdd.steps, cmd_ret);
-		free(tes.tbuf);
 		return -1;
 	}
 
@@ -682,14 +886,37 @@ write_track(struct cmd_settings *cmd_set,
 	if (cmd_ret != ACK_OKAY) {
 		msg_error("Failed to select side %d (%d).\n",
 			  eti->side ^ cmd_set->reverse_sides, cmd_ret);
-		free(tes.tbuf);
 		return -1;
 	}
 
-	ssize_t wsret = gw_write_stream(cmd_set->fdd.gwfd, tes.tbuf,
-					tes.tbuf_cnt, true, true, 5);
+	rt->seek_ns += monotime_ns() - seek_start;
 
-	free(tes.tbuf);
+	struct gw_io_stats	io_before, io_after;
+
+	gw_get_io_stats(&io_before);
+
+	/*
+	 * A write underflows when the link falls further behind the
+	 * stream than the device's prefill covers, and each retry costs
+	 * a revolution.  Retry only while the rate the last attempt
+	 * measured could have carried the stream.
+	 */
+
+	double	need_bw = gw_stream_bw(job->tbuf, job->tbuf_cnt,
+				       job->ebs.freq, GW_WRITE_PREFILL);
+	ssize_t	wsret;
+	int	tries = 0;
+
+	do {
+		wsret = gw_write_stream(cmd_set->fdd.gwfd, job->tbuf,
+					job->tbuf_cnt, true, true, 0);
+		measure_link(cmd_set->fdd.gwfd);
+	} while (wsret == -ACK_FLUX_UNDERFLOW && tries++ < 5 &&
+		 (link_bw == 0.0 || need_bw <= link_bw));
+
+	gw_get_io_stats(&io_after);
+	rr_track_add_xfer(rt, &io_before, &io_after);
+	rt->passes++;
 
 	if (wsret < 0) {
 		if (wsret == -ACK_WRPROT)
@@ -697,6 +924,11 @@ write_track(struct cmd_settings *cmd_set,
 
 		msg_error("Failed to write track %d, side %d (status %zd).\n",
 			  eti->track, eti->side, wsret);
+
+		if (wsret == -ACK_FLUX_UNDERFLOW && link_bw > 0.0)
+			msg_error("The track needs %.2f Mbps to the "
+				  "Greaseweazle; the link carried %.2f.\n",
+				  need_bw, link_bw);
 		return -1;
 	}
 
@@ -704,7 +936,111 @@ write_track(struct cmd_settings *cmd_set,
 }
 
 
-static void
+/*
+ * Read back the track just written, still under the head, and
+ * compare its sectors against the DMK track.  "dmkh" describes the
+ * DMK layout to decode into.
+ *
+ * Returns the number of sectors that failed to verify, or -1 if the
+ * track could not be read back.
+ */
+
+static int
+verify_track(struct cmd_settings *cmd_set,
+	     uint32_t sample_freq,
+	     struct gw_media_encoding *gme,
+	     struct dmk_header *dmkh,
+	     struct enc_job *job,
+	     struct rr_track *rt)
+{
+	struct extra_track_info	*eti = &job->eti;
+	struct gw_io_stats	io_before, io_after;
+
+	gw_get_io_stats(&io_before);
+
+	uint8_t *fbuf = NULL;
+	ssize_t bytes_read = gw_read_stream(cmd_set->fdd.gwfd, 1, 0, &fbuf);
+
+	gw_get_io_stats(&io_after);
+	rr_track_add_xfer(rt, &io_before, &io_after);
+
+	if (bytes_read < 0) {
+		int	gwerr = (int)-bytes_read;
+
+		free(fbuf);
+		msg_error("Failed to read back track %d, side %d: %s (%d)\n",
+			  eti->track, eti->side, gw_cmd_ack(gwerr), gwerr);
+		return -1;
+	}
+
+	uint64_t		decode_start = threadtime_ns();
+	struct dmk_disk_stats	dds;
+	struct dmk_track_stats	dts;
+	struct dmk_track	trk_merged;
+	struct flux2dmk_sm	flux2dmk;
+
+	dmk_disk_stats_init(&dds);
+	dmk_track_stats_init(&dts);
+	fdecoder_init(&flux2dmk.fdec, sample_freq);
+
+	flux2dmk.fdec.usr_encoding   = eti->rx02 ? RX02 : MIXED;
+	flux2dmk.fdec.first_encoding = eti->rx02 ? FM : MIXED;
+	flux2dmk.fdec.cur_encoding   = flux2dmk.fdec.first_encoding;
+	flux2dmk.fdec.quirk          = eti->quirks;
+	flux2dmk.fdec.reverse_sides  = cmd_set->reverse_sides;
+
+	dmk_track_sm_init(&flux2dmk.dtsm, &dds, dmkh, &trk_merged, &dts);
+
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+	ssize_t dsv = gwflux_decode_stream(fbuf, bytes_read, &ws,
+					   gme, &flux2dmk);
+
+	free(fbuf);
+
+	if (dsv == -1) {
+		msg_error("Failed to decode read back of track %d, "
+			  "side %d.\n", eti->track, eti->side);
+		return -1;
+	}
+
+	gw_decode_flush(&flux2dmk);
+
+	if (flux2dmk.dtsm.track_hole_p) {
+		dmk_data_rotate(&flux2dmk.dtsm.trk_working,
+				flux2dmk.dtsm.track_hole_p);
+	}
+
+	/* Only the first eti->track_len bytes were written (-l). */
+	struct dmk_track	src = *job->dmkt;
+
+	src.track_len = eti->track_len;
+
+	int	nsectors;
+	int	bad = dmk_track_compare(&src, &flux2dmk.dtsm.trk_working,
+					eti->fmtimes, eti->rx02, eti->quirks,
+					&nsectors);
+
+	rt->codec_cpu_ns += threadtime_ns() - decode_start;
+	rt->good_sectors  = nsectors - bad;
+	rt->errors        = bad;
+
+	if (bad) {
+		msg(MSG_NORMAL, "Track %d, side %d: %d of %d sector%s "
+		    "failed verify\n", eti->track, eti->side,
+		    bad, nsectors, plu(nsectors));
+	}
+
+	return bad;
+}
+
+
+/*
+ * Write out the DMK file.  Returns the number of tracks that failed
+ * to verify, or -1 if writing was stopped by an error.
+ */
+
+static int
 dmk2gw(struct cmd_settings *cmd_set,
        uint32_t sample_freq,
        struct dmk_file *dmkf)
@@ -802,14 +1138,46 @@ dmk2gw(struct cmd_settings *cmd_set,
 
 	struct encode_bit ebs;
 	encode_bit_init(&ebs, sample_freq, mult * rpm_adj);
+	ebs.extra_bytes = eti.extra_bytes;
 
 	/*
-	 * Loop over tracks.
+	 * For --verify, decode read backs as gw2dmk would, into the
+	 * same DMK layout as the file written.
 	 */
 
-	writing_floppy = true;
-	gw_motor(cmd_set->fdd.gwfd, cmd_set->fdd.drive, 1);
-	// XXX Do we need to ensure proper rotational speed here?
+	struct gw_media_encoding	gme = { 0 };
+	struct dmk_header		vfy_header;
+
+	if (cmd_set->verify) {
+		media_encoding_init(&gme, sample_freq,
+				    (double[]){ 4.0 * 300.0/360.0, 4.0,
+				    2.0, 2.0 }[cmd_set->fdd.kind-1]);
+		gme.postcomp = 0.5;
+
+		dmk_header_init(&vfy_header, 0, DMKRD_TRACKLEN_MAX);
+		vfy_header.options = dmkf->header.options &
+					(DMK_SDEN_OPT | DMK_RX02_OPT);
+		vfy_header.quirks  = dmkf->header.quirks;
+	}
+
+	int	verify_failed = 0;
+	int	rewritten = 0;
+
+	/*
+	 * Set up an encoding job per track and side, in write order.
+	 */
+
+	struct enc_job	*jobs = calloc(tracks * sides, sizeof(*jobs));
+
+	if (!jobs)
+		msg_fatal("Failed to get encoding jobs.\n");
+
+	int	njobs = 0;
+
+	/* When testing, fill with constant value instead of actual data. */
+	int	test_fill = (cmd_set->test_mode >= 0 &&
+			     cmd_set->test_mode <= 0xff) ?
+			    cmd_set->test_mode : -1;
 
 	for (int t = 0; t < tracks; ++t) {
 		eti.track   = t;
@@ -819,43 +1187,135 @@ dmk2gw(struct cmd_settings *cmd_set,
 			cmd_set->precomp_low;
 
 		for (int s = 0; s < sides; ++s) {
-			struct dmk_track *trkp =  &dmkf->track[t][s];
+			const uint8_t	*raw = dmk_file_track_raw(dmkf, t, s);
 			eti.side = s;
 
-			/* -h modes 2 and 3 vary density select by side:
-			 * 2 = low/high, 3 = high/low. */
-			if (cmd_set->hd == 2 || cmd_set->hd == 3) {
-				int densel = ((cmd_set->hd == 2) == (s == 1)) ?
-						DS_HD : DS_DD;
+			/* Checked here rather than by dmk2pulses() so
+			 * it cannot fire on an encoder thread. */
+			uint16_t idamp = 0;
 
-				if (gw_set_pin(cmd_set->fdd.gwfd, 2,
-					       densel) != ACK_OKAY)
-					msg_fatal("Failed to set density "
-						  "select.\n");
-			}
+			if (raw)
+				memcpy(&idamp, raw, sizeof(idamp));
+
+			idamp = le16toh(idamp);
+
+			if (s >= eti.max_sides && idamp != 0 &&
+			    idamp != 0xffff)
+				msg_fatal("Drive is 1-sided, but DMK file is "
+					  "2-sided.\n");
+
+			jobs[njobs++] = (struct enc_job){
+						.dmkf	   = dmkf,
+						.test_fill = test_fill,
+						.eti	   = eti,
+						.ebs	   = ebs
+					};
+		}
+	}
+
+	/*
+	 * Byte-level tracing from dmk2pulses() must stay in order, so
+	 * encode in line when it is enabled.
+	 */
+
+	int	nthreads = online_cpus();
+
+	if (msg_scrn_get_level() >= MSG_BYTES ||
+	    msg_file_get_level() >= MSG_BYTES)
+		nthreads = 0;
+
+	struct enc_pool	pool;
 
-			if (cmd_set->test_mode >= 0 &&
-			    cmd_set->test_mode <= 0xff) {
-				/* When testing, fill with constant value
-				 * instead of actual data. */
-				memset(trkp->data, cmd_set->test_mode,
-				       eti.track_len - DMK_TKHDR_SIZE);
+	enc_pool_start(&pool, jobs, njobs, nthreads);
+
+	/*
+	 * Loop over tracks.
+	 */
+
+	writing_floppy = true;
+	gw_motor(cmd_set->fdd.gwfd, cmd_set->fdd.drive, 1);
+	// XXX Do we need to ensure proper rotational speed here?
+
+	for (int j = 0; j < njobs; ++j) {
+		int	s = jobs[j].eti.side;
+
+		/* -h modes 2 and 3 vary density select by side:
+		 * 2 = low/high, 3 = high/low. */
+		if (cmd_set->hd == 2 || cmd_set->hd == 3) {
+			int densel = ((cmd_set->hd == 2) == (s == 1)) ?
+					DS_HD : DS_DD;
+
+			if (gw_set_pin(cmd_set->fdd.gwfd, 2,
+				       densel) != ACK_OKAY)
+				msg_fatal("Failed to set density "
+					  "select.\n");
+		}
+
+		struct rr_track *rt = rr_track_new(&run_report,
+						   jobs[j].eti.track, s);
+
+		if (!rt)
+			msg_fatal("Cannot allocate run report.\n");
+
+		struct gw_io_stats	io_before, io_after;
+		uint64_t		track_start = monotime_ns();
+
+		gw_get_io_stats(&io_before);
+
+		int wtret = write_track(cmd_set, &pool, j, rt);
+
+		/* Rewrite only a track that fails verify. */
+		for (int w = 0; wtret == 0 && cmd_set->verify; ++w) {
+			int	bad = verify_track(cmd_set, sample_freq, &gme,
+						   &vfy_header, &jobs[j], rt);
+
+			if (bad == 0)
+				break;
+
+			if (bad < 0 || w >= cmd_set->rewrites ||
+			    exit_requested) {
+				++verify_failed;
+				break;
 			}
 
-			if (write_track(cmd_set, trkp, &eti, &ebs) != 0)
-				goto leave;
+			++rewritten;
+			wtret = write_track(cmd_set, &pool, j, rt);
+		}
 
-			if (exit_requested)
-				goto leave;
+		enc_pool_release(&pool, j);
+
+		rt->total_ns = monotime_ns() - track_start;
+		gw_get_io_stats(&io_after);
+		rr_track_add_io(rt, &io_before, &io_after);
+
+		if (wtret != 0) {
+			verify_failed = -1;
+			goto leave;
 		}
+
+		if (exit_requested)
+			goto leave;
 	}
 
 leave:
 	gw_motor(cmd_set->fdd.gwfd, cmd_set->fdd.drive, 0);
 	writing_floppy = false;
 
+	enc_pool_finish(&pool);
+	free(jobs);
+
 	msg(MSG_NORMAL, "\n");
+
+	if (cmd_set->verify && verify_failed >= 0) {
+		msg(MSG_NORMAL, "Verify: %d track%s rewritten, "
+		    "%d track%s failed\n",
+		    rewritten, plu(rewritten),
+		    verify_failed, plu(verify_failed));
+	}
+
 	msg_scrn_flush();
+
+	return verify_failed;
 }
 
 
@@ -942,7 +1402,7 @@ main(int argc, char **argv)
 	}
 
 
-	struct dmk_file *dmkf = malloc(sizeof(struct dmk_file));
+	struct dmk_file *dmkf = calloc(1, sizeof(struct dmk_file));
 
 	if (!dmkf)
 		msg_fatal("Malloc of dmkf failed.\n");
@@ -1006,6 +1466,9 @@ main(int argc, char **argv)
 		msg_fatal("Cannot determine drive RPM.  Incorrect drive "
 			  "or media not in drive?\n");
 
+	/* A first estimate of the link until a write measures it. */
+	measure_link(cmd_settings.fdd.gwfd);
+
 	int	kind = cmd_settings.fdd.kind;
 
 	if (kind == 0) {
@@ -1070,12 +1533,23 @@ main(int argc, char **argv)
 	if (cmd_settings.fdd.steps == -1)
 		cmd_settings.fdd.steps = 1;
 
-	dmk2gw(&cmd_settings, gw_info.sample_freq, dmkf);
+	rr_init(&run_report, "dmk2gw");
+
+	int	failed = dmk2gw(&cmd_settings, gw_info.sample_freq, dmkf);
 
 	msg(MSG_NORMAL, "Done!\n");
 
+	dmk_file_free(dmkf);
 	free(dmkf);
 
+	if (cmd_settings.reportfile &&
+	    rr_write(&run_report, cmd_settings.reportfile)) {
+		msg_error("Failed to write report file '%s': %s (%d)\n",
+			  cmd_settings.reportfile, strerror(errno), errno);
+	}
+
+	rr_free(&run_report);
+
 	/*
 	 * Finish up and close out.
 	 */
@@ -1103,5 +1577,5 @@ main(int argc, char **argv)
 
 	free((char *)cmd_settings.logfile);
 
-	return EXIT_SUCCESS;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -43,11 +43,14 @@ struct cmd_settings {
 	int			ignore;
 	bool			dither;
 	bool			gwdebug;
+	bool			verify;
+	int			rewrites;
 	int			test_mode;
 	int			scrn_verbosity;
 	int			file_verbosity;
 	const char		*logfile;
 	const char		*devlogfile;
+	const char		*reportfile;
 	const char		*dmkfile;
 };
 
@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN64) || defined(WIN32)
+#include <io.h>
+#define fsync(fd)		_commit(fd)
+#define ftruncate(fd, len)	_chsize(fd, len)
+#else
+#include <unistd.h>
+#endif
+
+#include "crc.h"
+#include "dmkckpt.h"
+
+
+#define CKPT_MAGIC	"GW2DMKC1"
+#define CKPT_MAGIC_LEN	8
+
+#define CKPT_GEOM_LEN	4
+#define CKPT_TRACK_FIXED (4 + 2 * 7 + 2 * N_ENCS + DMK_MAX_SECTORS + 2)
+#define CKPT_PAYLOAD_MAX (CKPT_TRACK_FIXED + DMKRD_TRACKLEN_MAX)
+
+#define CKPT_GUESS_TRACKS	0x01
+#define CKPT_GUESS_SIDES	0x02
+#define CKPT_GUESS_STEPS	0x04
+
+#define CKPT_FLIPPY		0x01
+
+
+static uint8_t *
+put8(uint8_t *p, unsigned v)
+{
+	*p++ = v;
+
+	return p;
+}
+
+
+static uint8_t *
+put16(uint8_t *p, unsigned v)
+{
+	*p++ = v & 0xff;
+	*p++ = (v >> 8) & 0xff;
+
+	return p;
+}
+
+
+static const uint8_t *
+get16(const uint8_t *p, unsigned *v)
+{
+	*v = p[0] | (p[1] << 8);
+
+	return p + 2;
+}
+
+
+static uint16_t
+ckpt_crc(const uint8_t *buf, size_t len)
+{
+	uint16_t	crc = 0xffff;
+
+	for (size_t i = 0; i < len; ++i)
+		crc = calc_crc1(crc, buf[i]);
+
+	return crc;
+}
+
+
+FILE *
+ckpt_open(const char *path, long keep)
+{
+	FILE	*fp = fopen(path, keep ? "r+b" : "wb");
+
+	if (!fp)
+		return NULL;
+
+	bool	ok;
+
+	if (keep) {
+		/* Drop whatever a crash left of a record being written. */
+		ok = fflush(fp) != EOF &&
+		     ftruncate(fileno(fp), keep) == 0 &&
+		     fseek(fp, keep, SEEK_SET) == 0;
+	} else {
+		ok = fwrite(CKPT_MAGIC, CKPT_MAGIC_LEN, 1, fp) == 1 &&
+		     fflush(fp) != EOF;
+	}
+
+	if (!ok) {
+		int	err = errno;
+
+		fclose(fp);
+		errno = err;
+
+		return NULL;
+	}
+
+	return fp;
+}
+
+
+/*
+ * Frame the "len" bytes of payload already at "rec + 3" as a record
+ * of "type", and append it.
+ */
+
+static int
+ckpt_put(FILE *fp, int type, uint8_t *rec, size_t len)
+{
+	put8(rec, type);
+	put16(rec + 1, len);
+	put16(rec + 3 + len, ckpt_crc(rec, 3 + len));
+
+	if (fwrite(rec, 3 + len + 2, 1, fp) != 1 || fflush(fp) == EOF)
+		return -1;
+
+	return fsync(fileno(fp));
+}
+
+
+static int
+ckpt_put_geometry(FILE *fp, int type, const struct ckpt_geom *geom)
+{
+	uint8_t	rec[3 + CKPT_GEOM_LEN + 2];
+	uint8_t	*p = rec + 3;
+
+	p = put8(p, geom->tracks);
+	p = put8(p, geom->sides);
+	p = put8(p, geom->steps);
+	p = put8(p, (geom->guess_tracks ? CKPT_GUESS_TRACKS : 0) |
+		    (geom->guess_sides  ? CKPT_GUESS_SIDES  : 0) |
+		    (geom->guess_steps  ? CKPT_GUESS_STEPS  : 0));
+
+	return ckpt_put(fp, type, rec, p - (rec + 3));
+}
+
+
+int
+ckpt_put_start(FILE *fp, const struct ckpt_geom *geom)
+{
+	return ckpt_put_geometry(fp, 'S', geom);
+}
+
+
+int
+ckpt_put_geom(FILE *fp, const struct ckpt_geom *geom)
+{
+	return ckpt_put_geometry(fp, 'G', geom);
+}
+
+
+int
+ckpt_put_track(FILE *fp, int track, int side,
+	       const struct ckpt_track *ct,
+	       const struct dmk_track *trk)
+{
+	if (trk->track_len < DMK_TKHDR_SIZE ||
+	    trk->track_len > DMKRD_TRACKLEN_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint8_t	*rec = malloc(3 + CKPT_PAYLOAD_MAX + 2);
+
+	if (!rec)
+		return -1;
+
+	uint8_t	*p = rec + 3;
+
+	p = put8(p, track);
+	p = put8(p, side);
+	p = put8(p, ct->flippy ? CKPT_FLIPPY : 0);
+	p = put8(p, ct->first_encoding);
+	p = put16(p, ct->retries);
+	p = put16(p, ct->retries_saved);
+	p = put16(p, (uint16_t)ct->cyl_seen);
+	p = put16(p, ct->dts.good_sectors);
+	p = put16(p, ct->dts.errcount);
+	p = put16(p, ct->dts.bad_sectors);
+	p = put16(p, ct->dts.reused_sectors);
+
+	for (int i = 0; i < N_ENCS; ++i)
+		p = put16(p, ct->dts.enc_count[i]);
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i)
+		p = put8(p, ct->dts.enc_sec[i]);
+
+	/* The IDAM table is the start of the track. */
+	p = put16(p, trk->track_len);
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i)
+		p = put16(p, trk->idam_offset[i]);
+
+	memcpy(p, trk->data, trk->track_len - DMK_TKHDR_SIZE);
+	p += trk->track_len - DMK_TKHDR_SIZE;
+
+	int	ret = ckpt_put(fp, 'T', rec, p - (rec + 3));
+	int	err = errno;
+
+	free(rec);
+	errno = err;
+
+	return ret;
+}
+
+
+static bool
+ckpt_get_geom(const uint8_t *p, size_t len, struct ckpt_geom *geom)
+{
+	if (len != CKPT_GEOM_LEN || p[0] > DMK_MAX_TRACKS ||
+	    p[1] < 1 || p[1] > DMK_SIDES || p[2] < 1 || p[2] > 2)
+		return false;
+
+	*geom = (struct ckpt_geom){
+			.tracks       = p[0],
+			.sides        = p[1],
+			.steps        = p[2],
+			.guess_tracks = p[3] & CKPT_GUESS_TRACKS,
+			.guess_sides  = p[3] & CKPT_GUESS_SIDES,
+			.guess_steps  = p[3] & CKPT_GUESS_STEPS
+		};
+
+	return true;
+}
+
+
+static bool
+ckpt_get_track(const uint8_t *p, size_t len,
+	       struct ckpt_track cts[DMK_MAX_TRACKS][DMK_SIDES],
+	       struct dmk_file *dmkf)
+{
+	if (len < CKPT_TRACK_FIXED)
+		return false;
+
+	int		track = p[0];
+	int		side = p[1];
+	struct ckpt_track	ct = {
+		.have           = true,
+		.flippy         = p[2] & CKPT_FLIPPY,
+		.first_encoding = p[3]
+	};
+	unsigned	v;
+
+	if (track >= DMK_MAX_TRACKS || side >= DMK_SIDES ||
+	    ct.first_encoding >= N_ENCS)
+		return false;
+
+	p = get16(p + 4, &v);
+	ct.retries = v;
+	p = get16(p, &v);
+	ct.retries_saved = v;
+	p = get16(p, &v);
+	ct.cyl_seen = (int16_t)v;
+	p = get16(p, &v);
+	ct.dts.good_sectors = v;
+	p = get16(p, &v);
+	ct.dts.errcount = v;
+	p = get16(p, &v);
+	ct.dts.bad_sectors = v;
+	p = get16(p, &v);
+	ct.dts.reused_sectors = v;
+
+	for (int i = 0; i < N_ENCS; ++i) {
+		p = get16(p, &v);
+		ct.dts.enc_count[i] = v;
+	}
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i)
+		ct.dts.enc_sec[i] = *p++;
+
+	unsigned	track_len;
+
+	p = get16(p, &track_len);
+
+	if (track_len < DMK_TKHDR_SIZE || track_len > DMKRD_TRACKLEN_MAX ||
+	    len != CKPT_TRACK_FIXED + track_len)
+		return false;
+
+	uint8_t	*raw = dmk_file_track_alloc(dmkf, track, side, track_len);
+
+	if (!raw)
+		return false;
+
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i) {
+		uint16_t	idam_off;
+
+		p = get16(p, &v);
+		idam_off = v;
+		memcpy(raw + 2 * i, &idam_off, sizeof(idam_off));
+	}
+
+	memcpy(raw + DMK_TKHDR_SIZE, p, track_len - DMK_TKHDR_SIZE);
+
+	cts[track][side] = ct;
+
+	return true;
+}
+
+
+int
+ckpt_load(const char *path, struct ckpt_geom *geom,
+	  struct ckpt_track cts[DMK_MAX_TRACKS][DMK_SIDES],
+	  struct dmk_file *dmkf,
+	  long *end)
+{
+	FILE	*fp = fopen(path, "rb");
+
+	if (!fp)
+		return -1;
+
+	uint8_t	*rec = malloc(3 + CKPT_PAYLOAD_MAX + 2);
+	char	magic[CKPT_MAGIC_LEN];
+	bool	have_geom = false;
+
+	*end = CKPT_MAGIC_LEN;
+
+	if (!rec ||
+	    fread(magic, sizeof(magic), 1, fp) != 1 ||
+	    memcmp(magic, CKPT_MAGIC, CKPT_MAGIC_LEN) != 0) {
+		free(rec);
+		fclose(fp);
+		return -1;
+	}
+
+	/* Stop at the first record that isn't whole. */
+	while (fread(rec, 3, 1, fp) == 1) {
+		unsigned	len, crc;
+
+		get16(rec + 1, &len);
+
+		if (len > CKPT_PAYLOAD_MAX ||
+		    fread(rec + 3, len + 2, 1, fp) != 1)
+			break;
+
+		get16(rec + 3 + len, &crc);
+
+		if (crc != ckpt_crc(rec, 3 + len))
+			break;
+
+		const uint8_t	*payload = rec + 3;
+		bool		ok = false;
+
+		switch (rec[0]) {
+		case 'S':
+			for (int t = 0; t < DMK_MAX_TRACKS; ++t) {
+				for (int s = 0; s < DMK_SIDES; ++s)
+					cts[t][s].have = false;
+			}
+			/* Fall through */
+		case 'G':
+			ok = ckpt_get_geom(payload, len, geom);
+			have_geom |= ok;
+			break;
+
+		case 'T':
+			ok = ckpt_get_track(payload, len, cts, dmkf);
+			break;
+		}
+
+		if (!ok)
+			break;
+
+		*end = ftell(fp);
+	}
+
+	free(rec);
+	fclose(fp);
+
+	if (!have_geom)
+		return -1;
+
+	int	found = 0;
+
+	for (int t = 0; t < DMK_MAX_TRACKS; ++t) {
+		for (int s = 0; s < DMK_SIDES; ++s)
+			found += cts[t][s].have;
+	}
+
+	return found;
+}
@@ -0,0 +1,90 @@
+#ifndef DMKCKPT_H
+#define DMKCKPT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "dmk.h"
+
+/*
+ * Checkpoint journal of a DMK being read.
+ *
+ * Each track is appended to the journal as soon as it has been read,
+ * so a read that is interrupted or crashes can be resumed without
+ * reading again the tracks it already has.  The journal only grows
+ * while reading; a record cut short by a crash is ignored when the
+ * journal is loaded, and a later record for a track replaces an
+ * earlier one.
+ *
+ * The file starts with an 8-byte magic, followed by records:
+ *
+ *   type (1)  length (2)  payload (length)  CRC-16 (2)
+ *
+ * with little-endian integers and the CRC over the type, length, and
+ * payload.  A 'S' (start) record gives the geometry and discards
+ * every track before it, a 'G' record updates the geometry only,
+ * and a 'T' record holds one track and what reading it found.
+ */
+
+/* How the disk is being read, including which guesses are open. */
+struct ckpt_geom {
+	int	tracks;
+	int	sides;
+	int	steps;
+	bool	guess_tracks;
+	bool	guess_sides;
+	bool	guess_steps;
+};
+
+/* What reading a track found, apart from its data. */
+struct ckpt_track {
+	bool			have;
+	int			retries;
+	int			retries_saved;
+	int			cyl_seen;
+	int			first_encoding;
+	bool			flippy;
+	struct dmk_track_stats	dts;
+};
+
+
+/*
+ * Open the journal at "path" for writing.  If "keep" is nonzero, the
+ * journal's first "keep" bytes (as found whole by ckpt_load()) are
+ * kept and appended to; otherwise it is started over.  Returns NULL
+ * with a reason in "errno" on failure.
+ */
+extern FILE *ckpt_open(const char *path, long keep);
+
+/*
+ * Append a record.  Each reaches the disk before returning.  Return
+ * 0 on success, or -1 with a reason in "errno".
+ */
+extern int ckpt_put_start(FILE *fp, const struct ckpt_geom *geom);
+extern int ckpt_put_geom(FILE *fp, const struct ckpt_geom *geom);
+extern int ckpt_put_track(FILE *fp, int track, int side,
+			  const struct ckpt_track *ct,
+			  const struct dmk_track *trk);
+
+/*
+ * Load the journal at "path" into "geom", "cts", and the tracks of
+ * "dmkf", setting "have" in the "cts" entry of each track found.
+ * Entries of tracks not found are left alone.  "end" is set to the
+ * length of the journal up to its last whole record.  Returns the
+ * number of tracks found, or -1 if "path" can't be read or isn't a
+ * journal or has no geometry.
+ */
+extern int ckpt_load(const char *path, struct ckpt_geom *geom,
+		     struct ckpt_track cts[DMK_MAX_TRACKS][DMK_SIDES],
+		     struct dmk_file *dmkf, long *end);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
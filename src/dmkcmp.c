@@ -0,0 +1,162 @@
+#include "secsize.h"
+#include "dmkcmp.h"
+
+
+/*
+ * Where the parts of a sector lie in a DMK track.  FM bytes may be
+ * doubled, so each part also has the distance between its bytes.
+ */
+
+struct dmk_sector {
+	const uint8_t	*id;		/* ID address mark */
+	const uint8_t	*dam;		/* Data address mark or NULL */
+	const uint8_t	*data;		/* Data, followed by its CRC */
+	int		stride;		/* Of ID and DAM bytes */
+	int		dstride;	/* Of data and CRC bytes */
+	int		size;		/* Data bytes, excluding CRC */
+};
+
+
+/*
+ * Locate sector N in rotational order.  Returns false past the last
+ * sector.  A sector with an unusable ID is returned with "id" NULL.
+ */
+
+static bool
+dmk_sector_get(const struct dmk_track *trk,
+	       int n,
+	       int fmtimes,
+	       bool rx02,
+	       unsigned int quirk,
+	       struct dmk_sector *sec)
+{
+	if (n >= DMK_MAX_SECTORS)
+		return false;
+
+	uint16_t	idamp = le16toh(trk->idam_offset[n]);
+
+	if (idamp == 0 || idamp == 0xffff)
+		return false;
+
+	int	encoding = (idamp & DMK_DDEN_FLAG) ? MFM : FM;
+	int	off      = idamp & DMK_IDAMP_BITS;
+	int	end      = trk->track_len;
+
+	*sec = (struct dmk_sector){
+			.stride  = (encoding == FM) ? fmtimes : 1,
+			.dstride = (encoding == FM) ? fmtimes : 1
+		};
+
+	if (off < DMK_TKHDR_SIZE || off + 7 * sec->stride > end ||
+	    trk->track[off] != 0xfe)
+		return true;
+
+	sec->id = &trk->track[off];
+
+	/* Look for the DAM where the encoder does (ref 1791 datasheet). */
+	int	dam_min = off + 7 * sec->stride;
+	int	dam_max = dam_min + ((encoding == FM) ? 30 * fmtimes : 43);
+
+	for (int p = dam_min; p <= dam_max && p < end; ++p) {
+		uint8_t	mark = trk->track[p];
+
+		if ((mark < 0xf8 || mark > 0xfb) && mark != 0xfd)
+			continue;
+
+		/* RX02 data is MFM and so never doubled. */
+		if (rx02 && (mark == 0xf9 || mark == 0xfd)) {
+			encoding     = RX02;
+			sec->dstride = 1;
+		}
+
+		sec->size = secsize(sec->id[4 * sec->stride], encoding,
+				    3, quirk);
+
+		if (p + sec->stride + (sec->size + 2) * sec->dstride <= end) {
+			sec->dam  = &trk->track[p];
+			sec->data = sec->dam + sec->stride;
+		}
+		break;
+	}
+
+	return true;
+}
+
+
+static bool
+bytes_equal(const uint8_t *a, int astride,
+	    const uint8_t *b, int bstride, int cnt)
+{
+	for (int i = 0; i < cnt; ++i) {
+		if (a[i * astride] != b[i * bstride])
+			return false;
+	}
+
+	return true;
+}
+
+
+static bool
+dmk_sector_equal(const struct dmk_sector *a, const struct dmk_sector *b)
+{
+	/* Address mark, cylinder, head, sector, size code, and CRC. */
+	if (!bytes_equal(a->id, a->stride, b->id, b->stride, 7))
+		return false;
+
+	if (!a->dam || !b->dam)
+		return !a->dam && !b->dam;
+
+	return *a->dam == *b->dam && a->size == b->size &&
+	       bytes_equal(a->data, a->dstride, b->data, b->dstride,
+			   a->size + 2);
+}
+
+
+/*
+ * Compare the sectors of "src" against "rd", a read back of "src"
+ * after it was written.  Sectors are matched by ID field rather than
+ * position, so the read back may be rotated or have different gaps.
+ *
+ * Returns the number of sectors in "src" without a byte-identical
+ * copy (ID, data address mark, data, and CRCs) in "rd".  A sector
+ * written with a bad CRC on purpose verifies if it reads back with
+ * the same bad CRC.  The number of sectors compared is returned in
+ * "nsectors" if not NULL.
+ */
+
+int
+dmk_track_compare(const struct dmk_track *src,
+		  const struct dmk_track *rd,
+		  int fmtimes,
+		  bool rx02,
+		  unsigned int quirk,
+		  int *nsectors)
+{
+	struct dmk_sector	ss, rs;
+	int			cnt = 0;
+	int			bad = 0;
+
+	for (int n = 0; dmk_sector_get(src, n, fmtimes, rx02, quirk, &ss);
+	     ++n) {
+		if (!ss.id)
+			continue;
+
+		++cnt;
+
+		bool	found = false;
+
+		for (int m = 0;
+		     !found &&
+		     dmk_sector_get(rd, m, fmtimes, rx02, quirk, &rs); ++m) {
+			found = rs.id && dmk_sector_equal(&ss, &rs);
+		}
+
+		if (!found)
+			++bad;
+	}
+
+	if (nsectors)
+		*nsectors = cnt;
+
+	return bad;
+}
@@ -0,0 +1,27 @@
+#ifndef DMK_CMP_H
+#define DMK_CMP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dmk.h"
+
+
+extern int
+dmk_track_compare(const struct dmk_track *src,
+		  const struct dmk_track *rd,
+		  int fmtimes,
+		  bool rx02,
+		  unsigned int quirk,
+		  int *nsectors);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -82,50 +82,132 @@ dmk_get_sector_num(uint8_t *secdata)
 }
 
 
+/*
+ * Key a sector by the cylinder, head, sector, and size code of its ID
+ * field.  Like dmk_get_sector_num(), a repeated ID mark means the
+ * bytes are doubled single density.
+ */
+
+static uint32_t
+dmk_get_sector_key(const uint8_t *secdata)
+{
+	int	stride = (secdata[1] == 0xfe) ? 2 : 1;
+
+	return (uint32_t)secdata[1 * stride] << 24 |
+	       (uint32_t)secdata[2 * stride] << 16 |
+	       (uint32_t)secdata[3 * stride] << 8 |
+	       (uint32_t)secdata[4 * stride];
+}
+
+
 static int
-copy_preamble(uint8_t **dst, uint8_t *track)
+dsi_slot(uint32_t key)
+{
+	return (key * 2654435761u) >> (32 - DSI_SLOTS_BITS);
+}
+
+
+static const struct dmk_sector_ent *
+dsi_lookup(const struct dmk_sector_index *dsi, uint32_t key)
 {
-	uint8_t *pre_end = dmk_get_phys_sector(track, 0);
+	for (int h = dsi_slot(key); dsi->slot[h];
+	     h = (h + 1) & (DSI_SLOTS - 1)) {
+		const struct dmk_sector_ent *ent = &dsi->ent[dsi->slot[h] - 1];
 
-	if (!pre_end || pre_end <= track + DMK_TKHDR_SIZE)
-		return 0;
+		if (ent->key == key)
+			return ent;
+	}
 
-	int pre_len = pre_end - (track + DMK_TKHDR_SIZE);
+	return NULL;
+}
 
-	memcpy(*dst, track + DMK_TKHDR_SIZE, pre_len);
-	*dst += pre_len;
 
-	return 1;
+void
+dmk_sector_index_init(struct dmk_sector_index *dsi)
+{
+	dsi->cnt      = 0;
+	dsi->buf_used = 0;
+	memset(dsi->slot, 0, sizeof(dsi->slot));
 }
 
 
 /*
- * Go over the track we have read and replace any bad sectors with sectors
- * from any previous read attempts.
- *
- * Takes a very simple-minded approach and cannot cope with a situation
- * where sectors appear to be missing because of damage to the IDAM or DAM
- * headers.
+ * Add the good sectors of a track read to the index.  The first good
+ * copy of a sector is kept; later ones are ignored.  Each copy runs
+ * from its IDAM to the next, as the sector would be laid into a
+ * merged track.
  */
 
 void
-merge_sectors(struct dmk_track *trk_merged,
-	      struct dmk_track_stats *trk_merged_stats,
-	      struct dmk_track *trk_working,
-	      struct dmk_track_stats *trk_working_stats)
+dmk_sector_index_add(struct dmk_sector_index *dsi,
+		     const struct dmk_track *trk,
+		     const struct dmk_track_stats *trk_stats)
 {
-	uint8_t *dmk_merged_track = trk_merged->track;
-	uint8_t *dmk_track        = trk_working->track;
+	uint8_t	*track = (uint8_t *)trk->track;
+	int	tracklen = trk->track_len - DMK_TKHDR_SIZE;
+	uint8_t	*sec;
+
+	for (int n = 0; (sec = dmk_get_phys_sector(track, n)); ++n) {
+		if (trk->idam_offset[n] & DMK_EXTRA_FLAG)
+			continue;
+
+		if (dsi->cnt >= DMK_MAX_SECTORS)
+			break;
+
+		uint32_t	key = dmk_get_sector_key(sec);
+		int		h   = dsi_slot(key);
+
+		for (; dsi->slot[h]; h = (h + 1) & (DSI_SLOTS - 1)) {
+			if (dsi->ent[dsi->slot[h] - 1].key == key)
+				break;
+		}
 
-	int tracklen = trk_working->track_len - DMK_TKHDR_SIZE;
+		if (dsi->slot[h])
+			continue;
 
-	uint16_t *idam_p = trk_working->idam_offset;
-	uint16_t *merged_idam_p = trk_merged->idam_offset;
-	int overflow = 0;
-	int best_errcount;
-	int best_repair;
+		int	seclen = dmk_get_phys_sector_len(track, n, tracklen);
+
+		if (seclen <= 0 ||
+		    dsi->buf_used + seclen > (int)sizeof(dsi->buf))
+			continue;
+
+		struct dmk_sector_ent	*ent = &dsi->ent[dsi->cnt];
+
+		*ent = (struct dmk_sector_ent){
+				.key      = key,
+				.flags    = trk->idam_offset[n] &
+						~DMK_IDAMP_BITS,
+				.len      = seclen,
+				.encoding = trk_stats->enc_sec[n],
+				.off      = dsi->buf_used
+			};
+
+		memcpy(&dsi->buf[dsi->buf_used], sec, seclen);
+		dsi->buf_used += seclen;
+		dsi->slot[h] = ++dsi->cnt;
+	}
+}
+
+
+/*
+ * Go over the track we have read and replace any bad sectors with good
+ * copies from any earlier read of the track, found in the index by
+ * their ID fields.  The current read's good sectors are added to the
+ * index first.
+ *
+ * The result replaces the previous merged track unless the latter has
+ * fewer errors, or as many with fewer repairs.  A sector whose IDAM
+ * was not read at all cannot be recovered this way.
+ */
 
-	enum Pick { Merged, Current, Tmp } best;
+void
+merge_sectors_indexed(struct dmk_sector_index *dsi,
+		      struct dmk_track *trk_merged,
+		      struct dmk_track_stats *trk_merged_stats,
+		      struct dmk_track *trk_working,
+		      struct dmk_track_stats *trk_working_stats)
+{
+	dmk_sector_index_add(dsi, trk_working, trk_working_stats);
 
 	/* As a special case, use the track as-is if it read without error. */
 	if (trk_working_stats->errcount == 0) {
@@ -135,164 +217,141 @@ merge_sectors(struct dmk_track *trk_merged,
 		return;
 	}
 
-	struct dmk_track tmp_track;
-	uint8_t *dmk_tmp_track = tmp_track.track;
-
-	memset(dmk_tmp_track, 0, DMK_TKHDR_SIZE);
-	uint8_t *tmp_data_p  = dmk_tmp_track + DMK_TKHDR_SIZE;
-	uint16_t *tmp_idam_p = tmp_track.idam_offset;
-
-	struct dmk_track_stats tmp_stat;
-	tmp_stat = *trk_working_stats;
-	tmp_stat.reused_sectors = 0;
-
-	uint8_t *dmk_sec;
-
-	for (int cur = 0;
-	     (dmk_sec = dmk_get_phys_sector(dmk_track, cur)); cur++) {
-		int replaced = 0;
-		/* Bad sector?  See if we can find a replacement. */
-		if (idam_p[cur] & DMK_EXTRA_FLAG) {
-			int secnum = dmk_get_sector_num(dmk_sec);
-			uint8_t *prev_sec;
-
-			for (int prev = 0;
-			     (prev_sec =
-			      dmk_get_phys_sector(dmk_merged_track, prev));
-			     prev++) {
-				int seclen = dmk_get_phys_sector_len(
-						dmk_merged_track, prev,
-						trk_merged->track_len);
-
-				if (dmk_get_sector_num(prev_sec) != secnum)
-					continue;
-
-				/* Ignore previous sector if it had an error. */
-				if (merged_idam_p[prev] & DMK_EXTRA_FLAG)
-					continue;
-
-				/* The very first sector needs the pre-amble
-				 * copied over, too.  We only understand this
-				 * if the first sector is replacing the first
-				 * sector.  If not, then we skip because best
-				 * not create bogus data. */
-				if (cur == 0) {
-					if (prev != 0)
-						continue;
-
-					if (!copy_preamble
-					    (&tmp_data_p, dmk_merged_track))
-						continue;
-				}
-
-				// Don't overflow the merged track.
-				if (seclen <= 0
-				    || tmp_data_p + seclen >
-				    dmk_tmp_track + DMKRD_TRACKLEN_MAX)
-					continue;
-
-				msg(MSG_ERRORS, "[reuse %02x] ", secnum);
-
-				*tmp_idam_p++ =
-				    (merged_idam_p[prev] & ~DMK_IDAMP_BITS) |
-				    ((tmp_data_p -
-				      dmk_tmp_track) & DMK_IDAMP_BITS);
-
-				memcpy(tmp_data_p, prev_sec, seclen);
-				tmp_data_p += seclen;
-				replaced = 1;
-				tmp_stat.reused_sectors++;
-				tmp_stat.enc_sec[cur] =
-				    trk_merged_stats->enc_sec[prev];
-				tmp_stat.enc_count[
-				    trk_merged_stats->enc_sec[prev]]++;
-				/* There should be an error for every bad
-				 * sector, but just to be careful. */
-				if (tmp_stat.errcount > 0)
-					tmp_stat.errcount--;
-				break;
-			}
-		}
+	uint8_t	*dmk_track = trk_working->track;
+	int	tracklen   = trk_working->track_len - DMK_TKHDR_SIZE;
+	uint8_t	*pre_end   = dmk_get_phys_sector(dmk_track, 0);
+	int	pre_len    = pre_end ?
+				pre_end - (dmk_track + DMK_TKHDR_SIZE) :
+				tracklen;
+
+	/*
+	 * Plan the replacements and the merged length first, so nothing
+	 * is built unless the result is kept.
+	 */
 
-		if (!replaced) {
-			/* Copy the sector we have whether it be a good or
-			 * bad read. */
-			int seclen =
-			    dmk_get_phys_sector_len(dmk_track, cur, tracklen);
-
-			/* Need to copy preamble if we are the first sector. */
-			if (cur == 0 && !copy_preamble(&tmp_data_p, dmk_track))
-				overflow = 1;
-			else if (seclen < 0
-				 || tmp_data_p + seclen >
-					dmk_tmp_track + DMKRD_TRACKLEN_MAX)
-				overflow = 1;
-			else {
-				*tmp_idam_p++ =
-				    (idam_p[cur] & ~DMK_IDAMP_BITS) |
-				    ((tmp_data_p -
-				      dmk_tmp_track) & DMK_IDAMP_BITS);
-				memcpy(tmp_data_p, dmk_sec, seclen);
-				tmp_data_p += seclen;
-			}
+	const struct dmk_sector_ent	*repl[DMK_MAX_SECTORS];
+	int	nsec   = 0;
+	int	len    = pre_len;
+	int	reused = 0;
+	bool	overflow = false;
+	uint8_t	*dmk_sec;
+
+	for (; (dmk_sec = dmk_get_phys_sector(dmk_track, nsec)); ++nsec) {
+		repl[nsec] = NULL;
+
+		if (trk_working->idam_offset[nsec] & DMK_EXTRA_FLAG)
+			repl[nsec] = dsi_lookup(dsi,
+						dmk_get_sector_key(dmk_sec));
+
+		if (repl[nsec]) {
+			msg(MSG_ERRORS, "[reuse %02x] ",
+			    dmk_get_sector_num(dmk_sec));
+			len += repl[nsec]->len;
+			++reused;
+		} else {
+			int	seclen = dmk_get_phys_sector_len(dmk_track,
+								 nsec,
+								 tracklen);
+
+			if (seclen < 0)
+				overflow = true;
+			len += seclen;
 		}
 	}
 
-	tmp_track.track_len = tmp_data_p - dmk_tmp_track;
-
-	/* dmk_tmp_track has tmp_stat.errcount errors
-	 * (or is unusable if overflow is set).
-	 * dmk_merged_track has trk_merged_stats->errcount errors.
-	 * dmk_track has errcount errors. */
+	if (DMK_TKHDR_SIZE + len > DMKRD_TRACKLEN_MAX)
+		overflow = true;
 
-	/* We want to keep the best as determined by the lowest error
-	 * count and that will become our merged track. */
+	/* There should be an error for every bad sector, but just to be
+	 * careful. */
+	int	best_errcount = trk_working_stats->errcount;
+	int	best_repair   = 0;
 
-	best = Current;
-	best_errcount = trk_working_stats->errcount;
-	best_repair = 0;
-
-	/* overflow means that the candidate merged track tmp is not viable. */
-	if (!overflow && tmp_stat.errcount < best_errcount) {
-		best = Tmp;
-		best_errcount = tmp_stat.errcount;
-		best_repair = tmp_stat.reused_sectors;
+	if (!overflow && reused > 0) {
+		best_errcount -= reused < best_errcount ? reused :
+							  best_errcount;
+		best_repair    = reused;
 	}
 
 	/* If we have a previous merged track, it may still be the best.
 	 * Especially if it has fewer repairs. */
-	if (trk_merged->track_len > 0) {
-		if (trk_merged_stats->errcount < best_errcount ||
-		    (trk_merged_stats->errcount == best_errcount &&
-		     trk_merged_stats->reused_sectors < best_repair)) {
-			best = Merged;
-			best_errcount = trk_merged_stats->errcount;
-			best_repair = trk_merged_stats->reused_sectors;
-		}
+	if (trk_merged->track_len > 0 &&
+	    (trk_merged_stats->errcount < best_errcount ||
+	     (trk_merged_stats->errcount == best_errcount &&
+	      trk_merged_stats->reused_sectors < best_repair))) {
+		msg(MSG_ERRORS, "[using previous] ");
+		return;
 	}
 
-	//msg(MSG_ERRORS, "(%d,%d,%d) ", errcount, tmp_stat.errcount,
-	//    trk_merged_stats->errcount);
+	*trk_merged_stats = *trk_working_stats;
+	trk_merged_stats->errcount = best_errcount;
+	trk_merged_stats->reused_sectors = 0;
 
-	switch (best) {
-	default:
-	case Current:
+	if (best_repair == 0) {
 		msg(MSG_ERRORS, "[using current] ");
 		*trk_merged = *trk_working;
-		*trk_merged_stats = *trk_working_stats;
-		trk_merged_stats->reused_sectors = 0;
-		break;
+		return;
+	}
 
-	case Tmp:
-		msg(MSG_ERRORS, "[using merged] ");
-		*trk_merged = tmp_track;
-		*trk_merged_stats = tmp_stat;
-		break;
+	msg(MSG_ERRORS, "[using merged] ");
+
+	uint8_t		*data_p = trk_merged->track + DMK_TKHDR_SIZE;
+	uint16_t	*idam_p = trk_merged->idam_offset;
+
+	memset(trk_merged->idam_offset, 0, DMK_TKHDR_SIZE);
+	memcpy(data_p, dmk_track + DMK_TKHDR_SIZE, pre_len);
+	data_p += pre_len;
+
+	for (int cur = 0; cur < nsec; ++cur) {
+		const struct dmk_sector_ent	*ent = repl[cur];
+		uint16_t			flags;
+		const uint8_t			*src;
+		int				seclen;
+
+		if (ent) {
+			flags  = ent->flags;
+			src    = &dsi->buf[ent->off];
+			seclen = ent->len;
+
+			trk_merged_stats->reused_sectors++;
+			trk_merged_stats->enc_sec[cur] = ent->encoding;
+			trk_merged_stats->enc_count[ent->encoding]++;
+		} else {
+			flags  = trk_working->idam_offset[cur] &
+					~DMK_IDAMP_BITS;
+			src    = dmk_get_phys_sector(dmk_track, cur);
+			seclen = dmk_get_phys_sector_len(dmk_track, cur,
+							 tracklen);
+		}
 
-	case Merged:
-		msg(MSG_ERRORS, "[using previous] ");
-		break;
+		*idam_p++ = flags | ((data_p - trk_merged->track) &
+				     DMK_IDAMP_BITS);
+		memcpy(data_p, src, seclen);
+		data_p += seclen;
 	}
 
-	trk_merged_stats->errcount = best_errcount;
+	trk_merged->track_len = data_p - trk_merged->track;
+}
+
+
+/*
+ * Merge with only the previous merged track as the source of
+ * replacements, for callers that keep no index across reads.
+ */
+
+void
+merge_sectors(struct dmk_track *trk_merged,
+	      struct dmk_track_stats *trk_merged_stats,
+	      struct dmk_track *trk_working,
+	      struct dmk_track_stats *trk_working_stats)
+{
+	struct dmk_sector_index	dsi;
+
+	dmk_sector_index_init(&dsi);
+
+	if (trk_merged->track_len > 0)
+		dmk_sector_index_add(&dsi, trk_merged, trk_merged_stats);
+
+	merge_sectors_indexed(&dsi, trk_merged, trk_merged_stats,
+			      trk_working, trk_working_stats);
 }
@@ -13,6 +13,46 @@ extern "C" {
 #include "dmk.h"
 
 
+/*
+ * Good sectors seen in any read of a track, keyed by ID field, so a
+ * bad sector in a later read can be replaced by lookup.
+ */
+
+#define DSI_SLOTS_BITS	7
+#define DSI_SLOTS	(1 << DSI_SLOTS_BITS)	/* 2 * DMK_MAX_SECTORS */
+
+struct dmk_sector_ent {
+	uint32_t	key;		/* Cyl, head, sector, size code */
+	uint16_t	flags;		/* IDAM pointer flag bits */
+	uint16_t	len;		/* Bytes from IDAM to next IDAM */
+	int		encoding;
+	int		off;		/* Of the copy in buf */
+};
+
+struct dmk_sector_index {
+	int			cnt;
+	int			buf_used;
+	uint8_t			slot[DSI_SLOTS]; /* Entry + 1, or 0 */
+	struct dmk_sector_ent	ent[DMK_MAX_SECTORS];
+	uint8_t			buf[2 * DMKRD_TRACKLEN_MAX];
+};
+
+
+extern void
+dmk_sector_index_init(struct dmk_sector_index *dsi);
+
+extern void
+dmk_sector_index_add(struct dmk_sector_index *dsi,
+		     const struct dmk_track *trk,
+		     const struct dmk_track_stats *trk_stats);
+
+extern void
+merge_sectors_indexed(struct dmk_sector_index *dsi,
+		      struct dmk_track *trk_merged,
+		      struct dmk_track_stats *trk_merged_stats,
+		      struct dmk_track *trk_working,
+		      struct dmk_track_stats *trk_working_stats);
+
 extern void
 merge_sectors(struct dmk_track *trk_merged,
               struct dmk_track_stats *trk_merged_stats,
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "dmkx.h"
 
 
@@ -297,14 +299,16 @@ emit_final_pulse(struct encode_bit *ebs, struct dmk_encode_s *des)
 
 
 /*
- * Convert a DMK track to pulses with frequency timing in ebs.
+ * Convert a DMK track to pulses with frequency timing in ebs, noting
+ * each byte's encoding in dmk_encoding, eti->track_len long.
  */
 
-int
-dmk2pulses(struct dmk_track *dmkt,
-	   struct extra_track_info *eti,
-	   struct encode_bit *ebs,
-	   struct dmk_encode_s *des)
+static int
+dmk2pulses_enc(struct dmk_track *dmkt,
+	       struct extra_track_info *eti,
+	       struct encode_bit *ebs,
+	       struct dmk_encode_s *des,
+	       uint8_t *dmk_encoding)
 {
 	/*
 	 * Determine encoding for each byte and clean up.
@@ -318,7 +322,6 @@ dmk2pulses(struct dmk_track *dmkt,
 	bool	skip = false;
 	int	rx02_data = 0;
 	int	sector_data = 0;
-	uint8_t	dmk_encoding[DMKRD_TRACKLEN_MAX] = { 0 };
 
 	struct rx02_bitpair	rx02bp;
 	rx02_bitpair_init(&rx02bp);
@@ -766,3 +769,29 @@ dmk2pulses(struct dmk_track *dmkt,
 
 	return ret;
 }
+
+
+/*
+ * Convert a DMK track to pulses with frequency timing in ebs.
+ *
+ * The per-byte encodings need only be as long as the track.
+ */
+
+int
+dmk2pulses(struct dmk_track *dmkt,
+	   struct extra_track_info *eti,
+	   struct encode_bit *ebs,
+	   struct dmk_encode_s *des)
+{
+	uint8_t	*dmk_encoding = calloc(max(eti->track_len,
+					   DMK_TKHDR_SIZE + 1), 1);
+
+	if (!dmk_encoding)
+		return -1;
+
+	int	ret = dmk2pulses_enc(dmkt, eti, ebs, des, dmk_encoding);
+
+	free(dmk_encoding);
+
+	return ret;
+}
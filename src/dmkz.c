@@ -0,0 +1,495 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "crc.h"
+#include "dmkz.h"
+
+
+#define DMKZ_VERSION	1
+#define DMKZ_HDR_SIZE	(8 + DMK_HDR_SIZE)
+#define DMKZ_ENT_SIZE	8
+
+#define TOK_RUN		0x80
+#define TOK_COPY	0xc0
+#define TOK_LEN_BITS	0x3f
+
+#define LIT_MAX		128
+#define RUN_MIN		3
+#define COPY_MIN	4
+#define EXT_MAX		0xffff
+
+#define HASH_BITS	12
+#define CHAIN_DEPTH	16
+
+
+static uint8_t *
+put16(uint8_t *p, unsigned v)
+{
+	*p++ = v & 0xff;
+	*p++ = (v >> 8) & 0xff;
+
+	return p;
+}
+
+
+static unsigned
+get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static unsigned long
+get32(const uint8_t *p)
+{
+	return get16(p) | ((unsigned long)get16(p + 2) << 16);
+}
+
+
+static uint16_t
+dmkz_crc(const uint8_t *buf, size_t len)
+{
+	uint16_t	crc = 0xffff;
+
+	for (size_t i = 0; i < len; ++i)
+		crc = calc_crc1(crc, buf[i]);
+
+	return crc;
+}
+
+
+bool
+dmkz_path(const char *path)
+{
+	size_t	len = strlen(path);
+	size_t	elen = strlen(DMKZ_EXT);
+
+	return len > elen && strcasecmp(path + len - elen, DMKZ_EXT) == 0;
+}
+
+
+bool
+dmkz_is_packed(FILE *fp)
+{
+	char	magic[DMKZ_MAGIC_LEN];
+	bool	is_packed;
+
+	if (fseek(fp, 0, SEEK_SET) == -1)
+		return false;
+
+	is_packed = fread(magic, sizeof(magic), 1, fp) == 1 &&
+		 memcmp(magic, DMKZ_MAGIC, DMKZ_MAGIC_LEN) == 0;
+
+	rewind(fp);
+
+	return is_packed;
+}
+
+
+/*
+ * Code a run or copy of "n" bytes: the token with its length bits,
+ * and the extension if the length doesn't fit in them.
+ */
+
+static uint8_t *
+put_token(uint8_t *p, int tok, size_t n, size_t min)
+{
+	if (n - min < TOK_LEN_BITS) {
+		*p++ = tok | (n - min);
+	} else {
+		*p++ = tok | TOK_LEN_BITS;
+		p = put16(p, n - min - TOK_LEN_BITS);
+	}
+
+	return p;
+}
+
+
+static uint8_t *
+put_literals(uint8_t *p, const uint8_t *in, size_t n)
+{
+	while (n > 0) {
+		size_t	cnt = (n > LIT_MAX) ? LIT_MAX : n;
+
+		*p++ = cnt - 1;
+		memcpy(p, in, cnt);
+		p  += cnt;
+		in += cnt;
+		n  -= cnt;
+	}
+
+	return p;
+}
+
+
+static unsigned
+hash4(const uint8_t *p)
+{
+	uint32_t	v = p[0] | (p[1] << 8) | (p[2] << 16) |
+			    ((uint32_t)p[3] << 24);
+
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+size_t
+dmkz_pack(const uint8_t *in, size_t len, uint8_t *out)
+{
+	int32_t		head[1 << HASH_BITS];
+	int32_t		*prev = malloc(len * sizeof(*prev));
+	uint8_t		*p = out;
+	size_t		lit = 0;	/* Start of pending literals */
+	size_t		i = 0;
+
+	for (int h = 0; h < (1 << HASH_BITS); ++h)
+		head[h] = -1;
+
+	while (i < len) {
+		size_t	run = 1;
+		size_t	run_max = len - i;
+
+		if (run_max > RUN_MIN + TOK_LEN_BITS + EXT_MAX)
+			run_max = RUN_MIN + TOK_LEN_BITS + EXT_MAX;
+
+		while (run < run_max && in[i + run] == in[i])
+			++run;
+
+		/* The longest earlier match, if the chains are kept. */
+		size_t	best = 0, dist = 0;
+
+		if (prev && i + COPY_MIN <= len) {
+			size_t	cmax = len - i;
+
+			if (cmax > COPY_MIN + TOK_LEN_BITS + EXT_MAX)
+				cmax = COPY_MIN + TOK_LEN_BITS + EXT_MAX;
+
+			int32_t	cand = head[hash4(&in[i])];
+
+			for (int d = 0; cand >= 0 && d < CHAIN_DEPTH; ++d) {
+				size_t	n = 0;
+
+				if (i - cand > EXT_MAX)
+					break;
+
+				while (n < cmax && in[cand + n] == in[i + n])
+					++n;
+
+				if (n > best) {
+					best = n;
+					dist = i - cand;
+				}
+
+				cand = prev[cand];
+			}
+		}
+
+		size_t	step;
+
+		if (run >= RUN_MIN && run >= best) {
+			p = put_literals(p, &in[lit], i - lit);
+			p = put_token(p, TOK_RUN, run, RUN_MIN);
+			*p++ = in[i];
+			step = run;
+			lit = i + step;
+		} else if (best >= COPY_MIN) {
+			p = put_literals(p, &in[lit], i - lit);
+			p = put_token(p, TOK_COPY, best, COPY_MIN);
+			p = put16(p, dist);
+			step = best;
+			lit = i + step;
+		} else {
+			step = 1;
+		}
+
+		/* Chain every position passed, for later matches. */
+		for (size_t e = i + step; i < e; ++i) {
+			if (prev && i + COPY_MIN <= len) {
+				unsigned	h = hash4(&in[i]);
+
+				prev[i] = head[h];
+				head[h] = i;
+			}
+		}
+	}
+
+	p = put_literals(p, &in[lit], len - lit);
+
+	free(prev);
+
+	return p - out;
+}
+
+
+int
+dmkz_unpack(const uint8_t *in, size_t inlen, uint8_t *out, size_t len)
+{
+	const uint8_t	*end = in + inlen;
+	size_t		o = 0;
+
+	while (in < end) {
+		int	tok = *in++;
+		size_t	n;
+
+		if (tok < TOK_RUN) {
+			n = tok + 1;
+
+			if (end - in < (ptrdiff_t)n || len - o < n)
+				return -1;
+
+			memcpy(&out[o], in, n);
+			in += n;
+			o  += n;
+			continue;
+		}
+
+		n = (tok & TOK_LEN_BITS) + ((tok < TOK_COPY) ? RUN_MIN :
+								COPY_MIN);
+
+		if ((tok & TOK_LEN_BITS) == TOK_LEN_BITS) {
+			if (end - in < 2)
+				return -1;
+
+			n += get16(in);
+			in += 2;
+		}
+
+		if (len - o < n)
+			return -1;
+
+		if (tok < TOK_COPY) {
+			if (end - in < 1)
+				return -1;
+
+			memset(&out[o], *in++, n);
+		} else {
+			if (end - in < 2)
+				return -1;
+
+			size_t	dist = get16(in);
+
+			in += 2;
+
+			if (dist == 0 || dist > o)
+				return -1;
+
+			/* Byte by byte, as the copy may overlap itself. */
+			for (size_t k = 0; k < n; ++k, ++o)
+				out[o] = out[o - dist];
+
+			continue;
+		}
+
+		o += n;
+	}
+
+	return (o == len) ? 0 : -1;
+}
+
+
+/*
+ * Lay out a stored track as a plain DMK file holds it, padded with
+ * zeros to the file's track length.
+ */
+
+static void
+track_to_bytes(const uint8_t *raw, size_t rlen, uint8_t *buf, size_t len)
+{
+	memset(buf, 0, len);
+
+	for (int i = 0; i < DMK_MAX_SECTORS && 2 * i + 2 <= rlen; ++i) {
+		uint16_t	idam_off;
+
+		memcpy(&idam_off, raw + 2 * i, sizeof(idam_off));
+		put16(&buf[2 * i], idam_off & ~DMK_EXTRA_FLAG);
+	}
+
+	if (rlen > DMK_TKHDR_SIZE)
+		memcpy(buf + DMK_TKHDR_SIZE, raw + DMK_TKHDR_SIZE,
+		       min(rlen, len) - DMK_TKHDR_SIZE);
+}
+
+
+/* The reverse, in place: IDAM pointers to host order. */
+
+static void
+bytes_to_track(uint8_t *buf)
+{
+	for (int i = 0; i < DMK_MAX_SECTORS; ++i) {
+		uint16_t	idam_off = get16(&buf[2 * i]);
+
+		memcpy(&buf[2 * i], &idam_off, sizeof(idam_off));
+	}
+}
+
+
+static int
+dmkz_sides(const struct dmk_header *dmkh)
+{
+	return 2 - !!(dmkh->options & DMK_SSIDE_OPT);
+}
+
+
+/*
+ * Unpack a track's "len" bytes as the file holds them into buf.
+ */
+
+static bool
+track_bytes_fread(const struct dmk_header *dmkh,
+		  int track, int side,
+		  uint8_t *buf, FILE *fp)
+{
+	int		sides = dmkz_sides(dmkh);
+	uint8_t		ent[DMKZ_ENT_SIZE];
+	size_t		len = dmkh->tracklen;
+
+	if (track >= dmkh->ntracks || side >= sides)
+		return false;
+
+	long	pos = DMKZ_HDR_SIZE + (track * sides + side) * DMKZ_ENT_SIZE;
+
+	if (fseek(fp, pos, SEEK_SET) == -1 ||
+	    fread(ent, sizeof(ent), 1, fp) != 1)
+		return false;
+
+	size_t	blen = get16(&ent[4]);
+	uint8_t	*block = malloc(blen ? blen : 1);
+
+	if (!block)
+		return false;
+
+	bool	ok = fseek(fp, get32(ent), SEEK_SET) == 0 &&
+		     (blen == 0 || fread(block, blen, 1, fp) == 1) &&
+		     dmkz_unpack(block, blen, buf, len) == 0 &&
+		     dmkz_crc(buf, len) == get16(&ent[6]);
+
+	free(block);
+
+	return ok;
+}
+
+
+bool
+dmkz_track_fread(const struct dmk_header *dmkh,
+		 int track, int side,
+		 struct dmk_track *trk, FILE *fp)
+{
+	if (dmkh->tracklen > sizeof(trk->track) ||
+	    !track_bytes_fread(dmkh, track, side, trk->track, fp))
+		return false;
+
+	bytes_to_track(trk->track);
+	trk->track_len = dmkh->tracklen;
+
+	return true;
+}
+
+
+int
+dmkz_fp2dmk(FILE *fp, struct dmk_file *dmkf)
+{
+	uint8_t	hdr[8];
+
+	dmk_file_free(dmkf);
+
+	if (fseek(fp, 0, SEEK_SET) == -1 ||
+	    fread(hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr, DMKZ_MAGIC, DMKZ_MAGIC_LEN) != 0 ||
+	    hdr[4] != DMKZ_VERSION)
+		return -1;
+
+	if (!dmk_header_fread(&dmkf->header, fp) ||
+	    !dmk_header_valid(&dmkf->header))
+		return -1;
+
+	int	sides = dmkz_sides(&dmkf->header);
+
+	if (dmk_file_reserve(dmkf, (size_t)dmkf->header.ntracks * sides *
+				   dmkf->header.tracklen) == -1)
+		return -1;
+
+	for (int t = 0; t < dmkf->header.ntracks; ++t) {
+		for (int s = 0; s < sides; ++s) {
+			uint8_t	*raw = dmk_file_track_alloc(dmkf, t, s,
+						dmkf->header.tracklen);
+
+			if (!raw || !track_bytes_fread(&dmkf->header, t, s,
+						       raw, fp))
+				return -1;
+
+			bytes_to_track(raw);
+		}
+	}
+
+	dmkf->zipped = true;
+
+	return 0;
+}
+
+
+int
+dmkz_dmk2fp(const struct dmk_file *dmkf, FILE *fp)
+{
+	const struct dmk_header	*dmkh = &dmkf->header;
+	int			sides = dmkz_sides(dmkh);
+	int			n = dmkh->ntracks * sides;
+	size_t			len = dmkh->tracklen;
+	uint8_t			hdr[8] = DMKZ_MAGIC;
+
+	hdr[4] = DMKZ_VERSION;
+
+	if (fseek(fp, 0, SEEK_SET) == -1 ||
+	    fwrite(hdr, sizeof(hdr), 1, fp) != 1 ||
+	    !dmk_header_fwrite(dmkh, fp))
+		return -1;
+
+	uint8_t	*index = calloc(n ? n : 1, DMKZ_ENT_SIZE);
+	uint8_t	*buf = malloc(len + dmkz_bound(len));
+	int	ret = -1;
+
+	if (!index || !buf)
+		goto out;
+
+	/* The index is filled in once the blocks are placed. */
+	if (n && fwrite(index, n * DMKZ_ENT_SIZE, 1, fp) != 1)
+		goto out;
+
+	long	pos = DMKZ_HDR_SIZE + n * DMKZ_ENT_SIZE;
+	uint8_t	*block = buf + len;
+
+	for (int t = 0; t < dmkh->ntracks; ++t) {
+		for (int s = 0; s < sides; ++s) {
+			uint8_t	*ent = &index[(t * sides + s) *
+					      DMKZ_ENT_SIZE];
+
+			track_to_bytes(dmk_file_track_raw(dmkf, t, s),
+				       dmk_file_track_len(dmkf, t, s),
+				       buf, len);
+
+			size_t	blen = dmkz_pack(buf, len, block);
+
+			put16(ent, pos & 0xffff);
+			put16(ent + 2, (pos >> 16) & 0xffff);
+			put16(ent + 4, blen);
+			put16(ent + 6, dmkz_crc(buf, len));
+
+			if (fwrite(block, blen, 1, fp) != 1)
+				goto out;
+
+			pos += blen;
+		}
+	}
+
+	if (n && (fseek(fp, DMKZ_HDR_SIZE, SEEK_SET) == -1 ||
+		  fwrite(index, n * DMKZ_ENT_SIZE, 1, fp) != 1))
+		goto out;
+
+	ret = fseek(fp, 0, SEEK_END);
+
+out:
+	free(buf);
+	free(index);
+
+	return ret;
+}
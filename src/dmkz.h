@@ -0,0 +1,84 @@
+#ifndef DMKZ_H
+#define DMKZ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dmk.h"
+
+/*
+ * Packed DMK container.
+ *
+ * A DMK track is mostly gap and fill bytes, and the whole track
+ * length is stored even when little of it is used.  The packed
+ * container keeps the DMK header as is and codes each track as an
+ * independent block, so any one track can be read without the rest.
+ *
+ *   "DMKZ" (4)  version (1)  reserved (3)
+ *   DMK header (16)
+ *   index: per track, then side: offset (4)  length (2)  CRC-16 (2)
+ *   blocks
+ *
+ * Integers are little-endian.  An index entry gives the block's file
+ * offset and length, and the CRC of the track it decodes to: the
+ * track exactly as a plain DMK file would hold it.  A block is a
+ * series of tokens:
+ *
+ *   0x00-0x7f   literal: the next (token + 1) bytes
+ *   0x80-0xbf   run: (token & 0x3f) + 3 copies of the next byte
+ *   0xc0-0xff   copy: (token & 0x3f) + 4 bytes from "distance" (2)
+ *               bytes back in the track, which may overlap
+ *
+ * A run or copy whose low six bits are all set has a 2-byte length
+ * extension following the token, added to its length.
+ */
+
+#define DMKZ_MAGIC	"DMKZ"
+#define DMKZ_MAGIC_LEN	4
+#define DMKZ_EXT	".dmkz"
+
+
+/* True if the file at "path" should be written packed, by its name. */
+extern bool dmkz_path(const char *path);
+
+/* True if "fp" (at its start) holds a packed DMK.  Rewinds "fp". */
+extern bool dmkz_is_packed(FILE *fp);
+
+/*
+ * Code "len" bytes of track at "in" into "out", which must have room
+ * for dmkz_bound(len) bytes.  Returns the coded length.
+ */
+extern size_t dmkz_pack(const uint8_t *in, size_t len, uint8_t *out);
+
+#define dmkz_bound(len)	((len) + (len) / 128 + 1)
+
+/*
+ * Decode "inlen" bytes of block at "in" into exactly "len" bytes at
+ * "out".  Returns 0 on success, or -1 if the block is malformed.
+ */
+extern int dmkz_unpack(const uint8_t *in, size_t inlen,
+		       uint8_t *out, size_t len);
+
+/*
+ * Read one track of the packed DMK in "fp", whose header is "dmkh",
+ * into "trk".  Returns true on success.
+ */
+extern bool dmkz_track_fread(const struct dmk_header *dmkh,
+			     int track, int side,
+			     struct dmk_track *trk, FILE *fp);
+
+/* As fp2dmk() and dmk2fp(), for packed DMKs. */
+extern int dmkz_fp2dmk(FILE *fp, struct dmk_file *dmkf);
+extern int dmkz_dmk2fp(const struct dmk_file *dmkf, FILE *fp);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
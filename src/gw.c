@@ -1,4 +1,5 @@
 #include "gw.h"
+#include "monotime.h"
 
 
 /*
@@ -133,6 +134,16 @@ gw_set_backend(const struct gw_backend_ops *ops, void *ctx)
 }
 
 
+static struct gw_io_stats	io_stats;
+
+
+void
+gw_get_io_stats(struct gw_io_stats *ios)
+{
+	*ios = io_stats;
+}
+
+
 static void
 wr_db_dump(const uint8_t *buf, size_t buf_cnt)
 {
@@ -326,6 +337,107 @@ err:
 }
 
 
+#if defined(__linux__) && defined(TCGETS2)
+
+/*
+ * The kernel's struct termios2, for rates termios has no B* constant
+ * for.  <asm/termbits.h> clashes with <termios.h>, so it is laid out
+ * here as pyserial does.  TCGETS2 and TCSETS2 take its size by name.
+ */
+
+struct termios2 {
+	tcflag_t	c_iflag;
+	tcflag_t	c_oflag;
+	tcflag_t	c_cflag;
+	tcflag_t	c_lflag;
+	cc_t		c_line;
+	cc_t		c_cc[19];
+	speed_t		c_ispeed;
+	speed_t		c_ospeed;
+};
+
+#define GW_BOTHER	0010000
+
+
+static int
+gw_set_baud(gw_devt gwfd, int baud)
+{
+	struct termios2	t;
+
+	if (ioctl(gwfd, TCGETS2, &t) == -1)
+		return -1;
+
+	t.c_cflag   = (t.c_cflag & ~CBAUD) | GW_BOTHER;
+	t.c_ispeed  = baud;
+	t.c_ospeed  = baud;
+
+	return ioctl(gwfd, TCSETS2, &t);
+}
+
+#endif
+
+
+/*
+ * Bring the GW's command channel back from any state, as after a
+ * host that died in the middle of a stream.  Setting the line to
+ * BAUD_CLEAR_COMMS makes the firmware abandon any stream and reset
+ * itself; then whatever it had sent is discarded.  Where the rate
+ * can't be set, only the discarding is done.
+ *
+ * 0: Operation succeeded.
+ * Non-zero: Error value with possible error in "errno".
+ */
+
+int
+gw_clear_comms(gw_devt gwfd)
+{
+	/* A simulator backend has no line to clear. */
+	if (backend_ops)
+		return 0;
+
+#if defined(WIN64) || defined(WIN32)
+
+	DCB	dcb = { 0 };
+
+	dcb.DCBlength = sizeof(dcb);
+
+	if (!GetCommState(gwfd, &dcb))
+		goto err;
+
+	dcb.BaudRate = BAUD_CLEAR_COMMS;
+
+	if (!SetCommState(gwfd, &dcb))
+		goto err;
+
+	dcb.BaudRate = BAUD_NORMAL;
+
+	if (!SetCommState(gwfd, &dcb) ||
+	    !PurgeComm(gwfd, PURGE_RXCLEAR | PURGE_TXCLEAR))
+		goto err;
+
+	return 0;
+
+err:
+	errno = getlasterror2errno(GetLastError());
+	return -1;
+
+#else
+
+#if defined(__linux__) && defined(TCGETS2)
+	if (gw_set_baud(gwfd, BAUD_CLEAR_COMMS) == -1 ||
+	    gw_set_baud(gwfd, BAUD_NORMAL) == -1)
+		return -1;
+#endif
+
+	/* Give what the GW had in flight time to land, then drop it. */
+	usleep(10000);
+
+	return tcflush(gwfd, TCIOFLUSH);
+
+#endif
+}
+
+
 /*
  * Read from the GW.
  *
@@ -335,8 +447,8 @@ err:
  * "errno" returns a possible reason for failure.
  */
 
-ssize_t
-gw_read(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
+static ssize_t
+gw_read_dev(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
 {
 	if (backend_ops) {
 		ssize_t brd_cnt = backend_ops->bread(backend_ctx, rbuf,
@@ -387,6 +499,21 @@ gw_read(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
 }
 
 
+ssize_t
+gw_read(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
+{
+	uint64_t	t0     = monotime_ns();
+	ssize_t		rd_cnt = gw_read_dev(gwfd, rbuf, rbuf_cnt);
+
+	io_stats.rd_ns += monotime_ns() - t0;
+
+	if (rd_cnt > 0)
+		io_stats.rd_bytes += rd_cnt;
+
+	return rd_cnt;
+}
+
+
 /*
  * Write to the GW.
  *
@@ -396,8 +523,8 @@ gw_read(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
  * "errno" may be checked for a cause of error.
  */
 
-ssize_t
-gw_write(gw_devt gwfd, const uint8_t *wbuf, size_t wbuf_cnt)
+static ssize_t
+gw_write_dev(gw_devt gwfd, const uint8_t *wbuf, size_t wbuf_cnt)
 {
 	wr_db_dump(wbuf, wbuf_cnt);
 
@@ -440,6 +567,21 @@ gw_write(gw_devt gwfd, const uint8_t *wbuf, size_t wbuf_cnt)
 }
 
 
+ssize_t
+gw_write(gw_devt gwfd, const uint8_t *wbuf, size_t wbuf_cnt)
+{
+	uint64_t	t0     = monotime_ns();
+	ssize_t		wr_cnt = gw_write_dev(gwfd, wbuf, wbuf_cnt);
+
+	io_stats.wr_ns += monotime_ns() - t0;
+
+	if (wr_cnt > 0)
+		io_stats.wr_bytes += wr_cnt;
+
+	return wr_cnt;
+}
+
+
 /*
  * Return the number of bytes waiting to be read from the GW without
  * blocking, or -1 on failure with a possible reason in "errno".
@@ -486,8 +628,8 @@ gw_bytes_waiting(gw_devt gwfd)
  *    -3   I/O failure reading command
  */
 
-int
-gw_do_command(gw_devt gwfd, struct gw_cmd *gw_cmd)
+static int
+gw_do_command_dev(gw_devt gwfd, struct gw_cmd *gw_cmd)
 {
 	ssize_t wr_cnt = gw_write(gwfd, gw_cmd->cmd, gw_cmd->cmd_cnt);
 
@@ -520,6 +662,165 @@ gw_do_command(gw_devt gwfd, struct gw_cmd *gw_cmd)
 }
 
 
+int
+gw_do_command(gw_devt gwfd, struct gw_cmd *gw_cmd)
+{
+	uint64_t	t0  = monotime_ns();
+	int		ret = gw_do_command_dev(gwfd, gw_cmd);
+
+	io_stats.cmd_ns += monotime_ns() - t0;
+	++io_stats.cmds;
+
+	return ret;
+}
+
+
+static bool	batching = false;
+
+
+void
+gw_set_batching(bool on)
+{
+	batching = on;
+}
+
+
+bool
+gw_get_batching(void)
+{
+	return batching;
+}
+
+
+/*
+ * Read all of "rbuf_cnt" bytes, however the device hands them over.
+ * Return 0, or -1 on failure or end of file.
+ */
+
+static int
+gw_read_all(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt)
+{
+	for (size_t n = 0; n < rbuf_cnt; ) {
+		ssize_t	rd_cnt = gw_read(gwfd, &rbuf[n], rbuf_cnt - n);
+
+		if (rd_cnt <= 0)
+			return -1;
+
+		n += rd_cnt;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Send every command in one write, then read each one's response in
+ * order.  Every response is read, whatever the acks, since the
+ * device runs every command it was sent.
+ */
+
+static int
+gw_do_batch_dev(gw_devt gwfd, struct gw_cmd *gw_cmds, int cnt, int *failed)
+{
+	uint8_t	wbuf[GW_BATCH_MAX_BYTES];
+	size_t	wbuf_cnt = 0;
+
+	for (int i = 0; i < cnt; ++i) {
+		memcpy(&wbuf[wbuf_cnt], gw_cmds[i].cmd, gw_cmds[i].cmd_cnt);
+		wbuf_cnt += gw_cmds[i].cmd_cnt;
+	}
+
+	ssize_t wr_cnt = gw_write(gwfd, wbuf, wbuf_cnt);
+
+	if (wr_cnt == -1 || wr_cnt != wbuf_cnt) {
+		*failed = 0;
+		return -2;
+	}
+
+	int	ret = ACK_OKAY;
+
+	for (int i = 0; i < cnt; ++i) {
+		struct gw_cmd	*gw_cmd = &gw_cmds[i];
+		int		r;
+
+		if (gw_read_all(gwfd, gw_cmd->cmd_ret,
+				sizeof(gw_cmd->cmd_ret)) == -1) {
+			r = -3;
+		} else if (gw_cmd->cmd_ret[0] != gw_cmd->cmd[0]) {
+			r = -1;
+		} else {
+			r = gw_cmd->cmd_ret[1];
+
+			if (r == ACK_OKAY && gw_cmd->rbuf_cnt) {
+				if (gw_read_all(gwfd, gw_cmd->rbuf,
+						gw_cmd->rbuf_cnt) == -1)
+					r = -3;
+				else
+					gw_cmd->rbuf_cnt_ret = gw_cmd->rbuf_cnt;
+			}
+		}
+
+		if (r != ACK_OKAY && ret == ACK_OKAY) {
+			ret	= r;
+			*failed = i;
+		}
+
+		/* Out of step with the device: the rest are lost. */
+		if (r < 0)
+			break;
+	}
+
+	return ret;
+}
+
+
+/*
+ * Run "cnt" GW commands (at most GW_BATCH_MAX).
+ *
+ * With batching on, the commands are written to the device together
+ * and their acks read back in order, saving a round trip per
+ * command.  Otherwise they're run one by one as gw_do_command() does,
+ * stopping at the first to fail.  Either way, only the last command
+ * may be one the device follows with a stream (CMD_READ_FLUX); its
+ * ack is in its "cmd_ret" if it was run.
+ *
+ * Return ACK_OKAY if every command returned it, otherwise what the
+ * first not to returned (see gw_do_command()), with its index in
+ * "failed".  Batched, the device went on to run the rest anyway.
+ */
+
+int
+gw_do_commands(gw_devt gwfd, struct gw_cmd *gw_cmds, int cnt, int *failed)
+{
+	size_t	bytes = 0;
+
+	for (int i = 0; i < cnt; ++i)
+		bytes += gw_cmds[i].cmd_cnt;
+
+	if (!batching || cnt < 2 || cnt > GW_BATCH_MAX ||
+	    bytes > GW_BATCH_MAX_BYTES) {
+		for (int i = 0; i < cnt; ++i) {
+			int	ret = gw_do_command(gwfd, &gw_cmds[i]);
+
+			if (ret != ACK_OKAY) {
+				*failed = i;
+				return ret;
+			}
+		}
+
+		return ACK_OKAY;
+	}
+
+	uint64_t	t0  = monotime_ns();
+	int		ret = gw_do_batch_dev(gwfd, gw_cmds, cnt, failed);
+
+	io_stats.cmd_ns += monotime_ns() - t0;
+	io_stats.cmds	+= cnt;
+
+	return ret;
+}
+
+
 /*
  * Load a little-endian uint32 from a byte buffer without unaligned
  * or aliasing-unsafe access.
@@ -674,24 +975,107 @@ gw_motor(gw_devt gwfd, int drive, int motor)
  * Returns ACK_OKAY (0) on success, or other ACK_* on failure.
  */
 
-int
-gw_read_flux(gw_devt gwfd, int revs, int ticks)
+static void
+read_flux_cmd(uint8_t cmd[8], int revs, int ticks)
 {
 	/* The byte shifts below serialize the native values in
 	 * little-endian order, so no htole conversions here. */
 	uint16_t crevs  = revs ? revs+1 : 0;
 	uint32_t cticks = ticks;
 
+	cmd[0] = CMD_READ_FLUX;
+	cmd[1] = 8;
+	cmd[2] = cticks & 0xff;
+	cmd[3] = (cticks >> 8) & 0xff;
+	cmd[4] = (cticks >> 16) & 0xff;
+	cmd[5] = (cticks >> 24) & 0xff;
+	cmd[6] = crevs & 0xff;
+	cmd[7] = (crevs >> 8) & 0xff;
+}
+
+
+int
+gw_read_flux(gw_devt gwfd, int revs, int ticks)
+{
+	uint8_t	cmd[8];
+
+	read_flux_cmd(cmd, revs, ticks);
+
 	return gw_do_command(gwfd,
-			     &(struct gw_cmd){(uint8_t[])
-			     {CMD_READ_FLUX, 8,
-			     cticks & 0xff,
-			     (cticks >> 8) & 0xff,
-			     (cticks >> 16) & 0xff,
-			     (cticks >> 24) & 0xff,
-			     crevs & 0xff,
-			     (crevs >> 8) & 0xff},
-			     8, { 0, 0 }, 0, 0, 0});
+			     &(struct gw_cmd){cmd, 8, { 0, 0 }, 0, 0, 0});
+}
+
+
+/*
+ * Discard a flux stream through its terminator, then its status.
+ */
+
+static int
+gw_drain_flux(gw_devt gwfd)
+{
+	uint8_t	rbuf[512];
+
+	for (;;) {
+		ssize_t	nrd = gw_bytes_waiting(gwfd);
+
+		if (nrd == -1)
+			return -3;
+
+		if (nrd < 1)
+			nrd = 1;
+		else if (nrd > sizeof(rbuf))
+			nrd = sizeof(rbuf);
+
+		ssize_t	rd_cnt = gw_read(gwfd, rbuf, nrd);
+
+		if (rd_cnt <= 0)
+			return -3;
+
+		if (rbuf[rd_cnt - 1] == 0)
+			break;
+	}
+
+	return gw_get_flux_status(gwfd);
+}
+
+
+/*
+ * Seek to "cyl", select "head", and start reading flux as
+ * gw_read_flux() does, in one round trip if batching is on.
+ *
+ * Returns ACK_OKAY (0) with the stream to follow, or as
+ * gw_do_commands() does on failure: "failed" is 0 if the seek
+ * failed, 1 the head select, 2 the read.  If the read went ahead
+ * after a failed seek or head select, its stream is discarded.
+ */
+
+int
+gw_read_flux_at(gw_devt gwfd, int cyl, int head, int revs, int ticks,
+		int *failed)
+{
+	uint8_t	rcmd[8];
+
+	read_flux_cmd(rcmd, revs, ticks);
+
+	struct gw_cmd	gw_cmds[3] = {
+		{ (uint8_t[]){CMD_SEEK, 3, cyl}, 3 },
+		{ (uint8_t[]){CMD_HEAD, 3, head}, 3 },
+		{ rcmd, 8 }
+	};
+
+	int	ret = gw_do_commands(gwfd, gw_cmds, 3, failed);
+
+	if (ret != ACK_OKAY && *failed < 2 &&
+	    gw_cmds[2].cmd_ret[0] == CMD_READ_FLUX &&
+	    gw_cmds[2].cmd_ret[1] == ACK_OKAY) {
+		int	dret = gw_drain_flux(gwfd);
+
+		/* Losing sync outranks the seek's failure. */
+		if (dret < 0)
+			ret = dret;
+	}
+
+	return ret;
 }
 
 
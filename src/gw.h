@@ -49,6 +49,10 @@ struct gw_cmd {
 	size_t		rbuf_cnt_ret;
 };
 
+/* Most commands, and command bytes, gw_do_commands() sends at once. */
+#define GW_BATCH_MAX		8
+#define GW_BATCH_MAX_BYTES	64
+
 
 /*
  * Optional I/O backend substituting for the serial device.  When
@@ -63,6 +67,21 @@ struct gw_backend_ops {
 };
 
 
+/*
+ * Running totals of device I/O, for instrumentation.  Callers take
+ * snapshots with gw_get_io_stats() and subtract.
+ */
+
+struct gw_io_stats {
+	uint64_t	cmds;		/* gw_do_command() calls */
+	uint64_t	cmd_ns;		/* time spent in gw_do_command() */
+	uint64_t	rd_bytes;
+	uint64_t	rd_ns;		/* time spent in gw_read() */
+	uint64_t	wr_bytes;
+	uint64_t	wr_ns;		/* time spent in gw_write() */
+};
+
+
 extern const char *gw_cmd_name(uint8_t cmd);
 
 extern const char *gw_cmd_ack(uint8_t response);
@@ -73,12 +92,16 @@ extern FILE *gw_get_logfp(void);
 
 extern void gw_set_backend(const struct gw_backend_ops *ops, void *ctx);
 
+extern void gw_get_io_stats(struct gw_io_stats *io_stats);
+
 extern gw_devt gw_open(const char *gw_devname);
 
 extern int gw_close(gw_devt gwfd);
 
 extern int gw_init(gw_devt gwfd);
 
+extern int gw_clear_comms(gw_devt gwfd);
+
 extern ssize_t gw_read(gw_devt gwfd, uint8_t *rbuf, size_t rbuf_cnt);
 
 extern ssize_t gw_write(gw_devt gwfd, const uint8_t *wbuf, size_t wbuf_cnt);
@@ -87,6 +110,18 @@ extern ssize_t gw_bytes_waiting(gw_devt gwfd);
 
 extern int gw_do_command(gw_devt gwfd, struct gw_cmd *gw_cmd);
 
+/*
+ * Batching: whether gw_do_commands() sends its commands back to back
+ * in one write.  Only for devices that take more than one command per
+ * transfer, such as gwsim; off by default.
+ */
+extern void gw_set_batching(bool on);
+
+extern bool gw_get_batching(void);
+
+extern int gw_do_commands(gw_devt gwfd, struct gw_cmd *gw_cmds, int cnt,
+			  int *failed);
+
 extern int gw_get_info(gw_devt gwfd, struct gw_info *gw_info);
 
 extern int gw_get_info_bw_stats(gw_devt gwfd, struct gw_bw_stats *gw_bw_stats);
@@ -103,6 +138,9 @@ extern int gw_motor(gw_devt gwfd, int drive, int motor);
 
 extern int gw_read_flux(gw_devt gwfd, int revs, int ticks);
 
+extern int gw_read_flux_at(gw_devt gwfd, int cyl, int head, int revs,
+			   int ticks, int *failed);
+
 extern int gw_write_flux(gw_devt gwfd, bool cue_at_index,
 			 bool terminate_at_index);
 
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -24,6 +25,12 @@
 #include "parsetracks.h"
 #include "cfgfile.h"
 #include "gwreplay.h"
+#include "monotime.h"
+#include "runreport.h"
+#include "gwcalib.h"
+#include "retrypol.h"
+#include "dmkckpt.h"
+#include "dmkz.h"
 
 #if defined(WIN64) || defined(WIN32)
 #include <windows.h>
@@ -32,6 +39,15 @@
 
 #define	GUESS_TRACKS	GW_MAX_TRACKS
 
+/*
+ * Revolutions taken by a read starting anywhere (--immediate): one,
+ * plus enough to come around to the first sector ID read again.
+ */
+#define	IMMEDIATE_REVS		1.2
+
+/* How far the drive's speed may drift from its cached calibration. */
+#define	CALIB_RPM_TOLERANCE	0.03
+
 
 const char version[] = VERSION;
 
@@ -59,6 +75,7 @@ static const struct option cmd_long_args[] = {
 	{ "device",	 required_argument, NULL, 'G' },
 	{ "menu",	 required_argument, NULL, 'M' },
 	{ "replay",	 required_argument, NULL, 'R' },
+	{ "report",	 required_argument, NULL, 'J' },
 	{ "minsectors",	 required_argument, NULL, 'S' },
 	{ "stepdelay",	 required_argument, NULL, 'T' },
 	{ "gwlogfile",	 required_argument, NULL, 'U' },
@@ -66,6 +83,7 @@ static const struct option cmd_long_args[] = {
 	{ "serial",	 required_argument, NULL, 'Z' },
 	{ "mfmthresh1",	 required_argument, NULL, '1' },
 	{ "mfmthresh2",	 required_argument, NULL, '2' },
+	{ "stall",	 required_argument, NULL, 0 },
 	/* Start of binary long options without single letter counterparts. */
 	{ "noconfig",	 no_argument, NULL, 0 },
 	{ "hd",		 no_argument, NULL, 0 },
@@ -74,6 +92,12 @@ static const struct option cmd_long_args[] = {
 	{ "nohole",	 no_argument, NULL, 0 },
 	{ "join",	 no_argument, NULL, 0 },
 	{ "nojoin",	 no_argument, NULL, 0 },
+	{ "defer",	 no_argument, NULL, 0 },
+	{ "nodefer",	 no_argument, NULL, 0 },
+	{ "vary",	 no_argument, NULL, 0 },
+	{ "novary",	 no_argument, NULL, 0 },
+	{ "immediate",	 no_argument, NULL, 0 },
+	{ "noimmediate", no_argument, NULL, 0 },
 	{ "compat",	 no_argument, NULL, 0 },
 	{ "nocompat",	 no_argument, NULL, 0 },
 	{ "dmkopt",	 no_argument, NULL, 0 },
@@ -82,10 +106,17 @@ static const struct option cmd_long_args[] = {
 	{ "nousehisto",	 no_argument, NULL, 0 },
 	{ "force",	 no_argument, NULL, 0 },
 	{ "noforce",	 no_argument, NULL, 0 },
+	{ "checkpoint",	 no_argument, NULL, 0 },
+	{ "nocheckpoint", no_argument, NULL, 0 },
+	{ "resume",	 no_argument, NULL, 0 },
 	{ "reset",	 no_argument, NULL, 0 },
 	{ "noreset",	 no_argument, NULL, 0 },
+	{ "calib",	 no_argument, NULL, 0 },
+	{ "nocalib",	 no_argument, NULL, 0 },
 	{ "reverse",	 no_argument, NULL, 0 },
 	{ "noreverse",	 no_argument, NULL, 0 },
+	{ "batch",	 no_argument, NULL, 0 },
+	{ "nobatch",	 no_argument, NULL, 0 },
 	{ 0, 0, 0, 0 }
 };
 
@@ -116,11 +147,16 @@ static struct cmd_settings cmd_settings = {
 	.guess_steps = false,
 	.check_compat_sides = true,
 	.reset_on_init = true,
+	.use_calib = true,
 	.forcewrite = false,
+	.checkpoint = true,
+	.resume = false,
 	.use_histo = false,
 	.usr_encoding = MIXED,
 	.reverse_sides = false,
 	.hole = true,
+	.immediate = false,
+	.rev_ticks = 0,
 	.alternate = 0,
 	.iam_pos = -1,
 	.fmtimes = 2,
@@ -131,6 +167,9 @@ static struct cmd_settings cmd_settings = {
 	.ignore = 0,
 	.maxsecsize = 3,
 	.join_sectors = true,
+	.defer_retries = false,
+	.stall_limit = 3,
+	.vary_reads = false,
 	.menu_intr_enabled = false,
 	.menu_err_enabled = false,
 	.scrn_verbosity = MSG_TSUMMARY,
@@ -140,6 +179,7 @@ static struct cmd_settings cmd_settings = {
 	.logfile = NULL,
 	.devlogfile = NULL,
 	.replayfile = NULL,
+	.reportfile = NULL,
 	.dmkfile = NULL,
 	.gme.rpm = 0.0,
 	.gme.data_clock = 0.0,
@@ -160,6 +200,13 @@ static volatile bool    menu_requested = false;
 static volatile bool    exit_requested = false;
 static volatile bool    reading_floppy = false;
 
+static struct run_report	run_report;
+
+/* Checkpoint journal of the read, while one is being kept. */
+static char		*ckpt_path;
+static FILE		*ckpt_fp;
+static struct ckpt_geom	ckpt_last;
+
 
 static void
 usage(const char *pgm_name, struct cmd_settings *cmd_set)
@@ -200,14 +247,24 @@ usage(const char *pgm_name, struct cmd_settings *cmd_set)
 				"none");
 	u("  -R gwlogfile    Replay a Greaseweazle transaction logfile "
 				"(see -U)\n");
+	u("  -J report       Write per-track timing report, JSON or "
+				"*.csv [%s]\n",
+				cmd_set->reportfile ? cmd_set->reportfile :
+				"none");
 	u("  -M {i,e,d}      Menu control [d]\n");
 	u("                  i = Interrupt (^C) invokes menu\n");
 	u("                  e = Errors equals retries invokes menu\n");
 	u("                  d = Disables invoking menu\n");
 	u("  --[no]hole      Use or not index hole for track start [%shole]\n",
 				cmd_set->hole ? "" : "no");
+	u("  --[no]immediate Start reads or not without waiting for the "
+				"hole [%simmediate]\n",
+				cmd_set->immediate ? "" : "no");
 	u("  --[no]join      Join or not sectors between retries [%sjoin]\n",
 				cmd_set->join_sectors ? "" : "no");
+	u("  --[no]defer     Defer or not retries to passes after the "
+				"first [%sdefer]\n",
+				cmd_set->defer_retries ? "" : "no");
 	u("  --[no]compat    Compare or not sides for incompatible formats "
 				"[%scompat]\n",
 				cmd_set->check_compat_sides ? "" : "no");
@@ -219,9 +276,19 @@ usage(const char *pgm_name, struct cmd_settings *cmd_set)
 	u("  --[no]force     Force or not to overwrite existing DMK output "
 				"file [%sforce]\n",
 				cmd_set->forcewrite ? "" : "no");
+	u("  --[no]checkpoint Keep or not a checkpoint to resume an "
+				"unfinished read from [%scheckpoint]\n",
+				cmd_set->checkpoint ? "" : "no");
+	u("  --resume        Resume the unfinished read of file.dmk\n");
 	u("  --[no]reset     Reset Greaseweazle upon initialization "
 				"[%sreset]\n",
 				cmd_set->reset_on_init ? "" : "no");
+	u("  --[no]calib     Use or not the drive calibration cache "
+				"[%scalib]\n",
+				cmd_set->use_calib ? "" : "no");
+	u("  --[no]batch     Send each track's seek and read together, "
+				"for gwsim [%sbatch]\n",
+				cmd_set->batch ? "" : "no");
 
 	u("\n Options to manually set values that are normally "
 			"autodetected:\n");
@@ -240,6 +307,11 @@ usage(const char *pgm_name, struct cmd_settings *cmd_set)
 				cmd_set->min_retries[0][0]);
 	u("  -S min_sector   Min sector count [%d]\n",
 				cmd_set->min_sectors[0][0]);
+	u("  --stall reads   Stop retrying after reads recovering nothing "
+				"(0 = never) [%d]\n", cmd_set->stall_limit);
+	u("  --[no]vary      Vary or not how a track is read when retries "
+				"stall [%svary]\n",
+				cmd_set->vary_reads ? "" : "no");
 	u("  --[no]reverse   Reverse sides or not [%sreverse]\n",
 				cmd_set->reverse_sides ? "" : "no");
 	u("  -q quirk        Bitmap of support for some format quirks "
@@ -391,7 +463,7 @@ parse_args(int argc,
 	optind = 0;	/* Reset getopt state; parse_args runs twice. */
 
 	while ((opt = getopt_long(argc, argv,
-			"a:d:e:f:g:i:k:l:m:p:q:s:t:u:v:w:x:z:B:C:G:M:R:S:T:U:X:Z:1:2:",
+			"a:d:e:f:g:i:k:l:m:p:q:s:t:u:v:w:x:z:B:C:G:J:M:R:S:T:U:X:Z:1:2:",
 			cmd_long_args, &lindex)) != -1) {
 
 		switch(opt) {
@@ -412,10 +484,27 @@ parse_args(int argc,
 				cmd_set->hole = true;
 			} else if (!strcmp(name, "nohole")) {
 				cmd_set->hole = false;
+			} else if (!strcmp(name, "immediate")) {
+				cmd_set->immediate = true;
+			} else if (!strcmp(name, "noimmediate")) {
+				cmd_set->immediate = false;
 			} else if (!strcmp(name, "join")) {
 				cmd_set->join_sectors = true;
 			} else if (!strcmp(name, "nojoin")) {
 				cmd_set->join_sectors = false;
+			} else if (!strcmp(name, "defer")) {
+				cmd_set->defer_retries = true;
+			} else if (!strcmp(name, "nodefer")) {
+				cmd_set->defer_retries = false;
+			} else if (!strcmp(name, "stall")) {
+				const int stall = strtol_strict(optarg, 10,
+								"'stall'");
+				if (stall < 0) goto err_usage;
+				cmd_set->stall_limit = stall;
+			} else if (!strcmp(name, "vary")) {
+				cmd_set->vary_reads = true;
+			} else if (!strcmp(name, "novary")) {
+				cmd_set->vary_reads = false;
 			} else if (!strcmp(name, "compat")) {
 				cmd_set->check_compat_sides = true;
 			} else if (!strcmp(name, "nocompat")) {
@@ -432,15 +521,29 @@ parse_args(int argc,
 				cmd_set->forcewrite = true;
 			} else if (!strcmp(name, "noforce")) {
 				cmd_set->forcewrite = false;
+			} else if (!strcmp(name, "checkpoint")) {
+				cmd_set->checkpoint = true;
+			} else if (!strcmp(name, "nocheckpoint")) {
+				cmd_set->checkpoint = false;
+			} else if (!strcmp(name, "resume")) {
+				cmd_set->resume = true;
 			} else if (!strcmp(name, "reset")) {
 				cmd_set->reset_on_init = true;
 			} else if (!strcmp(name, "noreset")) {
 				cmd_set->reset_on_init = false;
+			} else if (!strcmp(name, "calib")) {
+				cmd_set->use_calib = true;
+			} else if (!strcmp(name, "nocalib")) {
+				cmd_set->use_calib = false;
 			} else if (!strcmp(name, "reverse")) {
 				cmd_set->reverse_sides = true;
 				opt_hw_given = true;
 			} else if (!strcmp(name, "noreverse")) {
 				cmd_set->reverse_sides = false;
+			} else if (!strcmp(name, "batch")) {
+				cmd_set->batch = true;
+			} else if (!strcmp(name, "nobatch")) {
+				cmd_set->batch = false;
 			} else {
 				goto err_usage;
 			}
@@ -626,6 +729,10 @@ parse_args(int argc,
 			}
 			break;
 
+		case 'J':
+			cmd_set->reportfile = optarg;
+			break;
+
 		case 'R':
 			cmd_set->replayfile = optarg;
 			break;
@@ -781,63 +888,364 @@ err_usage:
 }
 
 
-static int
-imark_fn(uint32_t imark, void *data)
+/*
+ * Open a binary file for writing and return a file pointer.
+ *
+ * If fail_if_exists is true, ensure file does not exist prior to open.
+ */
+
+static FILE *
+fopenwx(const char *file, bool fail_if_exists)
 {
-	return gwflux_decode_index(imark, (struct flux2dmk_sm *)data);
+	int oflags = O_RDWR | O_CREAT | O_TRUNC | (fail_if_exists ? O_EXCL : 0);
+#if defined(WIN64) || defined(WIN32)
+	oflags += O_BINARY;
+#endif
+
+	int fd = open(file, oflags, 0644);
+
+	if (fd == -1)
+		return NULL;
+
+	return fdopen(fd, "wb");
 }
 
 
-struct pulse_data {
-	struct gw_media_encoding	*gme;
-	struct flux2dmk_sm		*flux2dmk;
+/*
+ * What one read_track() call produced for a track and side.  Kept
+ * across a geometry change so tracks already read can be re-mapped
+ * rather than read again.
+ */
+
+struct track_rec {
+	bool			have;
+	bool			pending;	/* Deferred retries remain */
+	int			retries;
+	int			cyl_seen;
+	int			first_encoding;
+	bool			flippy;
+	struct dmk_track_stats	dts;
+	struct dmk_track_stats	merged;		/* To resume merging from */
+	struct retry_policy	rp;
+	int			retries_saved;	/* Left when retries stalled */
 };
 
 
+static void
+dds_add_track(struct dmk_disk_stats *dds, const struct track_rec *trec)
+{
+	dds->retries_total      += trec->retries;
+	dds->good_sectors_total += trec->dts.good_sectors;
+	dds->errcount_total     += trec->dts.errcount;
+
+	for (int i = 0; i < N_ENCS; ++i)
+		dds->enc_count_total[i] += trec->dts.enc_count[i];
+
+	if (trec->dts.errcount > 0) {
+		dds->err_tracks++;
+	} else if (trec->dts.good_sectors) {
+		dds->good_tracks++;
+	}
+
+	if (trec->retries_saved > 0) {
+		dds->stalled_tracks++;
+		dds->retries_saved += trec->retries_saved;
+	}
+
+	if (trec->flippy)
+		dds->flippy = true;
+}
+
+
+/* Count the tracks read so far into fresh disk stats. */
+
+static void
+dds_recount(struct dmk_disk_stats *dds,
+	    const struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES])
+{
+	dmk_disk_stats_init(dds);
+
+	for (int h = 0; h < DMK_MAX_TRACKS; ++h) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			if (trecs[h][s].have)
+				dds_add_track(dds, &trecs[h][s]);
+		}
+	}
+}
+
+
+static void
+track_rec_set(struct track_rec *trec,
+	      int retries,
+	      const struct flux2dmk_sm *flux2dmk,
+	      const struct dmk_track_stats *dts)
+{
+	*trec = (struct track_rec){
+			.have           = true,
+			.retries        = retries,
+			.cyl_seen       = flux2dmk->fdec.cyl_seen,
+			.first_encoding = flux2dmk->fdec.first_encoding,
+			.flippy         = flux2dmk->fdec.flippy,
+			.dts            = *dts
+		};
+}
+
+
+/* The geometry the read is using now, as the checkpoint keeps it. */
+
+static struct ckpt_geom
+ckpt_geom_now(const struct cmd_settings *cmd_set,
+	      const struct dmk_file *dmkf)
+{
+	int	tracks = cmd_set->fdd.tracks;
+
+	/* Guessing the track count can end the read early. */
+	if (dmkf->header.ntracks && dmkf->header.ntracks < tracks)
+		tracks = dmkf->header.ntracks;
+
+	return (struct ckpt_geom){
+			.tracks       = tracks,
+			.sides        = cmd_set->fdd.sides,
+			.steps        = cmd_set->fdd.steps,
+			.guess_tracks = cmd_set->guess_tracks,
+			.guess_sides  = cmd_set->guess_sides,
+			.guess_steps  = cmd_set->guess_steps
+		};
+}
+
+
+static bool
+ckpt_geom_equal(const struct ckpt_geom *a, const struct ckpt_geom *b)
+{
+	return a->tracks == b->tracks &&
+	       a->sides == b->sides &&
+	       a->steps == b->steps &&
+	       a->guess_tracks == b->guess_tracks &&
+	       a->guess_sides == b->guess_sides &&
+	       a->guess_steps == b->guess_steps;
+}
+
+
+/* A failure to checkpoint doesn't stop the read, but ends checkpoints. */
+
+static void
+ckpt_fail(void)
+{
+	msg_error("Failed to write checkpoint '%s': %s (%d); "
+		  "continuing without one\n", ckpt_path, strerror(errno),
+		  errno);
+
+	fclose(ckpt_fp);
+	ckpt_fp = NULL;
+}
+
+
 static int
-pulse_fn(uint32_t pulse, void *data)
+ckpt_put_trec(int track, int side,
+	      const struct track_rec *trec,
+	      const struct dmk_file *dmkf)
 {
-	struct pulse_data	*pdata = (struct pulse_data *)data;
+	static struct dmk_track	trk;
+
+	const struct ckpt_track	ct = {
+		.have           = true,
+		.retries        = trec->retries,
+		.retries_saved  = trec->retries_saved,
+		.cyl_seen       = trec->cyl_seen,
+		.first_encoding = trec->first_encoding,
+		.flippy         = trec->flippy,
+		.dts            = trec->dts
+	};
+
+	dmk_file_get_track(dmkf, track, side, &trk);
 
-	return gwflux_decode_pulse(pulse, pdata->gme, pdata->flux2dmk);
+	return ckpt_put_track(ckpt_fp, track, side, &ct, &trk);
 }
 
 
+/*
+ * Checkpoint a track just read ("track" -1 for none), after any
+ * change of geometry made while reading it.
+ */
+
 static void
-dmk_file_init(struct dmk_file *dmkf)
+ckpt_track(const struct cmd_settings *cmd_set,
+	   const struct dmk_file *dmkf,
+	   const struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES],
+	   int track, int side)
 {
-	dmk_header_init(&dmkf->header, 0, DMKRD_TRACKLEN_MAX);
+	if (!ckpt_fp)
+		return;
+
+	struct ckpt_geom	geom = ckpt_geom_now(cmd_set, dmkf);
+
+	if (!ckpt_geom_equal(&geom, &ckpt_last)) {
+		if (ckpt_put_geom(ckpt_fp, &geom)) {
+			ckpt_fail();
+			return;
+		}
+
+		ckpt_last = geom;
+	}
 
-	memset(dmkf->track, 0, sizeof(dmkf->track));
+	if (track >= 0 && trecs[track][side].have &&
+	    ckpt_put_trec(track, side, &trecs[track][side], dmkf)) {
+		ckpt_fail();
+	}
 }
 
 
 /*
- * Open a binary file for writing and return a file pointer.
- *
- * If fail_if_exists is true, ensure file does not exist prior to open.
+ * Start the checkpoint over at a (re)start of the read, keeping the
+ * tracks already read.
  */
 
-static FILE *
-fopenwx(const char *file, bool fail_if_exists)
+static void
+ckpt_start(const struct cmd_settings *cmd_set,
+	   const struct dmk_file *dmkf,
+	   const struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES])
 {
-	int oflags = O_RDWR | O_CREAT | O_TRUNC | (fail_if_exists ? O_EXCL : 0);
-#if defined(WIN64) || defined(WIN32)
-	oflags += O_BINARY;
-#endif
+	if (!ckpt_fp)
+		return;
 
-	int fd = open(file, oflags, 0644);
+	ckpt_last = ckpt_geom_now(cmd_set, dmkf);
 
-	if (fd == -1)
-		return NULL;
+	if (ckpt_put_start(ckpt_fp, &ckpt_last)) {
+		ckpt_fail();
+		return;
+	}
 
-	return fdopen(fd, "wb");
+	for (int h = 0; h < DMK_MAX_TRACKS; ++h) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			if (trecs[h][s].have &&
+			    ckpt_put_trec(h, s, &trecs[h][s], dmkf)) {
+				ckpt_fail();
+				return;
+			}
+		}
+	}
+}
+
+
+/*
+ * Take up an unfinished read where its checkpoint left off: its
+ * geometry, and the tracks it read without errors.  Tracks with
+ * errors are read again.  Returns the length of the checkpoint to
+ * keep appending to.
+ */
+
+static long
+ckpt_resume(struct cmd_settings *cmd_set,
+	    struct dmk_file *dmkf,
+	    struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES])
+{
+	static struct ckpt_track	cts[DMK_MAX_TRACKS][DMK_SIDES];
+	struct ckpt_geom		geom;
+	long				end;
+
+	memset(cts, 0, sizeof(cts));
+
+	if (ckpt_load(ckpt_path, &geom, cts, dmkf, &end) < 0)
+		msg_fatal("Cannot resume from checkpoint '%s'.\n", ckpt_path);
+
+	cmd_set->fdd.tracks  = geom.tracks;
+	cmd_set->fdd.sides   = geom.sides;
+	cmd_set->fdd.steps   = geom.steps;
+	cmd_set->guess_tracks = geom.guess_tracks;
+	cmd_set->guess_sides  = geom.guess_sides;
+	cmd_set->guess_steps  = geom.guess_steps;
+
+	int	kept = 0, again = 0;
+
+	for (int h = 0; h < DMK_MAX_TRACKS; ++h) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			const struct ckpt_track	*ct = &cts[h][s];
+
+			if (!ct->have)
+				continue;
+
+			if (ct->dts.errcount > 0) {
+				dmk_file_clear_track(dmkf, h, s);
+				++again;
+				continue;
+			}
+
+			trecs[h][s] = (struct track_rec){
+					.have           = true,
+					.retries        = ct->retries,
+					.cyl_seen       = ct->cyl_seen,
+					.first_encoding = ct->first_encoding,
+					.flippy         = ct->flippy,
+					.dts            = ct->dts,
+					.retries_saved  = ct->retries_saved
+				};
+			++kept;
+		}
+	}
+
+	/* Side 0 of track 0 isn't decoded again to compare sides with. */
+	if (trecs[0][0].have)
+		cmd_set->check_compat_sides = false;
+
+	msg(MSG_NORMAL, "Resuming from '%s': %d track%s kept, "
+	    "%d with errors to read again\n", ckpt_path, kept, plu(kept),
+	    again);
+
+	ckpt_last = geom;
+
+	return end;
+}
+
+
+/*
+ * Ways to read a track again when retries stop recovering sectors,
+ * tried in this order where they apply.
+ */
+
+enum read_strategy {
+	RS_AS_SET,		/* As configured */
+	RS_OTHER_POS,		/* The other half-track head position */
+	RS_POSTCOMP,		/* A different read-postcompensation */
+	RS_N
+};
+
+static const char *const read_strategy_desc[RS_N] = {
+	[RS_AS_SET]    = "as set",
+	[RS_OTHER_POS] = "other head position",
+	[RS_POSTCOMP]  = "other postcomp"
+};
+
+
+/* List the strategies that apply to reading with these settings. */
+
+static int
+read_strategies(const struct cmd_settings *cmd_set,
+		enum read_strategy strat[RS_N])
+{
+	int	n = 0;
+
+	strat[n++] = RS_AS_SET;
+
+	if (!cmd_set->vary_reads)
+		return n;
+
+	if (cmd_set->fdd.steps == 2 && !(cmd_set->alternate & 2) &&
+	    !gw_replay_active())
+		strat[n++] = RS_OTHER_POS;
+
+	strat[n++] = RS_POSTCOMP;
+
+	return n;
 }
 
 
 /*
  * Read the track and side.
  *
+ * With deferred retries, a track still failing after its first read
+ * is left pending in "trec", and each later call for it makes one
+ * more retry, resuming the merge from the track kept in "dmkf".
+ *
  *    -2	Attempt restart.
  *    -1	Side count changed to 1 (cmd_set->fdd.sides=1).
  *     0	Everything good, continue reading next track.
@@ -847,22 +1255,56 @@ fopenwx(const char *file, bool fail_if_exists)
 
 // XXX Too many args.  Rethink.
 static int
-read_track(struct cmd_settings *cmd_set,
-	   uint32_t sample_freq,
-	   struct dmk_file *dmkf,
-	   struct dmk_disk_stats *dds,
-	   int track,
-	   int side,
-	   int *first_encoding,
-	   int *prev_cyl,
-	   int *t0s0ss)
+read_track_into(struct cmd_settings *cmd_set,
+		uint32_t sample_freq,
+		struct dmk_file *dmkf,
+		struct dmk_track *trk,
+		struct dmk_disk_stats *dds,
+		int track,
+		int side,
+		int *first_encoding,
+		int *prev_cyl,
+		int *t0s0ss,
+		struct track_rec *trec,
+		struct rr_track *rt)
 {
 	struct dmk_track_stats	dts;
 	dmk_track_stats_init(&dts);
 
 	struct flux2dmk_sm flux2dmk;
 
-	int retry = 0;
+	/* Good sectors from every pass, for joining across retries. */
+	struct dmk_sector_index	dsi;
+	dmk_sector_index_init(&dsi);
+
+	int	retry   = 0;
+	bool	resume  = trec->pending;
+	bool	pending = false;
+
+	enum read_strategy	strat[RS_N];
+	int			nstrat = read_strategies(cmd_set, strat);
+	struct retry_policy	rp;
+
+	if (resume) {
+		retry = trec->retries + 1;
+		dts   = trec->merged;
+		rp    = trec->rp;
+		dmk_sector_index_add(&dsi, trk, &dts);
+	} else {
+		retry_policy_init(&rp, cmd_set->stall_limit, nstrat);
+	}
+
+	int	retries_saved = 0;
+
+	/*
+	 * Read without waiting for the index hole, and align the track
+	 * to it afterward, unless the track must be laid out from the
+	 * start of the read.
+	 */
+
+	bool	immediate = cmd_set->immediate && cmd_set->hole &&
+			    cmd_set->iam_pos < 0 && cmd_set->ignore == 0 &&
+			    cmd_set->rev_ticks > 0;
 
 retry:
 	msg(MSG_TSUMMARY, "Track %d, side %d, pass %d",
@@ -872,15 +1314,28 @@ retry:
 	msg(MSG_TSUMMARY, ":");
 	msg_scrn_flush();
 
+	rt->passes = retry + 1;
+
+	enum read_strategy	rs = strat[(rp.strategy < nstrat) ?
+					       rp.strategy : nstrat - 1];
+
 	int headpos = track * cmd_set->fdd.steps;
 
 	if (cmd_set->fdd.steps == 2) {
 		headpos += cmd_set->alternate & 1;
 
-		if ((retry > 0) && (cmd_set->alternate & 2))
+		if (((retry > 0) && (cmd_set->alternate & 2)) ||
+		    rs == RS_OTHER_POS)
 			headpos ^= 1;
 	}
 
+	cmd_set->gme.postcomp = cmd_set->usr_postcomp;
+
+	if (rs == RS_POSTCOMP) {
+		cmd_set->gme.postcomp += (cmd_set->usr_postcomp > 0.25) ?
+					 -0.25 : 0.25;
+	}
+
 	if (gw_replay_active()) {
 		switch (gw_replay_flux_avail(headpos, side)) {
 		case GW_REPLAY_AVAIL:
@@ -896,6 +1351,11 @@ retry:
 		case GW_REPLAY_EXHAUSTED:
 			msg(MSG_TSUMMARY, " [end of replay data]\n");
 
+			if (resume && retry == trec->retries + 1) {
+				trec->pending = false;
+				return 0;
+			}
+
 			if (retry == 0) {
 				dmkf->header.ntracks =
 					(side == 1) ? track + 1 : track;
@@ -906,18 +1366,27 @@ retry:
 		}
 	}
 
-	int gwret = gw_seek(cmd_set->fdd.gwfd, headpos);
+	int	head = side ^ cmd_set->reverse_sides;
 
-	if (gwret != ACK_OKAY) {
-		msg_fatal("Failed to seek to track %d (%d).\n",
-			  headpos, gwret);
-	}
+	/* Batched, the seek and head select go with the read below. */
+	if (!gw_get_batching()) {
+		uint64_t seek_start = monotime_ns();
 
-	gwret = gw_head(cmd_set->fdd.gwfd, side ^ cmd_set->reverse_sides);
+		int gwret = gw_seek(cmd_set->fdd.gwfd, headpos);
 
-	if (gwret != ACK_OKAY) {
-		msg_fatal("Failed to select side %d (%d).\n",
-			  side ^ cmd_set->reverse_sides, gwret);
+		if (gwret != ACK_OKAY) {
+			msg_fatal("Failed to seek to track %d (%d).\n",
+				  headpos, gwret);
+		}
+
+		gwret = gw_head(cmd_set->fdd.gwfd, head);
+
+		if (gwret != ACK_OKAY) {
+			msg_fatal("Failed to select side %d (%d).\n",
+				  head, gwret);
+		}
+
+		rt->seek_ns += monotime_ns() - seek_start;
 	}
 
 	fdecoder_init(&flux2dmk.fdec, sample_freq);
@@ -926,7 +1395,7 @@ retry:
 	flux2dmk.fdec.first_encoding = *first_encoding;
 	flux2dmk.fdec.cur_encoding   = *first_encoding;
 	flux2dmk.fdec.maxsecsize     = cmd_set->maxsecsize;
-	flux2dmk.fdec.use_hole       = cmd_set->hole;
+	flux2dmk.fdec.use_hole       = cmd_set->hole && !immediate;
 	flux2dmk.fdec.quirk          = cmd_set->quirk;
 	flux2dmk.fdec.reverse_sides  = cmd_set->reverse_sides;
 	flux2dmk.fdec.awaiting_iam   = (cmd_set->iam_pos >= 0) ? true : false;
@@ -935,15 +1404,40 @@ retry:
 	dmk_track_sm_init(&flux2dmk.dtsm,
 			  dds,
 			  &dmkf->header,
-			  &dmkf->track[track][side],
+			  trk,
 			  &dts);
 
 	flux2dmk.dtsm.dmk_iam_pos    = cmd_set->iam_pos;
 	flux2dmk.dtsm.dmk_ignore     = cmd_set->ignore;
 	flux2dmk.dtsm.accum_sectors  = cmd_set->join_sectors;
 
+	struct gw_io_stats	io_before, io_after;
+
+	gw_get_io_stats(&io_before);
+
 	uint8_t *fbuf = 0;
-	ssize_t bytes_read = gw_read_stream(cmd_set->fdd.gwfd, 1, 0, &fbuf);
+	int	revs  = immediate ? 0 : 1;
+	int	ticks = immediate ? cmd_set->rev_ticks * IMMEDIATE_REVS : 0;
+	int	failed = 2;
+	ssize_t bytes_read = gw_get_batching() ?
+		gw_read_stream_at(cmd_set->fdd.gwfd, headpos, head, revs,
+				  ticks, &fbuf, &failed) :
+		gw_read_stream(cmd_set->fdd.gwfd, revs, ticks, &fbuf);
+
+	gw_get_io_stats(&io_after);
+	rr_track_add_xfer(rt, &io_before, &io_after);
+
+	/* Batched, the seek's time is in the read command's round trip. */
+	if (gw_get_batching())
+		rt->batch_ns += io_after.cmd_ns - io_before.cmd_ns;
+
+	if (failed == 0) {
+		msg_fatal("Failed to seek to track %d (%d).\n",
+			  headpos, (int)-bytes_read);
+	} else if (failed == 1) {
+		msg_fatal("Failed to select side %d (%d).\n",
+			  head, (int)-bytes_read);
+	}
 
 	if (bytes_read < 0) {
 		int	gwerr = (int)-bytes_read;
@@ -955,20 +1449,12 @@ retry:
 		return 2;
 	}
 
-	struct pulse_data pdata = { &cmd_set->gme, &flux2dmk };
-	struct gw_decode_stream_s gwds = {
-					  .ds_ticks = 0,
-					  .ds_last_pulse = 0,
-					  .ds_status = -1,
-					  .decoded_imark = imark_fn,
-					  .imark_data = &flux2dmk,
-					  .decoded_space = NULL,
-					  .space_data = NULL,
-					  .decoded_pulse = pulse_fn,
-					  .pulse_data = &pdata
-					 };
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+	uint64_t decode_start = cputime_ns();
 
-	ssize_t dsv = gw_decode_stream(fbuf, bytes_read, &gwds);
+	ssize_t dsv = gwflux_decode_stream(fbuf, bytes_read, &ws,
+					   &cmd_set->gme, &flux2dmk);
 
 	/*
 	 * Check for stream processing errors.
@@ -981,11 +1467,11 @@ retry:
 		msg(MSG_ERRORS, "Decode error from stream\n");
 		free(fbuf);
 		return 3;
-	} else if (dsv < bytes_read && gwds.ds_status > 1) {
+	} else if (dsv < bytes_read && ws.status > 1) {
 		msg(MSG_ERRORS, "Leftover bytes in stream! "
 				"(%d out of %d bytes unparsed, status %d)\n",
 				(int)(bytes_read - dsv), (int)bytes_read,
-				gwds.ds_status);
+				ws.status);
 	}
 
 	msg(MSG_HEX, "[end of data] ");
@@ -994,29 +1480,48 @@ retry:
 
 	gw_decode_flush(&flux2dmk);
 
+	if (immediate && !gw_align_track(&flux2dmk.dtsm)) {
+		rt->codec_cpu_ns += cputime_ns() - decode_start;
+		msg(MSG_TSUMMARY, "[no wraparound; reading from index]\n");
+		immediate = false;
+		goto retry;
+	}
+
 	if (flux2dmk.fdec.use_hole && flux2dmk.dtsm.track_hole_p) {
 		dmk_data_rotate(&flux2dmk.dtsm.trk_working,
 				flux2dmk.dtsm.track_hole_p);
 	}
 
+	rt->codec_cpu_ns += cputime_ns() - decode_start;
+
+	uint64_t merge_start = monotime_ns();
+
 	if ((retry > 0) && flux2dmk.dtsm.accum_sectors) {
-		merge_sectors(flux2dmk.dtsm.trk_merged,
-			      flux2dmk.dtsm.trk_merged_stats,
-			      &flux2dmk.dtsm.trk_working,
-			      &flux2dmk.dtsm.trk_working_stats);
+		merge_sectors_indexed(&dsi,
+				      flux2dmk.dtsm.trk_merged,
+				      flux2dmk.dtsm.trk_merged_stats,
+				      &flux2dmk.dtsm.trk_working,
+				      &flux2dmk.dtsm.trk_working_stats);
 	} else {
 		*flux2dmk.dtsm.trk_merged = flux2dmk.dtsm.trk_working;
 		*flux2dmk.dtsm.trk_merged_stats =
 					flux2dmk.dtsm.trk_working_stats;
+
+		if (flux2dmk.dtsm.accum_sectors)
+			dmk_sector_index_add(&dsi,
+					     &flux2dmk.dtsm.trk_working,
+					     &flux2dmk.dtsm.trk_working_stats);
 	}
 
+	rt->merge_ns += monotime_ns() - merge_start;
+
 	gw_post_process_track(&flux2dmk);
 
 	/*
 	 * Flippy check.
 	 */
 
-	if (track == 0 && side == 1 &&
+	if (!resume && track == 0 && side == 1 &&
 	    dts.good_sectors == 0 &&
 	    flux2dmk.fdec.backward_am >= 9 &&
 	    flux2dmk.fdec.backward_am > dts.errcount) {
@@ -1028,7 +1533,7 @@ retry:
 	 * Check for incompatible formats.
 	 */
 
-	if (cmd_set->check_compat_sides &&
+	if (!resume && cmd_set->check_compat_sides &&
 	    cmd_set->fdd.sides == 2 &&
 	    track == 0 &&
 	    dts.good_sectors > 0) {
@@ -1053,7 +1558,7 @@ retry:
 	 * Guess sides check.
 	 */
 
-	if (cmd_set->guess_sides && side == 1) {
+	if (!resume && cmd_set->guess_sides && side == 1) {
 		cmd_set->guess_sides = false;
 
 		if (dts.good_sectors == 0) {
@@ -1067,7 +1572,7 @@ retry:
 	 * Guess steps check.
 	 */
 
-	if (cmd_set->guess_steps) {
+	if (!resume && cmd_set->guess_steps) {
 		if (track == 3)
 			cmd_set->guess_steps = 0;
 
@@ -1095,6 +1600,11 @@ retry:
 				    "[single-stepping apparently needed; "
 				    "restarting]\n");
 
+				/* A clean read is still good; keep it. */
+				if (dts.errcount == 0)
+					track_rec_set(trec, retry,
+						      &flux2dmk, &dts);
+
 				cmd_set->fdd.steps = 1;
 				if (cmd_set->guess_tracks) {
 					cmd_set->fdd.tracks =
@@ -1111,7 +1621,7 @@ retry:
 	 * Guess tracks check.
 	 */
 
-	if (cmd_set->guess_tracks &&
+	if (!resume && cmd_set->guess_tracks &&
 	    (track == 35 || track >= 40) &&
 	    (dts.good_sectors == 0 ||
 	     (side == 0 &&
@@ -1135,6 +1645,31 @@ retry:
 		 (gw_replay_active() &&
 		  retry < cmd_set->min_retries[track][side]));
 
+	/*
+	 * Give up on the track, or read it another way, once retries
+	 * stop recovering sectors.  Progress is counted in distinct
+	 * good sectors seen across reads, or fewer errors in the
+	 * merged track.
+	 */
+
+	struct dmk_track_stats	*mstats = flux2dmk.dtsm.trk_merged_stats;
+	int			good_seen = flux2dmk.dtsm.accum_sectors ?
+				    dsi.cnt : mstats->good_sectors +
+					      mstats->reused_sectors;
+
+	enum retry_verdict verdict =
+			retry_policy_update(&rp, good_seen, mstats->errcount);
+
+	if (failing && retry >= cmd_set->min_retries[track][side]) {
+		if (verdict == RP_STOP) {
+			failing       = false;
+			retries_saved = cmd_set->retries[track][side] - retry;
+		} else if (verdict == RP_SWITCH) {
+			msg(MSG_TSUMMARY, "[stalled; trying %s] ",
+			    read_strategy_desc[strat[rp.strategy]]);
+		}
+	}
+
 	/* Generally just reporting on the latest read. */
 	if (failing) {
 		if (cmd_set->min_sectors[track][side] &&
@@ -1187,7 +1722,10 @@ retry:
 		menu_requested = 0;
 	}
 
-	if (failing && ++retry)
+	/* Deferred, a failing track is read once per call. */
+	pending = failing && cmd_set->defer_retries;
+
+	if (failing && !pending && ++retry)
 		goto retry;
 
 leave:;
@@ -1197,6 +1735,7 @@ leave:;
 
 	int	min_sector_cnt = cmd_set->min_sectors[track][side];
 	int	reused_sectors = flux2dmk.dtsm.trk_merged_stats->reused_sectors;
+	struct dmk_track_stats	merged = dts;
 
 	dts.good_sectors += reused_sectors;
 
@@ -1210,28 +1749,29 @@ leave:;
 	if (reused_sectors > 0)
 		msg(MSG_TSUMMARY, " (%d reused)", reused_sectors);
 
-	msg(MSG_TSUMMARY, ", %d error%s\n", dts.errcount, plu(dts.errcount));
+	msg(MSG_TSUMMARY, ", %d error%s%s\n", dts.errcount, plu(dts.errcount),
+	    pending ? " [retry deferred]" :
+	    retries_saved ? " [retries stalled]" : "");
 	msg(MSG_IDS, "\n");
 
+	rt->good_sectors = dts.good_sectors;
+	rt->errors       = dts.errcount;
+
 	/*
-	 * Update disk stats.
+	 * Record the track and update disk stats.
 	 */
 
-	dds->retries_total      += retry;
-	dds->good_sectors_total += dts.good_sectors;
-	dds->errcount_total     += dts.errcount;
+	cmd_set->gme.postcomp = cmd_set->usr_postcomp;
 
-	for (int i = 0; i < N_ENCS; ++i)
-		dds->enc_count_total[i] += dts.enc_count[i];
+	track_rec_set(trec, retry, &flux2dmk, &dts);
+	trec->pending       = pending;
+	trec->merged        = merged;
+	trec->rp            = rp;
+	trec->retries_saved = retries_saved;
 
-	if (dts.errcount > 0) {
-		dds->err_tracks++;
-	} else if (dts.good_sectors) {
-		dds->good_tracks++;
-	}
-
-	if (flux2dmk.fdec.flippy)
-		dds->flippy = true;
+	/* Deferred retries recount the disk stats when done. */
+	if (!resume)
+		dds_add_track(dds, trec);
 
 	*first_encoding	= flux2dmk.fdec.first_encoding;
 	*prev_cyl	= flux2dmk.fdec.cyl_seen;
@@ -1240,11 +1780,244 @@ leave:;
 }
 
 
-static void
+/*
+ * Read the track and side as above, working on it out of the image
+ * and storing what the read leaves back into it.
+ */
+
+static int
+read_track(struct cmd_settings *cmd_set,
+	   uint32_t sample_freq,
+	   struct dmk_file *dmkf,
+	   struct dmk_disk_stats *dds,
+	   int track,
+	   int side,
+	   int *first_encoding,
+	   int *prev_cyl,
+	   int *t0s0ss,
+	   struct track_rec *trec,
+	   struct rr_track *rt)
+{
+	static struct dmk_track	trk;
+
+	dmk_file_get_track(dmkf, track, side, &trk);
+
+	int	ret = read_track_into(cmd_set, sample_freq, dmkf, &trk, dds,
+				      track, side, first_encoding, prev_cyl,
+				      t0s0ss, trec, rt);
+
+	if (dmk_file_put_track(dmkf, track, side, &trk) != 0)
+		msg_fatal("Out of memory for track %d, side %d.\n",
+			  track, side);
+
+	return ret;
+}
+
+
+/*
+ * Physical cylinder a track is read from with the given stepping
+ * (the first pass; retries may alternate to the other half-track).
+ */
+
+static int
+track_headpos(struct cmd_settings *cmd_set, int track, int steps)
+{
+	return track * steps + ((steps == 2) ? (cmd_set->alternate & 1) : 0);
+}
+
+
+/*
+ * After a stepping change from old_steps to cmd_set->fdd.steps,
+ * move the tracks already read to where they belong under the new
+ * stepping.  Tracks read from a cylinder the new stepping never
+ * visits are dropped.  Returns the count of tracks kept.
+ */
+
+static int
+remap_tracks(struct cmd_settings *cmd_set,
+	     struct dmk_file *dmkf,
+	     struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES],
+	     int old_steps)
+{
+	int	new_steps = cmd_set->fdd.steps;
+	int	kept = 0;
+
+	/* Double- to single-stepping moves tracks up, so walk down;
+	 * single- to double-stepping moves them down, so walk up. */
+	int	first = (new_steps < old_steps) ? DMK_MAX_TRACKS - 1 : 0;
+	int	last  = (new_steps < old_steps) ? -1 : DMK_MAX_TRACKS;
+	int	dir   = (new_steps < old_steps) ? -1 : 1;
+
+	for (int t = first; t != last; t += dir) {
+		int	cyl = track_headpos(cmd_set, t, old_steps);
+		int	nt  = -1;
+
+		if (new_steps == 1) {
+			nt = cyl;
+		} else if (new_steps == 2) {
+			int	off = cyl - (cmd_set->alternate & 1);
+
+			if (off >= 0 && !(off & 1))
+				nt = off / 2;
+		}
+
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			if (!trecs[t][s].have)
+				continue;
+
+			if (nt >= 0 && nt < DMK_MAX_TRACKS) {
+				if (nt != t) {
+					dmk_file_move_track(dmkf, nt, s, t, s);
+					trecs[nt][s] = trecs[t][s];
+				}
+
+				++kept;
+			}
+
+			if (nt != t)
+				trecs[t][s].have = false;
+		}
+	}
+
+	for (int t = 0; t < DMK_MAX_TRACKS; ++t) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			if (!trecs[t][s].have)
+				dmk_file_clear_track(dmkf, t, s);
+		}
+	}
+
+	return kept;
+}
+
+
+/* The run report record of a track's earlier reads, or a new one. */
+
+static struct rr_track *
+rr_track_resume(int track, int side)
+{
+	for (int i = run_report.cnt - 1; i >= 0; --i) {
+		struct rr_track	*rt = &run_report.tracks[i];
+
+		if (rt->track == track && rt->side == side)
+			return rt;
+	}
+
+	return rr_track_new(&run_report, track, side);
+}
+
+
+/*
+ * Retry the tracks the first pass left pending, one more read of
+ * each per pass until none remain.  Passes sweep alternately down
+ * and up the disk from where the head was left, so it only steps
+ * between pending tracks, reading both sides of each cylinder.
+ * Returns false if cut short.
+ */
+
+static bool
+retry_deferred(struct cmd_settings *cmd_set,
+	       uint32_t sample_freq,
+	       struct dmk_file *dmkf,
+	       struct dmk_disk_stats *dds,
+	       struct track_rec trecs[DMK_MAX_TRACKS][DMK_SIDES],
+	       int tracks,
+	       int sides)
+{
+	for (int pass = 1; ; ++pass) {
+		int	pending = 0;
+
+		for (int h = 0; h < tracks; ++h) {
+			for (int s = 0; s < sides; ++s)
+				pending += trecs[h][s].pending;
+		}
+
+		if (pending == 0)
+			return true;
+
+		msg(MSG_NORMAL, "Retry pass %d: %d track%s\n",
+		    pass, pending, plu(pending));
+
+		bool	down = pass & 1;
+
+		for (int i = 0; i < tracks; ++i) {
+			int	h = down ? tracks - 1 - i : i;
+
+			for (int s = 0; s < sides; ++s) {
+				struct track_rec	*trec = &trecs[h][s];
+
+				if (!trec->pending)
+					continue;
+
+				struct rr_track *rt = rr_track_resume(h, s);
+
+				if (!rt)
+					msg_fatal("Cannot allocate run "
+						  "report.\n");
+
+				struct gw_io_stats	io_before, io_after;
+				uint64_t		track_start =
+								monotime_ns();
+
+				gw_get_io_stats(&io_before);
+
+				int	first_encoding = trec->first_encoding;
+				int	prev_cyl       = trec->cyl_seen;
+				int	t0s0ss         = -1;
+
+				int rtv = read_track(cmd_set, sample_freq,
+						     dmkf, dds, h, s,
+						     &first_encoding,
+						     &prev_cyl, &t0s0ss,
+						     trec, rt);
+
+				rt->total_ns += monotime_ns() - track_start;
+				gw_get_io_stats(&io_after);
+				rr_track_add_io(rt, &io_before, &io_after);
+
+				ckpt_track(cmd_set, dmkf, trecs, h, s);
+
+				if (rtv != 0 || exit_requested)
+					return false;
+			}
+		}
+	}
+}
+
+
+/*
+ * Read the disk into "dmkf".  Returns true if the read finished,
+ * false if it was cut short.
+ */
+
+static bool
 gw2dmk(struct cmd_settings *cmd_set,
        uint32_t sample_freq,
        struct dmk_file *dmkf)
 {
+	static struct track_rec	trecs[DMK_MAX_TRACKS][DMK_SIDES];
+	bool			finished = false;
+
+	memset(trecs, 0, sizeof(trecs));
+	dmk_file_free(dmkf);
+	dmk_header_init(&dmkf->header, 0, DMKRD_TRACKLEN_MAX);
+
+	long	ckpt_keep = 0;
+
+	if (cmd_set->resume)
+		ckpt_keep = ckpt_resume(cmd_set, dmkf, trecs);
+
+	if (ckpt_path) {
+		ckpt_fp = ckpt_open(ckpt_path, ckpt_keep);
+
+		if (!ckpt_fp) {
+			msg_error("Failed to open checkpoint '%s': %s (%d); "
+				  "continuing without one\n", ckpt_path,
+				  strerror(errno), errno);
+		}
+	}
+
+	int t0s0ss = -1;
+
 restart:
 	if (cmd_set->guess_sides ||
 	    cmd_set->guess_steps ||
@@ -1258,10 +2031,15 @@ restart:
         	    encoding_name(cmd_set->usr_encoding));
 	}
 
-	dmk_file_init(dmkf);
+	dmk_header_init(&dmkf->header, 0, DMKRD_TRACKLEN_MAX);
+
+	/*
+	 * Tracks kept from before a restart count toward the totals
+	 * without being read again.
+	 */
 
 	struct dmk_disk_stats dds;
-	dmk_disk_stats_init(&dds);
+	dds_recount(&dds, trecs);
 
 	int tracks = cmd_set->fdd.tracks;
 	if (dmkf->header.ntracks < tracks)
@@ -1277,6 +2055,14 @@ restart:
 	if (cmd_set->usr_encoding == RX02)
 		dmkf->header.options |= DMK_RX02_OPT;
 
+	/* A resumed checkpoint already has the tracks kept. */
+	if (ckpt_keep)
+		ckpt_track(cmd_set, dmkf, trecs, -1, 0);
+	else
+		ckpt_start(cmd_set, dmkf, trecs);
+
+	ckpt_keep = 0;
+
 	/*
 	 * Loop over tracks.
 	 */
@@ -1286,19 +2072,57 @@ restart:
 	int first_encoding =
 		(cmd_set->usr_encoding == RX02) ? FM : cmd_set->usr_encoding;
 	int prev_cyl = -1;
-	int t0s0ss = -1;
 
 	for (int h = 0; h < tracks; ++h) {
 
 		for (int s = 0; s < sides; ++s) {
+			if (trecs[h][s].have) {
+				msg(MSG_TSUMMARY, "Track %d, side %d: "
+				    "[kept from earlier read]\n", h, s);
+
+				first_encoding = trecs[h][s].first_encoding;
+				prev_cyl       = trecs[h][s].cyl_seen;
+				continue;
+			}
+
+			int old_steps = cmd_set->fdd.steps;
+
+			struct rr_track *rt = rr_track_new(&run_report, h, s);
+
+			if (!rt)
+				msg_fatal("Cannot allocate run report.\n");
+
+			struct gw_io_stats	io_before, io_after;
+			uint64_t		track_start = monotime_ns();
+
+			gw_get_io_stats(&io_before);
+
 			int rtv = read_track(cmd_set, sample_freq,
 					     dmkf, &dds, h, s,
 					     &first_encoding, &prev_cyl,
-					     &t0s0ss);
+					     &t0s0ss, &trecs[h][s], rt);
+
+			rt->total_ns = monotime_ns() - track_start;
+			gw_get_io_stats(&io_after);
+			rr_track_add_io(rt, &io_before, &io_after);
+
+			/* A restart checkpoints the tracks it keeps. */
+			if (rtv != -2)
+				ckpt_track(cmd_set, dmkf, trecs, h, s);
 
 			switch (rtv) {
-			case -2:
+			case -2: {
+				int kept = remap_tracks(cmd_set, dmkf, trecs,
+							old_steps);
+
+				if (kept) {
+					msg(MSG_NORMAL,
+					    "[keeping %d track%s already "
+					    "read]\n", kept, plu(kept));
+				}
+
 				goto restart;
+			}
 
 			case -1:
 				sides = cmd_set->fdd.sides;
@@ -1308,7 +2132,9 @@ restart:
 			case 0:
 				break;
 
-			case 1:  /* FALL THRU */
+			case 1:
+				goto deferred;
+
 			default:
 				goto leave;
 			}
@@ -1318,6 +2144,18 @@ restart:
 		}
 	}
 
+deferred:
+	finished = !exit_requested;
+
+	if (cmd_set->defer_retries) {
+		int ntracks = (dmkf->header.ntracks < tracks) ?
+				dmkf->header.ntracks : tracks;
+
+		finished = retry_deferred(cmd_set, sample_freq, dmkf, &dds,
+					  trecs, ntracks, sides);
+		dds_recount(&dds, trecs);
+	}
+
 leave:
 	reading_floppy = false;
 
@@ -1336,10 +2174,24 @@ leave:
 	    dds.errcount_total, plu(dds.errcount_total),
 	    dds.retries_total, (dds.retries_total == 1) ? "y" : "ies");
 
+	if (dds.stalled_tracks) {
+		msg(MSG_SUMMARY, "%d track%s stopped retrying when reads "
+		    "stalled, %d retr%s saved\n",
+		    dds.stalled_tracks, plu(dds.stalled_tracks),
+		    dds.retries_saved, (dds.retries_saved == 1) ? "y" : "ies");
+	}
+
 	if (dds.flippy) {
 		msg(MSG_SUMMARY,
 		    "Possibly a flippy disk.  Check reverse side too.\n");
 	}
+
+	if (ckpt_fp) {
+		fclose(ckpt_fp);
+		ckpt_fp = NULL;
+	}
+
+	return finished;
 }
 
 
@@ -1368,6 +2220,37 @@ gw_get_histo_analysis(gw_devt gwfd,
 }
 
 
+/*
+ * Classify the drive and media by the speed and bit rate of track 0.
+ * Returns the kind, or -1 if unrecognized.
+ */
+
+static int
+rate2kind(double rpm, double brate)
+{
+	if (rpm > 270.0 && rpm < 330.0) {
+		/* 300 RPM */
+		if (brate > 225.0 && brate < 287.5) {
+			/* Bit rate 250 kHz */
+			return 2;
+		} else if (brate > 450.0 && brate < 575.5) {
+			/* Bit rate 500 kHz */
+			return 4;
+		}
+	} else if (rpm > 330.0 && rpm < 396.0) {
+		/* 360 RPM */
+		if (brate > 270.0 && brate < 345.0) {
+			/* Bit rate 300 kHz */
+			return 1;
+		} else if (brate > 450.0 && brate < 575.0) {
+			return 3;
+		}
+	}
+
+	return -1;
+}
+
+
 /*
  * Detect kind of drive using its media.
  *
@@ -1406,24 +2289,8 @@ redo_kind:;
 	double rpm   = ha->rpm;
 	double brate = ha->bit_rate_khz;
 
-	if (rpm > 270.0 && rpm < 330.0) {
-		/* 300 RPM */
-		if (brate > 225.0 && brate < 287.5) {
-			/* Bit rate 250 kHz */
-			kind = 2;
-		} else if (brate > 450.0 && brate < 575.5) {
-			/* Bit rate 500 kHz */
-			kind = 4;
-		}
-	} else if (rpm > 330.0 && rpm < 396.0) {
-		/* 360 RPM */
-		if (brate > 270.0 && brate < 345.0) {
-			/* Bit rate 300 kHz */
-			kind = 1;
-		} else if (brate > 450.0 && brate < 575.0) {
-			kind = 3;
-		}
-	}
+	if (kind == -1)
+		kind = rate2kind(rpm, brate);
 
 	if (kind == -1) {
 		msg_fatal("Failed to detect drive and media type.\n"
@@ -1452,6 +2319,55 @@ redo_kind:;
 }
 
 
+/*
+ * Confirm the drive's cached calibration with one revolution of
+ * track 0: the media must read as the same kind at about the same
+ * speed.  Saves the detection reads, including the second one after
+ * guessing the wrong density select.
+ *
+ * Returns true with fdd->kind and fdd->densel set and "ha" filled.
+ */
+
+static bool
+gw_calib_check(struct gw_fddrv *fdd,
+	       const struct gw_info *gw_info,
+	       const struct gw_calib *cal,
+	       struct histo_analysis *ha)
+{
+	if (cal->kind < 1 || cal->kind > 4 ||
+	    (fdd->densel != DS_NOTSET && fdd->densel != cal->densel))
+		return false;
+
+	if (gw_setdrive(fdd->gwfd, fdd->drive, cal->densel) != ACK_OKAY)
+		msg_fatal("Failed to select and start drive.\n");
+
+	struct histogram	histo;
+
+	histo_init(0, 0, 1, gw_info->sample_freq, TICKS_PER_BUCKET, &histo);
+
+	gw_get_histo_analysis(fdd->gwfd, &histo, ha);
+
+	if (ha->peaks == 0 || histo.data_overflow > 25 ||
+	    fabs(ha->rpm - cal->rpm) > cal->rpm * CALIB_RPM_TOLERANCE ||
+	    rate2kind(ha->rpm, ha->bit_rate_khz) != cal->kind) {
+		msg(MSG_TSUMMARY, "Drive calibration doesn't match; "
+				  "detecting anew\n");
+		return false;
+	}
+
+	fdd->kind   = cal->kind;
+	fdd->densel = cal->densel;
+
+	msg(MSG_NORMAL, "Detected %s (calibrated)\n", kind2desc(fdd->kind));
+	msg(MSG_TSUMMARY, "    (bit rate %.1f kHz, rpm %.1f, "
+			  "density select %s)\n",
+			  ha->bit_rate_khz, ha->rpm,
+			  fdd->densel == DS_HD ? "HD" : "DD");
+
+	return true;
+}
+
+
 static int
 gw_detect_sides(struct gw_fddrv *fdd,
 		const struct gw_info *gw_info)
@@ -1592,13 +2508,34 @@ main(int argc, char **argv)
 	 * Ensure DMK file doesn't yet exist if force writing not active.
 	 */
 
-	if (!cmd_settings.forcewrite &&
+	if (!cmd_settings.forcewrite && !cmd_settings.resume &&
 	    access(cmd_settings.dmkfile, F_OK) == 0) {
 		msg_fatal("DMK file '%s' exists.\n"
 		"    (Use the --force option if you want to ignore this "
 		"check.\n", cmd_settings.dmkfile);
 	}
 
+	/*
+	 * The checkpoint of an unfinished read sits beside its DMK file.
+	 */
+
+	if (cmd_settings.checkpoint || cmd_settings.resume) {
+		ckpt_path = malloc(strlen(cmd_settings.dmkfile) + 6);
+
+		if (!ckpt_path)
+			msg_fatal("Malloc of checkpoint path failed.\n");
+
+		sprintf(ckpt_path, "%s.ckpt", cmd_settings.dmkfile);
+
+		if (!cmd_settings.resume && !cmd_settings.forcewrite &&
+		    access(ckpt_path, F_OK) == 0) {
+			msg_fatal("Checkpoint '%s' of an unfinished read "
+			"exists.\n"
+			"    (Use the --resume option to finish the read, or "
+			"--force to start over.)\n", ckpt_path);
+		}
+	}
+
 	/*
 	 * Stop spinning the drive when handling fatal signals
 	 * XXX Is this even needed for GW with its motor timeout?
@@ -1655,6 +2592,8 @@ main(int argc, char **argv)
 
 	cleanup_gwfd = cmd_settings.fdd.gwfd;
 
+	gw_set_batching(cmd_settings.batch);
+
 	if (cmd_settings.fdd.drive == -1) {
 		if (cmd_settings.replayfile)
 			cmd_settings.fdd.drive = 0;
@@ -1662,6 +2601,33 @@ main(int argc, char **argv)
 			exit(EXIT_FAILURE);
 	}
 
+	/*
+	 * Look up the drive's calibration from earlier runs, and use its
+	 * step and settle delays unless given others.
+	 */
+
+	const char	*gw_id = gw_selected_id();
+	char		*calib_file = NULL;
+	struct gw_calib	calib;
+	bool		have_calib = false;
+
+	if (cmd_settings.use_calib && !cmd_settings.replayfile && gw_id &&
+	    (calib_file = calib_path())) {
+		have_calib = calib_load(calib_file, gw_id,
+					cmd_settings.fdd.drive, &calib);
+	}
+
+	if (have_calib && cmd_settings.fdd.step_ms == -1 &&
+	    cmd_settings.fdd.settle_ms == -1) {
+		cmd_settings.fdd.step_ms   = calib.step_ms;
+		cmd_settings.fdd.settle_ms = calib.settle_ms;
+
+		if (gw_set_delays(cmd_settings.fdd.gwfd,
+				  cmd_settings.fdd.step_ms,
+				  cmd_settings.fdd.settle_ms))
+			exit(EXIT_FAILURE);
+	}
+
 	/*
 	 * Detect drive kind and characteristics.
 	 */
@@ -1670,8 +2636,26 @@ main(int argc, char **argv)
 	bool			have_ha = false;
 
 	if (cmd_settings.fdd.kind == -1) {
-		gw_detect_drive_kind(&cmd_settings.fdd, &gw_info, &ha);
+		if (!have_calib || !gw_calib_check(&cmd_settings.fdd,
+						   &gw_info, &calib, &ha))
+			gw_detect_drive_kind(&cmd_settings.fdd, &gw_info, &ha);
 		have_ha = true;
+
+		struct gw_calib	new_calib = {
+			.kind      = cmd_settings.fdd.kind,
+			.densel    = cmd_settings.fdd.densel,
+			.rpm       = ha.rpm,
+			.step_ms   = cmd_settings.fdd.step_ms,
+			.settle_ms = cmd_settings.fdd.settle_ms
+		};
+
+		if (calib_file && (!have_calib ||
+				   calib_changed(&calib, &new_calib)) &&
+		    calib_store(calib_file, gw_id, cmd_settings.fdd.drive,
+				&new_calib)) {
+			msg(MSG_NORMAL, "Couldn't save drive calibration to "
+			    "'%s': %s\n", calib_file, strerror(errno));
+		}
 	} else {
 		if (cmd_settings.fdd.densel == DS_NOTSET)
 			cmd_settings.fdd.densel =
@@ -1709,6 +2693,13 @@ main(int argc, char **argv)
 
 	gme->postcomp = cmd_settings.usr_postcomp;
 
+	/* One revolution, for reads that don't wait for the hole. */
+	double	rev_rpm = (have_ha && ha.rpm > 0.0) ? ha.rpm :
+			  (cmd_settings.fdd.kind == 1 ||
+			   cmd_settings.fdd.kind == 3) ? 360.0 : 300.0;
+
+	cmd_settings.rev_ticks = gw_info.sample_freq * 60.0 / rev_rpm;
+
 	msg(MSG_TSUMMARY, "Thresholds");
 	if (cmd_settings.use_histo)
 		msg(MSG_TSUMMARY, " from histogram");
@@ -1773,12 +2764,14 @@ main(int argc, char **argv)
 	 * "dmkf" can't be on the stack because MSW doesn't like it.
 	 */
 
-	struct dmk_file *dmkf = malloc(sizeof(struct dmk_file));
+	struct dmk_file *dmkf = calloc(1, sizeof(struct dmk_file));
 
 	if (!dmkf)
 		msg_fatal("Malloc of dmkf failed.\n");
 
-	gw2dmk(&cmd_settings, gw_info.sample_freq, dmkf);
+	rr_init(&run_report, "gw2dmk");
+
+	bool	finished = gw2dmk(&cmd_settings, gw_info.sample_freq, dmkf);
 
 	/*
 	 * Optimize the DMK if needed and save it.
@@ -1806,12 +2799,15 @@ main(int argc, char **argv)
 	msg(MSG_NORMAL, "Writing DMK...");
 	msg_scrn_flush();
 
-	FILE *dmkfp = fopenwx(cmd_settings.dmkfile, !cmd_settings.forcewrite);
+	dmkf->zipped = dmkz_path(cmd_settings.dmkfile);
+
+	bool	exclusive = !cmd_settings.forcewrite && !cmd_settings.resume;
+	FILE	*dmkfp = fopenwx(cmd_settings.dmkfile, exclusive);
 
 	if (!dmkfp) {
 		msg_fatal("Failed to open DMK file '%s'%s: %s (%d)\n",
 			  cmd_settings.dmkfile,
-			  cmd_settings.forcewrite ? " " : " exclusively",
+			  exclusive ? " exclusively" : " ",
 			  strerror(errno), errno);
 	}
 
@@ -1827,8 +2823,29 @@ main(int argc, char **argv)
 
 	msg(MSG_NORMAL, "done!\n");
 
+	dmk_file_free(dmkf);
 	free(dmkf);
 
+	if (ckpt_path) {
+		if (!finished) {
+			msg(MSG_NORMAL, "Read unfinished; use --resume to "
+			    "finish it from checkpoint '%s'.\n", ckpt_path);
+		} else if (remove(ckpt_path) && errno != ENOENT) {
+			msg_error("Failed to remove checkpoint '%s': %s (%d)\n",
+				  ckpt_path, strerror(errno), errno);
+		}
+
+		free(ckpt_path);
+	}
+
+	if (cmd_settings.reportfile &&
+	    rr_write(&run_report, cmd_settings.reportfile)) {
+		msg_error("Failed to write report file '%s': %s (%d)\n",
+			  cmd_settings.reportfile, strerror(errno), errno);
+	}
+
+	rr_free(&run_report);
+
 	/*
 	 * Finish up and close out.
 	 */
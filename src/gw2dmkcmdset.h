@@ -34,11 +34,17 @@ struct cmd_settings {
 	bool			guess_steps;
 	bool			check_compat_sides;
 	bool			reset_on_init;
+	bool			use_calib;
+	bool			batch;
 	bool			forcewrite;
+	bool			checkpoint;
+	bool			resume;
 	bool			use_histo;
 	enum dmk_encoding_mode	usr_encoding;
 	bool			reverse_sides;
 	bool			hole;
+	bool			immediate;
+	uint32_t		rev_ticks;
 	bool			alternate;
 	unsigned int		quirk;
 	int			iam_pos;
@@ -50,6 +56,9 @@ struct cmd_settings {
 	int			ignore;
 	int			maxsecsize;
 	bool			join_sectors;
+	bool			defer_retries;
+	int			stall_limit;
+	bool			vary_reads;
 	volatile bool		menu_intr_enabled;
 	bool			menu_err_enabled;
 	int			scrn_verbosity;
@@ -59,6 +68,7 @@ struct cmd_settings {
 	const char		*logfile;
 	const char		*devlogfile;
 	const char		*replayfile;
+	const char		*reportfile;
 	const char		*dmkfile;
 	struct gw_media_encoding	gme;
 	int			min_sectors[DMK_MAX_TRACKS][2];
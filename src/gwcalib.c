@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cfgfile.h"
+#include "gwcalib.h"
+
+
+#define CALIB_LINE_MAX	512
+
+/* RPM drift below this fraction isn't worth rewriting the cache. */
+#define CALIB_RPM_SLOP	0.01
+
+
+char *
+calib_path(void)
+{
+	return cfg_dir_path("calib.txt");
+}
+
+
+/*
+ * Parse one cache line.  Returns true with "unit", "cal", and the
+ * start of the ID in "id" set (newline stripped) for a drive entry.
+ */
+
+static bool
+calib_parse(char *line, int *unit, struct gw_calib *cal, char **id)
+{
+	int	n = -1;
+
+	if (line[0] == '#')
+		return false;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (sscanf(line, "%d %d %d %lf %d %d %n", unit, &cal->kind,
+		   &cal->densel, &cal->rpm, &cal->step_ms,
+		   &cal->settle_ms, &n) != 6 || n == -1 || !line[n])
+		return false;
+
+	*id = &line[n];
+
+	return true;
+}
+
+
+bool
+calib_load(const char *path, const char *id, int unit,
+	   struct gw_calib *cal)
+{
+	FILE	*fp = fopen(path, "r");
+	char	line[CALIB_LINE_MAX];
+	bool	found = false;
+
+	if (!fp)
+		return false;
+
+	while (!found && fgets(line, sizeof(line), fp)) {
+		struct gw_calib	c;
+		int		u;
+		char		*lid;
+
+		if (calib_parse(line, &u, &c, &lid) && u == unit &&
+		    !strcmp(lid, id)) {
+			*cal  = c;
+			found = true;
+		}
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+
+int
+calib_store(const char *path, const char *id, int unit,
+	    const struct gw_calib *cal)
+{
+	size_t	plen = strlen(path);
+	char	*tmp = malloc(plen + 5);
+
+	if (!tmp)
+		return -1;
+
+	sprintf(tmp, "%s.new", path);
+
+	/* Make the directory if this is the first file in it. */
+	char	*slash = strrchr(tmp, '/');
+#if defined(WIN64) || defined(WIN32)
+	char	*bslash = strrchr(tmp, '\\');
+
+	if (bslash > slash)
+		slash = bslash;
+#endif
+
+	if (slash) {
+		*slash = '\0';
+#if defined(WIN64) || defined(WIN32)
+		mkdir(tmp);
+#else
+		mkdir(tmp, 0777);
+#endif
+		*slash = path[slash - tmp];
+	}
+
+	FILE	*out = fopen(tmp, "w");
+
+	if (!out) {
+		free(tmp);
+		return -1;
+	}
+
+	fputs("# gw2dmk drive calibration cache; safe to delete.\n"
+	      "# unit kind densel rpm step_ms settle_ms id\n", out);
+
+	/* Copy the other drives' lines. */
+	FILE	*in = fopen(path, "r");
+	char	line[CALIB_LINE_MAX];
+
+	while (in && fgets(line, sizeof(line), in)) {
+		char		copy[CALIB_LINE_MAX];
+		struct gw_calib	c;
+		int		u;
+		char		*lid;
+
+		strcpy(copy, line);
+
+		if (calib_parse(copy, &u, &c, &lid) &&
+		    !(u == unit && !strcmp(lid, id)))
+			fputs(line, out);
+	}
+
+	if (in)
+		fclose(in);
+
+	fprintf(out, "%d %d %d %.3f %d %d %s\n", unit, cal->kind,
+		cal->densel, cal->rpm, cal->step_ms, cal->settle_ms, id);
+
+	int	ret = (ferror(out) | fclose(out)) ? -1 : 0;
+
+#if defined(WIN64) || defined(WIN32)
+	if (ret == 0)
+		remove(path);
+#endif
+
+	if (ret == 0)
+		ret = rename(tmp, path);
+
+	if (ret != 0) {
+		int	err = errno;
+
+		remove(tmp);
+		errno = err;
+	}
+
+	free(tmp);
+
+	return ret;
+}
+
+
+bool
+calib_changed(const struct gw_calib *a, const struct gw_calib *b)
+{
+	return a->kind != b->kind || a->densel != b->densel ||
+	       a->step_ms != b->step_ms || a->settle_ms != b->settle_ms ||
+	       fabs(a->rpm - b->rpm) > a->rpm * CALIB_RPM_SLOP;
+}
@@ -0,0 +1,64 @@
+#ifndef GWCALIB_H
+#define GWCALIB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+/*
+ * Persistent drive calibration cache.
+ *
+ * What gw2dmk learns about a drive at startup (its kind, density
+ * select, and speed) is kept per Greaseweazle and drive unit, along
+ * with any step and settle delays given for it, so later runs can
+ * confirm it with a single revolution instead of detecting it anew.
+ *
+ * The cache is a text file next to the default config file, one
+ * drive per line:
+ *
+ *   unit kind densel rpm step_ms settle_ms id
+ *
+ * where "id" (the rest of the line) is the Greaseweazle's USB serial
+ * or device name, and -1 marks an unset delay.  Lines starting with
+ * '#' are comments.
+ */
+
+struct gw_calib {
+	int	kind;
+	int	densel;
+	double	rpm;
+	int	step_ms;	/* -1 if not set */
+	int	settle_ms;	/* -1 if not set */
+};
+
+
+/* Return the malloc'd path of the cache file, or NULL if none. */
+extern char *calib_path(void);
+
+/*
+ * Look up the calibration of drive "unit" on the GW "id".  Returns
+ * true and fills "cal" if found.
+ */
+extern bool calib_load(const char *path, const char *id, int unit,
+		       struct gw_calib *cal);
+
+/*
+ * Record the calibration of drive "unit" on the GW "id", replacing
+ * any earlier one.  Returns 0 on success, or -1 with a reason in
+ * "errno".
+ */
+extern int calib_store(const char *path, const char *id, int unit,
+		       const struct gw_calib *cal);
+
+/* True if "a" and "b" differ enough to be worth storing again. */
+extern bool calib_changed(const struct gw_calib *a,
+			  const struct gw_calib *b);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
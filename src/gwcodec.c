@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gwx.h"
+#include "gwwalk.h"
+#include "misc.h"
+#include "gwcodec.h"
+
+
+struct t2gw_data {
+	uint8_t		*tbuf;
+	size_t		tbuf_len;
+	size_t		tbuf_cnt;
+	uint32_t 	nfa_thresh;
+	uint32_t 	nfa_period;
+};
+
+
+static int
+encode_t2gw(uint32_t ticks, void *data)
+{
+	if (ticks == 0)
+		return 0;
+
+	struct t2gw_data *t2gwd = (struct t2gw_data *)data;
+
+	if (t2gwd->tbuf_cnt + GWCODE_MAX >= t2gwd->tbuf_len) {
+		/* Not expected given stream_bound(), but never fail
+		 * a write over a buffer estimate. */
+		size_t	nlen = t2gwd->tbuf_len * 2;
+		uint8_t	*nbuf = realloc(t2gwd->tbuf, nlen);
+
+		if (!nbuf)
+			return -1;
+
+		t2gwd->tbuf     = nbuf;
+		t2gwd->tbuf_len = nlen;
+	}
+
+	t2gwd->tbuf_cnt += encode_ticks(ticks,
+					t2gwd->nfa_thresh,
+					t2gwd->nfa_period,
+					&t2gwd->tbuf[t2gwd->tbuf_cnt]);
+
+	return 0;
+}
+
+
+/*
+ * Upper bound on the stream bytes for a track.  Each DMK byte is 16
+ * encode_bit() half-cells, flux transitions are at least two
+ * half-cells apart, and encode_ticks() never needs more stream bytes
+ * for a transition than the half-cells it spans, so 16 bytes per DMK
+ * byte covers the track, any bytes before it moved in by -i, and any
+ * fill.  Add room for the final, erase, and dummy pulses and the
+ * terminator.
+ */
+
+static size_t
+stream_bound(const struct extra_track_info *eti)
+{
+	int	len = max(eti->track_len, eti->fill_len) + max(eti->iam_pos, 0);
+
+	return 16 * (size_t)len + 3 * GWCODE_MAX + 1;
+}
+
+
+/*
+ * Turn a DMK track into a single GW stream of 8-bit encoded tick
+ * timings, so gw_write_stream() can retry if needed.
+ */
+
+int
+dmk2stream(struct dmk_track *dmkt, struct extra_track_info *eti,
+	   struct encode_bit *ebs, uint8_t **sbuf, size_t *scnt)
+{
+	uint32_t nfa_thresh = 150e-6 * ebs->freq + 0.5;   /* 150us */
+	uint32_t nfa_period = 1.25e-6 * ebs->freq + 0.5;  /* 1.25us */
+
+	size_t tbuf_sz = stream_bound(eti);
+	struct t2gw_data tes = { .tbuf     = malloc(tbuf_sz),
+				 .tbuf_len = tbuf_sz,
+				 .tbuf_cnt = 0,
+				 .nfa_thresh = nfa_thresh,
+				 .nfa_period = nfa_period };
+	int	ret = -1;
+
+	if (!tes.tbuf)
+		goto done;
+
+	struct dmk_encode_s des = {
+		.encode_pulse = encode_t2gw,
+		.pulse_data   = &tes
+	};
+
+	ret = dmk2pulses(dmkt, eti, ebs, &des);
+
+        /*
+         * To finish the stream, emit a dummy final flux value and a
+         * 0. The dummy is never written to disk because the write
+         * is aborted immediately the final flux is loaded into the
+         * WDATA timer. The dummy flux is sacrificial, ensuring that
+         * the real final flux gets written in full.
+	 */
+
+	uint32_t	dummy = 100e-6 * ebs->freq + 0.5;
+
+	if (!ret)
+		ret = encode_t2gw(dummy, &tes);
+
+	/* Mark end of stream. */
+	if (!ret)
+		tes.tbuf[tes.tbuf_cnt++] = 0;
+
+done:
+	*sbuf = tes.tbuf;
+	*scnt = tes.tbuf_cnt;
+
+	return ret;
+}
+
+
+void
+gwcodec_init(struct gwcodec *gc, uint32_t sample_freq, double rate_kbps,
+	     uint16_t tracklen)
+{
+	memset(gc, 0, sizeof(*gc));
+
+	gc->sample_freq = sample_freq;
+	gc->rate_kbps   = rate_kbps;
+	gc->precomp     = 0.0;
+
+	dmk_header_init(&gc->header, 0, tracklen);
+
+	gc->msg.detached = true;
+}
+
+
+int
+gwcodec_decode(struct gwcodec *gc, const uint8_t *fbuf, size_t cnt,
+	       struct dmk_track *trk, struct dmk_track_stats *dts)
+{
+	struct msg_ctx		*prev = msg_ctx_use(&gc->msg);
+	struct flux2dmk_sm	*f2d = &gc->f2d;
+	bool			rx02 = gc->header.options & DMK_RX02_OPT;
+
+	dmk_disk_stats_init(&gc->dds);
+	dmk_track_stats_init(&gc->merged_stats);
+	fdecoder_init(&f2d->fdec, gc->sample_freq);
+
+	f2d->fdec.usr_encoding   = rx02 ? RX02 : MIXED;
+	f2d->fdec.first_encoding = rx02 ? FM : MIXED;
+	f2d->fdec.cur_encoding   = f2d->fdec.first_encoding;
+	f2d->fdec.quirk          = gc->header.quirks;
+
+	dmk_track_sm_init(&f2d->dtsm, &gc->dds, &gc->header, &gc->merged,
+			  &gc->merged_stats);
+
+	media_encoding_init(&gc->gme, gc->sample_freq,
+			    1000.0 / gc->rate_kbps);
+	gc->gme.postcomp = 0.5;
+
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+	int			ret = 0;
+
+	if (gwflux_decode_stream(fbuf, cnt, &ws, &gc->gme, f2d) == -1) {
+		msg_error("Malformed flux stream.\n");
+		ret = -1;
+	} else {
+		gw_decode_flush(f2d);
+
+		if (f2d->dtsm.track_hole_p) {
+			dmk_data_rotate(&f2d->dtsm.trk_working,
+					f2d->dtsm.track_hole_p);
+		}
+
+		*trk = f2d->dtsm.trk_working;
+		*dts = f2d->dtsm.trk_working_stats;
+	}
+
+	msg_ctx_use(prev);
+
+	return ret;
+}
+
+
+ssize_t
+gwcodec_encode(struct gwcodec *gc, int track, int side,
+	       const struct dmk_track *trk, uint8_t **sbuf)
+{
+	struct msg_ctx		*prev = msg_ctx_use(&gc->msg);
+	struct dmk_header	*h = &gc->header;
+	int			extra_bytes = 0;
+
+	*sbuf = NULL;
+
+	/* dmk2pulses() would exit() over a side it can't write. */
+	if (track < 0 || track >= DMK_MAX_TRACKS ||
+	    side < 0 || side >= DMK_SIDES ||
+	    trk->track_len > DMKRD_TRACKLEN_MAX) {
+		msg_error("Cannot encode track %d, side %d.\n", track, side);
+		msg_ctx_use(prev);
+		return -1;
+	}
+
+	if (h->quirks & (DMK_QUIRK_EXTRA_CRC | DMK_QUIRK_EXTRA))
+		extra_bytes = 6;
+
+	struct extra_track_info	eti = {
+		.track	     = track,
+		.track_len   = trk->track_len ? trk->track_len : h->tracklen,
+		.side	     = side,
+		.max_sides   = 2,
+		.fmtimes     = 2 - !!(h->options & DMK_SDEN_OPT),
+		.iam_pos     = -1,
+		.rx02	     = !!(h->options & DMK_RX02_OPT),
+		.extra_bytes = extra_bytes,
+		.fill	     = 0,
+		.quirks	     = h->quirks,
+		.precomp     = gc->precomp
+	};
+
+	struct encode_bit	ebs;
+
+	encode_bit_init(&ebs, gc->sample_freq,
+			gc->sample_freq / 1e6 * 500.0 / gc->rate_kbps);
+	ebs.precomp	= gc->precomp;
+	ebs.extra_bytes	= extra_bytes;
+
+	/* dmk2pulses() tidies the track as it goes; leave the caller's be. */
+	gc->enc = *trk;
+
+	size_t	scnt;
+	int	ret = dmk2stream(&gc->enc, &eti, &ebs, sbuf, &scnt);
+
+	if (ret) {
+		msg_error("Failed to encode track %d, side %d.\n",
+			  track, side);
+		free(*sbuf);
+		*sbuf = NULL;
+	}
+
+	msg_ctx_use(prev);
+
+	return ret ? -1 : (ssize_t)scnt;
+}
@@ -0,0 +1,89 @@
+#ifndef GWCODEC_H
+#define GWCODEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "dmk.h"
+#include "dmkx.h"
+#include "gwmedia.h"
+#include "gwdecode.h"
+#include "msg.h"
+
+
+/*
+ * In-memory track codec (libgw2dmk).  gw2dmk's and dmk2gw's track
+ * conversions without a device: Greaseweazle flux stream bytes in,
+ * a DMK track and its stats out, and a DMK track in, write stream
+ * bytes out.
+ *
+ * Everything a conversion touches is in its struct gwcodec, its
+ * messages included, so codecs on different threads can run at once.
+ * One codec serves one thread at a time.
+ *
+ * Set up with gwcodec_init(), then adjust the settings as needed.
+ * Messages go to msg.file, if the caller sets one, at msg.file_level;
+ * never to the screen.
+ */
+
+struct gwcodec {
+	uint32_t		sample_freq;	/* Hz */
+	double			rate_kbps;	/* MFM data rate, e.g. 250 */
+	struct dmk_header	header;		/* tracklen, options, quirks */
+	double			precomp;	/* write precomp, ns */
+	struct msg_ctx		msg;
+
+	/* Working state. */
+	struct gw_media_encoding gme;
+	struct dmk_disk_stats	dds;
+	struct dmk_track	merged;
+	struct dmk_track_stats	merged_stats;
+	struct flux2dmk_sm	f2d;
+	struct dmk_track	enc;
+};
+
+
+extern void gwcodec_init(struct gwcodec *gc, uint32_t sample_freq,
+			 double rate_kbps, uint16_t tracklen);
+
+/*
+ * Decode one read of a track, "cnt" bytes of stream as from
+ * gw_read_stream(), into "trk" and "dts".  Returns 0, or -1 if the
+ * stream is malformed.
+ */
+
+extern int gwcodec_decode(struct gwcodec *gc, const uint8_t *fbuf,
+			  size_t cnt, struct dmk_track *trk,
+			  struct dmk_track_stats *dts);
+
+/*
+ * Encode track "track", side "side" as a write stream for
+ * gw_write_stream().  Returns the stream's length with the stream in
+ * a malloc()ed *sbuf, or -1 with *sbuf NULL, as for a track or side
+ * out of DMK range.
+ */
+
+extern ssize_t gwcodec_encode(struct gwcodec *gc, int track, int side,
+			      const struct dmk_track *trk, uint8_t **sbuf);
+
+/*
+ * The encoder core that gwcodec_encode() and dmk2gw share.  Encodes
+ * "dmkt", which dmk2pulses() tidies as it goes, into a malloc()ed
+ * *sbuf of *scnt bytes ending in the dummy pulse and terminator.
+ * Returns dmk2pulses()'s result or -1; *sbuf is set, if only to NULL,
+ * either way.
+ */
+
+extern int dmk2stream(struct dmk_track *dmkt, struct extra_track_info *eti,
+		      struct encode_bit *ebs, uint8_t **sbuf, size_t *scnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,866 @@
+/*
+ * gwd: hold a Greaseweazle open and run gw2dmk and dmk2gw jobs on it
+ * as they arrive over a UNIX socket, so each job skips finding,
+ * initializing, and resetting the device and probing for the drive.
+ *
+ * "gwd -c socket tool [args]" is the client: it hands the daemon its
+ * working directory, arguments, and standard I/O descriptors, then
+ * waits for the job's exit status.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "gw.h"
+#include "gwx.h"
+#include "msg_levels.h"
+#include "msg.h"
+#include "gwfddrv.h"
+#include "cmdutil.h"
+#include "gwdetect.h"
+
+#ifdef GW_SIM
+#include "simhost.h"
+#endif
+
+
+#define GWD_MAGIC	0x31647767	/* "gwd1" */
+#define GWD_WAIT	0x01		/* Wait for a diskette change */
+#define GWD_REQ_MAX	65536		/* Bytes of cwd and arguments */
+#define GWD_ARGS_MAX	256
+
+/* Request header, sent with the client's descriptors 0, 1, and 2. */
+struct gwd_req {
+	uint32_t	magic;
+	uint32_t	flags;
+	uint32_t	len;		/* NUL-terminated cwd, tool, args */
+};
+
+
+static const struct option cmd_long_args[] = {
+	{ "client",	 required_argument, NULL, 'c' },
+	{ "drive",	 required_argument, NULL, 'd' },
+	{ "logfile",	 required_argument, NULL, 'u' },
+	{ "verbosity",	 required_argument, NULL, 'v' },
+	{ "wait",	 no_argument,	    NULL, 'w' },
+	{ "bustype",	 required_argument, NULL, 'B' },
+	{ "device",	 required_argument, NULL, 'G' },
+	{ "stepdelay",	 required_argument, NULL, 'T' },
+	{ "serial",	 required_argument, NULL, 'Z' },
+	/* Start of binary long options without single letter counterparts. */
+	{ "hd",		 no_argument, NULL, 0 },
+	{ "dd",		 no_argument, NULL, 0 },
+	{ "reset",	 no_argument, NULL, 0 },
+	{ "noreset",	 no_argument, NULL, 0 },
+	{ 0, 0, 0, 0 }
+};
+
+/* Only used on platforms without a USB scan backend. */
+static const char *device_list[] = {
+	"/dev/greaseweazle",
+	"/dev/ttyACM0",
+	NULL
+};
+
+static struct cmd_settings {
+	struct gw_fddrv	fdd;
+	const char	*client;
+	bool		wait;
+	const char	*stepdelay;
+	bool		reset_on_init;
+	int		scrn_verbosity;
+	int		file_verbosity;
+	const char	*logfile;
+} cmd_settings = {
+	.fdd.device = NULL,
+	.fdd.serial = NULL,
+	.fdd.bus = BUS_IBMPC,
+	.fdd.drive = -1,
+	.fdd.kind = -1,
+	.fdd.tracks = -1,
+	.fdd.sides = -1,
+	.fdd.steps = -1,
+	.fdd.densel = DS_NOTSET,
+	.fdd.step_ms = -1,
+	.fdd.settle_ms = -1,
+	.client = NULL,
+	.wait = false,
+	.stepdelay = NULL,
+	.reset_on_init = true,
+	.scrn_verbosity = MSG_NORMAL,
+	.file_verbosity = MSG_QUIET,
+	.logfile = "gw.log"
+};
+
+static volatile sig_atomic_t	stop_requested = 0;
+static volatile pid_t		job_pid = 0;
+
+
+static void
+usage(const char *pgm_name)
+{
+	msg_fatal("Usage: %s [-G device] [-Z serial] [-d drive] "
+		  "[-B bustype] [--dd|--hd] [-T stp[,stl]] --[no]reset "
+		  "[-v verbosity] [-u logfile] socket\n"
+		  "       %s -c socket [-w] {gw2dmk|dmk2gw} [options]\n",
+		  pgm_name, pgm_name);
+}
+
+
+static void
+parse_args(int argc, char **argv, struct cmd_settings *cmd_set)
+{
+	int	opt;
+	int	lindex = 0;
+	int	opt_bus = BUS_NONE;
+	bool	opt_d_given = false;
+
+	/* Stop at the client's tool name; the rest are its options. */
+	while ((opt = getopt_long(argc, argv, "+c:d:u:v:wB:G:T:Z:",
+		cmd_long_args, &lindex)) != -1) {
+
+		switch(opt) {
+		case 0:;
+			const char *name = cmd_long_args[lindex].name;
+
+			if (!strcmp(name, "hd")) {
+				cmd_set->fdd.densel = DS_HD;
+			} else if (!strcmp(name, "dd")) {
+				cmd_set->fdd.densel = DS_DD;
+			} else if (!strcmp(name, "reset")) {
+				cmd_set->reset_on_init = true;
+			} else if (!strcmp(name, "noreset")) {
+				cmd_set->reset_on_init = false;
+			} else {
+				goto err_usage;
+			}
+			break;
+
+		case 'c':
+			cmd_set->client = optarg;
+			break;
+
+		case 'd':
+			if (parse_drive_arg(optarg, opt, &cmd_set->fdd))
+				goto err_usage;
+
+			opt_d_given = true;
+			break;
+
+		case 'u':
+			cmd_set->logfile = optarg;
+			break;
+
+		case 'v':;
+			const int optav = strtol_strict(optarg, 10, "'v'");
+
+			if (optav >= 10) {
+				cmd_set->scrn_verbosity = optav % 10;
+				cmd_set->file_verbosity = optav / 10;
+			} else {
+				cmd_set->scrn_verbosity = optav;
+				cmd_set->file_verbosity = optav;
+			}
+			break;
+
+		case 'w':
+			cmd_set->wait = true;
+			break;
+
+		case 'B':
+			if (parse_bustype_arg(optarg, opt, &opt_bus))
+				goto err_usage;
+			break;
+
+		case 'G':
+			if (parse_device_arg(optarg, &cmd_set->fdd))
+				goto err_usage;
+			break;
+
+		case 'T':
+			if (parse_stepdelay_arg(optarg, &cmd_set->fdd))
+				goto err_usage;
+
+			cmd_set->stepdelay = optarg;
+			break;
+
+		case 'Z':
+			cmd_set->fdd.serial = optarg;
+			break;
+
+		default:  /* '?' */
+			goto err_usage;
+			break;
+		}
+	}
+
+	if (opt_bus != BUS_NONE) {
+		if (opt_d_given && cmd_set->fdd.bus != opt_bus) {
+			msg_error("Option '-B' bus type conflicts with the "
+				  "bus type implied by '-d'.\n");
+			goto err_usage;
+		}
+
+		cmd_set->fdd.bus = opt_bus;
+	}
+
+	if (cmd_set->fdd.device && cmd_set->fdd.serial) {
+		msg_error("Options '-G' and '-Z' are mutually exclusive.\n");
+		goto err_usage;
+	}
+
+	if (cmd_set->client) {
+		if (optind == argc)
+			goto err_usage;
+		return;
+	}
+
+	if (cmd_set->wait) {
+		msg_error("Option '-w' is only for the client ('-c').\n");
+		goto err_usage;
+	}
+
+	if (optind != argc - 1)
+		goto err_usage;
+
+	msg_scrn_set_level(cmd_set->scrn_verbosity);
+	msg_file_set_level(cmd_set->file_verbosity);
+
+	if ((cmd_set->file_verbosity > MSG_QUIET) && cmd_set->logfile) {
+		if (!msg_fopen(cmd_set->logfile)) {
+			msg_error("Failed to open log file '%s': %s\n",
+				  cmd_set->logfile, strerror(errno));
+			goto err_usage;
+		}
+	}
+
+	return;
+
+err_usage:
+	usage(argv[0]);
+}
+
+
+static int
+write_all(int fd, const void *buf, size_t cnt)
+{
+	const uint8_t	*p = buf;
+
+	while (cnt > 0) {
+		ssize_t	n = write(fd, p, cnt);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -1;
+
+		p   += n;
+		cnt -= n;
+	}
+
+	return 0;
+}
+
+
+static int
+read_all(int fd, void *buf, size_t cnt)
+{
+	uint8_t	*p = buf;
+
+	while (cnt > 0) {
+		ssize_t	n = read(fd, p, cnt);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -1;
+
+		p   += n;
+		cnt -= n;
+	}
+
+	return 0;
+}
+
+
+static int
+sock_addr(const char *path, struct sockaddr_un *sun)
+{
+	*sun = (struct sockaddr_un){ .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(sun->sun_path)) {
+		msg_error("Socket path '%s' is too long.\n", path);
+		return -1;
+	}
+
+	strcpy(sun->sun_path, path);
+
+	return 0;
+}
+
+
+/*
+ * Client side.
+ */
+
+static void
+forward_signal(int sig)
+{
+	if (job_pid > 0)
+		kill(job_pid, sig);
+}
+
+
+static int
+run_client(const char *path, bool wait, int argc, char **argv)
+{
+	struct sockaddr_un	sun;
+
+	if (sock_addr(path, &sun))
+		return EXIT_FAILURE;
+
+	int	sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (sfd == -1 || connect(sfd, (struct sockaddr *)&sun,
+				 sizeof(sun)) == -1) {
+		msg_error("Failed to connect to gwd at '%s': %s\n",
+			  path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	static char	req[GWD_REQ_MAX];
+	size_t		len;
+
+	if (!getcwd(req, sizeof(req))) {
+		msg_error("Failed to get working directory: %s\n",
+			  strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	len = strlen(req) + 1;
+
+	for (int i = 0; i < argc; ++i) {
+		size_t	alen = strlen(argv[i]) + 1;
+
+		if (i >= GWD_ARGS_MAX || len + alen > sizeof(req)) {
+			msg_error("Too many or too long arguments for gwd.\n");
+			return EXIT_FAILURE;
+		}
+
+		memcpy(req + len, argv[i], alen);
+		len += alen;
+	}
+
+	/* Pass standard input, output, and error along with the header. */
+	struct gwd_req	hdr = { GWD_MAGIC, wait ? GWD_WAIT : 0, len };
+	int		fds[3] = { 0, 1, 2 };
+	union {
+		struct cmsghdr	align;
+		char		buf[CMSG_SPACE(sizeof(fds))];
+	} cbuf;
+	struct iovec	iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+	struct msghdr	mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf)
+	};
+	struct cmsghdr	*cm = CMSG_FIRSTHDR(&mh);
+
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type  = SCM_RIGHTS;
+	cm->cmsg_len   = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+	if (sendmsg(sfd, &mh, 0) != sizeof(hdr) ||
+	    write_all(sfd, req, len)) {
+		msg_error("Failed to send job to gwd: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* The daemon answers with the job's process ID (0 if it
+	 * didn't start), then its wait status. */
+	int32_t	pid, status;
+
+	if (read_all(sfd, &pid, sizeof(pid))) {
+		msg_error("gwd closed the connection.\n");
+		return EXIT_FAILURE;
+	}
+
+	job_pid = pid;
+
+	struct sigaction sa = { .sa_handler = forward_signal };
+	const int	 sigs[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+
+	for (int s = 0; s < COUNT_OF(sigs); ++s)
+		sigaction(sigs[s], &sa, NULL);
+
+	if (read_all(sfd, &status, sizeof(status))) {
+		msg_error("gwd closed the connection.\n");
+		return EXIT_FAILURE;
+	}
+
+	close(sfd);
+
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+
+/*
+ * Daemon side.
+ */
+
+static void
+stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+
+/*
+ * Receive a request and the descriptors that come with it.  Returns
+ * the number of strings unpacked into "strs", or -1 on a bad request.
+ */
+
+static int
+recv_req(int cfd, struct gwd_req *hdr, int fds[3],
+	 char *req, char **strs, int max_strs)
+{
+	union {
+		struct cmsghdr	align;
+		char		buf[CMSG_SPACE(3 * sizeof(int))];
+	} cbuf;
+	struct iovec	iov = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+	struct msghdr	mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf)
+	};
+
+	fds[0] = fds[1] = fds[2] = -1;
+
+	if (recvmsg(cfd, &mh, MSG_CMSG_CLOEXEC) != sizeof(*hdr))
+		return -1;
+
+	struct cmsghdr	*cm = CMSG_FIRSTHDR(&mh);
+
+	if (cm && cm->cmsg_level == SOL_SOCKET &&
+	    cm->cmsg_type == SCM_RIGHTS &&
+	    cm->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+		memcpy(fds, CMSG_DATA(cm), 3 * sizeof(int));
+
+	if (fds[2] == -1 || hdr->magic != GWD_MAGIC ||
+	    hdr->len == 0 || hdr->len > GWD_REQ_MAX ||
+	    read_all(cfd, req, hdr->len) || req[hdr->len - 1] != '\0')
+		return -1;
+
+	int	n = 0;
+
+	for (char *p = req; p < req + hdr->len; p += strlen(p) + 1) {
+		if (n == max_strs)
+			return -1;
+		strs[n++] = p;
+	}
+
+	return n;
+}
+
+
+/* True if the client hung up, waiting up to "ms" to find out. */
+
+static bool
+client_gone(int cfd, int ms)
+{
+	struct pollfd	pfd = { .fd = cfd, .events = POLLIN };
+
+	return poll(&pfd, 1, ms) > 0;
+}
+
+
+static bool
+has_index(gw_devt gwfd)
+{
+	uint8_t	*fbuf = NULL;
+	ssize_t	ret = gw_read_stream(gwfd, 1, 0, &fbuf);
+
+	free(fbuf);
+
+	return ret >= 0;
+}
+
+
+/*
+ * Wait for the diskette to be changed: for the one in the drive, if
+ * any, to come out, then for one to go in.  An empty drive shows no
+ * index.  Returns 0 with a diskette in the drive, or -1 if the client
+ * went away first.
+ */
+
+static int
+wait_change(struct cmd_settings *cmd_set, int cfd, int outfd)
+{
+	gw_devt	gwfd = cmd_set->fdd.gwfd;
+	bool	removed = false;
+
+	if (gw_setdrive(gwfd, cmd_set->fdd.drive,
+			cmd_set->fdd.densel == DS_HD ?
+			DS_HD : DS_DD) != ACK_OKAY) {
+		dprintf(outfd, "gwd: Failed to select and start drive.\n");
+		return -1;
+	}
+
+	dprintf(outfd, "Waiting for diskette change...\n");
+
+	while (!stop_requested && !client_gone(cfd, 100)) {
+		if (!has_index(gwfd))
+			removed = true;
+		else if (removed)
+			return 0;
+	}
+
+	gw_unsetdrive(gwfd, cmd_set->fdd.drive);
+
+	return -1;
+}
+
+
+/*
+ * In the forked child: take over the client's descriptors and
+ * directory and exec the tool with the inherited GW.
+ */
+
+static void
+exec_job(struct cmd_settings *cmd_set, const char *tooldir,
+	 const int fds[3], char **strs, int nstrs)
+{
+	for (int i = 0; i < 3; ++i) {
+		if (dup2(fds[i], i) == -1)
+			_exit(126);
+	}
+
+	struct sigaction sa_dfl = { .sa_handler = SIG_DFL };
+	const int	 sigs[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGPIPE };
+
+	for (int s = 0; s < COUNT_OF(sigs); ++s)
+		sigaction(sigs[s], &sa_dfl, NULL);
+
+	if (chdir(strs[0]) == -1) {
+		dprintf(2, "gwd: Failed to change to '%s': %s\n",
+			strs[0], strerror(errno));
+		_exit(126);
+	}
+
+	/* The job runs on the drive and bus found by the daemon.  The
+	 * tool resets the GW on exit, so the step delays go along too. */
+	char	env[32], unit[2] = {
+			unit2char(cmd_set->fdd.bus, cmd_set->fdd.drive) };
+	char	*argv[GWD_ARGS_MAX + 4];
+	int	argc = 0;
+	char	path[PATH_MAX + 16];
+
+	snprintf(env, sizeof(env), "%d", (int)cmd_set->fdd.gwfd);
+	setenv(GWD_FD_ENV, env, 1);
+
+	if (gw_selected_id())
+		setenv(GWD_ID_ENV, gw_selected_id(), 1);
+	fcntl(cmd_set->fdd.gwfd, F_SETFD, 0);
+
+	snprintf(path, sizeof(path), "%s%s", tooldir, strs[1]);
+
+	argv[argc++] = strs[1];
+	argv[argc++] = "-d";
+	argv[argc++] = unit;
+
+	if (cmd_set->stepdelay) {
+		argv[argc++] = "-T";
+		argv[argc++] = (char *)cmd_set->stepdelay;
+	}
+
+	for (int i = 2; i < nstrs; ++i)
+		argv[argc++] = strs[i];
+
+	argv[argc] = NULL;
+
+	if (*tooldir)
+		execv(path, argv);
+	else
+		execvp(path, argv);
+
+	dprintf(2, "gwd: Failed to run '%s': %s\n", path, strerror(errno));
+	_exit(127);
+}
+
+
+/*
+ * Put the GW back as the next job expects it.  A job killed by a
+ * signal may have left a stream half sent or half read, the motor
+ * on, or the drive selected, so clear the line, then reset and set
+ * the bus type again.  Done after every job, as a tool that exited
+ * normally has only reset the GW.
+ */
+
+static void
+restore_gw(struct cmd_settings *cmd_set, bool killed)
+{
+	gw_devt	gwfd = cmd_set->fdd.gwfd;
+	int	cmd_ret;
+
+	if (killed && gw_clear_comms(gwfd))
+		msg_error("Failed to clear Greaseweazle line: %s\n",
+			  strerror(errno));
+
+	cmd_ret = gw_reset(gwfd);
+
+	if (cmd_ret == ACK_OKAY)
+		cmd_ret = gw_set_bus_type(gwfd, cmd_set->fdd.bus);
+
+	if (cmd_ret != ACK_OKAY)
+		msg_error("Failed to reset Greaseweazle (%d).\n", cmd_ret);
+}
+
+
+static void
+run_job(struct cmd_settings *cmd_set, const char *tooldir, int cfd)
+{
+	static char	req[GWD_REQ_MAX];
+	char		*strs[GWD_ARGS_MAX + 1];
+	struct gwd_req	hdr;
+	int		fds[3];
+	int32_t		pid = 0;
+	int32_t		status = 2 << 8;	/* exit(2) if not run */
+
+	int	nstrs = recv_req(cfd, &hdr, fds, req, strs, COUNT_OF(strs));
+
+	if (nstrs < 0) {
+		msg_error("Ignoring bad request.\n");
+		goto done;
+	}
+
+	if (nstrs < 2 ||
+	    (strcmp(strs[1], "gw2dmk") && strcmp(strs[1], "dmk2gw"))) {
+		dprintf(fds[2], "gwd: Jobs must run gw2dmk or dmk2gw.\n");
+		goto reply;
+	}
+
+	/* In case restoring it after the last job failed. */
+	if (gw_set_bus_type(cmd_set->fdd.gwfd, cmd_set->fdd.bus) !=
+	    ACK_OKAY) {
+		dprintf(fds[2], "gwd: Failed to set bus type.\n");
+		goto reply;
+	}
+
+	if ((hdr.flags & GWD_WAIT) && wait_change(cmd_set, cfd, fds[1]))
+		goto done;
+
+	pid = fork();
+
+	if (pid == 0)
+		exec_job(cmd_set, tooldir, fds, strs, nstrs);
+
+	if (pid == -1) {
+		dprintf(fds[2], "gwd: Failed to start job: %s\n",
+			strerror(errno));
+		pid = 0;
+		goto reply;
+	}
+
+	msg(MSG_NORMAL, "Job %d: %s\n", (int)pid, strs[1]);
+	msg_scrn_flush();
+
+	if (write_all(cfd, &pid, sizeof(pid)))
+		msg_error("Job %d: client went away.\n", (int)pid);
+
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+
+	restore_gw(cmd_set, WIFSIGNALED(status));
+
+	msg(MSG_NORMAL, "Job %d: exit status %d\n", (int)pid,
+	    WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	msg_scrn_flush();
+
+	write_all(cfd, &status, sizeof(status));
+	goto done;
+
+reply:
+	write_all(cfd, &pid, sizeof(pid));
+	write_all(cfd, &status, sizeof(status));
+
+done:
+	for (int i = 0; i < 3; ++i) {
+		if (fds[i] != -1)
+			close(fds[i]);
+	}
+}
+
+
+/*
+ * Bind the socket, refusing to take over one a live daemon still
+ * answers on.  Only the owner may connect, as jobs run as the owner.
+ */
+
+static int
+listen_on(const char *path)
+{
+	struct sockaddr_un	sun;
+
+	if (sock_addr(path, &sun))
+		return -1;
+
+	int	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (lfd == -1)
+		return -1;
+
+	if (connect(lfd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+		msg_error("A gwd is already serving '%s'.\n", path);
+		close(lfd);
+		return -1;
+	}
+
+	unlink(path);
+
+	mode_t	old_mask = umask(077);
+	int	ret = bind(lfd, (struct sockaddr *)&sun, sizeof(sun));
+
+	umask(old_mask);
+
+	if (ret == -1 || listen(lfd, 4) == -1) {
+		msg_error("Failed to listen on '%s': %s\n",
+			  path, strerror(errno));
+		close(lfd);
+		return -1;
+	}
+
+	return lfd;
+}
+
+
+static int
+serve(struct cmd_settings *cmd_set, const char *tooldir, const char *path)
+{
+	struct gw_info	gw_info;
+	const char	*sdev = NULL;
+
+#ifdef GW_SIM
+	/* Its jobs inherit a descriptor, which a simulator hasn't got. */
+	if (cmd_set->fdd.device && sim_host_device(cmd_set->fdd.device))
+		msg_fatal("gwd cannot share a simulated Greaseweazle.\n");
+#endif
+
+	cmd_set->fdd.gwfd = gw_find_open_gw(cmd_set->fdd.device,
+					    cmd_set->fdd.serial,
+					    device_list, &sdev);
+
+	if (cmd_set->fdd.gwfd == GW_DEVT_INVALID)
+		return EXIT_FAILURE;
+
+	cmd_set->fdd.gwfd = gw_init_gw(&cmd_set->fdd, &gw_info,
+				       cmd_set->reset_on_init);
+
+	if (cmd_set->fdd.gwfd == GW_DEVT_INVALID)
+		msg_fatal("Failed to find or initialize Greaseweazle.\n");
+
+	if (cmd_set->fdd.drive == -1 && gw_detect_drive(&cmd_set->fdd, false))
+		return EXIT_FAILURE;
+
+	int	lfd = listen_on(path);
+
+	if (lfd == -1)
+		return EXIT_FAILURE;
+
+	/* No SA_RESTART, so accept() returns to check stop_requested. */
+	struct sigaction sa_stop = { .sa_handler = stop_handler };
+	struct sigaction sa_ign  = { .sa_handler = SIG_IGN };
+
+	sigaction(SIGHUP, &sa_stop, NULL);
+	sigaction(SIGINT, &sa_stop, NULL);
+	sigaction(SIGTERM, &sa_stop, NULL);
+	sigaction(SIGPIPE, &sa_ign, NULL);
+
+	msg(MSG_NORMAL, "Serving jobs on '%s'.\n", path);
+	msg_scrn_flush();
+
+	while (!stop_requested) {
+		int	cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (cfd == -1) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				msg_error("Failed to accept job: %s\n",
+					  strerror(errno));
+			continue;
+		}
+
+		run_job(cmd_set, tooldir, cfd);
+		close(cfd);
+	}
+
+	msg(MSG_NORMAL, "Stopping.\n");
+
+	close(lfd);
+	unlink(path);
+
+	gw_reset(cmd_set->fdd.gwfd);
+	gw_close(cmd_set->fdd.gwfd);
+
+	return EXIT_SUCCESS;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	const char *slash = strrchr(argv[0], '/');
+	const char *pgm   = slash ? slash + 1 : argv[0];
+
+	if (!msg_error_prefix(pgm)) {
+		msg_error("Failure to allocate memory for message prefix.\n");
+		return EXIT_FAILURE;
+	}
+
+	parse_args(argc, argv, &cmd_settings);
+
+	if (cmd_settings.client)
+		return run_client(cmd_settings.client, cmd_settings.wait,
+				  argc - optind, argv + optind);
+
+	/* Run the tools from gwd's own directory, else from PATH.  Jobs
+	 * change directory, so the directory must be absolute. */
+	char	tooldir[PATH_MAX + 1] = "";
+
+	if (slash) {
+		char	*dir = strndup(argv[0], slash - argv[0] + 1);
+
+		if (!dir || !realpath(dir, tooldir))
+			msg_fatal("Failed to find gwd's directory.\n");
+
+		strcat(tooldir, "/");
+		free(dir);
+	}
+
+	int	ret = serve(&cmd_settings, tooldir, argv[optind]);
+
+	msg_fclose();
+
+	return ret;
+}
@@ -82,6 +82,7 @@ dmk_track_sm_init(struct dmk_track_sm *dtsm,
 		.trk_merged_stats = trk_merged_stats,
 
 		.track_hole_p     = NULL,
+		.track_wrap_p     = NULL,
 
 		.dmk_ignored      = 0,
 		.dmk_full         = 0,
@@ -392,6 +393,8 @@ dmk_check_wraparound(struct flux2dmk_sm *f2dsm)
 		   cmplen) == 0) {
 
 		msg(MSG_ERRORS, "[wraparound] ");
+		dtsm->track_wrap_p = &dtsm->trk_working.track[last_idamp &
+							      DMK_IDAMP_BITS];
 		*--dtsm->idam_p = 0;
 		fdec->awaiting_dam = 0;
 		fdec->ibyte = -1;
@@ -1060,6 +1063,52 @@ gwflux_decode_index(uint32_t imark, struct flux2dmk_sm *f2dsm)
 }
 
 
+/*
+ * The stream walker of gwflux_decode_stream(), with the decoder
+ * inlined into it.
+ */
+
+struct flux2dmk_walk {
+	struct gw_media_encoding	*gme;
+	struct flux2dmk_sm		*f2dsm;
+};
+
+
+static inline int
+walk_index(struct flux2dmk_walk *fw, uint32_t imark)
+{
+	return gwflux_decode_index(imark, fw->f2dsm);
+}
+
+
+static inline int
+walk_pulse(struct flux2dmk_walk *fw, uint32_t pulse)
+{
+	return gwflux_decode_pulse(pulse, fw->gme, fw->f2dsm);
+}
+
+
+GW_STREAM_WALKER(walk_flux2dmk, struct flux2dmk_walk,
+		 walk_index, gw_walk_ignore, walk_pulse)
+
+
+/*
+ * Decode the stream into "f2dsm", as gw_decode_stream() would with
+ * gwflux_decode_index() and gwflux_decode_pulse() as its callbacks.
+ */
+
+ssize_t
+gwflux_decode_stream(const uint8_t *fbuf, size_t fbuf_cnt,
+		     struct gw_walk_state *ws,
+		     struct gw_media_encoding *gme,
+		     struct flux2dmk_sm *f2dsm)
+{
+	struct flux2dmk_walk	fw = { gme, f2dsm };
+
+	return walk_flux2dmk(fbuf, fbuf_cnt, ws, &fw);
+}
+
+
 void
 gw_post_process_track(struct flux2dmk_sm *f2dsm)
 {
@@ -1086,3 +1135,51 @@ gw_post_process_track(struct flux2dmk_sm *f2dsm)
 
 	msg(MSG_IDS, "\n");
 }
+
+
+/*
+ * Align a track decoded from wherever its read happened to start,
+ * rather than from the index hole.  What was read ahead of the first
+ * sector ID was read again at the end, up to where that ID came
+ * around, so keep the one revolution from the first ID up to its
+ * repeat and rotate it to start at the hole.
+ *
+ * Returns false if the read never came around to the first ID.
+ */
+
+bool
+gw_align_track(struct dmk_track_sm *dtsm)
+{
+	struct dmk_track	*trk = &dtsm->trk_working;
+
+	if (dmk_idam_list_empty(dtsm)) {
+		dmk_data_rotate(trk, dtsm->track_hole_p);
+		return true;
+	}
+
+	if (!dtsm->track_wrap_p)
+		return false;
+
+	uint8_t	*first = trk->track + (trk->idam_offset[0] & DMK_IDAMP_BITS);
+	int	lead   = first - trk->data;
+	int	len    = dtsm->track_wrap_p - first;
+
+	memmove(trk->data, first, len);
+	trk->track_len = DMK_TKHDR_SIZE + len;
+
+	for (int i = 0; i < DMK_MAX_SECTORS && trk->idam_offset[i]; ++i)
+		trk->idam_offset[i] -= lead;
+
+	if (dtsm->track_hole_p) {
+		int	hole = dtsm->track_hole_p - first;
+
+		if (hole < 0)
+			hole += len;
+		else if (hole >= len)
+			hole -= len;
+
+		dmk_data_rotate(trk, trk->data + hole);
+	}
+
+	return true;
+}
@@ -19,6 +19,7 @@ extern "C" {
 #include "crc.h"
 #include "gw.h"
 #include "gwx.h"
+#include "gwwalk.h"
 #include "gwmedia.h"
 #include "secsize.h"
 #include "dmk.h"
@@ -93,6 +94,7 @@ struct dmk_track_sm {
 	uint16_t		*idam_p;
 	uint8_t			*track_data_p;
 	uint8_t			*track_hole_p;
+	uint8_t			*track_wrap_p;	/* Repeat of first IDAM */
 
 	struct dmk_track	trk_working;
 	struct dmk_track_stats	trk_working_stats;
@@ -134,8 +136,15 @@ extern void gw_decode_flush(struct flux2dmk_sm *f2dsm);
 
 extern int gwflux_decode_index(uint32_t imark, struct flux2dmk_sm *f2dsm);
 
+extern ssize_t gwflux_decode_stream(const uint8_t *fbuf, size_t fbuf_cnt,
+				    struct gw_walk_state *ws,
+				    struct gw_media_encoding *gme,
+				    struct flux2dmk_sm *f2dsm);
+
 extern void gw_post_process_track(struct flux2dmk_sm *f2dsm);
 
+extern bool gw_align_track(struct dmk_track_sm *dtsm);
+
 
 #ifdef __cplusplus
 }
@@ -5,6 +5,17 @@
 
 #include "gwdetect.h"
 
+#ifdef GW_SIM
+#include "simhost.h"
+#endif
+
+
+/* Set when the GW was handed down by gwd rather than opened here. */
+static bool	gw_inherited = false;
+
+/* Identity of the GW opened: its USB serial, else its device name. */
+static char	*gw_id = NULL;
+
 
 const char *
 kind2desc(int kind)
@@ -95,6 +106,8 @@ gw_open_scanned_dev(const struct gw_scan_dev *devs, int di,
 	msg(MSG_NORMAL, "Using Greaseweazle at '%s' (serial '%s').\n",
 	    devs[di].device, devs[di].serial);
 
+	gw_id = strdup(devs[di].serial[0] ? devs[di].serial : devs[di].device);
+
 	if (selected_dev) {
 		char	*dev_copy = strdup(devs[di].device);
 
@@ -112,13 +125,101 @@ gw_open_scanned_dev(const struct gw_scan_dev *devs, int di,
 }
 
 
+/*
+ * Find the USB serial of the GW at "device" for gw_selected_id(), or
+ * failing that, use the device name.
+ */
+
+static void
+gw_set_id_from_dev(const char *device)
+{
+	struct gw_scan_dev	*devs;
+	int			cnt = gw_scan(&devs);
+
+	for (int di = 0; di < cnt; ++di) {
+#if defined(WIN64) || defined(WIN32)
+		bool	same = !strcasecmp(devs[di].device, device);
+#else
+		char	*a = realpath(devs[di].device, NULL);
+		char	*b = realpath(device, NULL);
+		bool	same = a && b && !strcmp(a, b);
+
+		free(a);
+		free(b);
+#endif
+
+		if (same && devs[di].serial[0]) {
+			gw_id = strdup(devs[di].serial);
+			break;
+		}
+	}
+
+	if (cnt > 0)
+		gw_scan_free(devs, cnt);
+
+	if (!gw_id)
+		gw_id = strdup(device);
+}
+
+
+/*
+ * Return an identity for the GW opened by gw_find_open_gw(), stable
+ * across runs: its USB serial if known, else its device name.  NULL
+ * if none was opened.
+ */
+
+const char *
+gw_selected_id(void)
+{
+	return gw_id;
+}
+
+
+#if !defined(WIN64) && !defined(WIN32)
+
+/*
+ * Return the GW a gwd(1) job inherited, named by descriptor number
+ * "env".  The descriptor is open and initialized.  It is closed on
+ * any further exec.
+ */
+
+static gw_devt
+gw_inherited_gw(const char *env, const char **selected_dev)
+{
+	char	*endptr;
+	long	fd = strtol(env, &endptr, 10);
+
+	if (endptr == env || *endptr != '\0' || fd < 3 || fd > INT_MAX ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		msg_error("Bad Greaseweazle descriptor '%s' from gwd.\n",
+			  env);
+		return GW_DEVT_INVALID;
+	}
+
+	gw_inherited = true;
+
+	const char *id = getenv(GWD_ID_ENV);
+
+	if (id && *id)
+		gw_id = strdup(id);
+
+	if (selected_dev)
+		*selected_dev = "(gwd)";
+
+	return fd;
+}
+
+#endif
+
+
 /*
  * Find and open GW.
  *
- * If "device" is given, open it directly.  Otherwise scan the USB bus
- * for Greaseweazles; if "serial" is given, use the device whose USB
- * serial number matches exactly, else use the sole device found.  On
- * platforms without a scan backend, fall back to trying "device_list".
+ * Under gwd, use the GW it holds open.  Otherwise, if "device" is
+ * given, open it directly, or else scan the USB bus for Greaseweazles;
+ * if "serial" is given, use the device whose USB serial number matches
+ * exactly, else use the sole device found.  On platforms without a
+ * scan backend, fall back to trying "device_list".
  *
  * Returns device file descriptor and sets "selected_dev" to device name
  * or returns GW_DEVT_INVALID on failure.
@@ -132,6 +233,30 @@ gw_find_open_gw(const char *device,
 {
 	gw_devt gwfd;
 
+#if !defined(WIN64) && !defined(WIN32)
+	const char *env = getenv(GWD_FD_ENV);
+
+	if (env)
+		return gw_inherited_gw(env, selected_dev);
+#endif
+
+#ifdef GW_SIM
+	if (device && sim_host_device(device)) {
+		gwfd = sim_host_open(device);
+
+		if (gwfd == GW_DEVT_INVALID) {
+			msg_error("Failed to start simulator ('%s').\n",
+				  device);
+			return GW_DEVT_INVALID;
+		}
+
+		if (selected_dev)
+			*selected_dev = device;
+
+		return gwfd;
+	}
+#endif
+
 	if (device) {
 		gwfd = gw_open(device);
 
@@ -143,6 +268,8 @@ gw_find_open_gw(const char *device,
 		if (selected_dev)
 			*selected_dev = device;
 
+		gw_set_id_from_dev(device);
+
 		return gwfd;
 	}
 
@@ -156,7 +283,9 @@ gw_find_open_gw(const char *device,
 			return GW_DEVT_INVALID;
 		}
 
-		gwfd = gw_openlist(device_list, selected_dev);
+		const char	*dev = NULL;
+
+		gwfd = gw_openlist(device_list, &dev);
 
 		if (gwfd == GW_DEVT_INVALID) {
 			msg_error("Failed find Greaseweazle.  Use "
@@ -164,6 +293,11 @@ gw_find_open_gw(const char *device,
 			return GW_DEVT_INVALID;
 		}
 
+		if (selected_dev)
+			*selected_dev = dev;
+
+		gw_id = strdup(dev);
+
 		return gwfd;
 	}
 
@@ -223,7 +357,7 @@ gw_devt
 gw_init_gw(struct gw_fddrv *fdd, struct gw_info *gw_info, bool reset)
 {
 	gw_devt	gwfd     = fdd->gwfd;
-	int	init_ret = gw_init(gwfd);
+	int	init_ret = gw_inherited ? 0 : gw_init(gwfd);
 
 	if (init_ret != 0) {
 		msg_error("Failed initialize Greaseweazle (%d).\n", init_ret);
@@ -232,8 +366,9 @@ gw_init_gw(struct gw_fddrv *fdd, struct gw_info *gw_info, bool reset)
 
 	int	cmd_ret;
 
-	/* Put GW back to a better state if crashed on previous run. */
-	if (reset) {
+	/* Put GW back to a better state if crashed on previous run.
+	 * gwd resets an inherited GW after each job. */
+	if (reset && !gw_inherited) {
 		cmd_ret = gw_reset(gwfd);
 
 		if (cmd_ret != ACK_OKAY) {
@@ -264,50 +399,67 @@ gw_init_gw(struct gw_fddrv *fdd, struct gw_info *gw_info, bool reset)
 	 */
 	// XXX Is setting step and settle per drive or per GW?
 
-	if (fdd->step_ms != -1 || fdd->settle_ms != -1) {
-		struct gw_delay	gw_delay;
+	if (gw_set_delays(gwfd, fdd->step_ms, fdd->settle_ms))
+		return GW_DEVT_INVALID;
 
-		cmd_ret = gw_get_params(gwfd, &gw_delay);
+	return gwfd;
+}
 
-		if (cmd_ret != ACK_OKAY) {
-			msg_error("Failed to get parameters of Greaseweazle "
-				  "(%d).\n", cmd_ret);
-			return GW_DEVT_INVALID;
-		}
 
-		if (fdd->step_ms != -1) {
-			uint16_t	old_delay = gw_delay.step_delay;
+/*
+ * Set the GW's step delay and head settling time in milliseconds,
+ * leaving either alone if -1.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
 
-			gw_delay.step_delay = fdd->step_ms * 1000;
-			msg(MSG_NORMAL, "Changing step delay from %dms "
-			    "to %dms.\n", (int)old_delay / 1000,
-			    (int)gw_delay.step_delay / 1000);
-		}
+int
+gw_set_delays(gw_devt gwfd, int step_ms, int settle_ms)
+{
+	if (step_ms == -1 && settle_ms == -1)
+		return 0;
 
-		if (fdd->settle_ms != -1) {
-			uint16_t	old_settle = gw_delay.seek_settle;
+	struct gw_delay	gw_delay;
 
-			gw_delay.seek_settle = fdd->settle_ms;
-			msg(MSG_NORMAL, "Changing settle delay from %dms "
-			    "to %dms.\n", (int)old_settle,
-			    (int)gw_delay.seek_settle);
-		}
+	int cmd_ret = gw_get_params(gwfd, &gw_delay);
 
-		cmd_ret = gw_set_params(gwfd, &gw_delay);
+	if (cmd_ret != ACK_OKAY) {
+		msg_error("Failed to get parameters of Greaseweazle "
+			  "(%d).\n", cmd_ret);
+		return -1;
+	}
 
-		if (cmd_ret != ACK_OKAY) {
-			msg_error("Failed to set parameters of Greaseweazle "
-				  "(%d).\n", cmd_ret);
-			return GW_DEVT_INVALID;
-		}
+	if (step_ms != -1) {
+		uint16_t	old_delay = gw_delay.step_delay;
 
+		gw_delay.step_delay = step_ms * 1000;
+		msg(MSG_NORMAL, "Changing step delay from %dms "
+		    "to %dms.\n", (int)old_delay / 1000,
+		    (int)gw_delay.step_delay / 1000);
 	}
 
-	return gwfd;
+	if (settle_ms != -1) {
+		uint16_t	old_settle = gw_delay.seek_settle;
+
+		gw_delay.seek_settle = settle_ms;
+		msg(MSG_NORMAL, "Changing settle delay from %dms "
+		    "to %dms.\n", (int)old_settle,
+		    (int)gw_delay.seek_settle);
+	}
+
+	cmd_ret = gw_set_params(gwfd, &gw_delay);
+
+	if (cmd_ret != ACK_OKAY) {
+		msg_error("Failed to set parameters of Greaseweazle "
+			  "(%d).\n", cmd_ret);
+		return -1;
+	}
+
+	return 0;
 }
 
 
-static char
+char
 unit2char(int bus, int unit)
 {
 	return (bus == BUS_SHUGART) ? '0' + unit : 'a' + unit;
@@ -11,6 +11,7 @@ extern "C" {
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 
 #include "gw.h"
 #include "gwx.h"
@@ -21,6 +22,12 @@ extern "C" {
 #include "msg_levels.h"
 
 
+/* Environment variables naming the GW descriptor gwd hands its jobs,
+ * and that GW's identity (see gw_selected_id()). */
+#define GWD_FD_ENV	"GWD_FD"
+#define GWD_ID_ENV	"GWD_ID"
+
+
 extern const char *kind2desc(int kind);
 
 extern int kind2densel(int kind);
@@ -31,9 +38,15 @@ extern gw_devt gw_find_open_gw(const char *device, const char *serial,
 			       const char **device_list,
 			       const char **selected_dev);
 
+extern const char *gw_selected_id(void);
+
 extern gw_devt gw_init_gw(struct gw_fddrv *fdd, struct gw_info *gw_info,
 			  bool reset);
 
+extern int gw_set_delays(gw_devt gwfd, int step_ms, int settle_ms);
+
+extern char unit2char(int bus, int unit);
+
 extern int gw_detect_drive(struct gw_fddrv *fdd, bool require_unique);
 
 
@@ -1,6 +1,45 @@
+#include "gwx.h"
 #include "gwencode.h"
 
+
+/*
+ * Encode one interval of "ticks" as write stream bytes into "sbuf".
+ * Intervals past "nfa_thresh" become a no-flux area written at
+ * "nfa_period".  Returns the bytes used, at most GWCODE_MAX.  Needs
+ * nothing of the device, so the codec library takes it alone.
+ */
+
 int
-gw_encode_pulse(uint32_t pulse)
+encode_ticks(uint32_t ticks,
+	     uint32_t nfa_thresh,
+	     uint32_t nfa_period,
+	     uint8_t sbuf[GWCODE_MAX])
 {
+	int	sbuf_cnt = 0;
+
+	if (ticks < 250) {
+		sbuf[sbuf_cnt++] = ticks;
+	} else if (ticks > nfa_thresh) {
+		sbuf[sbuf_cnt++] = 255;
+		sbuf[sbuf_cnt++] = FLUXOP_SPACE;
+		gw_write_28(ticks, &sbuf[sbuf_cnt]);
+		sbuf_cnt += 4;
+		sbuf[sbuf_cnt++] = FLUXOP_ASTABLE;
+		gw_write_28(nfa_period, &sbuf[sbuf_cnt]);
+		sbuf_cnt += 4;
+	} else {
+		int high = (ticks - 250) / 255;
+		if (high < 5) {
+			sbuf[sbuf_cnt++] = 250 + high;
+			sbuf[sbuf_cnt++] = 1 + (ticks - 250) % 255;
+		} else {
+			sbuf[sbuf_cnt++] = 255;
+			sbuf[sbuf_cnt++] = FLUXOP_SPACE;
+			gw_write_28(ticks - 249, &sbuf[sbuf_cnt]);
+			sbuf_cnt += 4;
+			sbuf[sbuf_cnt++] = 249;
+		}
+	}
+
+	return sbuf_cnt;
 }
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "gw.h"
 #include "gwx.h"
@@ -19,8 +20,10 @@
 
 
 static const struct option cmd_long_args[] = {
+	{ "bucket",	 required_argument, NULL, 'b' },
 	{ "config",	 required_argument, NULL, 'C' },
 	{ "drive",	 required_argument, NULL, 'd' },
+	{ "report",	 required_argument, NULL, 'J' },
 	{ "revs",	 required_argument, NULL, 'r' },
 	{ "side",	 required_argument, NULL, 's' },
 	{ "track",	 required_argument, NULL, 't' },
@@ -54,8 +57,12 @@ static const char *device_list[] = {
 static struct cmd_settings {
 	struct gw_fddrv	fdd;
 	int		track;
+	int		track_end;
 	int		side;
+	int		side_end;
 	int		revs;
+	double		bucket_ns;
+	const char	*reportfile;
 	bool		reset_on_init;
 	int		scrn_verbosity;
 	int		file_verbosity;
@@ -74,8 +81,12 @@ static struct cmd_settings {
 	.fdd.step_ms = -1,
 	.fdd.settle_ms = -1,
 	.track = 0,
+	.track_end = 0,
 	.side = 0,
+	.side_end = 0,
 	.revs = 1,
+	.bucket_ns = -1.0,
+	.reportfile = NULL,
 	.reset_on_init = true,
 	.scrn_verbosity = MSG_NORMAL,
 	.file_verbosity = MSG_QUIET,
@@ -88,13 +99,60 @@ static void
 usage(const char *pgm_name)
 {
 	msg_fatal("Usage: %s [-G device] [-Z serial] [-d drive] "
-		  "[-B bustype] [-t track] [-s side] [-r revs] "
-		  "[--dd|--hd] [-T stp[,stl]] --[no]reset "
+		  "[-B bustype] [-t track[-track]] [-s side[-side]] "
+		  "[-r revs] [-b ns] [-J report] [--dd|--hd] [-T stp[,stl]] "
+		  "--[no]reset "
 		  "[-v verbosity] [-u logfile] [-U gwlogfile]\n",
 		  pgm_name);
 }
 
 
+/*
+ * Parse "first" or "first-last" for option "opt" into "lo" and "hi",
+ * each between 0 and "max".  Returns 0 on success, or -1 after
+ * reporting the problem.
+ */
+
+static int
+parse_range_arg(const char *arg, int opt, int max, int *lo, int *hi)
+{
+	char	*endptr;
+	long	first = strtol(arg, &endptr, 10);
+	long	last  = first;
+
+	if (endptr == arg)
+		goto err;
+
+	if (*endptr == '-') {
+		const char *p = endptr + 1;
+
+		last = strtol(p, &endptr, 10);
+
+		if (endptr == p)
+			goto err;
+	}
+
+	if (*endptr != '\0')
+		goto err;
+
+	if (first < 0 || last > max || first > last) {
+		msg_error("Option-argument to '%c' must be between 0 and %d, "
+			  "low to high.\n", opt, max);
+		return -1;
+	}
+
+	*lo = first;
+	*hi = last;
+
+	return 0;
+
+err:
+	msg_error("Option-argument to '%c' must be a number or a range "
+		  "of two.\n", opt);
+	return -1;
+}
+
+
 static void
 parse_args(int argc, char **argv, struct cmd_settings *cmd_set,
 	   const char *cfgfile)
@@ -107,7 +165,7 @@ parse_args(int argc, char **argv, struct cmd_settings *cmd_set,
 
 	optind = 0;	/* Reset getopt state; parse_args runs twice. */
 
-	while ((opt = getopt_long(argc, argv, "d:r:s:t:u:v:B:C:G:T:U:Z:",
+	while ((opt = getopt_long(argc, argv, "b:d:r:s:t:u:v:B:C:G:J:T:U:Z:",
 		cmd_long_args, &lindex)) != -1) {
 
 		switch(opt) {
@@ -133,6 +191,20 @@ parse_args(int argc, char **argv, struct cmd_settings *cmd_set,
 			}
 			break;
 
+		case 'b':;
+			char		*bend;
+			const double	ns = strtod(optarg, &bend);
+
+			if (bend == optarg || *bend != '\0' || ns < 0.0) {
+				msg_error("Option-argument to '%c' must "
+					  "be a width in ns, or 0 for one "
+					  "tick.\n", opt);
+				goto err_usage;
+			}
+
+			cmd_set->bucket_ns = ns;
+			break;
+
 		case 'd':
 			if (parse_drive_arg(optarg, opt, &cmd_set->fdd))
 				goto err_usage;
@@ -152,29 +224,17 @@ parse_args(int argc, char **argv, struct cmd_settings *cmd_set,
 			}
 			break;
 
-		case 's':;
-			const int side = strtol_strict(optarg, 10, "'s'");
-
-			if (side >= 0 && side <= 1) {
-				cmd_set->side = side;
-			} else {
-				msg_error("Option-argument to '%c' must "
-					  "be 0 or 1.\n", opt);
+		case 's':
+			if (parse_range_arg(optarg, opt, 1, &cmd_set->side,
+					    &cmd_set->side_end))
 				goto err_usage;
-			}
 			break;
 
-		case 't':;
-			const int track = strtol_strict(optarg, 10, "'t'");
-
-			if (track >= 0 && track < GW_MAX_TRACKS) {
-				cmd_set->track = track;
-			} else {
-				msg_error("Option-argument to '%c' must "
-					  "be between 0 and %d.\n",
-					  opt, GW_MAX_TRACKS - 1);
+		case 't':
+			if (parse_range_arg(optarg, opt, GW_MAX_TRACKS - 1,
+					    &cmd_set->track,
+					    &cmd_set->track_end))
 				goto err_usage;
-			}
 			break;
 
 		case 'u':
@@ -215,6 +275,10 @@ parse_args(int argc, char **argv, struct cmd_settings *cmd_set,
 				goto err_usage;
 			break;
 
+		case 'J':
+			cmd_set->reportfile = optarg;
+			break;
+
 		case 'G':
 			if (parse_device_arg(optarg, &cmd_set->fdd))
 				goto err_usage;
@@ -297,6 +361,175 @@ err_usage:
 }
 
 
+/*
+ * A sweep reads each track on the main thread and hands its flux to
+ * an analysis thread through a single slot, so building and analyzing
+ * the histogram of one track overlaps reading the next.
+ */
+
+struct sweep {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	pthread_t		thread;
+
+	/* Slot handed from the reader to the analyzer. */
+	struct histogram	histo;
+	uint8_t			*fbuf;
+	size_t			len;
+	bool			full;
+	bool			done;
+
+	bool			single;	/* Show the full histogram */
+	struct histogram	total;	/* All tracks' samples */
+	FILE			*fp;	/* Per-track table or NULL */
+	bool			csv;
+	int			rows;
+	int			errors;
+};
+
+
+static void
+sweep_analyze(struct sweep *sw, struct histogram *histo,
+	      uint8_t *fbuf, size_t len)
+{
+	int	f2hret = flux2histo(fbuf, len, histo);
+
+	free(fbuf);
+
+	if (f2hret) {
+		msg_error("Track %d, side %d: couldn't collect histogram.  "
+			  "Internal error.\n", histo->track, histo->side);
+		++sw->errors;
+		return;
+	}
+
+	struct histo_analysis	ha;
+
+	histo_analysis_init(&ha);
+	histo_analyze(histo, &ha);
+
+	histo_merge(&sw->total, histo);
+
+	if (sw->single) {
+		histo_show(MSG_NORMAL, histo, &ha);
+	} else if (ha.peaks > 0) {
+		msg(MSG_NORMAL, "Track %2d, side %d: %7.3f RPM, %d peaks, "
+				"bit rate %7.3f kHz\n",
+			histo->track, histo->side, ha.rpm, ha.peaks,
+			ha.bit_rate_khz);
+	} else {
+		msg(MSG_NORMAL, "Track %2d, side %d: %7.3f RPM, no peaks\n",
+			histo->track, histo->side, ha.rpm);
+	}
+
+	if (sw->fp && histo_table_row(sw->fp, sw->csv, sw->rows++,
+				      histo, &ha))
+		++sw->errors;
+}
+
+
+static void *
+sweep_worker(void *arg)
+{
+	struct sweep	*sw = arg;
+
+	pthread_mutex_lock(&sw->lock);
+
+	for (;;) {
+		while (!sw->full && !sw->done)
+			pthread_cond_wait(&sw->cond, &sw->lock);
+
+		if (!sw->full)
+			break;
+
+		struct histogram	histo = sw->histo;
+		uint8_t			*fbuf = sw->fbuf;
+		size_t			len = sw->len;
+
+		sw->full = false;
+		pthread_cond_broadcast(&sw->cond);
+		pthread_mutex_unlock(&sw->lock);
+
+		sweep_analyze(sw, &histo, fbuf, len);
+
+		pthread_mutex_lock(&sw->lock);
+	}
+
+	pthread_mutex_unlock(&sw->lock);
+
+	return NULL;
+}
+
+
+/* Hand a track's flux to the analysis thread, waiting for the slot. */
+
+static void
+sweep_put(struct sweep *sw, const struct histogram *histo,
+	  uint8_t *fbuf, size_t len)
+{
+	pthread_mutex_lock(&sw->lock);
+
+	while (sw->full)
+		pthread_cond_wait(&sw->cond, &sw->lock);
+
+	sw->histo = *histo;
+	sw->fbuf  = fbuf;
+	sw->len   = len;
+	sw->full  = true;
+
+	pthread_cond_broadcast(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+}
+
+
+/* Wait for the analysis thread to finish the tracks handed to it. */
+
+static void
+sweep_finish(struct sweep *sw)
+{
+	pthread_mutex_lock(&sw->lock);
+	sw->done = true;
+	pthread_cond_broadcast(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+
+	pthread_join(sw->thread, NULL);
+
+	pthread_cond_destroy(&sw->cond);
+	pthread_mutex_destroy(&sw->lock);
+}
+
+
+/*
+ * Summarize the samples of all the tracks swept together, whose
+ * peaks are steadier than any one track's.
+ */
+
+static void
+sweep_summary(const struct sweep *sw)
+{
+	struct histo_analysis	ha;
+	const double		us = 1000000.0 * sw->total.ticks_per_bucket /
+				     sw->total.sample_freq;
+
+	histo_analysis_init(&ha);
+	histo_analyze(&sw->total, &ha);
+
+	msg(MSG_NORMAL, "All tracks: %7.3f RPM, %d peaks", ha.rpm, ha.peaks);
+
+	for (int j = 0; j < ha.peaks; ++j) {
+		msg(MSG_NORMAL, "%s%.3f", j ? "/" : " at ",
+			ha.peak[j] * us);
+	}
+
+	if (ha.peaks > 0) {
+		msg(MSG_NORMAL, " us, bit rate %7.3f kHz\n",
+			ha.bit_rate_khz);
+	} else {
+		msg(MSG_NORMAL, "\n");
+	}
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -364,29 +597,93 @@ main(int argc, char **argv)
 		msg_fatal("Failed to select and start drive.\n");
 	}
 
-	msg(MSG_NORMAL, "Reading track %d, side %d...\n",
-		cmd_settings.track, cmd_settings.side);
+	struct sweep	sweep = {
+		.single = cmd_settings.track == cmd_settings.track_end &&
+			  cmd_settings.side == cmd_settings.side_end
+	};
 
-	struct histogram	histo;
+	/* Bucket width in ticks; histo_init() makes it at least one. */
+	const double	tpb = cmd_settings.bucket_ns < 0.0 ? TICKS_PER_BUCKET :
+			      cmd_settings.bucket_ns * gw_info.sample_freq /
+			      1000000000.0;
 
-	histo_init(cmd_settings.track, cmd_settings.side, cmd_settings.revs,
-			gw_info.sample_freq, TICKS_PER_BUCKET, &histo);
+	histo_init(0, 0, 0, gw_info.sample_freq, tpb, &sweep.total);
+	histo_clear(&sweep.total);
 
-	int chft_ret = collect_histo_from_track(gwfd, &histo);
+	if (cmd_settings.reportfile) {
+		size_t	len = strlen(cmd_settings.reportfile);
 
-	if (chft_ret > 0) {
-		msg_fatal("%s (%d)%s\n", gw_cmd_ack(chft_ret), chft_ret,
-			  chft_ret == ACK_NO_INDEX ?
-			  " [Is diskette in drive?]" : "");
-	} else if (chft_ret < 0) {
-		msg_fatal("Couldn't collect histogram.  Internal error.\n");
+		sweep.csv = len >= 4 &&
+			    !strcasecmp(cmd_settings.reportfile + len - 4,
+					".csv");
+		sweep.fp  = fopen(cmd_settings.reportfile, "w");
+
+		if (!sweep.fp || histo_table_begin(sweep.fp, sweep.csv)) {
+			msg_fatal("Failed to write report file '%s': %s\n",
+				  cmd_settings.reportfile, strerror(errno));
+		}
 	}
 
-	struct histo_analysis	ha;
+	pthread_mutex_init(&sweep.lock, NULL);
+	pthread_cond_init(&sweep.cond, NULL);
 
-	histo_analysis_init(&ha);
-	histo_analyze(&histo, &ha);
-	histo_show(MSG_NORMAL, &histo, &ha);
+	if (pthread_create(&sweep.thread, NULL, sweep_worker, &sweep))
+		msg_fatal("Failed to start analysis thread.\n");
+
+	if (sweep.single) {
+		msg(MSG_NORMAL, "Reading track %d, side %d...\n",
+			cmd_settings.track, cmd_settings.side);
+	} else {
+		msg(MSG_NORMAL, "Reading tracks %d to %d, sides %d to %d...\n",
+			cmd_settings.track, cmd_settings.track_end,
+			cmd_settings.side, cmd_settings.side_end);
+	}
+
+	for (int track = cmd_settings.track;
+	     track <= cmd_settings.track_end; ++track) {
+		for (int side = cmd_settings.side;
+		     side <= cmd_settings.side_end; ++side) {
+			struct histogram	histo;
+			uint8_t			*fbuf;
+			size_t			len;
+
+			histo_init(track, side, cmd_settings.revs,
+				   gw_info.sample_freq, tpb, &histo);
+
+			int rd_ret = read_histo_flux(gwfd, &histo,
+						     &fbuf, &len);
+
+			if (rd_ret) {
+				sweep_finish(&sweep);
+
+				if (rd_ret < 0) {
+					msg_fatal("Couldn't read track %d, "
+						  "side %d.  Internal "
+						  "error.\n", track, side);
+				}
+
+				msg_fatal("%s (%d)%s\n", gw_cmd_ack(rd_ret),
+					  rd_ret, rd_ret == ACK_NO_INDEX ?
+					  " [Is diskette in drive?]" : "");
+			}
+
+			sweep_put(&sweep, &histo, fbuf, len);
+		}
+	}
+
+	sweep_finish(&sweep);
+
+	if (!sweep.single && sweep.total.revs > 0)
+		sweep_summary(&sweep);
+
+	if (sweep.fp) {
+		if (histo_table_end(sweep.fp, sweep.csv, sweep.rows) ||
+		    fclose(sweep.fp)) {
+			msg_error("Failed to write report file '%s': %s\n",
+				  cmd_settings.reportfile, strerror(errno));
+			++sweep.errors;
+		}
+	}
 
 	if (gw_unsetdrive(gwfd, cmd_settings.fdd.drive) != ACK_OKAY)
 		msg_error("Failed to stop and deselect drive.\n");
@@ -396,5 +693,5 @@ main(int argc, char **argv)
 	// error checking
 	msg_fclose();
 
-	return EXIT_SUCCESS;
+	return sweep.errors ? EXIT_FAILURE : EXIT_SUCCESS;
 }
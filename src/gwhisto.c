@@ -8,6 +8,7 @@
 #include <math.h>
 
 #include "gwhisto.h"
+#include "gwwalk.h"
 
 
 void
@@ -16,7 +17,17 @@ histo_init(uint8_t track, uint8_t side, uint32_t revs,
 		double ticks_per_bucket,
 		struct histogram *histo)
 {
-	// Should there be a check on the max bucket size?
+	if (ticks_per_bucket < HIST_TICKS_MIN)
+		ticks_per_bucket = HIST_TICKS_MIN;
+
+	uint32_t	buckets = ceil(HIST_RANGE_TICKS / ticks_per_bucket -
+				       1e-6);
+
+	buckets = (buckets + 7) & ~7u;
+
+	if (buckets > HIST_BUCKETS_MAX)
+		buckets = HIST_BUCKETS_MAX;
+
 	*histo = (struct histogram){
 		.track = track,
 		.side  = side,
@@ -24,6 +35,7 @@ histo_init(uint8_t track, uint8_t side, uint32_t revs,
 		.sample_freq = sample_freq,
 		.total_ticks = 0,
 		.ticks_per_bucket = ticks_per_bucket,
+		.buckets = buckets,
 		.data_overflow = 0
 	};
 }
@@ -32,7 +44,45 @@ histo_init(uint8_t track, uint8_t side, uint32_t revs,
 void
 histo_analysis_init(struct histo_analysis *ha)
 {
-	*ha = (struct histo_analysis){};
+	*ha = (struct histo_analysis){ .ticks_per_bucket = TICKS_PER_BUCKET };
+}
+
+
+/*
+ * Peaks narrower than this share of all samples are taken for noise
+ * and skipped.
+ */
+
+#define PEAK_MIN_SHARE	0.01
+
+
+/*
+ * Weighted mean and standard deviation of the samples in buckets
+ * "lo" up to "hi".  Returns the number of samples.
+ */
+
+static double
+peak_moments(const uint32_t *data, int lo, int hi,
+	     double *mean, double *std_dev)
+{
+	double	n = 0.0, sum = 0.0, sq = 0.0;
+
+	for (int i = lo; i < hi; ++i) {
+		n   += data[i];
+		sum += (double)data[i] * i;
+	}
+
+	if (n == 0.0)
+		return 0.0;
+
+	*mean = sum / n;
+
+	for (int i = lo; i < hi; ++i)
+		sq += data[i] * pow((double)i - *mean, 2);
+
+	*std_dev = (n > 1.0) ? sqrt(sq / (n - 1.0)) : 0.0;
+
+	return n;
 }
 
 
@@ -42,51 +92,95 @@ histo_analyze(const struct histogram *histo,
 {
 	/*
 	 * Find 2-3 peaks in the data.
+	 *
+	 * Peaks are found where the counts, averaged over about one
+	 * default bucket's width, are above half the mean count.  The
+	 * averaging keeps fine buckets from splitting a peak into
+	 * several; at the default width there is none.
 	 */
 
-	unsigned int data_total_cnt = 0;
-	for (int i = 0; i < COUNT_OF(histo->data); ++i)
+	const int	buckets = histo->buckets;
+	const int	hw = (int)(TICKS_PER_BUCKET /
+				   histo->ticks_per_bucket / 2.0);
+
+	double		data_total_cnt = 0.0;
+	for (int i = 0; i < buckets; ++i)
 		data_total_cnt += histo->data[i];
 
-	unsigned int min_threshold =
-		(int)(0.50 * data_total_cnt / COUNT_OF(histo->data));
+	double		min_threshold = (int)(0.50 * data_total_cnt / buckets);
+	double		level[HIST_BUCKETS_MAX];
+
+	for (int i = 0; i < buckets; ++i) {
+		int	lo = (i - hw < 0) ? 0 : i - hw;
+		int	hi = (i + hw >= buckets) ? buckets - 1 : i + hw;
+		double	sum = 0.0;
 
-	int max_width = (int)(COUNT_OF(histo->data) / 5.3);
+		for (int k = lo; k <= hi; ++k)
+			sum += histo->data[k];
+
+		level[i] = sum / (hi - lo + 1);
+	}
+
+	int max_width = (int)(buckets / 5.3);
 
 	int j = 0, i = 0;
-	for (; j < HIST_MAX_PEAKS; ++j) {
-		int pwidth = 0, psamps = 0, psampsw = 0;
+	while (j < HIST_MAX_PEAKS) {
+		for (; (i < buckets) && (level[i] < min_threshold); ++i);
 
-		for (; (i < COUNT_OF(histo->data)) &&
-			(histo->data[i] < min_threshold); ++i);
+		int	lo = i;
 
-		for (; (i < COUNT_OF(histo->data)) &&
-				(histo->data[i] >= min_threshold); ++i) {
-			++pwidth;
-			psamps  += histo->data[i];
-			psampsw += histo->data[i] * i;
-		}
+		for (; (i < buckets) && (level[i] >= min_threshold); ++i);
+
+		int	pwidth = i - lo;
 
 		if ((pwidth == 0) || (pwidth > max_width)) {
 			/* Not a real peak */
 			break;
-		} else {
-			ha->peak[j]    = (double)psampsw / psamps;
-			ha->ps[j]      = psamps;
-			ha->std_dev[j] = 0.0;
-
-			for (int ii = i - pwidth; ii < i; ++ii) {
-				ha->std_dev[j] += histo->data[ii] *
-					pow((double)ii - ha->peak[j], 2);
-			}
-			ha->std_dev[j] = sqrt(ha->std_dev[j] /
-						((double)psamps - 1));
 		}
+
+		double	mean = 0.0, sd = 0.0;
+		double	psamps = peak_moments(histo->data, lo, i, &mean, &sd);
+
+		if (psamps < PEAK_MIN_SHARE * data_total_cnt)
+			continue;
+
+		/*
+		 * Refine the mean over the buckets within three standard
+		 * deviations of it, so a skewed shoulder that happens to
+		 * clear the threshold doesn't drag it off the peak.
+		 */
+		for (int pass = 0; pass < 2; ++pass) {
+			double	reach = fmax(3.0 * sd, hw + 1.0);
+			int	clo = (int)ceil(mean - reach);
+			int	chi = (int)floor(mean + reach) + 1;
+
+			if (clo < lo)
+				clo = lo;
+			if (chi > i)
+				chi = i;
+
+			double	cmean = mean, csd = sd;
+			double	cn = peak_moments(histo->data, clo, chi,
+						  &cmean, &csd);
+
+			if (cn == 0.0)
+				break;
+
+			mean = cmean;
+			sd = csd;
+			psamps = cn;
+		}
+
+		ha->peak[j]    = mean;
+		ha->ps[j]      = psamps;
+		ha->std_dev[j] = sd;
+		++j;
 	}
 
-	ha->peaks          = j;
-	ha->bit_rate_khz   = 0.0;
-	ha->data_clock_khz = 0.0;
+	ha->peaks            = j;
+	ha->ticks_per_bucket = histo->ticks_per_bucket;
+	ha->bit_rate_khz     = 0.0;
+	ha->data_clock_khz   = 0.0;
 
 	/* With no peaks (e.g. unformatted track), leave the rates zero;
 	 * callers must check ha->peaks before trusting them. */
@@ -127,7 +221,7 @@ histo_show(int msg_level,
 {
 	msg(msg_level, "Track %d, side %d, revolutions %" PRIu32 "\n",
 			histo->track, histo->side, histo->revs);
-	for (int i = 0; i < COUNT_OF(histo->data); i += 8) {
+	for (int i = 0; i < histo->buckets; i += 8) {
 		msg(msg_level,
 			"%3d: %06" PRIu32 " %06" PRIu32 " %06" PRIu32
 			" %06" PRIu32 " %06" PRIu32 " %06" PRIu32
@@ -142,7 +236,7 @@ histo_show(int msg_level,
 				histo->ticks_per_bucket / histo->sample_freq);
 	msg(msg_level, "Last bucket is less than: %.3fus\n",
 				1000000.0 * histo->ticks_per_bucket *
-				COUNT_OF(histo->data) / histo->sample_freq);
+				histo->buckets / histo->sample_freq);
 	msg(msg_level, "Entries exceeding last bucket: %u\n",
 				histo->data_overflow);
 
@@ -171,76 +265,163 @@ histo_show(int msg_level,
 }
 
 
-struct decode_imark_data {
-	uint32_t	total_ticks;	// Only count ticks between index holes
-	unsigned int	revs_seen;
-	uint32_t	index[2];
+/*
+ * Intervals under 250 ticks, nearly all of them, are counted by
+ * length in interleaved tables, so runs of equal intervals don't wait
+ * on one counter, and folded into the buckets once at the end.  Only
+ * longer intervals are placed one at a time.
+ */
+
+#define RAW_LANES	4
+#define RAW_MAX		250
+
+
+struct histo_walk {
+	struct histogram	*histo;
+	uint32_t		index[2];
+	uint32_t		raw[RAW_LANES][RAW_MAX];
 };
 
 
-static int
-imark_fn(uint32_t imark, void *data)
+static inline void
+histo_place(struct histogram *histo, uint32_t ticks, uint32_t n)
 {
-	struct decode_imark_data *dmd = (struct decode_imark_data *)data;
+	uint32_t	bucket = (uint32_t)(ticks / histo->ticks_per_bucket);
 
-	dmd->index[0] = dmd->index[1];
-	dmd->index[1] = imark;
+	if (bucket >= histo->buckets)
+		histo->data_overflow += n;
+	else
+		histo->data[bucket] += n;
+}
+
+
+static inline int
+walk_index(struct histo_walk *hw, uint32_t imark)
+{
+	hw->index[0] = hw->index[1];
+	hw->index[1] = imark;
 
-	if  (dmd->index[0] != ~0) {
-		dmd->total_ticks += dmd->index[1] - dmd->index[0];
-		++dmd->revs_seen;
+	if (hw->index[0] != ~0) {
+		hw->histo->total_ticks += hw->index[1] - hw->index[0];
+		++hw->histo->revs;
 	}
 
 	return 0;
 }
 
 
-static int
-pulse_fn(uint32_t ticks, void *data)
+static inline int
+walk_pulse(struct histo_walk *hw, uint32_t ticks)
 {
-	struct histogram	*histo = (struct histogram *)data;
-	const unsigned int	buckets = COUNT_OF(histo->data);
-	uint32_t		bucket = (int)(ticks / histo->ticks_per_bucket);
-
-	if (bucket >= buckets)
-		++histo->data_overflow;
-	else if (ticks > 0)
-		++histo->data[bucket];
+	if (ticks < RAW_MAX)
+		++hw->raw[0][ticks];
+	else
+		histo_place(hw->histo, ticks, 1);
 
 	return 0;
 }
 
 
+static inline void
+walk_run(struct histo_walk *hw, const uint8_t *p, size_t n)
+{
+	size_t	i = 0;
+
+	for (; i + RAW_LANES <= n; i += RAW_LANES) {
+		++hw->raw[0][p[i]];
+		++hw->raw[1][p[i + 1]];
+		++hw->raw[2][p[i + 2]];
+		++hw->raw[3][p[i + 3]];
+	}
+
+	for (; i < n; ++i)
+		++hw->raw[0][p[i]];
+}
+
+
+GW_STREAM_RUN_WALKER(walk_histo, struct histo_walk,
+		     walk_index, gw_walk_ignore, walk_pulse, walk_run)
+
+
+/*
+ * Add the flux intervals of the stream in "fbuf" to "histo", as well
+ * as its revolutions and the ticks between its first and last index
+ * marks.
+ *
+ * Returns 0, or -1 if the stream has no index mark.
+ */
+
 int
-flux2histo(const uint8_t *fbuf, size_t bytes_read, struct histogram *histo)
+flux2histo_add(const uint8_t *fbuf, size_t bytes_read,
+	       struct histogram *histo)
+{
+	struct histo_walk	hw = {
+		.histo = histo,
+		.index = { ~0, ~0 }
+	};
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+	walk_histo(fbuf, bytes_read, &ws, &hw);
+
+	for (int t = 1; t < RAW_MAX; ++t) {
+		uint32_t	n = 0;
+
+		for (int l = 0; l < RAW_LANES; ++l)
+			n += hw.raw[l][t];
+
+		if (n)
+			histo_place(histo, t, n);
+	}
+
+	return (hw.index[1] == ~0) ? -1 : 0;
+}
+
+
+/*
+ * Empty "histo" of samples and revolutions, keeping its track, side,
+ * and buckets, to collect into with flux2histo_add() or histo_merge().
+ */
+
+void
+histo_clear(struct histogram *histo)
 {
 	histo->total_ticks = 0;
+	histo->revs = 0;
 	histo->data_overflow = 0;
 	memset(histo->data, 0, sizeof(histo->data));
+}
 
-	struct decode_imark_data idata = { 0, 0, { ~0, ~0 } };
-	struct gw_decode_stream_s gwds = {
-					  .ds_ticks = 0,
-					  .ds_status = -1,
-					  .decoded_imark = imark_fn,
-					  .imark_data = &idata,
-					  .decoded_space = NULL,
-					  .space_data = NULL,
-					  .decoded_pulse = pulse_fn,
-					  .pulse_data = histo
-					 };
 
-	gw_decode_stream(fbuf, bytes_read, &gwds);
+int
+flux2histo(const uint8_t *fbuf, size_t bytes_read, struct histogram *histo)
+{
+	histo_clear(histo);
+
+	// Should we check to ensure revs seen and those read are equal?
+
+	return flux2histo_add(fbuf, bytes_read, histo);
+}
 
-	histo->total_ticks = idata.total_ticks;
-	histo->revs        = idata.revs_seen;
 
-	// Should we check to ensure revs_seen and histo->revs are equal?
+/*
+ * Add "src" into "dst", which must have buckets of the same width
+ * at the same sample frequency.  Returns 0, or -1 if they differ.
+ */
 
-	if (idata.index[1] == ~0) {
-		// error handling
+int
+histo_merge(struct histogram *dst, const struct histogram *src)
+{
+	if (dst->sample_freq != src->sample_freq ||
+	    dst->ticks_per_bucket != src->ticks_per_bucket ||
+	    dst->buckets != src->buckets)
 		return -1;
-	}
+
+	for (uint32_t i = 0; i < dst->buckets; ++i)
+		dst->data[i] += src->data[i];
+
+	dst->data_overflow += src->data_overflow;
+	dst->total_ticks   += src->total_ticks;
+	dst->revs          += src->revs;
 
 	return 0;
 }
@@ -259,7 +440,36 @@ flux2histo(const uint8_t *fbuf, size_t bytes_read, struct histogram *histo)
 int
 collect_histo_from_track(gw_devt gwfd, struct histogram *histo)
 {
-	uint8_t	*fbuf = 0;
+	uint8_t	*fbuf;
+	size_t	len;
+
+	int ret = read_histo_flux(gwfd, histo, &fbuf, &len);
+
+	if (ret)
+		return ret;
+
+	int f2hret = flux2histo(fbuf, len, histo);
+
+	free(fbuf);
+
+	return f2hret ? -1 : 0;
+}
+
+
+/*
+ * Read the raw flux of the track and side in "histo" without
+ * building the histogram, so flux2histo() may run on it later
+ * while the next track is read.
+ *
+ * Returns as collect_histo_from_track().  On success, "*fbuf" is
+ * the stream of "*len" bytes for the caller to free.
+ */
+
+int
+read_histo_flux(gw_devt gwfd, const struct histogram *histo,
+		uint8_t **fbuf, size_t *len)
+{
+	*fbuf = NULL;
 
 	int cmd_ret = gw_seek(gwfd, histo->track);
 
@@ -271,14 +481,87 @@ collect_histo_from_track(gw_devt gwfd, struct histogram *histo)
 	if (cmd_ret != ACK_OKAY)
 		return cmd_ret > 0 ? cmd_ret : -1;
 
-	ssize_t rd_ret = gw_read_stream(gwfd, histo->revs, 0, &fbuf);
+	ssize_t rd_ret = gw_read_stream(gwfd, histo->revs, 0, fbuf);
 
 	if (rd_ret < 0)
 		return -rd_ret;
 
-	int f2hret = flux2histo(fbuf, rd_ret, histo);
+	*len = rd_ret;
 
-	free(fbuf);
+	return 0;
+}
 
-	return f2hret ? -1 : 0;
+
+/*
+ * Per-track table of a histogram sweep.  Rows are written as each
+ * track is analyzed, as CSV or as a JSON array of objects.  Peak
+ * means and standard deviations are in microseconds.
+ */
+
+static const char	table_csv_header[] =
+	"track,side,revs,rpm,peaks,peak1_us,peak2_us,peak3_us,"
+	"sd1_us,sd2_us,sd3_us,bit_rate_khz,data_clock_khz,overflow\n";
+
+
+int
+histo_table_begin(FILE *fp, bool csv)
+{
+	fputs(csv ? table_csv_header : "[", fp);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+
+int
+histo_table_row(FILE *fp, bool csv, int row,
+		const struct histogram *histo,
+		const struct histo_analysis *ha)
+{
+	const double	us = 1000000.0 * histo->ticks_per_bucket /
+			     histo->sample_freq;
+	const double	rpm = histo->total_ticks ? ha->rpm : 0.0;
+	double		peak_us[HIST_MAX_PEAKS] = { 0 };
+	double		sd_us[HIST_MAX_PEAKS] = { 0 };
+
+	for (int j = 0; j < ha->peaks; ++j) {
+		peak_us[j] = ha->peak[j] * us;
+		sd_us[j]   = ha->std_dev[j] * us;
+	}
+
+	if (csv) {
+		fprintf(fp, "%d,%d,%" PRIu32 ",%.3f,%d,%.4f,%.4f,%.4f,"
+			    "%.4f,%.4f,%.4f,%.3f,%.3f,%" PRIu32 "\n",
+			histo->track, histo->side, histo->revs, rpm,
+			ha->peaks, peak_us[0], peak_us[1], peak_us[2],
+			sd_us[0], sd_us[1], sd_us[2],
+			ha->bit_rate_khz, ha->data_clock_khz,
+			histo->data_overflow);
+	} else {
+		fprintf(fp, "%s\n  { \"track\": %d, \"side\": %d, "
+			    "\"revs\": %" PRIu32 ", \"rpm\": %.3f, "
+			    "\"peaks\": %d, "
+			    "\"peak_us\": [%.4f, %.4f, %.4f], "
+			    "\"sd_us\": [%.4f, %.4f, %.4f], "
+			    "\"bit_rate_khz\": %.3f, "
+			    "\"data_clock_khz\": %.3f, "
+			    "\"overflow\": %" PRIu32 " }",
+			row ? "," : "",
+			histo->track, histo->side, histo->revs, rpm,
+			ha->peaks, peak_us[0], peak_us[1], peak_us[2],
+			sd_us[0], sd_us[1], sd_us[2],
+			ha->bit_rate_khz, ha->data_clock_khz,
+			histo->data_overflow);
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
+
+
+int
+histo_table_end(FILE *fp, bool csv, int rows)
+{
+	if (!csv)
+		fputs(rows ? "\n]\n" : "]\n", fp);
+
+	return ferror(fp) ? -1 : 0;
 }
@@ -6,6 +6,8 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 #include "msg.h"
 #include "gw.h"
@@ -16,6 +18,15 @@ extern "C" {
 #define TICKS_PER_BUCKET	5.0843808
 #define	HIST_MAX_PEAKS		3
 
+/*
+ * Buckets may be as narrow as one sample tick.  However wide they
+ * are, there are as many as cover the ticks of HIST_BUCKETS default
+ * buckets, in rows of 8.
+ */
+#define	HIST_BUCKETS_MAX	1024
+#define	HIST_TICKS_MIN		1.0
+#define	HIST_RANGE_TICKS	(HIST_BUCKETS * TICKS_PER_BUCKET)
+
 
 // XXX Should I move track, side, revs out?
 struct histogram {
@@ -25,13 +36,16 @@ struct histogram {
 	uint32_t	sample_freq;
 	uint32_t	total_ticks;	// Only count ticks between index holes
 	double		ticks_per_bucket;
-	uint32_t	data[HIST_BUCKETS];
+	uint32_t	buckets;	// In use of data[]
+	uint32_t	data[HIST_BUCKETS_MAX];
 	uint32_t	data_overflow;
 };
 
 
+// Peak means and deviations are in buckets of ticks_per_bucket.
 struct histo_analysis {
 	int		peaks;
+	double		ticks_per_bucket;
 	double		peak[HIST_MAX_PEAKS];
 	double		ps[HIST_MAX_PEAKS];
 	double		std_dev[HIST_MAX_PEAKS];
@@ -55,8 +69,26 @@ extern int histo_show(int msg_level, const struct histogram *histo,
 extern int flux2histo(const uint8_t *fbuf, size_t bytes_read,
 			struct histogram *histo);
 
+extern void histo_clear(struct histogram *histo);
+
+extern int flux2histo_add(const uint8_t *fbuf, size_t bytes_read,
+			struct histogram *histo);
+
+extern int histo_merge(struct histogram *dst, const struct histogram *src);
+
 extern int collect_histo_from_track(gw_devt gwfd, struct histogram *histo);
 
+extern int read_histo_flux(gw_devt gwfd, const struct histogram *histo,
+			uint8_t **fbuf, size_t *len);
+
+extern int histo_table_begin(FILE *fp, bool csv);
+
+extern int histo_table_row(FILE *fp, bool csv, int row,
+			const struct histogram *histo,
+			const struct histo_analysis *ha);
+
+extern int histo_table_end(FILE *fp, bool csv, int rows);
+
 
 #ifdef __cplusplus
 }               
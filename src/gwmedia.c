@@ -45,6 +45,7 @@ media_encoding_init_from_histo(struct gw_media_encoding *gme,
 			       const struct histo_analysis *ha,
 			       uint32_t sample_freq)
 {
+	const double	tpb = ha->ticks_per_bucket;
 
 	media_encoding_init_base(gme);
 
@@ -55,27 +56,27 @@ media_encoding_init_from_histo(struct gw_media_encoding *gme,
 	if (ha->peaks == 2) {
 		double	p6g = (ha->peak[0] + ha->peak[1]) / 2.0;
 
-		gme->fmthresh   = (int)round(p6g * TICKS_PER_BUCKET);
+		gme->fmthresh   = (int)round(p6g * tpb);
 
 		gme->mfmthresh1 = (int)round((ha->peak[0] + p6g) *
-						TICKS_PER_BUCKET / 2.0);
+						tpb / 2.0);
 
 		gme->mfmthresh2 = (int)round((p6g + ha->peak[1]) *
-						TICKS_PER_BUCKET / 2.0);
+						tpb / 2.0);
 
-		gme->mfmshort   = (ha->peak[0] + p6g) * TICKS_PER_BUCKET / 5.0;
+		gme->mfmshort   = (ha->peak[0] + p6g) * tpb / 5.0;
 	} else {
 		gme->fmthresh   = (int)round((ha->peak[0] + ha->peak[2]) *
-						TICKS_PER_BUCKET / 2.0);
+						tpb / 2.0);
 
 		gme->mfmthresh1 = (int)round((ha->peak[0] + ha->peak[1]) *
-						TICKS_PER_BUCKET / 2.0);
+						tpb / 2.0);
 
 		gme->mfmthresh2 = (int)round((ha->peak[1] + ha->peak[2]) *
-						TICKS_PER_BUCKET / 2.0);
+						tpb / 2.0);
 
 		gme->mfmshort   = (ha->peak[0] + ha->peak[1]) *
-						TICKS_PER_BUCKET / 5.0;
+						tpb / 5.0;
 	}
 
 	gme->mfmthresh0 = (int)round(gme->mfmthresh1 * 0.6);
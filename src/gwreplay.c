@@ -111,21 +111,26 @@ flux_append(struct gw_replay_log *log, int cyl, int head,
  * Logfile parser.
  *
  * Host transfers are always whole command frames (gw_do_command
- * writes each command in a single gw_write), while responses are
- * chunked over multiple reads and must be concatenated.  A command's
- * complete response is on hand once the next host transfer (or EOF)
- * is seen, so resolution of a pending command is deferred until then.
+ * writes each command in a single gw_write, and gw_do_commands a
+ * batch of them back to back), while responses are chunked over
+ * multiple reads and must be concatenated.  A transfer's complete
+ * responses are on hand once the next host transfer (or EOF) is seen,
+ * so resolution of its pending commands is deferred until then, and
+ * then the responses are consumed in order.
  */
 
 struct parse_state {
 	struct gw_replay_log	*log;
 	int			cur_cyl;
 	int			cur_head;
-	/* pending host command frame awaiting its response */
-	uint8_t			pcmd[64];
-	size_t			pcmd_cnt;
-	int			pcyl, phead;
-	/* accumulated response bytes for the pending command */
+	/* pending host command frames awaiting their responses */
+	struct {
+		uint8_t		cmd[64];
+		size_t		cnt;
+		int		cyl, head;
+	}			pcmd[GW_BATCH_MAX];
+	int			pcmd_cnt;
+	/* accumulated response bytes for the pending commands */
 	uint8_t			*dbuf;
 	size_t			dbuf_cnt, dbuf_cap;
 	/* most recently appended flux stream, for GET_FLUX_STATUS */
@@ -134,94 +139,91 @@ struct parse_state {
 
 
 /*
- * Consume the accumulated response bytes for the pending command.
- * Returns 0 on success, -1 on memory failure.
+ * Consume pending command "n"'s response from the accumulated bytes
+ * at *used.  Returns 0 on success (having advanced *used), 1 if the
+ * responses can't be followed past it, or -1 on memory failure.
  */
 
 static int
-resolve_pending(struct parse_state *ps)
+resolve_one(struct parse_state *ps, int n, size_t *used)
 {
 	struct gw_replay_log	*log = ps->log;
-	size_t			used = 0;
-
-	if (ps->pcmd_cnt == 0) {
-		if (ps->dbuf_cnt)
-			++log->warnings;
-		goto done;
-	}
+	const uint8_t		*pcmd = ps->pcmd[n].cmd;
+	size_t			pcmd_cnt = ps->pcmd[n].cnt;
+	size_t			at = *used;
 
-	if (ps->dbuf_cnt < 2) {
+	if (ps->dbuf_cnt - at < 2) {
 		/* Truncated exchange (e.g. interrupted capture). */
 		++log->warnings;
-		goto done;
+		return 1;
 	}
 
-	uint8_t	cmd = ps->pcmd[0];
-	uint8_t	ack = ps->dbuf[1];
-
-	used = 2;
+	uint8_t	cmd = pcmd[0];
+	uint8_t	ack = ps->dbuf[at + 1];
 
-	if (ps->dbuf[0] != cmd) {
+	if (ps->dbuf[at] != cmd) {
 		++log->warnings;
-		goto done;
+		return 1;
 	}
 
+	at += 2;
+
 	switch (cmd) {
 	case CMD_GET_INFO:
 		if (ack == ACK_OKAY &&
-		    ps->pcmd_cnt >= 3 &&
-		    ps->pcmd[2] == GETINFO_FIRMWARE &&
-		    ps->dbuf_cnt - used >= sizeof(log->getinfo)) {
+		    pcmd_cnt >= 3 &&
+		    pcmd[2] == GETINFO_FIRMWARE &&
+		    ps->dbuf_cnt - at >= sizeof(log->getinfo)) {
 			if (!log->have_getinfo) {
-				memcpy(log->getinfo, &ps->dbuf[used],
+				memcpy(log->getinfo, &ps->dbuf[at],
 				       sizeof(log->getinfo));
 				log->sample_freq =
 					le32_get(&log->getinfo[4]);
 				log->have_getinfo = true;
 			}
-			used += sizeof(log->getinfo);
+			at += sizeof(log->getinfo);
 		} else if (ack == ACK_OKAY) {
-			used = ps->dbuf_cnt;
+			at = ps->dbuf_cnt;
 		}
 		break;
 
 	case CMD_GET_PARAMS:
 		if (ack == ACK_OKAY)
-			used = ps->dbuf_cnt;
+			at = ps->dbuf_cnt;
 		break;
 
 	case CMD_READ_FLUX:
 		if (ack != ACK_OKAY)
 			break;
 
-		uint8_t	*term = memchr(&ps->dbuf[used], 0,
-				       ps->dbuf_cnt - used);
+		uint8_t	*term = memchr(&ps->dbuf[at], 0,
+				       ps->dbuf_cnt - at);
 		size_t	stream_cnt;
-		uint8_t	*stream = &ps->dbuf[used];
+		uint8_t	*stream = &ps->dbuf[at];
 
 		if (term) {
 			stream_cnt = term - stream + 1;
 		} else {
 			/* Truncated capture; add the terminator. */
-			stream_cnt = ps->dbuf_cnt - used;
+			stream_cnt = ps->dbuf_cnt - at;
 			if (buf_append(&ps->dbuf, &ps->dbuf_cnt,
 				       &ps->dbuf_cap,
 				       (const uint8_t *)"", 1))
 				return -1;
-			stream = &ps->dbuf[used];
+			stream = &ps->dbuf[at];
 			++stream_cnt;
 			++log->warnings;
 		}
 
 		if (stream_cnt > 1) {
-			ps->last_flux = flux_append(log, ps->pcyl,
-						    ps->phead,
+			ps->last_flux = flux_append(log, ps->pcmd[n].cyl,
+						    ps->pcmd[n].head,
 						    stream, stream_cnt);
 			if (!ps->last_flux)
 				return -1;
 		}
 
-		used += stream_cnt;
+		at += stream_cnt;
 		break;
 
 	case CMD_GET_FLUX_STATUS:
@@ -233,20 +235,47 @@ resolve_pending(struct parse_state *ps)
 		break;
 	}
 
-	if (ps->dbuf_cnt > used)
-		++log->warnings;
+	*used = at;
+
+	return 0;
+}
+
+
+/*
+ * Consume the accumulated response bytes for the pending commands,
+ * in order.  Returns 0 on success, -1 on memory failure.
+ */
+
+static int
+resolve_pending(struct parse_state *ps)
+{
+	size_t	used = 0;
+	int	ret = 0;
+
+	if (ps->pcmd_cnt == 0 && ps->dbuf_cnt)
+		++ps->log->warnings;
+
+	for (int n = 0; n < ps->pcmd_cnt; ++n) {
+		ret = resolve_one(ps, n, &used);
+
+		if (ret != 0)
+			break;
+	}
+
+	if (ret == 0 && ps->pcmd_cnt && ps->dbuf_cnt > used)
+		++ps->log->warnings;
 
-done:
 	ps->pcmd_cnt = 0;
 	ps->dbuf_cnt = 0;
 
-	return 0;
+	return ret == -1 ? -1 : 0;
 }
 
 
 /*
- * Process a complete host command frame: resolve the previous
- * command, then track drive position and set the new pending command.
+ * Process a complete host transfer: resolve the previous commands,
+ * then split it into command frames, tracking drive position, and
+ * set them pending.
  */
 
 static int
@@ -255,31 +284,42 @@ host_frame(struct parse_state *ps, const uint8_t *frame, size_t cnt)
 	if (resolve_pending(ps))
 		return -1;
 
-	if (cnt < 2 || cnt > sizeof(ps->pcmd) || frame[1] != cnt) {
-		++ps->log->warnings;
-		return 0;
-	}
+	while (cnt > 0) {
+		size_t	len = (cnt >= 2) ? frame[1] : 0;
 
-	switch (frame[0]) {
-	case CMD_SEEK:
-		if (frame[2] < GW_MAX_TRACKS)
-			ps->cur_cyl = frame[2];
-		else
+		if (len < 2 || len > cnt ||
+		    len > sizeof(ps->pcmd[0].cmd) ||
+		    ps->pcmd_cnt == GW_BATCH_MAX) {
 			++ps->log->warnings;
-		break;
+			return 0;
+		}
 
-	case CMD_HEAD:
-		ps->cur_head = frame[2] & 1;
-		break;
+		switch (frame[0]) {
+		case CMD_SEEK:
+			if (frame[2] < GW_MAX_TRACKS)
+				ps->cur_cyl = frame[2];
+			else
+				++ps->log->warnings;
+			break;
 
-	default:
-		break;
-	}
+		case CMD_HEAD:
+			ps->cur_head = frame[2] & 1;
+			break;
 
-	memcpy(ps->pcmd, frame, cnt);
-	ps->pcmd_cnt = cnt;
-	ps->pcyl  = ps->cur_cyl;
-	ps->phead = ps->cur_head;
+		default:
+			break;
+		}
+
+		int	n = ps->pcmd_cnt++;
+
+		memcpy(ps->pcmd[n].cmd, frame, len);
+		ps->pcmd[n].cnt	 = len;
+		ps->pcmd[n].cyl	 = ps->cur_cyl;
+		ps->pcmd[n].head = ps->cur_head;
+
+		frame += len;
+		cnt   -= len;
+	}
 
 	return 0;
 }
@@ -0,0 +1,196 @@
+#ifndef GWWALK_H
+#define GWWALK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "gwx.h"
+
+/*
+ * Greaseweazle flux stream walkers specialized at compile time.
+ *
+ * gw_decode_stream() calls its consumers through function pointers,
+ * two or more indirect calls for every flux transition.  A walker
+ * defined with
+ *
+ *   GW_STREAM_WALKER(name, type, imark, space, pulse)
+ *
+ * is a static function
+ *
+ *   ssize_t name(const uint8_t *fbuf, size_t fbuf_cnt,
+ *                struct gw_walk_state *ws, type *data);
+ *
+ * which walks the stream exactly as gw_decode_stream() does, but
+ * calls the consumers imark(), space() and pulse() directly so the
+ * compiler can inline them.  Each is called as
+ *
+ *   int consumer(type *data, uint32_t ticks);
+ *
+ * with the same ticks and the same meaning of its return value as
+ * the corresponding gw_decode_stream() callback.  gw_walk_ignore()
+ * serves for a consumer that isn't wanted.
+ *
+ * Runs of one-byte intervals, the bulk of any stream, are walked in
+ * a loop of their own.  A consumer that never stops the walk can take
+ * them whole instead, from a walker defined with
+ *
+ *   GW_STREAM_RUN_WALKER(name, type, imark, space, pulse, run)
+ *
+ * which calls
+ *
+ *   void run(type *data, const uint8_t *p, size_t n);
+ *
+ * with "n" stream bytes, each byte the ticks of one interval, rather
+ * than calling pulse() for each.
+ */
+
+struct gw_walk_state {
+	uint32_t	ticks;		/* As ds_ticks */
+	uint32_t	last_pulse;	/* As ds_last_pulse */
+	int		status;		/* As ds_status */
+};
+
+#define GW_WALK_STATE_INIT	{ .ticks = 0, .last_pulse = 0, .status = -1 }
+
+#define gw_walk_short(c)	((uint8_t)((c) - 1) < 249)
+
+
+static inline int
+gw_walk_ignore(void *data, uint32_t ticks)
+{
+	return 0;
+}
+
+
+/* One-byte intervals, one pulse() each. */
+
+#define GW_WALK_PULSES_(pulse, run)					\
+		while (f < fend && gw_walk_short(*f)) {			\
+			gw_ticks += *f++;				\
+			status = pulse(data, gw_ticks - last);		\
+			last = gw_ticks;				\
+									\
+			if (status) {					\
+				ff = f;					\
+				goto done;				\
+			}						\
+		}
+
+
+/* One-byte intervals as a run, after any space ends in a pulse. */
+
+#define GW_WALK_RUN_(pulse, run)					\
+		if (gw_ticks != last && f < fend && gw_walk_short(*f)) { \
+			gw_ticks += *f++;				\
+			status = pulse(data, gw_ticks - last);		\
+			last = gw_ticks;				\
+		}							\
+									\
+		const uint8_t	*r = f;					\
+									\
+		while (fend - f >= 4 &&					\
+		       gw_walk_short(f[0]) && gw_walk_short(f[1]) &&	\
+		       gw_walk_short(f[2]) && gw_walk_short(f[3])) {	\
+			gw_ticks += f[0] + f[1] + f[2] + f[3];		\
+			f += 4;						\
+		}							\
+									\
+		while (f < fend && gw_walk_short(*f))			\
+			gw_ticks += *f++;				\
+									\
+		if (f != r) {						\
+			run(data, r, f - r);				\
+			last = gw_ticks;				\
+		}
+
+
+#define GW_WALKER_(name, type, imark, space, pulse, run, shorts)	\
+static ssize_t								\
+name(const uint8_t *fbuf, size_t fbuf_cnt,				\
+     struct gw_walk_state *ws, type *data)				\
+{									\
+	uint32_t	gw_ticks = ws->ticks;				\
+	uint32_t	last = ws->last_pulse;				\
+	int		status = ws->status;				\
+	ssize_t		ret;						\
+	const uint8_t	*f = fbuf, *ff = fbuf;				\
+	const uint8_t	*const fend = fbuf + fbuf_cnt;			\
+									\
+	while (f < fend) {						\
+		shorts(pulse, run)					\
+									\
+		ff = f;							\
+									\
+		if (f == fend)						\
+			break;						\
+									\
+		uint8_t c = *f++;					\
+									\
+		if (c == 0) {						\
+			ff = f;						\
+			goto done;					\
+		} else if (c == 255) {					\
+			if (fend - f < 5)				\
+				goto done;				\
+									\
+			uint8_t  fop = *f++;				\
+			uint32_t v   = gw_read_28(f);			\
+			f += 4;						\
+									\
+			switch (fop) {					\
+			case FLUXOP_INDEX:				\
+				ff = f;					\
+				status = imark(data, gw_ticks + v);	\
+				break;					\
+									\
+			case FLUXOP_SPACE:				\
+				gw_ticks += v;				\
+				ff = f;					\
+				status = space(data, v);		\
+				break;					\
+									\
+			default:					\
+				ret = -1;				\
+				goto out;				\
+			}						\
+		} else if (f < fend) {					\
+			gw_ticks += 250 + (c - 250) * 255 + *f++ - 1;	\
+			ff = f;						\
+			status = pulse(data, gw_ticks - last);		\
+			last = gw_ticks;				\
+		} else {						\
+			goto done;					\
+		}							\
+									\
+		if (status)						\
+			break;						\
+	}								\
+									\
+done:									\
+	ws->ticks = gw_ticks;						\
+	ret = ff - fbuf;						\
+									\
+out:									\
+	ws->last_pulse = last;						\
+	ws->status = status;						\
+									\
+	return ret;							\
+}
+
+
+#define GW_STREAM_WALKER(name, type, imark, space, pulse)		\
+	GW_WALKER_(name, type, imark, space, pulse, pulse, GW_WALK_PULSES_)
+
+#define GW_STREAM_RUN_WALKER(name, type, imark, space, pulse, run)	\
+	GW_WALKER_(name, type, imark, space, pulse, run, GW_WALK_RUN_)
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,7 @@
+#include <math.h>
+
 #include "gwx.h"
+#include "gwwalk.h"
 
 
 /*
@@ -55,23 +58,14 @@ gw_get_bandwidth(gw_devt gwfd, double *min_bw, double *max_bw)
 
 
 /*
- * Stream bytes from GW.
- *
- * On success, returns number of bytes read.
- * On failure, returns either the negative value of the GW error code
- * or -99 if an internal error occurred.
- *
- * Data returned via fbuf, must be free()d by caller when done.
+ * Collect a flux stream through its terminator, then its status, for
+ * gw_read_stream() and gw_read_stream_at().
  */
 
-ssize_t
-gw_read_stream(gw_devt gwfd, int revs, int ticks, uint8_t **fbuf)
+static ssize_t
+gw_collect_stream(gw_devt gwfd, uint8_t **fbuf)
 {
-	int cmd_ret = gw_read_flux(gwfd, revs, ticks);
-
-	if (cmd_ret != ACK_OKAY)
-		return cmd_ret < 0 ? -99 : -cmd_ret;
-
+	int	cmd_ret;
 	ssize_t fbuf_cnt = 0;
 	size_t	fbuf_cap = 0;
 
@@ -146,13 +140,82 @@ flux_status:
 }
 
 
-static int
-decode_stub(uint32_t ticks, void *data)
+/*
+ * Stream bytes from GW.
+ *
+ * On success, returns number of bytes read.
+ * On failure, returns either the negative value of the GW error code
+ * or -99 if an internal error occurred.
+ *
+ * Data returned via fbuf, must be free()d by caller when done.
+ */
+
+ssize_t
+gw_read_stream(gw_devt gwfd, int revs, int ticks, uint8_t **fbuf)
+{
+	int cmd_ret = gw_read_flux(gwfd, revs, ticks);
+
+	if (cmd_ret != ACK_OKAY)
+		return cmd_ret < 0 ? -99 : -cmd_ret;
+
+	return gw_collect_stream(gwfd, fbuf);
+}
+
+
+/*
+ * Seek to "cyl", select "head", and stream bytes from GW as
+ * gw_read_stream() does, in one round trip if batching is on (see
+ * gw_read_flux_at()).  On failure, "failed" says which step failed:
+ * 0 the seek, 1 the head select, 2 the read.
+ */
+
+ssize_t
+gw_read_stream_at(gw_devt gwfd, int cyl, int head, int revs, int ticks,
+		  uint8_t **fbuf, int *failed)
 {
-	return 0;
+	int cmd_ret = gw_read_flux_at(gwfd, cyl, head, revs, ticks, failed);
+
+	if (cmd_ret != ACK_OKAY)
+		return cmd_ret < 0 ? -99 : -cmd_ret;
+
+	*failed = 2;
+
+	return gw_collect_stream(gwfd, fbuf);
 }
 
 
+/*
+ * gw_decode_stream()'s consumers: the callbacks in gwds, if set.
+ */
+
+static inline int
+call_imark(struct gw_decode_stream_s *gwds, uint32_t ticks)
+{
+	return gwds->decoded_imark ?
+		(*gwds->decoded_imark)(ticks, gwds->imark_data) : 0;
+}
+
+
+static inline int
+call_space(struct gw_decode_stream_s *gwds, uint32_t ticks)
+{
+	return gwds->decoded_space ?
+		(*gwds->decoded_space)(ticks, gwds->space_data) : 0;
+}
+
+
+static inline int
+call_pulse(struct gw_decode_stream_s *gwds, uint32_t ticks)
+{
+	return gwds->decoded_pulse ?
+		(*gwds->decoded_pulse)(ticks, gwds->pulse_data) : 0;
+}
+
+
+GW_STREAM_WALKER(walk_callbacks, struct gw_decode_stream_s,
+		 call_imark, call_space, call_pulse)
+
+
 /*
  * Decode the byte stream from the Greaseweazle.  Use the callbacks
  * from gwds to process the index holes and data pulses.
@@ -162,6 +225,9 @@ decode_stub(uint32_t ticks, void *data)
  * processed due to a multibyte sequence that couldn't be fully decoded.
  * Call again with existing undecoded bytes plus additional following
  * bytes.
+ *
+ * Hot paths use a walker from gwwalk.h instead, without the calls
+ * through pointers.
  */
 
 ssize_t
@@ -169,75 +235,19 @@ gw_decode_stream(const uint8_t *fbuf,
 		 size_t fbuf_cnt,
 		 struct gw_decode_stream_s *gwds)
 {
-	uint32_t	gw_ticks = gwds->ds_ticks;
-	const uint8_t	*f = fbuf, *ff = fbuf;
-	const uint8_t	*const fend = fbuf + fbuf_cnt;
-	int		(*f_imark)(uint32_t ticks, void *data);
-	int		(*f_space)(uint32_t ticks, void *data);
-	int		(*f_pulse)(uint32_t ticks, void *data);
-
-	f_imark = gwds->decoded_imark ? gwds->decoded_imark : decode_stub;
-	f_space = gwds->decoded_space ? gwds->decoded_space : decode_stub;
-	f_pulse = gwds->decoded_pulse ? gwds->decoded_pulse : decode_stub;
-
-	while (f < fend) {
-		uint8_t c = *f++;
-
-		if (c == 0) {
-			ff = f;
-			goto done;
-		} else if (c == 255) {
-			if ((f + 4) < fend) {
-				uint8_t  fop = *f++;
-				uint32_t v   = gw_read_28(f);
-				f += 4;
+	struct gw_walk_state	ws = {
+		.ticks      = gwds->ds_ticks,
+		.last_pulse = gwds->ds_last_pulse,
+		.status     = gwds->ds_status
+	};
 
-				switch (fop) {
-				case FLUXOP_INDEX:
-					ff = f;
-					gwds->ds_status = (*f_imark)(
-							gw_ticks + v,
-							gwds->imark_data);
-					break;
+	ssize_t ret = walk_callbacks(fbuf, fbuf_cnt, &ws, gwds);
 
-				case FLUXOP_SPACE:
-					gw_ticks += v;
-					ff = f;
-					gwds->ds_status = (*f_space)(v,
-							gwds->space_data);
-					break;
+	gwds->ds_ticks      = ws.ticks;
+	gwds->ds_last_pulse = ws.last_pulse;
+	gwds->ds_status     = ws.status;
 
-				default:
-					return -1;
-				}
-			} else {
-				goto done;
-			}
-		} else if (c < 250) {
-			gw_ticks += c;
-			ff = f;
-			gwds->ds_status = (*f_pulse)(gw_ticks -
-						     gwds->ds_last_pulse,
-						     gwds->pulse_data);
-			gwds->ds_last_pulse = gw_ticks;
-		} else if (f < fend) {
-			gw_ticks += 250 + (c - 250) * 255 + *f++ - 1;
-			ff = f;
-			gwds->ds_status = (*f_pulse)(gw_ticks -
-						     gwds->ds_last_pulse,
-						     gwds->pulse_data);
-			gwds->ds_last_pulse = gw_ticks;
-		} else {
-			goto done;
-		}
-
-		if (gwds->ds_status)
-			break;
-	}
-
-done:
-	gwds->ds_ticks = gw_ticks;
-	return ff - fbuf;
+	return ret;
 }
 
 
@@ -366,37 +376,50 @@ flux_status:
 }
 
 
-int
-encode_ticks(uint32_t ticks,
-	     uint32_t nfa_thresh,
-	     uint32_t nfa_period,
-	     uint8_t sbuf[GWCODE_MAX])
+/*
+ * The slowest link, in Mbps, that can feed encoded write stream
+ * "enbuf" without the device running dry, given "prefill" bytes
+ * buffered before the write starts.  Each code must have arrived by
+ * the time the flux before it has been written.  HUGE_VAL if the
+ * stream's opening codes alone outrun the prefill.
+ */
+
+double
+gw_stream_bw(const uint8_t *enbuf, size_t enbuf_cnt, uint32_t sample_freq,
+	     size_t prefill)
 {
-	int	sbuf_cnt = 0;
-
-	if (ticks < 250) {
-		sbuf[sbuf_cnt++] = ticks;
-	} else if (ticks > nfa_thresh) {
-		sbuf[sbuf_cnt++] = 255;
-		sbuf[sbuf_cnt++] = FLUXOP_SPACE;
-		gw_write_28(ticks, &sbuf[sbuf_cnt]);
-		sbuf_cnt += 4;
-		sbuf[sbuf_cnt++] = FLUXOP_ASTABLE;
-		gw_write_28(nfa_period, &sbuf[sbuf_cnt]);
-		sbuf_cnt += 4;
-	} else {
-		int high = (ticks - 250) / 255;
-		if (high < 5) {
-			sbuf[sbuf_cnt++] = 250 + high;
-			sbuf[sbuf_cnt++] = 1 + (ticks - 250) % 255;
-		} else {
-			sbuf[sbuf_cnt++] = 255;
-			sbuf[sbuf_cnt++] = FLUXOP_SPACE;
-			gw_write_28(ticks - 249, &sbuf[sbuf_cnt]);
-			sbuf_cnt += 4;
-			sbuf[sbuf_cnt++] = 249;
+	uint64_t	ticks = 0;
+	double		bw = 0.0;
+	size_t		i = 0;
+
+	while (i < enbuf_cnt && enbuf[i] != 0) {
+		uint8_t	c = enbuf[i];
+		size_t	len = (c < 250) ? 1 : (c < 255) ? 2 : 6;
+
+		if (i + len > enbuf_cnt)
+			break;
+
+		/* Bytes through this code, beyond what was buffered. */
+		if (i + len > prefill) {
+			if (ticks == 0)
+				return HUGE_VAL;
+
+			double	need = 8.0 * (i + len - prefill) *
+				       sample_freq / (1e6 * ticks);
+
+			if (need > bw)
+				bw = need;
 		}
+
+		if (c < 250)
+			ticks += c;
+		else if (c < 255)
+			ticks += 250 + (c - 250) * 255 + enbuf[i + 1] - 1;
+		else if (enbuf[i + 1] == FLUXOP_SPACE)
+			ticks += gw_read_28(&enbuf[i + 2]);
+
+		i += len;
 	}
 
-	return sbuf_cnt;
+	return bw;
 }
@@ -22,6 +22,13 @@ extern "C" {
 /* Maximum size of a tick timing pulse encoded as an 8-bit sequence for GW. */
 #define GWCODE_MAX	11
 
+/*
+ * Write stream bytes assumed buffered in the device before a write
+ * starts, when judging a stream against the link with gw_stream_bw().
+ * A conservative figure; firmware buffers differ by model.
+ */
+#define GW_WRITE_PREFILL	8192
+
 
 /*
  * Values for "status":
@@ -65,6 +72,9 @@ extern int gw_get_bandwidth(gw_devt gwfd, double *min_bw, double *max_bw);
 extern ssize_t gw_read_stream(gw_devt gwfd, int revs, int ticks,
 			      uint8_t **fbuf);
 
+extern ssize_t gw_read_stream_at(gw_devt gwfd, int cyl, int head, int revs,
+				 int ticks, uint8_t **fbuf, int *failed);
+
 extern ssize_t gw_decode_stream(const uint8_t *fbuf, size_t fbuf_cnt,
 				struct gw_decode_stream_s *gwds);
 
@@ -78,6 +88,9 @@ extern ssize_t gw_write_stream(gw_devt gwfd, const uint8_t *enbuf,
 extern int encode_ticks(uint32_t ticks, uint32_t nfa_thresh,
 			uint32_t nfa_period, uint8_t sbuf[GWCODE_MAX]);
 
+extern double gw_stream_bw(const uint8_t *enbuf, size_t enbuf_cnt,
+			   uint32_t sample_freq, size_t prefill);
+
 
 static inline uint32_t
 gw_read_28(const uint8_t *p)
@@ -0,0 +1,53 @@
+#ifndef MONOTIME_H
+#define MONOTIME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Nanosecond clocks for instrumentation: elapsed time from a
+ * monotonic clock, and CPU time consumed by the process or by the
+ * calling thread.
+ */
+
+static inline uint64_t
+monotime_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static inline uint64_t
+cputime_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static inline uint64_t
+threadtime_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
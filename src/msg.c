@@ -1,17 +1,36 @@
 #include "msg.h"
 
 
-static int file_msg_level       = 0;
-static int scrn_msg_level       = 0;
-static const char *msg_prefix   = NULL;
-static const char *msg_filename = NULL;
-static FILE *msg_file           = NULL;
+static struct msg_ctx			msg_default;
+static _Thread_local struct msg_ctx	*msg_cur;
+
+static inline struct msg_ctx *
+msg_state(void)
+{
+	return msg_cur ? msg_cur : &msg_default;
+}
+
+
+/*
+ * Make "ctx" the calling thread's message state, or the default one
+ * if NULL.  Returns the one it replaces, to put back when done.
+ */
+
+struct msg_ctx *
+msg_ctx_use(struct msg_ctx *ctx)
+{
+	struct msg_ctx	*prev = msg_cur;
+
+	msg_cur = ctx;
+
+	return prev;
+}
 
 
 int
 msg_scrn_get_level()
 {
-	return scrn_msg_level;
+	return msg_state()->scrn_level;
 }
 
 
@@ -21,16 +40,16 @@ msg_scrn_set_level(int new_msg_level)
 	if (new_msg_level < 0)
 		return -1;
 
-	scrn_msg_level = new_msg_level;
+	msg_state()->scrn_level = new_msg_level;
 
-	return scrn_msg_level;
+	return msg_state()->scrn_level;
 }
 
 
 int
 msg_file_get_level()
 {
-	return file_msg_level;
+	return msg_state()->file_level;
 }
 
 
@@ -40,44 +59,48 @@ msg_file_set_level(int new_msg_level)
 	if (new_msg_level < 0)
 		return -1;
 
-	file_msg_level = new_msg_level;
+	msg_state()->file_level = new_msg_level;
 
-	return file_msg_level;
+	return msg_state()->file_level;
 }
 
 
 const char *
 msg_get_filename()
 {
-	return msg_filename;
+	return msg_state()->filename;
 }
 
 
 const char *
 msg_error_prefix(const char *pf)
 {
-	if (msg_prefix)
-		free((void *)msg_prefix);
+	struct msg_ctx	*c = msg_state();
 
-	msg_prefix = pf ? strdup(pf) : NULL;
+	if (c->prefix)
+		free((void *)c->prefix);
 
-	return msg_prefix;
+	c->prefix = pf ? strdup(pf) : NULL;
+
+	return c->prefix;
 }
 
 
 int
 msg_fclose()
 {
-	if (!msg_file)
+	struct msg_ctx	*c = msg_state();
+
+	if (!c->file)
 		return 0;
 
-	free((void *)msg_filename);
-	msg_filename = NULL;
+	free((void *)c->filename);
+	c->filename = NULL;
 
 	msg_error_prefix(NULL);  // Should this be called here?
 
-	FILE *f = msg_file;
-	msg_file = NULL;
+	FILE *f = c->file;
+	c->file = NULL;
 
 	return fclose(f);
 }
@@ -96,8 +119,8 @@ msg_fopen(const char *filename)
 	FILE *f = fopen(filename, "w");
 
 	if (f) {
-		msg_filename = fn;
-		msg_file = f;
+		msg_state()->filename = fn;
+		msg_state()->file = f;
 	} else {
 		free((void *)fn);
 	}
@@ -109,7 +132,7 @@ msg_fopen(const char *filename)
 int
 msg_scrn_flush()
 {
-	return fflush(stdout);
+	return msg_state()->detached ? 0 : fflush(stdout);
 }
 
 
@@ -117,14 +140,20 @@ int
 msg_verror(const char *fmt, va_list ap)
 {
 	int ret = 0;
+	struct msg_ctx *c = msg_state();
+	FILE *err = c->detached ? c->file : stderr;
+
+	/* Detached with no log, errors go only by return codes. */
+	if (!err)
+		return 0;
 
 	msg_scrn_flush();
 
-	if (msg_prefix)
-		ret = fprintf(stderr, "%s: ", msg_prefix);
+	if (c->prefix)
+		ret = fprintf(err, "%s: ", c->prefix);
 
 	if (ret != -1) {
-		int ret2 = vfprintf(stderr, fmt, ap);
+		int ret2 = vfprintf(err, fmt, ap);
 		ret = (ret2 != -1) ? ret + ret2 : -1;
 	}
 
@@ -176,9 +205,11 @@ msg_fatal(const char *fmt, ...)
 void
 msg_vfprintf(int msg_level, FILE *scrn, const char *fmt, va_list ap)
 {
-	if (msg_level <= scrn_msg_level &&
-	    !(msg_level == MSG_RAW && scrn_msg_level != MSG_RAW) &&
-	    !(msg_level == MSG_HEX && scrn_msg_level == MSG_RAW)) {
+	struct msg_ctx	*c = msg_state();
+
+	if (!c->detached && msg_level <= c->scrn_level &&
+	    !(msg_level == MSG_RAW && c->scrn_level != MSG_RAW) &&
+	    !(msg_level == MSG_HEX && c->scrn_level == MSG_RAW)) {
 		va_list	aq;
 
 		va_copy(aq, ap);
@@ -187,10 +218,10 @@ msg_vfprintf(int msg_level, FILE *scrn, const char *fmt, va_list ap)
 	}
 
 
-	if (msg_file && (msg_level <= file_msg_level) &&
-	    !(msg_level == MSG_RAW && file_msg_level != MSG_RAW) &&
-	    !(msg_level == MSG_HEX && file_msg_level == MSG_RAW)) {
-		vfprintf(msg_file, fmt, ap);
+	if (c->file && (msg_level <= c->file_level) &&
+	    !(msg_level == MSG_RAW && c->file_level != MSG_RAW) &&
+	    !(msg_level == MSG_HEX && c->file_level == MSG_RAW)) {
+		vfprintf(c->file, fmt, ap);
 	}
 }
 
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,26 @@ extern "C" {
 #endif
 
 
+/*
+ * Message state: levels, log file, and error prefix.  The tools use
+ * the default state throughout.  Library code run for a caller
+ * switches its thread to the caller's state with msg_ctx_use(), so
+ * calls on different threads share none.  A detached state has no
+ * screen: it writes nothing to stdout or stderr, only to its file.
+ */
+
+struct msg_ctx {
+	int		scrn_level;
+	int		file_level;
+	const char	*prefix;
+	const char	*filename;
+	FILE		*file;
+	bool		detached;
+};
+
+
+extern struct msg_ctx *msg_ctx_use(struct msg_ctx *ctx);
+
 extern int msg_scrn_get_level(void);
 
 extern int msg_scrn_set_level(int new_msg_level);
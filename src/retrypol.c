@@ -0,0 +1,45 @@
+#include "retrypol.h"
+
+
+void
+retry_policy_init(struct retry_policy *rp, int stall_limit, int strategies)
+{
+	*rp = (struct retry_policy){
+			.stall_limit = stall_limit,
+			.strategies  = (strategies > 0) ? strategies : 1
+		};
+}
+
+
+enum retry_verdict
+retry_policy_update(struct retry_policy *rp, int good, int errs)
+{
+	bool	progress = (rp->reads == 0 || good > rp->best_good ||
+			    errs < rp->best_errs);
+
+	if (rp->reads == 0 || good > rp->best_good)
+		rp->best_good = good;
+
+	if (rp->reads == 0 || errs < rp->best_errs)
+		rp->best_errs = errs;
+
+	++rp->reads;
+
+	if (progress) {
+		rp->stalled = 0;
+		return RP_AGAIN;
+	}
+
+	if (rp->stall_limit <= 0 || ++rp->stalled < rp->stall_limit)
+		return RP_AGAIN;
+
+	/* Give each strategy its own run of reads to make progress. */
+	rp->stalled = 0;
+
+	if (rp->strategy + 1 < rp->strategies) {
+		++rp->strategy;
+		return RP_SWITCH;
+	}
+
+	return RP_STOP;
+}
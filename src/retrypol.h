@@ -0,0 +1,53 @@
+#ifndef RETRYPOL_H
+#define RETRYPOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+/*
+ * Retry policy for reading a track.
+ *
+ * After each read, the caller reports how many distinct sectors have
+ * been read good so far and how many errors remain in the merged
+ * track.  A read that improves on neither made no progress.  After
+ * "stall_limit" reads in a row without progress, the policy moves to
+ * the caller's next alternate read strategy, if it has any left, and
+ * otherwise says to stop retrying.
+ *
+ * Strategies are numbered from 0, the read as configured; what each
+ * alternate does is up to the caller.
+ */
+
+enum retry_verdict {
+	RP_AGAIN,	/* Retry as before */
+	RP_SWITCH,	/* Retry with the next strategy */
+	RP_STOP		/* Retrying is not paying off */
+};
+
+struct retry_policy {
+	int	stall_limit;	/* 0 never stops or switches */
+	int	strategies;	/* Including the configured one */
+
+	int	reads;
+	int	best_good;
+	int	best_errs;
+	int	stalled;	/* Reads since the last progress */
+	int	strategy;	/* In use for the next read */
+};
+
+
+extern void retry_policy_init(struct retry_policy *rp, int stall_limit,
+			      int strategies);
+
+extern enum retry_verdict retry_policy_update(struct retry_policy *rp,
+					      int good, int errs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
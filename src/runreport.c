@@ -0,0 +1,213 @@
+/*
+ * Per-track timing and I/O instrumentation.  See runreport.h.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monotime.h"
+#include "runreport.h"
+
+
+void
+rr_init(struct run_report *rr, const char *tool)
+{
+	*rr = (struct run_report){
+			.tool         = tool,
+			.start_ns     = monotime_ns(),
+			.start_cpu_ns = cputime_ns()
+		};
+
+	gw_get_io_stats(&rr->start_io);
+}
+
+
+void
+rr_free(struct run_report *rr)
+{
+	free(rr->tracks);
+
+	*rr = (struct run_report){};
+}
+
+
+/*
+ * Append a zeroed record for the track and side.  Returns NULL if
+ * memory is exhausted.
+ */
+
+struct rr_track *
+rr_track_new(struct run_report *rr, int track, int side)
+{
+	if (rr->cnt == rr->cap) {
+		int		ncap = rr->cap ? rr->cap * 2 : 2 * GW_MAX_TRACKS;
+		struct rr_track	*nt  = realloc(rr->tracks,
+					       ncap * sizeof(*nt));
+
+		if (!nt)
+			return NULL;
+
+		rr->tracks = nt;
+		rr->cap    = ncap;
+	}
+
+	struct rr_track	*rt = &rr->tracks[rr->cnt++];
+
+	*rt = (struct rr_track){ .track = track, .side = side };
+
+	return rt;
+}
+
+
+/* Account the device commands issued between two snapshots. */
+
+void
+rr_track_add_io(struct rr_track *rt,
+		const struct gw_io_stats *before,
+		const struct gw_io_stats *after)
+{
+	rt->cmds   += after->cmds - before->cmds;
+	rt->cmd_ns += after->cmd_ns - before->cmd_ns;
+}
+
+
+/* Account the raw transfers made between two snapshots. */
+
+void
+rr_track_add_xfer(struct rr_track *rt,
+		  const struct gw_io_stats *before,
+		  const struct gw_io_stats *after)
+{
+	rt->xfer_bytes += (after->rd_bytes - before->rd_bytes) +
+			  (after->wr_bytes - before->wr_bytes);
+	rt->xfer_ns    += (after->rd_ns - before->rd_ns) +
+			  (after->wr_ns - before->wr_ns);
+}
+
+
+static const char	csv_header[] =
+	"track,side,passes,total_ns,seek_ns,batch_ns,cmds,cmd_ns,xfer_bytes,"
+	"xfer_ns,codec_cpu_ns,merge_ns,good_sectors,errors\n";
+
+
+static void
+write_csv(const struct run_report *rr, FILE *fp)
+{
+	fputs(csv_header, fp);
+
+	for (int i = 0; i < rr->cnt; ++i) {
+		const struct rr_track	*rt = &rr->tracks[i];
+
+		fprintf(fp, "%d,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,"
+			    "%llu,%llu,%d,%d\n",
+			rt->track, rt->side, rt->passes,
+			(unsigned long long)rt->total_ns,
+			(unsigned long long)rt->seek_ns,
+			(unsigned long long)rt->batch_ns,
+			(unsigned long long)rt->cmds,
+			(unsigned long long)rt->cmd_ns,
+			(unsigned long long)rt->xfer_bytes,
+			(unsigned long long)rt->xfer_ns,
+			(unsigned long long)rt->codec_cpu_ns,
+			(unsigned long long)rt->merge_ns,
+			rt->good_sectors, rt->errors);
+	}
+}
+
+
+static void
+write_json(const struct run_report *rr, FILE *fp)
+{
+	struct gw_io_stats	io;
+
+	gw_get_io_stats(&io);
+
+	fprintf(fp, "{\n"
+		    "  \"tool\": \"%s\",\n"
+		    "  \"total_ns\": %llu,\n"
+		    "  \"cpu_ns\": %llu,\n",
+		rr->tool,
+		(unsigned long long)(monotime_ns() - rr->start_ns),
+		(unsigned long long)(cputime_ns() - rr->start_cpu_ns));
+
+	fprintf(fp, "  \"io\": { \"cmds\": %llu, \"cmd_ns\": %llu, "
+		    "\"rd_bytes\": %llu, \"rd_ns\": %llu, "
+		    "\"wr_bytes\": %llu, \"wr_ns\": %llu },\n",
+		(unsigned long long)(io.cmds - rr->start_io.cmds),
+		(unsigned long long)(io.cmd_ns - rr->start_io.cmd_ns),
+		(unsigned long long)(io.rd_bytes - rr->start_io.rd_bytes),
+		(unsigned long long)(io.rd_ns - rr->start_io.rd_ns),
+		(unsigned long long)(io.wr_bytes - rr->start_io.wr_bytes),
+		(unsigned long long)(io.wr_ns - rr->start_io.wr_ns));
+
+	fprintf(fp, "  \"tracks\": [");
+
+	for (int i = 0; i < rr->cnt; ++i) {
+		const struct rr_track	*rt = &rr->tracks[i];
+
+		fprintf(fp, "%s\n    { \"track\": %d, \"side\": %d, "
+			    "\"passes\": %d, \"total_ns\": %llu, "
+			    "\"seek_ns\": %llu, \"batch_ns\": %llu, "
+			    "\"cmds\": %llu, \"cmd_ns\": %llu, "
+			    "\"xfer_bytes\": %llu, \"xfer_ns\": %llu, "
+			    "\"codec_cpu_ns\": %llu, \"merge_ns\": %llu, "
+			    "\"good_sectors\": %d, \"errors\": %d }",
+			i ? "," : "",
+			rt->track, rt->side, rt->passes,
+			(unsigned long long)rt->total_ns,
+			(unsigned long long)rt->seek_ns,
+			(unsigned long long)rt->batch_ns,
+			(unsigned long long)rt->cmds,
+			(unsigned long long)rt->cmd_ns,
+			(unsigned long long)rt->xfer_bytes,
+			(unsigned long long)rt->xfer_ns,
+			(unsigned long long)rt->codec_cpu_ns,
+			(unsigned long long)rt->merge_ns,
+			rt->good_sectors, rt->errors);
+	}
+
+	fprintf(fp, "%s]\n}\n", rr->cnt ? "\n  " : "");
+}
+
+
+void
+rr_fwrite(const struct run_report *rr, FILE *fp, bool csv)
+{
+	if (csv)
+		write_csv(rr, fp);
+	else
+		write_json(rr, fp);
+}
+
+
+/*
+ * Write the report to "path", as CSV if the name ends in ".csv",
+ * otherwise as JSON.  Returns 0 on success, or -1 with a reason in
+ * "errno".
+ */
+
+int
+rr_write(const struct run_report *rr, const char *path)
+{
+	size_t	len = strlen(path);
+	bool	csv = len >= 4 && !strcasecmp(path + len - 4, ".csv");
+	FILE	*fp = fopen(path, "w");
+
+	if (!fp)
+		return -1;
+
+	rr_fwrite(rr, fp, csv);
+
+	if (ferror(fp)) {
+		int	eno = errno;
+
+		fclose(fp);
+		errno = eno;
+		return -1;
+	}
+
+	return fclose(fp) == EOF ? -1 : 0;
+}
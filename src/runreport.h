@@ -0,0 +1,74 @@
+#ifndef RUNREPORT_H
+#define RUNREPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gw.h"
+
+/*
+ * Per-track timing and I/O instrumentation, written at the end of a
+ * run as a machine-readable report (JSON, or CSV if the report file
+ * name ends in ".csv").  All times are in nanoseconds from the
+ * monotonic clock, except codec_cpu_ns which is the CPU time of the
+ * thread that decoded or encoded the track.
+ */
+
+struct rr_track {
+	int		track;
+	int		side;
+	int		passes;		/* revolutions read or writes made */
+	uint64_t	total_ns;
+	uint64_t	seek_ns;	/* seek and head select */
+	uint64_t	batch_ns;	/* batched seek, select and read
+					   command, also in cmd_ns */
+	uint64_t	cmds;		/* device commands issued */
+	uint64_t	cmd_ns;		/* command round trips */
+	uint64_t	xfer_bytes;	/* flux stream bytes moved */
+	uint64_t	xfer_ns;	/* flux stream transfer */
+	uint64_t	codec_cpu_ns;	/* decoding (or encoding) */
+	uint64_t	merge_ns;	/* merging sectors across retries */
+	int		good_sectors;
+	int		errors;
+};
+
+struct run_report {
+	const char		*tool;
+	uint64_t		start_ns;
+	uint64_t		start_cpu_ns;
+	struct gw_io_stats	start_io;
+	struct rr_track		*tracks;
+	int			cnt;
+	int			cap;
+};
+
+
+extern void rr_init(struct run_report *rr, const char *tool);
+
+extern void rr_free(struct run_report *rr);
+
+extern struct rr_track *rr_track_new(struct run_report *rr,
+				     int track, int side);
+
+extern void rr_track_add_io(struct rr_track *rt,
+			    const struct gw_io_stats *before,
+			    const struct gw_io_stats *after);
+
+extern void rr_track_add_xfer(struct rr_track *rt,
+			      const struct gw_io_stats *before,
+			      const struct gw_io_stats *after);
+
+extern void rr_fwrite(const struct run_report *rr, FILE *fp, bool csv);
+
+extern int rr_write(const struct run_report *rr, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,6 +10,7 @@
 
 static struct dmk_file	dmkf;
 static struct dmk_file	dmkf2;
+static struct dmk_track	work;
 
 
 static void
@@ -204,13 +205,17 @@ test_track_length_optimal(void)
 {
 	static struct dmk_file	f;
 
-	memset(&f, 0, sizeof(f));
 	dmk_header_init(&f.header, 2, DMKRD_TRACKLEN_MAX);
 
-	f.track[0][0].track_len = 100;
-	f.track[0][1].track_len = 200;
-	f.track[1][0].track_len = 150;
-	f.track[1][1].track_len = 50;
+	memset(&work, 0, sizeof(work));
+	work.track_len = 100;
+	dmk_file_put_track(&f, 0, 0, &work);
+	work.track_len = 200;
+	dmk_file_put_track(&f, 0, 1, &work);
+	work.track_len = 150;
+	dmk_file_put_track(&f, 1, 0, &work);
+	work.track_len = 50;
+	dmk_file_put_track(&f, 1, 1, &work);
 
 	CHECK_EQ(dmk_track_length_optimal(&f), 200);
 
@@ -222,6 +227,118 @@ test_track_length_optimal(void)
 	f.header.options = 0;
 	f.header.ntracks = 1;
 	CHECK_EQ(dmk_track_length_optimal(&f), 200);
+
+	dmk_file_free(&f);
+}
+
+
+/* Fill the working track with a pattern keyed on "key". */
+
+static void
+work_fill(uint16_t len, int key)
+{
+	memset(&work, 0, sizeof(work));
+	work.track_len = len;
+	work.idam_offset[0] = (DMK_TKHDR_SIZE + key) | DMK_DDEN_FLAG;
+
+	for (int i = 0; i < len - DMK_TKHDR_SIZE; ++i)
+		work.data[i] = (key * 31 + i) & 0xff;
+}
+
+
+static bool
+work_matches(uint16_t len, int key)
+{
+	bool	ok = work.track_len == len &&
+		     work.idam_offset[0] ==
+			((DMK_TKHDR_SIZE + key) | DMK_DDEN_FLAG);
+
+	for (int i = 0; ok && i < len - DMK_TKHDR_SIZE; ++i)
+		ok = work.data[i] == ((key * 31 + i) & 0xff);
+
+	/* Nothing past the track's length. */
+	for (int i = len; ok && i < DMKRD_TRACKLEN_MAX; ++i)
+		ok = work.track[i] == 0;
+
+	return ok;
+}
+
+
+static void
+test_file_tracks(void)
+{
+	static struct dmk_file	f;
+
+	/* An empty position reads back as an empty track. */
+	memset(&work, 0xa5, sizeof(work));
+	dmk_file_get_track(&f, 5, 1, &work);
+	CHECK_EQ(work.track_len, 0);
+	CHECK(work.track[0] == 0 && work.track[DMKRD_TRACKLEN_MAX - 1] == 0);
+	CHECK(dmk_file_track_raw(&f, 5, 1) == NULL);
+
+	/* Each track takes only its own length. */
+	work_fill(DMKRD_TRACKLEN_5SD, 1);
+	CHECK_EQ(dmk_file_put_track(&f, 0, 0, &work), 0);
+	work_fill(DMKRD_TRACKLEN_5, 2);
+	CHECK_EQ(dmk_file_put_track(&f, 0, 1, &work), 0);
+	CHECK_EQ(f.slab_used - f.slab_dead,
+		 DMKRD_TRACKLEN_5SD + DMKRD_TRACKLEN_5);
+
+	dmk_file_get_track(&f, 0, 0, &work);
+	CHECK(work_matches(DMKRD_TRACKLEN_5SD, 1));
+	dmk_file_get_track(&f, 0, 1, &work);
+	CHECK(work_matches(DMKRD_TRACKLEN_5, 2));
+	CHECK_EQ(dmk_file_track_len(&f, 0, 1), DMKRD_TRACKLEN_5);
+
+	/* The same length is rewritten in place. */
+	const uint8_t	*raw = dmk_file_track_raw(&f, 0, 0);
+	size_t		used = f.slab_used;
+
+	work_fill(DMKRD_TRACKLEN_5SD, 3);
+	CHECK_EQ(dmk_file_put_track(&f, 0, 0, &work), 0);
+	CHECK(dmk_file_track_raw(&f, 0, 0) == raw);
+	CHECK_EQ(f.slab_used, used);
+
+	/* Tracks changing length over and over leave the slab bounded
+	 * by what they hold, and the others intact. */
+	bool	ok = true;
+
+	for (int i = 0; i < 200; ++i) {
+		uint16_t	len = (i & 1) ? DMKRD_TRACKLEN_8 :
+						DMKRD_TRACKLEN_5;
+
+		work_fill(len, i);
+		ok = ok && dmk_file_put_track(&f, 1 + i % 3, 0, &work) == 0;
+		ok = ok && f.slab_size <= 2 * (DMKRD_TRACKLEN_5SD +
+					       DMKRD_TRACKLEN_5 +
+					       4 * DMKRD_TRACKLEN_8);
+	}
+
+	CHECK(ok);
+	dmk_file_get_track(&f, 0, 0, &work);
+	CHECK(work_matches(DMKRD_TRACKLEN_5SD, 3));
+	dmk_file_get_track(&f, 3, 0, &work);
+	CHECK(work_matches(DMKRD_TRACKLEN_8, 197));
+
+	/* Moving a track empties where it was. */
+	dmk_file_move_track(&f, 10, 1, 0, 1);
+	CHECK_EQ(dmk_file_track_len(&f, 0, 1), 0);
+	dmk_file_get_track(&f, 10, 1, &work);
+	CHECK(work_matches(DMKRD_TRACKLEN_5, 2));
+
+	/* An empty track clears the position. */
+	memset(&work, 0, sizeof(work));
+	CHECK_EQ(dmk_file_put_track(&f, 10, 1, &work), 0);
+	CHECK_EQ(dmk_file_track_len(&f, 10, 1), 0);
+
+	/* Too long for any track. */
+	work.track_len = DMKRD_TRACKLEN_MAX + 1;
+	CHECK_EQ(dmk_file_put_track(&f, 0, 0, &work), -1);
+	CHECK_EQ(dmk_file_track_len(&f, 0, 0), DMKRD_TRACKLEN_5SD);
+
+	dmk_file_free(&f);
+	CHECK(f.slab == NULL);
+	CHECK_EQ(dmk_file_track_len(&f, 0, 0), 0);
 }
 
 
@@ -234,23 +351,20 @@ test_file_roundtrip(void)
 	if (!fp)
 		return;
 
-	memset(&dmkf, 0, sizeof(dmkf));
+	dmk_file_free(&dmkf);
 	dmk_header_init(&dmkf.header, 3, DMKI_TRACKLEN_5SD);
 
-	int	datalen = dmkf.header.tracklen - DMK_TKHDR_SIZE;
-
 	for (int t = 0; t < dmkf.header.ntracks; ++t) {
 		for (int s = 0; s < DMK_SIDES; ++s) {
-			struct dmk_track	*trk = &dmkf.track[t][s];
-
-			trk->track_len = dmkf.header.tracklen;
-			trk->idam_offset[0] = DMK_TKHDR_SIZE | DMK_DDEN_FLAG;
-
-			for (int i = 0; i < datalen; ++i)
-				trk->data[i] = (t * 31 + s * 17 + i) & 0xff;
+			work_fill(dmkf.header.tracklen, t * 2 + s);
+			dmk_file_put_track(&dmkf, t, s, &work);
 		}
 	}
 
+	/* A short track is padded out to the header's length. */
+	work_fill(DMKI_TRACKLEN_5SD - 100, 6);
+	dmk_file_put_track(&dmkf, 2, 1, &work);
+
 	CHECK_EQ(dmk2fp(&dmkf, fp), 0);
 
 	/* File size must be header plus ntracks * sides tracks. */
@@ -258,22 +372,34 @@ test_file_roundtrip(void)
 	CHECK_EQ(ftell(fp), DMK_HDR_SIZE +
 		 3 * DMK_SIDES * dmkf.header.tracklen);
 
-	memset(&dmkf2, 0, sizeof(dmkf2));
 	CHECK_EQ(fp2dmk(fp, &dmkf2), 0);
 
 	CHECK_EQ(dmkf2.header.ntracks, dmkf.header.ntracks);
 	CHECK_EQ(dmkf2.header.tracklen, dmkf.header.tracklen);
 	CHECK_EQ(dmkf2.header.options, dmkf.header.options);
 
+	/* Loaded into a slab just big enough. */
+	CHECK_EQ(dmkf2.slab_size, 3 * DMK_SIDES * DMKI_TRACKLEN_5SD);
+
+	bool	ok = true;
+
 	for (int t = 0; t < dmkf.header.ntracks; ++t) {
 		for (int s = 0; s < DMK_SIDES; ++s) {
-			CHECK_EQ(dmkf2.track[t][s].idam_offset[0],
-				 DMK_TKHDR_SIZE | DMK_DDEN_FLAG);
-			CHECK(memcmp(dmkf2.track[t][s].data,
-				     dmkf.track[t][s].data, datalen) == 0);
+			if (t == 2 && s == 1)
+				continue;
+
+			dmk_file_get_track(&dmkf2, t, s, &work);
+			ok = ok && work_matches(DMKI_TRACKLEN_5SD, t * 2 + s);
 		}
 	}
 
+	CHECK(ok);
+
+	dmk_file_get_track(&dmkf2, 2, 1, &work);
+	CHECK_EQ(work.track_len, DMKI_TRACKLEN_5SD);
+	work.track_len = DMKI_TRACKLEN_5SD - 100;
+	CHECK(work_matches(DMKI_TRACKLEN_5SD - 100, 6));
+
 	fclose(fp);
 }
 
@@ -324,6 +450,7 @@ main(void)
 	test_track_roundtrip();
 	test_data_rotate();
 	test_track_length_optimal();
+	test_file_tracks();
 	test_file_roundtrip();
 	test_file_sanity();
 
@@ -0,0 +1,246 @@
+/*
+ * Validate the checkpoint journal: tracks and geometry round trip,
+ * later records win, a start record discards earlier tracks, and a
+ * torn record is dropped without losing what came before it.
+ */
+
+#include <unistd.h>
+
+#include "dmkckpt.h"
+
+#include "test.h"
+
+
+static char	dir[] = "/tmp/test_dmkckpt.XXXXXX";
+static char	path[64];
+
+static struct dmk_file		dmkf;
+static struct ckpt_track	cts[DMK_MAX_TRACKS][DMK_SIDES];
+
+
+static void
+make_track(struct dmk_track *trk, uint8_t fill, uint16_t len)
+{
+	memset(trk, 0, sizeof(*trk));
+
+	trk->track_len = len;
+	trk->idam_offset[0] = 0x8000 | (DMK_TKHDR_SIZE + 10);
+	trk->idam_offset[1] = 0x8000 | (DMK_TKHDR_SIZE + 400);
+	memset(trk->data, fill, len - DMK_TKHDR_SIZE);
+}
+
+
+static int
+load(struct ckpt_geom *geom, long *end)
+{
+	memset(cts, 0, sizeof(cts));
+	dmk_file_free(&dmkf);
+
+	return ckpt_load(path, geom, cts, &dmkf, end);
+}
+
+
+/* A track of what load() read. */
+
+static const struct dmk_track *
+loaded(int track, int side)
+{
+	static struct dmk_track	trk;
+
+	dmk_file_get_track(&dmkf, track, side, &trk);
+
+	return &trk;
+}
+
+
+static const struct ckpt_geom	geom40 = { 40, 2, 1, false, true, false };
+static const struct ckpt_geom	geom40s = { 40, 1, 1, false, false, false };
+
+
+/* Tracks and geometry read back as written; a later track wins. */
+
+static void
+test_round_trip(void)
+{
+	static struct dmk_track	trk;
+	struct ckpt_track	ct = {
+		.retries = 3, .retries_saved = 2, .cyl_seen = -1,
+		.first_encoding = MFM, .flippy = true,
+		.dts = { .good_sectors = 18, .errcount = 1,
+			 .enc_count = { [MFM] = 18 }, .enc_sec = { MFM, FM } }
+	};
+
+	FILE	*fp = ckpt_open(path, 0);
+
+	CHECK(fp != NULL);
+
+	CHECK_EQ(ckpt_put_start(fp, &geom40), 0);
+
+	make_track(&trk, 0xe5, DMKRD_TRACKLEN_5);
+	CHECK_EQ(ckpt_put_track(fp, 0, 0, &ct, &trk), 0);
+
+	make_track(&trk, 0x11, DMKRD_TRACKLEN_MIN);
+	CHECK_EQ(ckpt_put_track(fp, 3, 1, &ct, &trk), 0);
+
+	ct.dts.errcount = 0;
+	ct.cyl_seen = 3;
+	make_track(&trk, 0x22, DMKRD_TRACKLEN_5);
+	CHECK_EQ(ckpt_put_track(fp, 3, 1, &ct, &trk), 0);
+
+	CHECK_EQ(ckpt_put_geom(fp, &geom40s), 0);
+
+	fclose(fp);
+
+	struct ckpt_geom	geom;
+	long			end;
+
+	CHECK_EQ(load(&geom, &end), 2);
+
+	CHECK_EQ(geom.tracks, 40);
+	CHECK_EQ(geom.sides, 1);
+	CHECK(!geom.guess_sides);
+
+	CHECK(cts[0][0].have);
+	CHECK_EQ(cts[0][0].retries, 3);
+	CHECK_EQ(cts[0][0].retries_saved, 2);
+	CHECK_EQ(cts[0][0].cyl_seen, -1);
+	CHECK_EQ(cts[0][0].first_encoding, MFM);
+	CHECK(cts[0][0].flippy);
+	CHECK_EQ(cts[0][0].dts.good_sectors, 18);
+	CHECK_EQ(cts[0][0].dts.errcount, 1);
+	CHECK_EQ(cts[0][0].dts.enc_count[MFM], 18);
+	CHECK_EQ(cts[0][0].dts.enc_sec[1], FM);
+	CHECK_EQ(loaded(0, 0)->track_len, DMKRD_TRACKLEN_5);
+	CHECK_EQ(loaded(0, 0)->idam_offset[1], 0x8000 | (DMK_TKHDR_SIZE + 400));
+	CHECK_EQ(loaded(0, 0)->track[DMKRD_TRACKLEN_5 - 1], 0xe5);
+
+	CHECK(cts[3][1].have);
+	CHECK_EQ(cts[3][1].dts.errcount, 0);
+	CHECK_EQ(cts[3][1].cyl_seen, 3);
+	CHECK_EQ(loaded(3, 1)->track_len, DMKRD_TRACKLEN_5);
+	CHECK_EQ(loaded(3, 1)->track[DMK_TKHDR_SIZE], 0x22);
+
+	CHECK(!cts[1][0].have);
+}
+
+
+/* A torn last record is dropped, and appending resumes before it. */
+
+static void
+test_torn(void)
+{
+	static struct dmk_track	trk;
+	struct ckpt_track	ct = { .first_encoding = FM };
+	struct ckpt_geom	geom;
+	long			end, torn_end;
+
+	CHECK_EQ(load(&geom, &end), 2);
+
+	FILE	*fp = fopen(path, "ab");
+
+	CHECK(fp != NULL);
+	fwrite("T\x40\x00garbage", 10, 1, fp);
+	fclose(fp);
+
+	CHECK_EQ(load(&geom, &torn_end), 2);
+	CHECK_EQ(torn_end, end);
+
+	fp = ckpt_open(path, torn_end);
+	CHECK(fp != NULL);
+
+	make_track(&trk, 0x33, DMKRD_TRACKLEN_MIN);
+	CHECK_EQ(ckpt_put_track(fp, 1, 0, &ct, &trk), 0);
+	fclose(fp);
+
+	CHECK_EQ(load(&geom, &end), 3);
+	CHECK(cts[1][0].have);
+	CHECK_EQ(loaded(1, 0)->track[DMK_TKHDR_SIZE], 0x33);
+
+	/* A corrupted record ends the journal there too. */
+	fp = fopen(path, "r+b");
+	CHECK(fp != NULL);
+	fseek(fp, torn_end + 20, SEEK_SET);
+	fputc(0xff ^ 0x33, fp);
+	fclose(fp);
+
+	CHECK_EQ(load(&geom, &end), 2);
+	CHECK_EQ(end, torn_end);
+}
+
+
+/* A start record discards the tracks before it. */
+
+static void
+test_restart(void)
+{
+	static struct dmk_track	trk;
+	struct ckpt_track	ct = { .first_encoding = MFM };
+	const struct ckpt_geom	geom80 = { 80, 2, 1, true, false, false };
+	struct ckpt_geom	geom;
+	long			end;
+
+	CHECK(load(&geom, &end) > 0);
+
+	FILE	*fp = ckpt_open(path, end);
+
+	CHECK(fp != NULL);
+	CHECK_EQ(ckpt_put_start(fp, &geom80), 0);
+
+	make_track(&trk, 0x44, DMKRD_TRACKLEN_5);
+	CHECK_EQ(ckpt_put_track(fp, 6, 0, &ct, &trk), 0);
+	fclose(fp);
+
+	CHECK_EQ(load(&geom, &end), 1);
+	CHECK(cts[6][0].have);
+	CHECK(!cts[0][0].have);
+	CHECK_EQ(geom.tracks, 80);
+	CHECK_EQ(geom.steps, 1);
+	CHECK(geom.guess_tracks);
+}
+
+
+/* Neither a missing file nor one without a geometry is a journal. */
+
+static void
+test_not_journal(void)
+{
+	struct ckpt_geom	geom;
+	long			end;
+
+	remove(path);
+	CHECK_EQ(load(&geom, &end), -1);
+
+	FILE	*fp = ckpt_open(path, 0);
+
+	CHECK(fp != NULL);
+	fclose(fp);
+	CHECK_EQ(load(&geom, &end), -1);
+
+	fp = fopen(path, "wb");
+	CHECK(fp != NULL);
+	fputs("not a checkpoint", fp);
+	fclose(fp);
+	CHECK_EQ(load(&geom, &end), -1);
+}
+
+
+int
+main(void)
+{
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "%s/disk.dmk.ckpt", dir);
+
+	test_round_trip();
+	test_torn();
+	test_restart();
+	test_not_journal();
+
+	remove(path);
+	rmdir(dir);
+
+	return test_exit("test_dmkckpt");
+}
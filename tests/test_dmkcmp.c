@@ -0,0 +1,215 @@
+/*
+ * Validate dmk_track_compare(): matching the sectors of a track read
+ * back from disk against the DMK track written.
+ *
+ * Synthetic track layout: a gap, then sectors of ID (fe c h r n crc
+ * crc), a short gap, DAM, 128 bytes of data, and a data CRC.  FM
+ * tracks double every byte, as in a DMK without DMK_SDEN_OPT.
+ */
+
+#include "dmkcmp.h"
+
+#include "test.h"
+
+
+#define GAP_LEN		16
+#define ID_GAP		11
+#define SEC_DATA	128
+
+
+/* Append one sector of "nsec" with data "fill" at *p. */
+
+static void
+add_sector(struct dmk_track *trk, int *p, int nsec, int r, bool mfm,
+	   int stride, uint8_t fill)
+{
+	uint8_t	id[] = { 0xfe, 1, 0, r, 0, 0x12, r };
+
+	trk->idam_offset[nsec] = *p | (mfm ? DMK_DDEN_FLAG : 0);
+
+	for (int i = 0; i < 7; ++i)
+		for (int k = 0; k < stride; ++k)
+			trk->track[(*p)++] = id[i];
+
+	for (int i = 0; i < ID_GAP * stride; ++i)
+		trk->track[(*p)++] = mfm ? 0x4e : 0xff;
+
+	for (int k = 0; k < stride; ++k)
+		trk->track[(*p)++] = 0xfb;
+
+	for (int i = 0; i < SEC_DATA + 2; ++i)
+		for (int k = 0; k < stride; ++k)
+			trk->track[(*p)++] = (i < SEC_DATA) ?
+					     fill + r + i : 0xc0 + r;
+}
+
+
+/* Build a track of sectors "first" to "last", after "lead" gap bytes. */
+
+static void
+build_track(struct dmk_track *trk, bool mfm, int lead, int first,
+	    int last, uint8_t fill)
+{
+	int	stride = mfm ? 1 : 2;
+	int	p = DMK_TKHDR_SIZE;
+
+	memset(trk, 0, sizeof(*trk));
+
+	for (int i = 0; i < lead * stride; ++i)
+		trk->track[p++] = mfm ? 0x4e : 0xff;
+
+	int	nsec = 0;
+
+	for (int r = first; r <= last; ++r)
+		add_sector(trk, &p, nsec++, r, mfm, stride, fill);
+
+	trk->track_len = p + GAP_LEN;
+}
+
+
+static struct dmk_track	src, rd;
+
+
+/* An identical read back verifies, and every sector is counted. */
+
+static void
+test_identical(void)
+{
+	int	nsec = -1;
+
+	build_track(&src, true, GAP_LEN, 1, 5, 0x40);
+	build_track(&rd, true, GAP_LEN, 1, 5, 0x40);
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, &nsec), 0);
+	CHECK_EQ(nsec, 5);
+}
+
+
+/* Sectors are matched by ID, not by position on the track. */
+
+static void
+test_rotated(void)
+{
+	build_track(&src, true, GAP_LEN, 1, 5, 0x40);
+	build_track(&rd, true, GAP_LEN * 3, 3, 5, 0x40);
+
+	/* Append sectors 1 and 2 after 3 to 5, as if read from
+	 * elsewhere in the revolution. */
+	int	p = rd.track_len;
+
+	add_sector(&rd, &p, 3, 1, true, 1, 0x40);
+	add_sector(&rd, &p, 4, 2, true, 1, 0x40);
+	rd.track_len = p;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 0);
+}
+
+
+/* A differing data byte or data CRC fails just that sector. */
+
+static void
+test_data_differs(void)
+{
+	build_track(&src, true, GAP_LEN, 1, 5, 0x40);
+	build_track(&rd, true, GAP_LEN, 1, 5, 0x40);
+
+	int	off = rd.idam_offset[1] & DMK_IDAMP_BITS;
+
+	rd.track[off + 7 + ID_GAP + 1 + 17] ^= 0x01;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 1);
+
+	build_track(&rd, true, GAP_LEN, 1, 5, 0x40);
+	off = rd.idam_offset[4] & DMK_IDAMP_BITS;
+	rd.track[off + 7 + ID_GAP + 1 + SEC_DATA + 1] ^= 0x80;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 1);
+}
+
+
+/* A differing ID CRC fails the sector; a missing sector fails too. */
+
+static void
+test_id_differs(void)
+{
+	build_track(&src, true, GAP_LEN, 1, 5, 0x40);
+	build_track(&rd, true, GAP_LEN, 1, 5, 0x40);
+
+	int	off = rd.idam_offset[2] & DMK_IDAMP_BITS;
+
+	rd.track[off + 6] ^= 0xff;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 1);
+
+	build_track(&rd, true, GAP_LEN, 1, 3, 0x40);
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 2);
+}
+
+
+/* Gaps are not compared. */
+
+static void
+test_gap_ignored(void)
+{
+	build_track(&src, true, GAP_LEN, 1, 5, 0x40);
+	build_track(&rd, true, GAP_LEN, 1, 5, 0x40);
+
+	int	off = rd.idam_offset[0] & DMK_IDAMP_BITS;
+
+	rd.track[off + 7 + 3] = 0x00;
+	rd.track[DMK_TKHDR_SIZE] = 0x00;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 0);
+}
+
+
+/* Doubled FM bytes are compared once per data byte. */
+
+static void
+test_fm_doubled(void)
+{
+	int	nsec = -1;
+
+	build_track(&src, false, GAP_LEN, 1, 4, 0x20);
+	build_track(&rd, false, GAP_LEN, 1, 4, 0x20);
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, &nsec), 0);
+	CHECK_EQ(nsec, 4);
+
+	int	off = rd.idam_offset[3] & DMK_IDAMP_BITS;
+
+	rd.track[off + 2 * (7 + ID_GAP + 1 + 100)] ^= 0x10;
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, NULL), 1);
+}
+
+
+/* A track with no sectors trivially verifies. */
+
+static void
+test_empty(void)
+{
+	int	nsec = -1;
+
+	build_track(&src, true, GAP_LEN, 1, 0, 0);
+	build_track(&rd, true, GAP_LEN, 1, 2, 0);
+
+	CHECK_EQ(dmk_track_compare(&src, &rd, 2, false, 0, &nsec), 0);
+	CHECK_EQ(nsec, 0);
+}
+
+
+int
+main(void)
+{
+	test_identical();
+	test_rotated();
+	test_data_differs();
+	test_id_differs();
+	test_gap_ignored();
+	test_fm_doubled();
+	test_empty();
+
+	return test_exit("test_dmkcmp");
+}
@@ -163,6 +163,148 @@ test_no_replacement(void)
 }
 
 
+/*
+ * Build a track of "nsec" 64-byte sectors numbered from 1.  Bit n of
+ * "bad" marks sector n+1 bad; bit n of "missing" leaves it out, as if
+ * its IDAM was not read at all.
+ */
+
+static void
+build_track_n(struct dmk_track *trk, struct dmk_track_stats *stats,
+	      int nsec, unsigned bad, unsigned missing, uint8_t fill)
+{
+	memset(trk, 0, sizeof(*trk));
+	dmk_track_stats_init(stats);
+
+	memset(trk->data, 0x4e, PRE_LEN);
+
+	int	off  = SEC1_OFF;
+	int	idam = 0;
+
+	for (int s = 0; s < nsec; ++s) {
+		if (missing & (1u << s))
+			continue;
+
+		uint8_t	*sec = trk->track + off;
+		int	is_bad = !!(bad & (1u << s));
+
+		trk->idam_offset[idam] = off | DMK_DDEN_FLAG |
+					 (is_bad ? DMK_EXTRA_FLAG : 0);
+		stats->enc_sec[idam++] = MFM;
+
+		memset(sec, fill + s, SEC_LEN);
+		sec[0] = 0xfe;
+		sec[1] = 0;		/* cyl */
+		sec[2] = 0;		/* side */
+		sec[3] = s + 1;		/* sector number */
+		sec[4] = 1;		/* size code */
+
+		if (is_bad) {
+			++stats->errcount;
+		} else {
+			++stats->good_sectors;
+			++stats->enc_count[MFM];
+		}
+
+		off += SEC_LEN;
+	}
+
+	trk->track_len = off;
+}
+
+
+/* Find sector "num" in a track, or NULL. */
+
+static const uint8_t *
+find_sector(const struct dmk_track *trk, int num)
+{
+	for (int i = 0; i < DMK_MAX_SECTORS && trk->idam_offset[i]; ++i) {
+		const uint8_t	*sec = trk->track +
+				       (trk->idam_offset[i] & DMK_IDAMP_BITS);
+
+		if (sec[3] == num)
+			return sec;
+	}
+
+	return NULL;
+}
+
+
+/* The index replaces sectors from any earlier pass, even one whose
+ * result was not kept as the merged track. */
+
+static void
+test_index_earlier_pass(void)
+{
+	static struct dmk_sector_index	dsi;
+	static struct dmk_track		working, merged;
+	struct dmk_track_stats		wstats, mstats;
+
+	dmk_sector_index_init(&dsi);
+
+	/* Pass 1: only sector 1 good. */
+	build_track_n(&merged, &mstats, 4, 0xe, 0, 0x10);
+	dmk_sector_index_add(&dsi, &merged, &mstats);
+
+	/* Pass 2: sector 1 unreadable, 2 and 3 good, 4 bad.  Becomes
+	 * the merged track, which then lacks sector 1. */
+	build_track_n(&working, &wstats, 4, 0x8, 0x1, 0x20);
+	merge_sectors_indexed(&dsi, &merged, &mstats, &working, &wstats);
+
+	CHECK_EQ(mstats.errcount, 1);
+	CHECK(find_sector(&merged, 1) == NULL);
+
+	/* Pass 3: sectors 1 to 3 bad, only sector 4 good. */
+	build_track_n(&working, &wstats, 4, 0x7, 0, 0x30);
+	merge_sectors_indexed(&dsi, &merged, &mstats, &working, &wstats);
+
+	CHECK_EQ(mstats.errcount, 0);
+	CHECK_EQ(mstats.reused_sectors, 3);
+	CHECK_EQ(mstats.enc_count[MFM], 4);
+
+	const uint8_t	*sec;
+
+	CHECK((sec = find_sector(&merged, 1)) && sec[5] == 0x10);
+	CHECK((sec = find_sector(&merged, 2)) && sec[5] == 0x21);
+	CHECK((sec = find_sector(&merged, 3)) && sec[5] == 0x22);
+	CHECK((sec = find_sector(&merged, 4)) && sec[5] == 0x33);
+
+	for (int i = 0; i < 4; ++i)
+		CHECK(!(merged.idam_offset[i] & DMK_EXTRA_FLAG));
+	CHECK_EQ(merged.idam_offset[4], 0);
+	CHECK_EQ(merged.track_len, SEC1_OFF + 4 * SEC_LEN);
+}
+
+
+/* The index keeps one copy per ID and stays linear on a full track. */
+
+static void
+test_index_full_track(void)
+{
+	static struct dmk_sector_index	dsi;
+	static struct dmk_track		working, merged;
+	struct dmk_track_stats		wstats, mstats;
+
+	dmk_sector_index_init(&dsi);
+
+	/* 32 sectors: even ones good on the first pass, odd ones on the
+	 * second; the same pass again adds nothing new. */
+	build_track_n(&merged, &mstats, 32, 0xaaaaaaaa, 0, 0x40);
+	dmk_sector_index_add(&dsi, &merged, &mstats);
+	dmk_sector_index_add(&dsi, &merged, &mstats);
+	CHECK_EQ(dsi.cnt, 16);
+
+	build_track_n(&working, &wstats, 32, 0x55555555, 0, 0x80);
+	merge_sectors_indexed(&dsi, &merged, &mstats, &working, &wstats);
+
+	CHECK_EQ(dsi.cnt, 32);
+	CHECK_EQ(mstats.errcount, 0);
+	CHECK_EQ(mstats.reused_sectors, 16);
+	CHECK_EQ(find_sector(&merged, 1)[5], 0x40);
+	CHECK_EQ(find_sector(&merged, 2)[5], 0x81);
+}
+
+
 int
 main(void)
 {
@@ -170,6 +312,8 @@ main(void)
 	test_repair();
 	test_keep_previous();
 	test_no_replacement();
+	test_index_earlier_pass();
+	test_index_full_track();
 
 	return test_exit("test_dmkmerge");
 }
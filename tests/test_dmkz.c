@@ -0,0 +1,243 @@
+/*
+ * Validate the packed DMK container: the block coder round trips
+ * any data within its bound, whole files load back exactly through
+ * fp2dmk(), single tracks can be read alone, and damage is caught.
+ */
+
+#include <unistd.h>
+
+#include "dmkz.h"
+
+#include "test.h"
+#include "testtrack.h"
+
+
+static struct dmk_file	dmkf;
+static struct dmk_file	dmkf2;
+static struct dmk_track	work;
+
+static uint8_t	in[DMKRD_TRACKLEN_MAX];
+static uint8_t	out[dmkz_bound(DMKRD_TRACKLEN_MAX)];
+static uint8_t	back[DMKRD_TRACKLEN_MAX];
+
+
+static bool
+round_trip(const uint8_t *buf, size_t len, size_t *plen)
+{
+	*plen = dmkz_pack(buf, len, out);
+
+	memset(back, 0x5a, sizeof(back));
+
+	return *plen <= dmkz_bound(len) &&
+	       dmkz_unpack(out, *plen, back, len) == 0 &&
+	       memcmp(buf, back, len) == 0;
+}
+
+
+/* Gap-heavy tracks shrink a lot; any data survives within bound. */
+
+static void
+test_codec(void)
+{
+	size_t	plen;
+
+	test_track_make((struct dmk_track *)in, 3, 1, DMKRD_TRACKLEN_5,
+			false, false);
+	CHECK(round_trip(in, DMKRD_TRACKLEN_5, &plen));
+	CHECK(plen < DMKRD_TRACKLEN_5 / 10);
+
+	test_track_make((struct dmk_track *)in, 3, 1, DMKRD_TRACKLEN_5,
+			true, false);
+	CHECK(round_trip(in, DMKRD_TRACKLEN_5, &plen));
+	CHECK(plen < DMKRD_TRACKLEN_5 * 3 / 4);
+
+	/* Incompressible data grows by no more than the bound. */
+	uint32_t	x = 1;
+
+	for (size_t i = 0; i < sizeof(in); ++i) {
+		x = x * 1103515245 + 12345;
+		in[i] = x >> 23;
+	}
+
+	CHECK(round_trip(in, sizeof(in), &plen));
+
+	/* Long runs and short tails. */
+	memset(in, 0xff, sizeof(in));
+	CHECK(round_trip(in, sizeof(in), &plen));
+	CHECK(plen <= 4);
+
+	for (size_t len = 1; len <= 9; ++len)
+		CHECK(round_trip((const uint8_t *)"abcabcabc", len, &plen));
+}
+
+
+/* Blocks that don't decode to exactly the track length are refused. */
+
+static void
+test_malformed(void)
+{
+	uint8_t	lit[] = { 0x02, 'a', 'b', 'c' };
+	uint8_t	copy_back[] = { 0x00, 'a', 0xc0, 0x02, 0x00 };
+	uint8_t	short_run[] = { 0x80 };
+	uint8_t	ext[] = { 0xbf, 0x01 };
+
+	CHECK_EQ(dmkz_unpack(lit, sizeof(lit), back, 3), 0);
+	CHECK_EQ(dmkz_unpack(lit, sizeof(lit), back, 2), -1);
+	CHECK_EQ(dmkz_unpack(lit, sizeof(lit), back, 4), -1);
+	CHECK_EQ(dmkz_unpack(lit, sizeof(lit) - 1, back, 3), -1);
+	CHECK_EQ(dmkz_unpack(copy_back, sizeof(copy_back), back, 5), -1);
+	CHECK_EQ(dmkz_unpack(short_run, sizeof(short_run), back, 3), -1);
+	CHECK_EQ(dmkz_unpack(ext, sizeof(ext), back, 66), -1);
+}
+
+
+static void
+make_file(struct dmk_file *f, int tracks, bool sside)
+{
+	dmk_file_free(f);
+	dmk_header_init(&f->header, tracks, DMKRD_TRACKLEN_5);
+
+	if (sside)
+		f->header.options |= DMK_SSIDE_OPT;
+
+	for (int t = 0; t < tracks; ++t) {
+		for (int s = 0; s < DMK_SIDES; ++s) {
+			test_track_make(&work, t, s, DMKRD_TRACKLEN_5,
+					t & 1, false);
+			dmk_file_put_track(f, t, s, &work);
+		}
+	}
+}
+
+
+static bool
+same_file(const struct dmk_file *a, const struct dmk_file *b)
+{
+	int	sides = 2 - !!(a->header.options & DMK_SSIDE_OPT);
+
+	if (memcmp(&a->header, &b->header, sizeof(a->header)) != 0)
+		return false;
+
+	for (int t = 0; t < a->header.ntracks; ++t) {
+		for (int s = 0; s < sides; ++s) {
+			if (dmk_file_track_len(a, t, s) !=
+			    dmk_file_track_len(b, t, s) ||
+			    memcmp(dmk_file_track_raw(a, t, s),
+				   dmk_file_track_raw(b, t, s),
+				   dmk_file_track_len(a, t, s)) != 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+/* fp2dmk() reads either container, and dmk2fp() keeps the choice. */
+
+static void
+test_file(void)
+{
+	FILE	*plain = tmpfile();
+	FILE	*packed = tmpfile();
+
+	CHECK(plain && packed);
+	if (!plain || !packed)
+		return;
+
+	make_file(&dmkf, 40, false);
+
+	CHECK_EQ(dmk2fp(&dmkf, plain), 0);
+
+	dmkf.zipped = true;
+	CHECK_EQ(dmk2fp(&dmkf, packed), 0);
+
+	fseek(plain, 0, SEEK_END);
+	fseek(packed, 0, SEEK_END);
+	CHECK(ftell(packed) < ftell(plain) / 3);
+
+	CHECK_EQ(fp2dmk(packed, &dmkf2), 0);
+	CHECK(dmkf2.zipped);
+	CHECK(same_file(&dmkf, &dmkf2));
+
+	CHECK_EQ(fp2dmk(plain, &dmkf2), 0);
+	CHECK(!dmkf2.zipped);
+	CHECK(same_file(&dmkf, &dmkf2));
+
+	/* Any one track can be read alone. */
+	memset(&work, 0, sizeof(work));
+	CHECK(dmkz_track_fread(&dmkf.header, 37, 1, &work, packed));
+	CHECK_EQ(work.track_len, DMKRD_TRACKLEN_5);
+	CHECK(memcmp(work.track, dmk_file_track_raw(&dmkf, 37, 1),
+		     DMKRD_TRACKLEN_5) == 0);
+	CHECK(!dmkz_track_fread(&dmkf.header, 40, 0, &work, packed));
+
+	/* Single-sided files index one side per track. */
+	make_file(&dmkf, 3, true);
+	dmkf.zipped = true;
+	CHECK_EQ(dmk2fp(&dmkf, packed), 0);
+	CHECK(ftruncate(fileno(packed), ftell(packed)) == 0);
+
+	CHECK_EQ(fp2dmk(packed, &dmkf2), 0);
+	CHECK(same_file(&dmkf, &dmkf2));
+
+	fclose(plain);
+	fclose(packed);
+}
+
+
+/* A damaged block fails its CRC or decoding. */
+
+static void
+test_damage(void)
+{
+	FILE	*fp = tmpfile();
+
+	CHECK(fp != NULL);
+	if (!fp)
+		return;
+
+	make_file(&dmkf, 2, false);
+	dmkf.zipped = true;
+	CHECK_EQ(dmk2fp(&dmkf, fp), 0);
+
+	long	end = ftell(fp);
+
+	fseek(fp, end - 20, SEEK_SET);
+
+	int	c = fgetc(fp);
+
+	fseek(fp, end - 20, SEEK_SET);
+	fputc(c ^ 0x01, fp);
+
+	CHECK_EQ(fp2dmk(fp, &dmkf2), -1);
+
+	/* The other tracks are still readable. */
+	CHECK(dmkz_track_fread(&dmkf.header, 0, 0, &work, fp));
+
+	fclose(fp);
+}
+
+
+static void
+test_path(void)
+{
+	CHECK(dmkz_path("disk.dmkz"));
+	CHECK(dmkz_path("/a/b/DISK.DMKZ"));
+	CHECK(!dmkz_path("disk.dmk"));
+	CHECK(!dmkz_path(".dmkz"));
+	CHECK(!dmkz_path("disk.dmkz.ckpt"));
+}
+
+
+int
+main(void)
+{
+	test_codec();
+	test_malformed();
+	test_file();
+	test_damage();
+	test_path();
+
+	return test_exit("test_dmkz");
+}
@@ -0,0 +1,136 @@
+/*
+ * Validate the drive calibration cache: storing, finding, and
+ * replacing entries by Greaseweazle ID and drive unit.
+ */
+
+#include <unistd.h>
+
+#include "gwcalib.h"
+
+#include "test.h"
+
+
+static char	dir[] = "/tmp/test_gwcalib.XXXXXX";
+static char	path[64];
+
+
+/* A missing cache file has no entries. */
+
+static void
+test_missing(void)
+{
+	struct gw_calib	cal;
+
+	CHECK(!calib_load(path, "GW0001", 0, &cal));
+}
+
+
+/* A stored entry is found again by its ID and unit only. */
+
+static void
+test_store_load(void)
+{
+	struct gw_calib	cal = { 2, 0, 300.2, -1, -1 };
+	struct gw_calib	got;
+
+	CHECK_EQ(calib_store(path, "GW0001", 0, &cal), 0);
+
+	CHECK(calib_load(path, "GW0001", 0, &got));
+	CHECK_EQ(got.kind, 2);
+	CHECK_EQ(got.densel, 0);
+	CHECK_NEAR(got.rpm, 300.2, 0.001);
+	CHECK_EQ(got.step_ms, -1);
+	CHECK_EQ(got.settle_ms, -1);
+
+	CHECK(!calib_load(path, "GW0001", 1, &got));
+	CHECK(!calib_load(path, "GW000", 0, &got));
+}
+
+
+/* Other drives keep their entries; the same drive's is replaced. */
+
+static void
+test_replace(void)
+{
+	struct gw_calib	cal_b = { 1, 1, 360.0, 6, 20 };
+	struct gw_calib	cal_a = { 4, 1, 299.5, 3, 15 };
+	struct gw_calib	other = { 3, 1, 359.0, -1, -1 };
+	struct gw_calib	got;
+
+	CHECK_EQ(calib_store(path, "GW0001", 1, &cal_b), 0);
+	CHECK_EQ(calib_store(path, "/dev/tty ACM0", 0, &other), 0);
+	CHECK_EQ(calib_store(path, "GW0001", 0, &cal_a), 0);
+
+	CHECK(calib_load(path, "GW0001", 0, &got));
+	CHECK_EQ(got.kind, 4);
+	CHECK_EQ(got.step_ms, 3);
+	CHECK_EQ(got.settle_ms, 15);
+
+	CHECK(calib_load(path, "GW0001", 1, &got));
+	CHECK_EQ(got.kind, 1);
+	CHECK_NEAR(got.rpm, 360.0, 0.001);
+
+	CHECK(calib_load(path, "/dev/tty ACM0", 0, &got));
+	CHECK_EQ(got.kind, 3);
+
+	/* One line per drive, plus the two header comments. */
+	FILE	*fp = fopen(path, "r");
+	char	line[256];
+	int	lines = 0;
+
+	while (fp && fgets(line, sizeof(line), fp))
+		++lines;
+
+	if (fp)
+		fclose(fp);
+
+	CHECK_EQ(lines, 5);
+}
+
+
+/* Only a meaningful change is worth storing again. */
+
+static void
+test_changed(void)
+{
+	struct gw_calib	a = { 2, 0, 300.0, -1, -1 };
+	struct gw_calib	b = a;
+
+	CHECK(!calib_changed(&a, &b));
+
+	b.rpm = 301.5;
+	CHECK(!calib_changed(&a, &b));
+
+	b.rpm = 306.0;
+	CHECK(calib_changed(&a, &b));
+
+	b = a;
+	b.densel = 1;
+	CHECK(calib_changed(&a, &b));
+
+	b = a;
+	b.step_ms = 6;
+	CHECK(calib_changed(&a, &b));
+}
+
+
+int
+main(void)
+{
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "%s/calib.txt", dir);
+
+	test_missing();
+	test_store_load();
+	test_replace();
+	test_changed();
+
+	remove(path);
+	rmdir(dir);
+
+	return test_exit("test_gwcalib");
+}
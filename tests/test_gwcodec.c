@@ -0,0 +1,277 @@
+/*
+ * Validate the in-memory track codec: a track encoded to a write
+ * stream decodes back to the same sectors, a bad stream fails with
+ * its error in the codec's own log, a bad position fails without
+ * exiting, and codecs on separate threads give the same results and
+ * logs as each other.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "msg_levels.h"
+#include "gwcodec.h"
+
+#include "test.h"
+#include "testtrack.h"
+
+
+#define FREQ		72000000
+#define NTHREADS	2
+#define ROUNDS		8
+
+static struct dmk_track	src;
+
+
+/*
+ * Read a write stream back as the device would: one revolution
+ * between two index pulses.
+ */
+
+static uint8_t *
+read_stream(const uint8_t *wbuf, size_t wcnt, size_t *rcnt)
+{
+	static const uint8_t	index[] = { 0xff, FLUXOP_INDEX, 1, 1, 1, 1 };
+	uint8_t	*rbuf = malloc(wcnt + 2 * sizeof(index));
+
+	if (!rbuf)
+		return NULL;
+
+	memcpy(rbuf, index, sizeof(index));
+	memcpy(rbuf + sizeof(index), wbuf, wcnt - 1);
+	memcpy(rbuf + sizeof(index) + wcnt - 1, index, sizeof(index));
+	rbuf[2 * sizeof(index) + wcnt - 1] = 0;
+
+	*rcnt = 2 * sizeof(index) + wcnt;
+
+	return rbuf;
+}
+
+
+/* Every sector of the source came back, data intact. */
+
+static bool
+same_sectors(const struct dmk_track *trk)
+{
+	int	n = 0;
+
+	while (n < DMK_MAX_SECTORS && trk->idam_offset[n])
+		++n;
+
+	if (n != TEST_TRACK_SECTORS)
+		return false;
+
+	for (int r = 1; r <= TEST_TRACK_SECTORS; ++r) {
+		uint8_t	data[TEST_TRACK_SECSIZE];
+
+		for (int i = 0; i < TEST_TRACK_SECSIZE; ++i)
+			data[i] = test_track_data(0, r, i);
+
+		if (!memmem(trk->data, trk->track_len - DMK_TKHDR_SIZE,
+			    data, sizeof(data)))
+			return false;
+	}
+
+	return true;
+}
+
+
+struct round_trip {
+	struct gwcodec		gc;
+	struct dmk_track	trk;
+	struct dmk_track_stats	dts;
+	FILE			*log;
+	long			log_len;
+	bool			ok;
+};
+
+
+static void *
+round_trips(void *arg)
+{
+	struct round_trip	*rt = arg;
+
+	rt->ok = true;
+
+	for (int i = 0; i < ROUNDS && rt->ok; ++i) {
+		uint8_t	*wbuf, *rbuf;
+		size_t	rcnt;
+		ssize_t	wcnt = gwcodec_encode(&rt->gc, 0, 0, &src, &wbuf);
+
+		rt->ok = wcnt > 0 &&
+			 (rbuf = read_stream(wbuf, wcnt, &rcnt)) != NULL;
+
+		if (rt->ok) {
+			rt->ok = gwcodec_decode(&rt->gc, rbuf, rcnt,
+						&rt->trk, &rt->dts) == 0;
+			free(rbuf);
+		}
+
+		free(wbuf);
+	}
+
+	rt->log_len = ftell(rt->log);
+
+	return NULL;
+}
+
+
+static void
+test_round_trip(void)
+{
+	static struct round_trip	rt;
+
+	gwcodec_init(&rt.gc, FREQ, 250.0, DMKRD_TRACKLEN_5);
+	rt.log = tmpfile();
+	rt.gc.msg.file = rt.log;
+
+	round_trips(&rt);
+
+	CHECK(rt.ok);
+	CHECK(same_sectors(&rt.trk));
+	CHECK_EQ(rt.dts.good_sectors, TEST_TRACK_SECTORS);
+	CHECK_EQ(rt.dts.errcount, 0);
+	CHECK_EQ(rt.log_len, 0);
+
+	/* Each call put back the thread's own message state. */
+	CHECK(msg_ctx_use(NULL) == NULL);
+
+	/* The source track was left as it was. */
+	static struct dmk_track	again;
+
+	test_track_make(&again, 0, 0, DMKRD_TRACKLEN_5, true, true);
+	CHECK(memcmp(&src, &again, sizeof(src)) == 0);
+
+	fclose(rt.log);
+}
+
+
+static void
+test_bad_stream(void)
+{
+	static struct gwcodec	gc;
+	static struct dmk_track	trk;
+	struct dmk_track_stats	dts;
+	static const uint8_t	bad[] = { 0xff, 9, 1, 1, 1, 1, 0 };
+	char			line[80] = "";
+
+	gwcodec_init(&gc, FREQ, 250.0, DMKRD_TRACKLEN_5);
+	gc.msg.file = tmpfile();
+
+	CHECK_EQ(gwcodec_decode(&gc, bad, sizeof(bad), &trk, &dts), -1);
+
+	rewind(gc.msg.file);
+	CHECK(fgets(line, sizeof(line), gc.msg.file) != NULL);
+	CHECK(strstr(line, "flux stream") != NULL);
+
+	fclose(gc.msg.file);
+
+	/* With no log, the failure is only in the return. */
+	gc.msg.file = NULL;
+	CHECK_EQ(gwcodec_decode(&gc, bad, sizeof(bad), &trk, &dts), -1);
+}
+
+
+/* Positions out of DMK range fail rather than reach dmk2pulses(). */
+
+static void
+test_bad_position(void)
+{
+	static struct gwcodec	gc;
+	static const int	pos[][2] = {
+		{ 0, 2 }, { 0, -1 }, { -1, 0 }, { DMK_MAX_TRACKS, 0 }
+	};
+	bool			ok = true;
+
+	gwcodec_init(&gc, FREQ, 250.0, DMKRD_TRACKLEN_5);
+
+	for (int i = 0; i < COUNT_OF(pos); ++i) {
+		uint8_t	*sbuf = (uint8_t *)&gc;
+
+		ok = ok && gwcodec_encode(&gc, pos[i][0], pos[i][1], &src,
+					  &sbuf) == -1 && !sbuf;
+	}
+
+	CHECK(ok);
+}
+
+
+/*
+ * Codecs logging everything the decoder says, on threads at once.
+ * Shared state would show as differing tracks or logs.
+ */
+
+static void
+test_threads(void)
+{
+	static struct round_trip	rt[NTHREADS];
+	pthread_t			tid[NTHREADS];
+	bool				ok = true;
+
+	for (int i = 0; i < NTHREADS; ++i) {
+		gwcodec_init(&rt[i].gc, FREQ, 250.0, DMKRD_TRACKLEN_5);
+		rt[i].log = tmpfile();
+		rt[i].gc.msg.file = rt[i].log;
+		rt[i].gc.msg.file_level = MSG_DEBUG;
+		ok = ok && rt[i].log;
+	}
+
+	CHECK(ok);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		ok = ok && pthread_create(&tid[i], NULL, round_trips,
+					  &rt[i]) == 0;
+
+	CHECK(ok);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		pthread_join(tid[i], NULL);
+
+	CHECK(rt[0].log_len > 0);
+
+	for (int i = 0; i < NTHREADS; ++i) {
+		ok = ok && rt[i].ok && same_sectors(&rt[i].trk) &&
+		     rt[i].log_len == rt[0].log_len &&
+		     memcmp(&rt[i].trk, &rt[0].trk, sizeof(rt[0].trk)) == 0;
+	}
+
+	CHECK(ok);
+
+	char	*a = malloc(rt[0].log_len), *b = malloc(rt[0].log_len);
+
+	ok = a && b;
+
+	for (int i = 1; i < NTHREADS && ok; ++i) {
+		rewind(rt[0].log);
+		rewind(rt[i].log);
+		ok = fread(a, rt[0].log_len, 1, rt[0].log) == 1 &&
+		     fread(b, rt[0].log_len, 1, rt[i].log) == 1 &&
+		     memcmp(a, b, rt[0].log_len) == 0;
+	}
+
+	CHECK(ok);
+
+	free(a);
+	free(b);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		fclose(rt[i].log);
+
+	/* None of it reached the default state. */
+	CHECK(msg_get_filename() == NULL);
+	CHECK_EQ(msg_file_get_level(), 0);
+}
+
+
+int
+main(void)
+{
+	test_track_make(&src, 0, 0, DMKRD_TRACKLEN_5, true, true);
+
+	test_round_trip();
+	test_bad_stream();
+	test_bad_position();
+	test_threads();
+
+	return test_exit("test_gwcodec");
+}
@@ -138,8 +138,10 @@ static struct dmk_header	header;
 static struct gw_media_encoding	gme;
 
 
+/* Set up to decode from wherever the read starts. */
+
 static struct fluxgen
-decode_setup(void)
+decode_setup_anywhere(void)
 {
 	dmk_disk_stats_init(&dds);
 	dmk_track_stats_init(&trk_merged_stats);
@@ -152,10 +154,23 @@ decode_setup(void)
 
 	media_encoding_init(&gme, SAMPLE_FREQ, 4.0);
 
+	f2dsm.fdec.use_hole = false;
+
+	return (struct fluxgen){ .gme = &gme, .f2dsm = &f2dsm };
+}
+
+
+static struct fluxgen
+decode_setup(void)
+{
+	struct fluxgen	fg = decode_setup_anywhere();
+
+	f2dsm.fdec.use_hole = true;
+
 	/* Index hole at the start of the track. */
 	gwflux_decode_index(0, &f2dsm);
 
-	return (struct fluxgen){ .gme = &gme, .f2dsm = &f2dsm };
+	return fg;
 }
 
 
@@ -398,6 +413,82 @@ test_mfm_bad_crc(void)
 }
 
 
+/*
+ * A read starting partway into sector 5 of 12 and running past the
+ * hole until sector 6 comes around again is aligned to one
+ * revolution starting at the hole, with each sector once.
+ */
+
+#define ALIGN_SECS	12
+#define ALIGN_GAP	32
+#define ALIGN_SECLEN	342	/* Bytes mfm_sector() lays down */
+
+static void
+test_mfm_align(void)
+{
+	static uint8_t	data[256];
+
+	memset(data, 0x5a, sizeof(data));
+
+	struct fluxgen	fg = decode_setup_anywhere();
+
+	/* The tail of sector 5's data. */
+	mfm_fill(&fg, 0x5a, 100);
+	mfm_fill(&fg, 0x4e, 24);
+
+	for (int r = 6; r <= ALIGN_SECS; ++r)
+		mfm_sector(&fg, 3, 0, r, data, 1);
+
+	mfm_fill(&fg, 0x4e, ALIGN_GAP);
+	gwflux_decode_index(fg.total_ticks, &f2dsm);
+	mfm_fill(&fg, 0x4e, ALIGN_GAP);
+
+	for (int r = 1; r <= 6; ++r)
+		mfm_sector(&fg, 3, 0, r, data, 1);
+
+	gw_decode_flush(&f2dsm);
+
+	CHECK(f2dsm.dtsm.track_wrap_p != NULL);
+	CHECK(gw_align_track(&f2dsm.dtsm));
+
+	const struct dmk_track_stats	*ts = &f2dsm.dtsm.trk_working_stats;
+	const struct dmk_track		*trk = &f2dsm.dtsm.trk_working;
+
+	CHECK_EQ(ts->good_sectors, ALIGN_SECS);
+	CHECK_EQ(ts->errcount, 0);
+
+	/* The repeat of the first ID is read but not kept. */
+	CHECK_EQ(trk->track_len - DMK_TKHDR_SIZE,
+		 2 * ALIGN_GAP + ALIGN_SECS * ALIGN_SECLEN);
+
+	for (int i = 0; i < ALIGN_SECS; ++i) {
+		int	off = trk->idam_offset[i] & DMK_IDAMP_BITS;
+
+		CHECK(off >= DMK_TKHDR_SIZE && off < trk->track_len);
+		CHECK_EQ(trk->track[off], 0xfe);
+		CHECK_EQ(trk->track[off + 3], i + 1);
+	}
+
+	CHECK_EQ(trk->idam_offset[ALIGN_SECS], 0);
+
+	/* Sector 1's ID follows the gap, its zeros, and its A1s after
+	 * the hole, give or take the decoder's lag in placing the hole. */
+	int	first = (trk->idam_offset[0] & DMK_IDAMP_BITS) - DMK_TKHDR_SIZE;
+
+	CHECK(first >= ALIGN_GAP + 15 - 8 && first <= ALIGN_GAP + 15 + 8);
+
+	/* Without a repeat of the first ID, the read can't be aligned. */
+	fg = decode_setup_anywhere();
+
+	for (int r = 1; r <= 3; ++r)
+		mfm_sector(&fg, 3, 0, r, data, 1);
+
+	gw_decode_flush(&f2dsm);
+
+	CHECK(!gw_align_track(&f2dsm.dtsm));
+}
+
+
 static void
 test_encoding_name(void)
 {
@@ -435,6 +526,7 @@ main(void)
 	test_mfm_track();
 	test_fm_track();
 	test_mfm_bad_crc();
+	test_mfm_align();
 
 	return test_exit("test_gwdecode");
 }
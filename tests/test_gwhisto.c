@@ -48,6 +48,180 @@ synth_stream(uint8_t *buf)
 }
 
 
+/*
+ * Bucket a stream one pulse at a time through gw_decode_stream(),
+ * as a reference for flux2histo().
+ */
+
+static int
+ref_pulse(uint32_t ticks, void *data)
+{
+	struct histogram	*histo = data;
+	uint32_t		bucket = ticks / histo->ticks_per_bucket;
+
+	if (bucket >= histo->buckets)
+		++histo->data_overflow;
+	else
+		++histo->data[bucket];
+
+	return 0;
+}
+
+
+static uint32_t	seed = 1;
+
+static uint32_t
+rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 8) % n;
+}
+
+
+/*
+ * Jittered MFM-like flux over "revs" revolutions, with a share of
+ * noise, long intervals, and spaces mixed in.
+ */
+
+static size_t
+synth_jitter(uint8_t *buf, int revs, int cycles, int noise)
+{
+	size_t	n = 0;
+
+	for (int r = 0; r <= revs; ++r) {
+		buf[n++] = 255;
+		buf[n++] = FLUXOP_INDEX;
+		gw_write_28(rnd(50), &buf[n]); n += 4;
+
+		if (r == revs)
+			break;
+
+		for (int i = 0; i < cycles; ++i) {
+			for (int k = 2; k <= 4; ++k)
+				buf[n++] = k * 48 - 4 + rnd(9);
+
+			if (rnd(100) >= noise)
+				continue;
+
+			uint32_t	v = 40 + rnd(1000);
+
+			if (rnd(4) == 0) {
+				buf[n++] = 255;
+				buf[n++] = FLUXOP_SPACE;
+				gw_write_28(v, &buf[n]); n += 4;
+				v = 1 + rnd(249);
+			}
+
+			n += encode_ticks(v, ~0u, 0, &buf[n]);
+		}
+	}
+
+	buf[n++] = 0;
+
+	return n;
+}
+
+
+/* The direct walk buckets exactly as the decoder does. */
+
+static void
+test_reference(double tpb)
+{
+	static uint8_t		buf[16 * 2000 + 64];
+	struct histogram	histo, ref;
+
+	size_t	n = synth_jitter(buf, 2, 2000, 20);
+
+	histo_init(0, 0, 2, FREQ, tpb, &histo);
+	histo_init(0, 0, 2, FREQ, tpb, &ref);
+	memset(ref.data, 0, sizeof(ref.data));
+
+	CHECK_EQ(flux2histo(buf, n, &histo), 0);
+
+	struct gw_decode_stream_s gwds = {
+		.ds_status = -1,
+		.decoded_pulse = ref_pulse,
+		.pulse_data = &ref
+	};
+
+	gw_decode_stream(buf, n, &gwds);
+
+	CHECK_EQ(histo.revs, 2);
+	CHECK_EQ(histo.data_overflow, ref.data_overflow);
+	CHECK(histo.data_overflow > 0);
+	CHECK(memcmp(histo.data, ref.data, sizeof(ref.data)) == 0);
+}
+
+
+/*
+ * Buckets down to one tick: peaks are still found whole through the
+ * jitter and noise, and several reads add up.
+ */
+
+static void
+test_fine(void)
+{
+	static uint8_t		buf[16 * 20000 + 64];
+	struct histogram	histo, total;
+	struct histo_analysis	ha, hac;
+
+	histo_init(0, 0, 1, FREQ, 0.25, &histo);
+	CHECK_NEAR(histo.ticks_per_bucket, HIST_TICKS_MIN, 0.0);
+	CHECK_EQ(histo.buckets, 656);
+
+	histo_init(0, 0, 1, FREQ, 1.0, &total);
+	histo_clear(&total);
+
+	size_t	n = synth_jitter(buf, 1, 20000, 2);
+
+	CHECK_EQ(flux2histo(buf, n, &histo), 0);
+
+	histo_analysis_init(&ha);
+	histo_analyze(&histo, &ha);
+
+	CHECK_EQ(ha.peaks, 3);
+	CHECK_NEAR(ha.ticks_per_bucket, 1.0, 0.0);
+	CHECK_NEAR(ha.peak[0], 96.0, 0.1);
+	CHECK_NEAR(ha.peak[1], 144.0, 0.1);
+	CHECK_NEAR(ha.peak[2], 192.0, 0.1);
+	CHECK(ha.std_dev[0] > 2.0 && ha.std_dev[0] < 3.5);
+
+	/* Same peaks at the default width, in its buckets. */
+	struct histogram	coarse;
+
+	histo_init(0, 0, 1, FREQ, TICKS_PER_BUCKET, &coarse);
+	CHECK_EQ(flux2histo(buf, n, &coarse), 0);
+
+	histo_analysis_init(&hac);
+	histo_analyze(&coarse, &hac);
+
+	CHECK_EQ(hac.peaks, 3);
+	for (int j = 0; j < 3; ++j) {
+		CHECK_NEAR(hac.peak[j] * TICKS_PER_BUCKET, ha.peak[j],
+			   TICKS_PER_BUCKET);
+	}
+
+	CHECK_NEAR(ha.bit_rate_khz, hac.bit_rate_khz, 10.0);
+
+	CHECK_EQ(histo_merge(&total, &histo), 0);
+	CHECK_EQ(histo_merge(&total, &histo), 0);
+	CHECK_EQ(total.revs, 2);
+	CHECK_EQ(total.total_ticks, 2 * histo.total_ticks);
+	CHECK_EQ(total.data[96], 2 * histo.data[96]);
+	CHECK_EQ(flux2histo_add(buf, n, &total), 0);
+	CHECK_EQ(total.revs, 3);
+	CHECK_EQ(total.data[144], 3 * histo.data[144]);
+
+	histo_analysis_init(&ha);
+	histo_analyze(&total, &ha);
+	CHECK_EQ(ha.peaks, 3);
+	CHECK_NEAR(ha.rpm, 60.0 * FREQ / histo.total_ticks, 0.001);
+
+	CHECK_EQ(histo_merge(&total, &coarse), -1);
+}
+
+
 int
 main(void)
 {
@@ -145,5 +319,52 @@ main(void)
 
 	CHECK_EQ(flux2histo(buf3, sizeof(buf3), &histo3), -1);
 
+	/* Sweep table rows: peak means in microseconds, CSV and JSON. */
+	char	line[512];
+	FILE	*fp = tmpfile();
+
+	CHECK(fp != NULL);
+	CHECK_EQ(histo_table_begin(fp, true), 0);
+	CHECK_EQ(histo_table_row(fp, true, 0, &histo, &ha), 0);
+	CHECK_EQ(histo_table_end(fp, true, 1), 0);
+	rewind(fp);
+
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(!strncmp(line, "track,side,revs,rpm,peaks,", 26));
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(!strncmp(line, "3,1,1,300.00", 12));
+
+	double	p1;
+
+	CHECK_EQ(sscanf(line, "%*d,%*d,%*d,%*f,%*d,%lf", &p1), 1);
+	CHECK_NEAR(p1, ha.peak[0] * TICKS_PER_BUCKET * 1e6 / FREQ, 0.0001);
+	CHECK(fgets(line, sizeof(line), fp) == NULL);
+	fclose(fp);
+
+	fp = tmpfile();
+	CHECK(fp != NULL);
+	CHECK_EQ(histo_table_begin(fp, false), 0);
+	CHECK_EQ(histo_table_row(fp, false, 0, &histo, &ha), 0);
+	CHECK_EQ(histo_table_row(fp, false, 1, &histo2, &ha2), 0);
+	CHECK_EQ(histo_table_end(fp, false, 2), 0);
+	rewind(fp);
+
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(!strcmp(line, "[\n"));
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(strstr(line, "\"track\": 3, \"side\": 1,") != NULL);
+	CHECK(line[strlen(line) - 2] == ',');
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(strstr(line, "\"peaks\": 2,") != NULL);
+	CHECK(line[strlen(line) - 2] == '}');
+	CHECK(fgets(line, sizeof(line), fp) != NULL);
+	CHECK(!strcmp(line, "]\n"));
+	fclose(fp);
+
+	test_reference(TICKS_PER_BUCKET);
+	test_reference(1.0);
+	test_reference(7.5);
+	test_fine();
+
 	return test_exit("test_gwhisto");
 }
@@ -141,6 +141,40 @@ test_parse_junk(void)
 }
 
 
+static void
+test_parse_batched(void)
+{
+	/* Seek, head and read sent together, their acks in one read. */
+	static const char batch_log[] =
+		"-> 0x02 0x03 0x04 0x03 0x03 0x01 0x07 0x08 0x00 0x00 0x00"
+		" 0x00 0x02 0x00\n"
+		"<- 0x02 0x00 0x03 0x00\n"
+		"<- 0x07 0x00 0x61 0x62 0x00\n"
+		"-> 0x09 0x02\n"
+		"<- 0x09 0x00\n"
+		"-> 0x02 0x03 0x05 0x03 0x03 0x00 0x07 0x08 0x00 0x00 0x00"
+		" 0x00 0x02 0x00\n"
+		"<- 0x02 0x00 0x03 0x00 0x07 0x00 0x63 0x00\n"
+		"-> 0x09 0x02\n"
+		"<- 0x09 0x00\n";
+
+	struct gw_replay_log	log;
+
+	memset(&log, 0, sizeof(log));
+	CHECK_EQ(parse_string(batch_log, &log), 0);
+
+	CHECK_EQ(log.warnings, 0);
+	CHECK_EQ(log.nstreams, 2);
+	CHECK_EQ(log.pos[4][1].cnt, 1);
+	CHECK_EQ(log.pos[4][1].flux[0].cnt, 3);
+	CHECK(!memcmp(log.pos[4][1].flux[0].buf, "\x61\x62\x00", 3));
+	CHECK_EQ(log.pos[5][0].cnt, 1);
+	CHECK_EQ(log.pos[5][0].flux[0].cnt, 2);
+
+	gw_replay_log_free(&log);
+}
+
+
 /*
  * Drive the responder through the public gw I/O entry points, as
  * gw2dmk would: command writes, exact-count ack reads, and the
@@ -262,13 +296,64 @@ test_responder(void)
 }
 
 
+/*
+ * Batched, a track's seek, head select and read are one exchange.  A
+ * failed seek is reported as such, with the read that went ahead
+ * anyway drained, so the next exchange is in step.
+ */
+
+static void
+test_batched(void)
+{
+	struct gw_replay_log	log;
+	struct gw_io_stats	before, after;
+	uint8_t			*fbuf = NULL;
+	int			failed = -1;
+
+	memset(&log, 0, sizeof(log));
+	CHECK_EQ(parse_string(basic_log, &log), 0);
+	CHECK_EQ(gw_replay_start_parsed(&log), 0);
+
+	gw_set_batching(true);
+	gw_get_io_stats(&before);
+
+	CHECK_EQ(gw_read_stream_at(GW_REPLAY_DEVT, 2, 1, 1, 0, &fbuf,
+				   &failed), 4);
+	CHECK_EQ(failed, 2);
+	CHECK(fbuf && !memcmp(fbuf, "\x32\x33\x34\x00", 4));
+
+	gw_get_io_stats(&after);
+	CHECK_EQ(after.cmds - before.cmds, 4);
+
+	CHECK_EQ(gw_read_stream_at(GW_REPLAY_DEVT, GW_MAX_TRACKS, 1, 1, 0,
+				   &fbuf, &failed), -ACK_BAD_CYLINDER);
+	CHECK_EQ(failed, 0);
+
+	/* The second pass went to the drained read. */
+	CHECK_EQ(gw_replay_flux_avail(2, 1), GW_REPLAY_EXHAUSTED);
+	CHECK_EQ(gw_head(GW_REPLAY_DEVT, 0), ACK_OKAY);
+
+	/* Unbatched, the read isn't sent after the failed seek. */
+	gw_set_batching(false);
+	CHECK_EQ(gw_read_stream_at(GW_REPLAY_DEVT, GW_MAX_TRACKS, 0, 1, 0,
+				   &fbuf, &failed), -ACK_BAD_CYLINDER);
+	CHECK_EQ(failed, 0);
+	CHECK_EQ(gw_bytes_waiting(GW_REPLAY_DEVT), 0);
+
+	free(fbuf);
+	gw_replay_finish();
+}
+
+
 int
 main(void)
 {
 	test_parse_basic();
 	test_parse_truncated();
 	test_parse_junk();
+	test_parse_batched();
 	test_responder();
+	test_batched();
 
 	return test_exit("test_gwreplay");
 }
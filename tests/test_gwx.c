@@ -1,9 +1,13 @@
 /*
  * Validate the Greaseweazle flux stream codec: 28-bit value packing,
- * gw_decode_stream() opcode parsing, and encode_ticks() round trips.
+ * gw_decode_stream() opcode parsing, encode_ticks() round trips, and
+ * gw_stream_bw()'s link rates.
  */
 
+#include <math.h>
+
 #include "gwx.h"
+#include "gwwalk.h"
 
 #include "test.h"
 
@@ -243,6 +247,121 @@ test_encode_ticks(void)
 }
 
 
+static void
+test_stream_bw(void)
+{
+	static uint8_t	buf[1 + 6 + 1000];
+	const uint32_t	freq = 72000000;
+
+	/* 1000 codes of 100 ticks each. */
+	memset(buf, 100, 1000);
+	buf[1000] = 0;
+
+	/* All of it prefilled, so any link will do. */
+	CHECK(gw_stream_bw(buf, 1001, freq, 1000) == 0.0);
+
+	/* With nothing prefilled, the first code is due at once. */
+	CHECK(gw_stream_bw(buf, 1001, freq, 0) == HUGE_VAL);
+
+	/* Past the prefill, the last code sets the pace: 990 bytes by
+	 * 99900 ticks. */
+	double	want = 8.0 * 990 * freq / (1e6 * 99900);
+
+	CHECK(fabs(gw_stream_bw(buf, 1001, freq, 10) - want) < 1e-9);
+
+	/* A space before them (1 ms) lets the link get ahead. */
+	buf[0] = 255;
+	buf[1] = FLUXOP_SPACE;
+	gw_write_28(72000, &buf[2]);
+	memset(&buf[6], 100, 1000);
+	buf[1006] = 0;
+
+	want = 8.0 * 996 * freq / (1e6 * (72000 + 99900));
+	CHECK(fabs(gw_stream_bw(buf, 1007, freq, 10) - want) < 1e-9);
+
+	/* Nothing after the terminator counts. */
+	buf[506] = 0;
+	want = 8.0 * 496 * freq / (1e6 * (72000 + 49900));
+	CHECK(fabs(gw_stream_bw(buf, 1007, freq, 10) - want) < 1e-9);
+}
+
+
+/* A walker specialized for the same consumers sees the same events. */
+
+static inline int
+walk_pulse(struct events *ev, uint32_t ticks)
+{
+	return pulse_cb(ticks, ev);
+}
+
+
+static inline int
+walk_imark(struct events *ev, uint32_t ticks)
+{
+	return imark_cb(ticks, ev);
+}
+
+
+static inline int
+walk_space(struct events *ev, uint32_t ticks)
+{
+	return space_cb(ticks, ev);
+}
+
+
+GW_STREAM_WALKER(walk_events, struct events,
+		 walk_imark, walk_space, walk_pulse)
+
+
+static void
+test_walker(void)
+{
+	uint8_t		buf[64];
+	int		n = 0;
+
+	buf[n++] = 7;
+	buf[n++] = 255;
+	buf[n++] = FLUXOP_INDEX;
+	gw_write_28(3, &buf[n]); n += 4;
+	buf[n++] = 249;
+	buf[n++] = 251;
+	buf[n++] = 5;
+	buf[n++] = 17;
+	buf[n++] = 255;
+	buf[n++] = FLUXOP_SPACE;
+	gw_write_28(600, &buf[n]); n += 4;
+	buf[n++] = 1;
+	buf[n++] = 0;
+
+	/* Every prefix, so each truncated sequence is covered. */
+	for (int len = 0; len <= n; ++len) {
+		for (int stop = 0; stop <= 1; ++stop) {
+			struct events	ev = { .pulse_status = stop };
+			struct events	wev = { .pulse_status = stop };
+			struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+
+			CHECK_EQ(walk_events(buf, len, &ws, &wev),
+				 decode(buf, len, &ev));
+			CHECK(memcmp(&ev, &wev, sizeof(ev)) == 0);
+		}
+	}
+
+	/* The state carries a stream across calls. */
+	struct events		ev = {};
+	struct gw_walk_state	ws = GW_WALK_STATE_INIT;
+	ssize_t			used = walk_events(buf, 9, &ws, &ev);
+
+	CHECK_EQ(used, 8);
+	CHECK_EQ(walk_events(buf + used, n - used, &ws, &ev), n - used);
+	CHECK_EQ(ev.npulses, 5);
+	CHECK_EQ(ev.pulse[2], 509);
+	CHECK_EQ(ev.pulse[3], 17);
+	CHECK_EQ(ev.pulse[4], 601);
+	CHECK_EQ(ev.imark[0], 10);
+	CHECK_EQ(ws.ticks, 7 + 249 + 509 + 17 + 600 + 1);
+}
+
+
 int
 main(void)
 {
@@ -251,6 +370,8 @@ main(void)
 	test_decode_ops();
 	test_decode_partial();
 	test_encode_ticks();
+	test_stream_bw();
+	test_walker();
 
 	return test_exit("test_gwx");
 }
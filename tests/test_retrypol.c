@@ -0,0 +1,100 @@
+/*
+ * Validate the retry policy: progress resets the stall count, and a
+ * stall moves through the alternate strategies before stopping.
+ */
+
+#include "retrypol.h"
+
+#include "test.h"
+
+
+/* Reads that recover sectors or clear errors never stall. */
+
+static void
+test_progress(void)
+{
+	struct retry_policy	rp;
+
+	retry_policy_init(&rp, 2, 1);
+
+	CHECK_EQ(retry_policy_update(&rp, 5, 4), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 6, 4), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 6, 3), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 6, 3), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 7, 3), RP_AGAIN);
+	CHECK_EQ(rp.reads, 5);
+	CHECK_EQ(rp.best_good, 7);
+	CHECK_EQ(rp.best_errs, 3);
+}
+
+
+/* A worse read is no progress, and doesn't lower the bests. */
+
+static void
+test_stall_stop(void)
+{
+	struct retry_policy	rp;
+
+	retry_policy_init(&rp, 2, 1);
+
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 6, 3), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_STOP);
+	CHECK_EQ(rp.best_good, 8);
+	CHECK_EQ(rp.best_errs, 1);
+}
+
+
+/* Each strategy gets a full run of reads before the next. */
+
+static void
+test_switch(void)
+{
+	struct retry_policy	rp;
+
+	retry_policy_init(&rp, 2, 3);
+
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_SWITCH);
+	CHECK_EQ(rp.strategy, 1);
+
+	/* Progress under the new strategy restarts its count. */
+	CHECK_EQ(retry_policy_update(&rp, 8, 1), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 9, 0), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 9, 0), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 9, 0), RP_SWITCH);
+	CHECK_EQ(rp.strategy, 2);
+
+	CHECK_EQ(retry_policy_update(&rp, 9, 0), RP_AGAIN);
+	CHECK_EQ(retry_policy_update(&rp, 9, 0), RP_STOP);
+	CHECK_EQ(rp.strategy, 2);
+}
+
+
+/* A stall limit of 0 retries as configured. */
+
+static void
+test_disabled(void)
+{
+	struct retry_policy	rp;
+
+	retry_policy_init(&rp, 0, 3);
+
+	for (int i = 0; i < 20; ++i)
+		CHECK_EQ(retry_policy_update(&rp, 4, 2), RP_AGAIN);
+
+	CHECK_EQ(rp.strategy, 0);
+}
+
+
+int
+main(void)
+{
+	test_progress();
+	test_stall_stop();
+	test_switch();
+	test_disabled();
+
+	return test_exit("test_retrypol");
+}
@@ -0,0 +1,182 @@
+/*
+ * Validate the run report: per-track records grow on demand, I/O
+ * snapshot deltas are attributed to the right fields, and both the
+ * CSV and JSON renderings carry every track.
+ */
+
+#include "runreport.h"
+
+#include "test.h"
+
+
+/* Records are appended in order and start zeroed. */
+
+static void
+test_track_new(void)
+{
+	struct run_report	rr;
+
+	rr_init(&rr, "test");
+
+	for (int i = 0; i < 3 * GW_MAX_TRACKS; ++i) {
+		struct rr_track	*rt = rr_track_new(&rr, i / 2, i & 1);
+
+		CHECK(rt != NULL);
+		if (!rt)
+			break;
+
+		rt->passes = i;
+	}
+
+	CHECK_EQ(rr.cnt, 3 * GW_MAX_TRACKS);
+	CHECK_EQ(rr.tracks[0].track, 0);
+	CHECK_EQ(rr.tracks[5].track, 2);
+	CHECK_EQ(rr.tracks[5].side, 1);
+	CHECK_EQ(rr.tracks[5].passes, 5);
+	CHECK_EQ(rr.tracks[5].seek_ns, 0);
+	CHECK_EQ(rr.tracks[3 * GW_MAX_TRACKS - 1].passes,
+		 3 * GW_MAX_TRACKS - 1);
+
+	rr_free(&rr);
+	CHECK(rr.tracks == NULL);
+	CHECK_EQ(rr.cnt, 0);
+}
+
+
+/* Command and transfer deltas accumulate separately. */
+
+static void
+test_io_deltas(void)
+{
+	struct gw_io_stats	a = { .cmds = 10, .cmd_ns = 1000,
+				      .rd_bytes = 100, .rd_ns = 50,
+				      .wr_bytes = 20, .wr_ns = 5 };
+	struct gw_io_stats	b = { .cmds = 13, .cmd_ns = 1600,
+				      .rd_bytes = 5100, .rd_ns = 950,
+				      .wr_bytes = 30, .wr_ns = 15 };
+	struct rr_track		rt = { 0 };
+
+	rr_track_add_io(&rt, &a, &b);
+	CHECK_EQ(rt.cmds, 3);
+	CHECK_EQ(rt.cmd_ns, 600);
+	CHECK_EQ(rt.xfer_bytes, 0);
+
+	rr_track_add_xfer(&rt, &a, &b);
+	rr_track_add_xfer(&rt, &a, &b);
+	CHECK_EQ(rt.xfer_bytes, 2 * (5000 + 10));
+	CHECK_EQ(rt.xfer_ns, 2 * (900 + 10));
+	CHECK_EQ(rt.cmds, 3);
+}
+
+
+static char *
+render(const struct run_report *rr, bool csv)
+{
+	FILE	*fp = tmpfile();
+	long	len;
+	char	*buf;
+
+	if (!fp)
+		return NULL;
+
+	rr_fwrite(rr, fp, csv);
+
+	len = ftell(fp);
+	rewind(fp);
+
+	buf = calloc(1, len + 1);
+
+	if (buf && fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(fp);
+
+	return buf;
+}
+
+
+static int
+count_lines(const char *s)
+{
+	int	n = 0;
+
+	for (; *s; ++s)
+		n += (*s == '\n');
+
+	return n;
+}
+
+
+static void
+test_render(void)
+{
+	struct run_report	rr;
+
+	rr_init(&rr, "gw2dmk");
+
+	struct rr_track	*rt = rr_track_new(&rr, 7, 1);
+
+	rt->passes       = 2;
+	rt->seek_ns      = 12345;
+	rt->batch_ns     = 67890;
+	rt->good_sectors = 18;
+	rt->errors       = 1;
+
+	rr_track_new(&rr, 8, 0);
+
+	char	*csv = render(&rr, true);
+
+	CHECK(csv != NULL);
+	if (csv) {
+		CHECK(!strncmp(csv, "track,side,passes,", 18));
+		CHECK_EQ(count_lines(csv), 3);
+		CHECK(strstr(csv, "\n7,1,2,") != NULL);
+		CHECK(strstr(csv, ",12345,67890,") != NULL);
+		CHECK(strstr(csv, ",18,1\n") != NULL);
+		CHECK(strstr(csv, "\n8,0,0,") != NULL);
+		free(csv);
+	}
+
+	char	*json = render(&rr, false);
+
+	CHECK(json != NULL);
+	if (json) {
+		CHECK(json[0] == '{');
+		CHECK(strstr(json, "\"tool\": \"gw2dmk\"") != NULL);
+		CHECK(strstr(json, "\"track\": 7, \"side\": 1, "
+				   "\"passes\": 2") != NULL);
+		CHECK(strstr(json, "\"seek_ns\": 12345, "
+				   "\"batch_ns\": 67890") != NULL);
+		CHECK(strstr(json, "\"track\": 8, \"side\": 0") != NULL);
+		CHECK(strstr(json, "}\n  ]\n}\n") != NULL);
+		free(json);
+	}
+
+	rr_free(&rr);
+
+	/* An empty report is still well formed. */
+	rr_init(&rr, "dmk2gw");
+
+	json = render(&rr, false);
+	CHECK(json && strstr(json, "\"tracks\": []\n}\n") != NULL);
+	free(json);
+
+	csv = render(&rr, true);
+	CHECK(csv && count_lines(csv) == 1);
+	free(csv);
+
+	rr_free(&rr);
+}
+
+
+int
+main(void)
+{
+	test_track_new();
+	test_io_deltas();
+	test_render();
+
+	return test_exit("test_runreport");
+}
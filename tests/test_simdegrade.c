@@ -0,0 +1,258 @@
+/*
+ * Validate degraded media: every degraded turn keeps the media's
+ * period and index, the same inputs render the same turns, and each
+ * kind of damage shows where it should and nowhere else.
+ */
+
+#include <string.h>
+
+#include "simdegrade.h"
+#include "simflux.h"
+
+#include "test.h"
+
+
+#define FREQ		72000000
+#define IVAL		288		/* 4 us */
+#define IVALS		50000
+#define TURNS		8
+
+
+/* A regular track: one interval, IVALS times over. */
+
+static void
+make_rev(struct sim_rev *rev)
+{
+	bool	ok = sim_rev_init(rev, IVALS) == 0;
+
+	for (int i = 0; ok && i < IVALS; ++i)
+		ok = sim_rev_pulse(IVAL, rev) == 0;
+
+	CHECK(ok);
+}
+
+
+/* Turn "k"'s intervals, into "iv" (up to "max"); returns how many. */
+
+static size_t
+turn_intervals(const struct sim_rev *rev, uint64_t rt, unsigned k,
+	       uint32_t *iv, size_t max)
+{
+	uint64_t	t = 0;
+	size_t		off = 0;
+	size_t		n = 0;
+
+	while (off < rev->cnt && t < (k + 1) * rt) {
+		uint32_t	p;
+
+		off += sim_rev_interval(rev, off, &p);
+		t   += p;
+
+		if (t > k * rt && n < max)
+			iv[n++] = p;
+	}
+
+	return n;
+}
+
+
+static bool
+render(const char *spec, uint64_t revno, unsigned nrevs,
+       const struct sim_rev *rev, struct sim_rev *out)
+{
+	struct sim_degrade	dg;
+
+	return sim_degrade_parse(spec, &dg) == 0 &&
+	       sim_degrade_rev(&dg, 3, 0, rev, revno, nrevs, FREQ, out) == 0;
+}
+
+
+static void
+test_parse(void)
+{
+	struct sim_degrade	dg = { .seed = 42 };
+	char			buf[128];
+	const char		*bad[] = {
+		"jitter", "jitter=", "jitter=x", "bogus=1", "weak=65",
+		"wobble=50", "wobble=-1", "seed=7,,dropout"
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		CHECK_EQ(sim_degrade_parse(bad[i], &dg), -1);
+		CHECK_EQ(dg.seed, 42);
+		CHECK(!dg.on);
+	}
+
+	CHECK_EQ(sim_degrade_parse("seed=7,jitter=150,wobble=1.5,weak=2,"
+				   "dropout=1,splice=3", &dg), 0);
+	CHECK(dg.on);
+	sim_degrade_format(&dg, buf, sizeof(buf));
+	CHECK(!strcmp(buf, "seed=7,jitter=150,wobble=1.5,weak=2,dropout=1,"
+			   "splice=3"));
+
+	/* Settings not given are back to their defaults. */
+	CHECK_EQ(sim_degrade_parse("weak=1", &dg), 0);
+	sim_degrade_format(&dg, buf, sizeof(buf));
+	CHECK(!strcmp(buf, "seed=0,weak=1"));
+}
+
+
+/* Every turn is one period long, its index at the end. */
+
+static void
+test_period(const struct sim_rev *rev)
+{
+	const uint64_t	rt = rev->total_ticks;
+	struct sim_rev	out;
+
+	CHECK(render("jitter=300,wobble=3,weak=4,dropout=2,splice=2", 0,
+		     TURNS, rev, &out));
+	CHECK_EQ(out.total_ticks, TURNS * rt);
+	CHECK_EQ(out.index_cnt, TURNS);
+
+	for (size_t i = 0; i < out.index_cnt; ++i)
+		CHECK_EQ(out.index[i].ticks, (i + 1) * rt);
+
+	sim_rev_free(&out);
+}
+
+
+/* With nothing to do, the turns are the media's own. */
+
+static void
+test_clean(const struct sim_rev *rev)
+{
+	static uint32_t	iv[IVALS + 1];
+	struct sim_rev	out;
+	bool		ok = true;
+
+	CHECK(render("seed=9", 0, 3, rev, &out));
+
+	for (unsigned k = 0; k < 3; ++k) {
+		size_t	n = turn_intervals(&out, rev->total_ticks, k, iv,
+					   IVALS + 1);
+
+		ok = ok && n == IVALS;
+		for (size_t i = 0; i < n; ++i)
+			ok = ok && iv[i] == IVAL;
+	}
+
+	CHECK(ok);
+	sim_rev_free(&out);
+}
+
+
+/*
+ * Turns are numbered from "revno": rendering from turn 5 on gives
+ * what rendering from turn 0 gave there, byte for byte.
+ */
+
+static void
+test_repeat(const struct sim_rev *rev)
+{
+	const char	*spec = "seed=1,jitter=200,wobble=2,weak=3,splice=1";
+	static uint32_t	a[IVALS * 2], b[IVALS * 2];
+	struct sim_rev	x, y;
+
+	CHECK(render(spec, 0, TURNS, rev, &x));
+	CHECK(render(spec, 0, TURNS, rev, &y));
+	CHECK_EQ(x.cnt, y.cnt);
+	CHECK(memcmp(x.b, y.b, x.cnt) == 0);
+	sim_rev_free(&y);
+
+	CHECK(render(spec, 5, 2, rev, &y));
+
+	for (unsigned k = 0; k < 2; ++k) {
+		size_t	na = turn_intervals(&x, rev->total_ticks, 5 + k, a,
+					    IVALS * 2);
+		size_t	nb = turn_intervals(&y, rev->total_ticks, k, b,
+					    IVALS * 2);
+
+		CHECK_EQ(na, nb);
+		CHECK(memcmp(a, b, na * sizeof(*a)) == 0);
+	}
+
+	sim_rev_free(&x);
+	sim_rev_free(&y);
+}
+
+
+/* How many of the turns' intervals differ from the first turn's. */
+
+static int
+turns_differing(const struct sim_rev *out, uint64_t rt, unsigned nrevs)
+{
+	static uint32_t	a[IVALS * 2], b[IVALS * 2];
+	size_t		na = turn_intervals(out, rt, 0, a, IVALS * 2);
+	int		diff = 0;
+
+	for (unsigned k = 1; k < nrevs; ++k) {
+		size_t	nb = turn_intervals(out, rt, k, b, IVALS * 2);
+
+		diff += na != nb || memcmp(a, b, na * sizeof(*a)) != 0;
+	}
+
+	return diff;
+}
+
+
+static void
+test_regions(const struct sim_rev *rev)
+{
+	static uint32_t	iv[IVALS * 2];
+	const uint64_t	rt = rev->total_ticks;
+	struct sim_rev	out;
+
+	/* Splices and dropouts are the same every turn... */
+	CHECK(render("splice=4,dropout=2", 0, TURNS, rev, &out));
+	CHECK_EQ(turns_differing(&out, rt, TURNS), 0);
+
+	/* ...and leave gaps where the flux dropped out. */
+	size_t		n = turn_intervals(&out, rt, 0, iv, IVALS * 2);
+	uint32_t	longest = 0;
+
+	CHECK(n != IVALS);
+	for (size_t i = 0; i < n; ++i)
+		longest = iv[i] > longest ? iv[i] : longest;
+
+	CHECK(longest >= 32 * (FREQ / 1000000));
+	sim_rev_free(&out);
+
+	/* Weak regions read differently from turn to turn. */
+	CHECK(render("weak=2", 0, TURNS, rev, &out));
+	CHECK(turns_differing(&out, rt, TURNS) > 0);
+	sim_rev_free(&out);
+
+	/* Another seed puts the damage elsewhere. */
+	struct sim_rev	other;
+	static uint32_t	jv[IVALS * 2];
+
+	CHECK(render("splice=1", 0, 1, rev, &out));
+	CHECK(render("seed=2,splice=1", 0, 1, rev, &other));
+
+	size_t	no = turn_intervals(&other, rt, 0, jv, IVALS * 2);
+
+	n = turn_intervals(&out, rt, 0, iv, IVALS * 2);
+	CHECK(n != no || memcmp(iv, jv, n * sizeof(*iv)) != 0);
+	sim_rev_free(&out);
+	sim_rev_free(&other);
+}
+
+
+int
+main(void)
+{
+	struct sim_rev	rev;
+
+	make_rev(&rev);
+
+	test_parse();
+	test_period(&rev);
+	test_clean(&rev);
+	test_repeat(&rev);
+	test_regions(&rev);
+
+	sim_rev_free(&rev);
+
+	return test_exit("test_simdegrade");
+}
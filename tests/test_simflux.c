@@ -0,0 +1,274 @@
+/*
+ * Validate simulated read streams: a revolution rendered as stream
+ * bytes reads back as the same intervals from any rotational phase,
+ * with each index exactly one revolution after the last, or where it
+ * was put.
+ */
+
+#include "greaseweazle.h"
+#include "gwx.h"
+#include "simflux.h"
+
+#include "test.h"
+
+
+/* One of each encoding: one byte, two bytes, and a space. */
+static const uint32_t	ivals[] = { 100, 300, 1524, 1525, 20000, 249, 250 };
+
+#define IVALS_CNT	(sizeof(ivals) / sizeof(ivals[0]))
+#define REV_REPEAT	100
+
+
+struct walk {
+	uint64_t	t;		/* Stream ticks so far */
+	uint64_t	pulse[4 * IVALS_CNT * REV_REPEAT];
+	size_t		pulse_cnt;
+	uint64_t	index[8];
+	size_t		index_cnt;
+};
+
+
+static int
+walk_imark(uint32_t ticks, void *data)
+{
+	struct walk	*w = data;
+
+	if (w->index_cnt < 8)
+		w->index[w->index_cnt++] = ticks;
+
+	return 0;
+}
+
+
+static int
+walk_pulse(uint32_t ticks, void *data)
+{
+	struct walk	*w = data;
+
+	w->t += ticks;
+
+	if (w->pulse_cnt < sizeof(w->pulse) / sizeof(w->pulse[0]))
+		w->pulse[w->pulse_cnt++] = w->t;
+
+	return 0;
+}
+
+
+static bool
+walk_stream(const uint8_t *b, size_t cnt, struct walk *w)
+{
+	struct gw_decode_stream_s	ds = {
+		.ds_ticks = 0,
+		.ds_last_pulse = 0,
+		.ds_status = -1,
+		.decoded_imark = walk_imark,
+		.imark_data = w,
+		.decoded_space = NULL,
+		.decoded_pulse = walk_pulse,
+		.pulse_data = w
+	};
+
+	memset(w, 0, sizeof(*w));
+
+	return cnt > 0 && b[cnt - 1] == 0 &&
+	       gw_decode_stream(b, cnt, &ds) == (ssize_t)cnt;
+}
+
+
+static void
+make_rev(struct sim_rev *rev)
+{
+	CHECK_EQ(sim_rev_init(rev, 16), 0);
+
+	for (int r = 0; r < REV_REPEAT; ++r) {
+		for (size_t i = 0; i < IVALS_CNT; ++i)
+			CHECK_EQ(sim_rev_pulse(ivals[i], rev), 0);
+
+		/* Zero-length intervals are dropped. */
+		CHECK_EQ(sim_rev_pulse(0, rev), 0);
+	}
+
+	CHECK_EQ(rev->intervals, IVALS_CNT * REV_REPEAT);
+	CHECK(rev->mark_cnt > 1);
+}
+
+
+/* Transition times from "phase" on, over "revs" revolutions. */
+
+static bool
+check_pulses(const struct sim_rev *rev, uint64_t phase,
+	     const struct walk *w, size_t revs)
+{
+	uint64_t	t = 0;
+	size_t		k = 0;
+
+	for (size_t r = 0; r < revs; ++r) {
+		for (int n = 0; n < REV_REPEAT; ++n) {
+			for (size_t i = 0; i < IVALS_CNT; ++i) {
+				t += ivals[i];
+
+				if (t <= phase)
+					continue;
+
+				if (k < w->pulse_cnt &&
+				    w->pulse[k] != t - phase)
+					return false;
+				++k;
+			}
+		}
+	}
+
+	return k >= w->pulse_cnt;
+}
+
+
+static void
+test_index(void)
+{
+	struct sim_rev	rev;
+	const uint64_t	phases[] = { 0, 1, 99, 100, 101, 2000, 20000, 123457 };
+
+	make_rev(&rev);
+
+	uint64_t	rt = rev.total_ticks;
+
+	for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); ++p) {
+		uint64_t	phase = phases[p] % rt;
+		uint8_t		*b;
+		size_t		cnt;
+		uint64_t	dur;
+		struct walk	w;
+
+		CHECK_EQ(sim_flux_stream(&rev, phase, 3, 0, &b, &cnt, &dur),
+			 0);
+		CHECK(walk_stream(b, cnt, &w));
+
+		CHECK_EQ(w.index_cnt, 3);
+		for (size_t i = 0; i < w.index_cnt; ++i)
+			CHECK_EQ(w.index[i], (i + 1) * rt - phase);
+
+		/* It stops at the index, short of the final interval. */
+		CHECK_EQ(dur, 3 * rt - ivals[IVALS_CNT - 1] - phase);
+		CHECK_EQ(w.t, dur);
+		CHECK(check_pulses(&rev, phase, &w, 3));
+
+		free(b);
+
+		/* By time instead, stopping past the limit. */
+		CHECK_EQ(sim_flux_stream(&rev, phase + rt, 0, rt + 777,
+					 &b, &cnt, &dur), 0);
+		CHECK(walk_stream(b, cnt, &w));
+
+		CHECK(dur >= rt + 777);
+		CHECK(dur < rt + 777 + 20000);
+		CHECK_EQ(w.t, dur);
+		CHECK(w.index_cnt >= 1);
+		CHECK_EQ(w.index[0], rt - phase);
+		CHECK(check_pulses(&rev, phase, &w, 3));
+
+		free(b);
+	}
+
+	sim_rev_free(&rev);
+}
+
+
+/*
+ * A loop of several revolutions, each index within an interval: every
+ * one is reported where it falls, from any phase, the bytes between
+ * them copied as they are.
+ */
+
+static void
+test_listed(void)
+{
+	struct sim_rev	rev;
+	uint64_t	at[3];
+	bool		ok = true;
+
+	CHECK_EQ(sim_rev_init(&rev, 16), 0);
+
+	for (int k = 0; k < 3; ++k) {
+		for (int r = 0; r < REV_REPEAT; ++r) {
+			for (size_t i = 0; i < IVALS_CNT; ++i) {
+				/* Part way into the long interval. */
+				if (r == REV_REPEAT - 1 && i == 4) {
+					at[k] = rev.total_ticks + 1000 + k;
+					ok = sim_rev_index(&rev, at[k]) == 0 &&
+					     ok;
+				}
+
+				ok = sim_rev_pulse(ivals[i], &rev) == 0 && ok;
+			}
+		}
+	}
+
+	CHECK(ok);
+	CHECK_EQ(rev.index_cnt, 3);
+
+	uint64_t	rt = rev.total_ticks;
+	const uint64_t	phases[] = { 0, 5, at[0], at[0] + 1, at[1] - 1,
+				     rt - 1 };
+
+	for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); ++p) {
+		uint64_t	phase = phases[p];
+		uint8_t		*b;
+		size_t		cnt;
+		uint64_t	dur;
+		struct walk	w;
+
+		CHECK_EQ(sim_flux_stream(&rev, phase, 5, 0, &b, &cnt, &dur),
+			 0);
+		CHECK(walk_stream(b, cnt, &w));
+		CHECK_EQ(w.index_cnt, 5);
+
+		/* The first still to come, and round the loop from there. */
+		size_t	k = 0;
+
+		while (k < 3 && at[k] < phase)
+			++k;
+
+		for (size_t i = 0; i < w.index_cnt; ++i, ++k)
+			CHECK_EQ(w.index[i],
+				 (k / 3) * rt + at[k % 3] - phase);
+
+		CHECK(check_pulses(&rev, phase, &w, 3 * 3));
+
+		free(b);
+	}
+
+	sim_rev_free(&rev);
+}
+
+
+static void
+test_noise(void)
+{
+	struct sim_rev	rev;
+	uint8_t		*b;
+	size_t		cnt;
+	uint64_t	dur;
+	struct walk	w;
+
+	CHECK_EQ(sim_noise_rev(72000000, 300, &rev), 0);
+	CHECK_EQ(rev.total_ticks, 72000000 / 5);
+
+	CHECK_EQ(sim_flux_stream(&rev, 5000, 2, 0, &b, &cnt, &dur), 0);
+	CHECK(walk_stream(b, cnt, &w));
+	CHECK_EQ(w.index_cnt, 2);
+	CHECK_EQ(w.index[1] - w.index[0], rev.total_ticks);
+
+	free(b);
+	sim_rev_free(&rev);
+}
+
+
+int
+main(void)
+{
+	test_index();
+	test_listed();
+	test_noise();
+
+	return test_exit("test_simflux");
+}
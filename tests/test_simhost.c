@@ -0,0 +1,167 @@
+/*
+ * Validate the simulator transports: the shared-memory rings carry
+ * any amount of data intact across their wrap, time out and close
+ * cleanly, and the in-process backend answers protocol commands.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "greaseweazle.h"
+#include "gw.h"
+#include "simhost.h"
+#include "simshm.h"
+
+#include "test.h"
+
+
+#define XFER_LEN	(3 * SIM_SHM_RING_SIZE + 12345)
+
+
+static uint8_t
+pattern(size_t i)
+{
+	return (i * 7 + (i >> 11)) & 0xff;
+}
+
+
+/* The child echoes everything back, in odd-sized pieces. */
+
+static void
+echo(struct sim_shm *shm)
+{
+	static uint8_t	buf[4093];
+	ssize_t		rd;
+
+	while ((rd = sim_ring_read(shm, &shm->to_sim, buf, sizeof(buf),
+				   0)) > 0) {
+		if (sim_ring_write(shm, &shm->to_host, buf, rd) == -1)
+			break;
+	}
+
+	_exit(0);
+}
+
+
+static void
+test_ring(void)
+{
+	char	name[64];
+
+	snprintf(name, sizeof(name), "/gw2dmk-test-%d", (int)getpid());
+
+	struct sim_shm	*shm = sim_shm_create(name, false);
+
+	CHECK(shm != NULL);
+	if (!shm)
+		return;
+
+	/* A name in use is refused unless it is to be reclaimed. */
+	CHECK(sim_shm_create(name, false) == NULL && errno == EEXIST);
+
+	CHECK(sim_shm_map("/gw2dmk-test-none") == NULL);
+
+	pid_t	pid = fork();
+
+	CHECK(pid != -1);
+	if (pid == 0)
+		echo(shm);
+
+	/* Writes fill the ring while the reads drain it. */
+	static uint8_t	out[XFER_LEN], in[XFER_LEN];
+	size_t		wr = 0, rd = 0;
+	bool		ok = true;
+
+	for (size_t i = 0; i < XFER_LEN; ++i)
+		out[i] = pattern(i);
+
+	while (rd < XFER_LEN && ok) {
+		if (wr < XFER_LEN) {
+			size_t	n = XFER_LEN - wr < 100000 ?
+				    XFER_LEN - wr : 100000;
+
+			ok = sim_ring_write(shm, &shm->to_sim, out + wr,
+					    n) == 0;
+			wr += n;
+		}
+
+		while (rd < wr && ok) {
+			size_t	avail = sim_ring_avail(&shm->to_host);
+			ssize_t	n = sim_ring_read(shm, &shm->to_host,
+						  in + rd, wr - rd, 5);
+
+			/* Reads take all there is, across the wrap. */
+			ok = n > 0 && (size_t)n >= avail;
+			rd += n;
+		}
+	}
+
+	CHECK(ok);
+	CHECK_EQ(rd, XFER_LEN);
+	CHECK(memcmp(in, out, XFER_LEN) == 0);
+
+	/* Nothing more comes; the read times out. */
+	uint8_t	b;
+
+	CHECK_EQ(sim_ring_read(shm, &shm->to_host, &b, 1, 1), -1);
+	CHECK_EQ(errno, ETIMEDOUT);
+
+	/* Closing wakes the child, which exits. */
+	atomic_store(&shm->closing, 1);
+	sim_shm_wake(shm);
+
+	int	status = -1;
+
+	CHECK_EQ(waitpid(pid, &status, 0), pid);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	CHECK_EQ(sim_ring_read(shm, &shm->to_host, &b, 1, 1), -1);
+
+	sim_shm_destroy(shm, name);
+	CHECK(sim_shm_map(name) == NULL);
+}
+
+
+static void
+test_host(void)
+{
+	CHECK(sim_host_device("sim:disk.dmk"));
+	CHECK(sim_host_device("shm:gwsim"));
+	CHECK(!sim_host_device("/dev/ttyACM0"));
+
+	CHECK(sim_host_open("/dev/ttyACM0") == GW_DEVT_INVALID);
+	CHECK(sim_host_open("sim:model=none") == GW_DEVT_INVALID);
+	CHECK(sim_host_open("sim:drive=0:none") == GW_DEVT_INVALID);
+	CHECK(sim_host_open("sim:/nonexistent.dmk") == GW_DEVT_INVALID);
+	CHECK(sim_host_open("shm:gw2dmk-test-none") == GW_DEVT_INVALID);
+
+	gw_devt	gwfd = sim_host_open("sim:model=v4.1;drive=1:35hd");
+
+	CHECK(gwfd == GW_SIM_DEVT);
+	CHECK(sim_host_open("sim:") == GW_DEVT_INVALID);
+
+	struct gw_info	info;
+
+	memset(&info, 0, sizeof(info));
+	CHECK_EQ(gw_get_info(gwfd, &info), ACK_OKAY);
+	CHECK_EQ(info.sample_freq, 72000000);
+	CHECK_EQ(info.hw_model, 4);
+	CHECK_EQ(gw_bytes_waiting(gwfd), 0);
+
+	sim_host_close();
+
+	gwfd = sim_host_open("sim:");
+	CHECK(gwfd == GW_SIM_DEVT);
+	sim_host_close();
+}
+
+
+int
+main(void)
+{
+	test_ring();
+	test_host();
+
+	return test_exit("test_simhost");
+}
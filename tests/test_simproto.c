@@ -0,0 +1,316 @@
+/*
+ * Validate the simulator's write path: a CMD_WRITE_FLUX stream
+ * decodes to the same track however the host splits it, streams far
+ * longer than any track are taken whole, bad streams are dropped
+ * without losing sync, and a link too slow for the stream underflows
+ * just where gw_stream_bw() says.
+ */
+
+#include <unistd.h>
+
+#include "dmk.h"
+#include "greaseweazle.h"
+#include "gwx.h"
+#include "simclock.h"
+#include "simflux.h"
+#include "simmedia.h"
+#include "simproto.h"
+#include "simsetup.h"
+
+#include "test.h"
+#include "testtrack.h"
+
+
+static char	src_path[] = "/tmp/test_simprotoXXXXXX.dmk";
+static char	dst_path[] = "/tmp/test_simprotoXXXXXX.dmk";
+
+static struct dmk_file	dmkf;
+static struct dmk_track	track0;		/* Track 0 as last written */
+
+static uint8_t	*wstream;
+static size_t	wstream_cnt;
+
+static uint8_t	reply_buf[256];
+static size_t	reply_cnt;
+
+
+static int
+out(void *ctx, const uint8_t *buf, size_t cnt)
+{
+	if (reply_cnt + cnt > sizeof(reply_buf))
+		reply_cnt = 0;
+
+	memcpy(&reply_buf[reply_cnt], buf, cnt);
+	reply_cnt += cnt;
+
+	return 0;
+}
+
+
+static bool
+write_file(const char *path, bool formatted)
+{
+	FILE	*fp = fopen(path, "wb");
+
+	if (!fp)
+		return false;
+
+	dmk_file_free(&dmkf);
+	dmk_header_init(&dmkf.header, 2, DMKRD_TRACKLEN_5);
+
+	if (formatted) {
+		static struct dmk_track	trk;
+
+		test_track_make(&trk, 0, 0, DMKRD_TRACKLEN_5, true, true);
+		dmk_file_put_track(&dmkf, 0, 0, &trk);
+	}
+
+	bool	ok = dmk2fp(&dmkf, fp) == 0;
+
+	return fclose(fp) == 0 && ok;
+}
+
+
+/*
+ * The write stream for one revolution of the formatted track: its
+ * read-stream bytes hold no index ops, so they serve as is.
+ */
+
+static bool
+make_wstream(void)
+{
+	struct sim_media	*media = sim_media_load(src_path);
+	struct sim_rev		rev;
+
+	if (!media)
+		return false;
+
+	bool	ok = media->ops->track_rev(media, 0, 0, 72000000, 300,
+					   &rev) == 0;
+
+	if (ok) {
+		wstream = malloc(rev.cnt + 1);
+		ok = wstream != NULL;
+	}
+
+	if (ok) {
+		memcpy(wstream, rev.b, rev.cnt);
+		wstream[rev.cnt] = 0;
+		wstream_cnt = rev.cnt + 1;
+		sim_rev_free(&rev);
+	}
+
+	sim_media_eject(media);
+
+	return ok;
+}
+
+
+static void
+send_cmd(struct sim_proto *sp, const uint8_t *cmd)
+{
+	reply_cnt = 0;
+	CHECK_EQ(sim_proto_input(sp, cmd, cmd[1]), 0);
+	CHECK_EQ(reply_cnt, 2);
+	CHECK_EQ(reply_buf[1], ACK_OKAY);
+}
+
+
+/*
+ * Write "cnt" bytes of "stream" to track 0 of a blank image, "chunk"
+ * bytes at a time, then read it back into track0.  Returns the
+ * CMD_GET_FLUX_STATUS ack.
+ */
+
+static int
+write_track(const uint8_t *stream, size_t cnt, size_t chunk)
+{
+	struct sim_gw		gw;
+	struct sim_proto	sp;
+	char			ins[64];
+
+	memset(&gw, 0, sizeof(gw));
+	CHECK(write_file(dst_path, false));
+	CHECK_EQ(sim_setup_finish(&gw, "f7"), 0);
+	snprintf(ins, sizeof(ins), "0:%s", dst_path);
+	CHECK_EQ(sim_setup_insert(&gw, ins), 0);
+
+	sim_proto_init(&sp, &gw, out, NULL);
+
+	send_cmd(&sp, (uint8_t[]){ CMD_SET_BUS_TYPE, 3, BUS_IBMPC });
+	send_cmd(&sp, (uint8_t[]){ CMD_SELECT, 3, 0 });
+	send_cmd(&sp, (uint8_t[]){ CMD_MOTOR, 4, 0, 1 });
+	send_cmd(&sp, (uint8_t[]){ CMD_WRITE_FLUX, 4, 1, 1 });
+
+	reply_cnt = 0;
+
+	bool	ok = true;
+
+	for (size_t i = 0; i < cnt; i += chunk) {
+		size_t	n = (cnt - i < chunk) ? cnt - i : chunk;
+
+		ok = sim_proto_input(&sp, &stream[i], n) == 0 && ok;
+	}
+
+	CHECK(ok);
+
+	/* The synchronization byte, once the terminator is in. */
+	CHECK_EQ(reply_cnt, 1);
+	CHECK_EQ(reply_buf[0], 0);
+
+	reply_cnt = 0;
+	CHECK_EQ(sim_proto_input(&sp, (uint8_t[]){ CMD_GET_FLUX_STATUS, 2 },
+				 2), 0);
+
+	int	ack = reply_buf[1];
+
+	sim_setup_free(&gw);
+
+	FILE	*fp = fopen(dst_path, "rb");
+
+	CHECK(fp && fp2dmk(fp, &dmkf) == 0);
+	dmk_file_get_track(&dmkf, 0, 0, &track0);
+
+	if (fp)
+		fclose(fp);
+
+	return ack;
+}
+
+
+static int
+sectors(const struct dmk_track *trk)
+{
+	int	n = 0;
+
+	while (n < DMK_MAX_SECTORS && trk->idam_offset[n])
+		++n;
+
+	return n;
+}
+
+
+static void
+test_chunks(void)
+{
+	static struct dmk_track	whole;
+	const size_t		chunks[] = { 1, 2, 5, 6, 7, 4093 };
+
+	CHECK_EQ(write_track(wstream, wstream_cnt, wstream_cnt), ACK_OKAY);
+	whole = track0;
+	CHECK_EQ(sectors(&whole), 16);
+
+	for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+		CHECK_EQ(write_track(wstream, wstream_cnt, chunks[c]),
+			 ACK_OKAY);
+		CHECK(memcmp(&track0, &whole, sizeof(whole)) == 0);
+	}
+}
+
+
+/* Well past the old 4 MiB capture limit, in host-sized pieces. */
+
+static void
+test_long(void)
+{
+	size_t	revs = (5 << 20) / wstream_cnt + 1;
+	size_t	cnt = revs * (wstream_cnt - 1) + 1;
+	uint8_t	*stream = malloc(cnt);
+
+	CHECK(stream != NULL);
+	if (!stream)
+		return;
+
+	for (size_t r = 0; r < revs; ++r)
+		memcpy(&stream[r * (wstream_cnt - 1)], wstream,
+		       wstream_cnt - 1);
+
+	stream[cnt - 1] = 0;
+
+	/* Every revolution is decoded, for as many IDAMs as fit. */
+	CHECK_EQ(write_track(stream, cnt, 65536), ACK_OKAY);
+	CHECK_EQ(sectors(&track0), DMK_MAX_SECTORS);
+
+	free(stream);
+}
+
+
+/* A bad opcode drops the write; the terminator still ends it. */
+
+static void
+test_bad(void)
+{
+	size_t	cnt = wstream_cnt + 6;
+	uint8_t	*stream = malloc(cnt);
+
+	CHECK(stream != NULL);
+	if (!stream)
+		return;
+
+	memcpy(stream, wstream, wstream_cnt - 1);
+	memcpy(&stream[wstream_cnt - 1],
+	       (uint8_t[]){ 255, 0x7f, 1, 1, 1, 1, 0 }, 7);
+
+	CHECK_EQ(write_track(stream, cnt, 100), ACK_OKAY);
+	CHECK_EQ(sectors(&track0), 0);
+
+	free(stream);
+}
+
+
+/*
+ * A link just slower than the stream needs past the prefill underflows
+ * and leaves the track unwritten; one just faster writes it.
+ */
+
+static void
+test_link(void)
+{
+	double	need = gw_stream_bw(wstream, wstream_cnt, 72000000,
+				   GW_WRITE_PREFILL);
+
+	CHECK(need > 0.0 && need < 100.0);
+
+	sim_proto_link_kbps = need * 1000 - 1;
+	CHECK_EQ(write_track(wstream, wstream_cnt, 4096), ACK_FLUX_UNDERFLOW);
+	CHECK_EQ(sectors(&track0), 0);
+
+	sim_proto_link_kbps = need * 1000 + 1;
+	CHECK_EQ(write_track(wstream, wstream_cnt, 4096), ACK_OKAY);
+	CHECK_EQ(sectors(&track0), 16);
+
+	sim_proto_link_kbps = 0;
+}
+
+
+int
+main(void)
+{
+	int	fd;
+
+	sim_fast = true;
+
+	if ((fd = mkstemps(src_path, 4)) == -1 ||
+	    close(fd) == -1 ||
+	    (fd = mkstemps(dst_path, 4)) == -1 ||
+	    close(fd) == -1) {
+		perror("mkstemps");
+		return 1;
+	}
+
+	CHECK(write_file(src_path, true));
+	CHECK(make_wstream());
+
+	if (wstream) {
+		test_chunks();
+		test_long();
+		test_bad();
+		test_link();
+	}
+
+	free(wstream);
+	unlink(src_path);
+	unlink(dst_path);
+
+	return test_exit("test_simproto");
+}
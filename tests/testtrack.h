@@ -0,0 +1,103 @@
+/*
+ * DMK track fixture shared by the tests that need whole formatted
+ * tracks.
+ */
+
+#ifndef TESTTRACK_H
+#define TESTTRACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc.h"
+#include "dmk.h"
+
+#define TEST_TRACK_SECTORS	16
+#define TEST_TRACK_SECSIZE	256
+
+
+/* Byte "i" of sector "r"'s data on track "t", when varied. */
+
+static inline uint8_t
+test_track_data(int t, int r, int i)
+{
+	return (t * 31 + r * 17 + i * i) & 0xff;
+}
+
+
+static inline uint16_t
+test_track_crc(const uint8_t *buf, size_t len)
+{
+	uint16_t	crc = 0xffff;
+
+	while (len--)
+		crc = calc_crc1(crc, *buf++);
+
+	return crc;
+}
+
+
+/*
+ * Lay out a DD track much as a formatter would: sixteen 256-byte MFM
+ * sectors of track "t", side "s" between gaps, filled out to
+ * "tracklen" with gap.  The data is test_track_data() if "varied",
+ * else 0xe5.  With "crcs" the ID and data CRCs are good; without,
+ * they are left zero, for tests that only move bytes about.
+ */
+
+static inline void
+test_track_make(struct dmk_track *trk, int t, int s, size_t tracklen,
+		bool varied, bool crcs)
+{
+	uint8_t	*p = trk->data;
+	int	n = 0;
+
+	memset(trk, 0, sizeof(*trk));
+	trk->track_len = tracklen;
+
+	memset(p, 0x4e, 80);
+	p += 80;
+
+	for (int r = 1; r <= TEST_TRACK_SECTORS; ++r) {
+		uint8_t		*m;
+		uint16_t	crc;
+
+		memset(p, 0x00, 12);
+		p += 12;
+		m = p;
+		memset(p, 0xa1, 3);
+		p += 3;
+		trk->idam_offset[n++] = DMK_DDEN_FLAG |
+					(DMK_TKHDR_SIZE + (p - trk->data));
+		*p++ = 0xfe;
+		*p++ = t;
+		*p++ = s;
+		*p++ = r;
+		*p++ = 1;
+		crc = crcs ? test_track_crc(m, p - m) : 0;
+		*p++ = crc >> 8;
+		*p++ = crc;
+		memset(p, 0x4e, 22);
+		p += 22;
+		memset(p, 0x00, 12);
+		p += 12;
+		m = p;
+		memset(p, 0xa1, 3);
+		p += 3;
+		*p++ = 0xfb;
+
+		for (int i = 0; i < TEST_TRACK_SECSIZE; ++i)
+			*p++ = varied ? test_track_data(t, r, i) : 0xe5;
+
+		crc = crcs ? test_track_crc(m, p - m) : 0;
+		*p++ = crc >> 8;
+		*p++ = crc;
+		memset(p, 0x4e, 24);
+		p += 24;
+	}
+
+	memset(p, 0x4e, trk->data + tracklen - DMK_TKHDR_SIZE - p);
+}
+
+#endif